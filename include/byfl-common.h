@@ -84,6 +84,60 @@ enum {
   BF_NUM_MEM_INTRIN
 };
 
+// Distinguish the memory intrinsics tallied per call site.
+enum {
+  BF_MEMINTRIN_MEMSET,    // llvm.memset.*
+  BF_MEMINTRIN_MEMCPY,    // llvm.memcpy.*
+  BF_MEMINTRIN_MEMMOVE,   // llvm.memmove.*
+  BF_MEMINTRIN_NUM
+};
+
+// Define indexes into the per-loop tallies maintained by the instrumented
+// code.
+enum {
+  BF_LOOP_ITERATIONS,     // Executions of the loop header
+  BF_LOOP_ENTRIES,        // Entries into the loop from outside
+  BF_LOOP_SCALAR_FLOPS,   // Floating-point operations performed by scalar instructions
+  BF_LOOP_VECTOR_FLOPS,   // Floating-point operations performed by vector instructions
+  BF_LOOP_LOADS,          // Load instructions executed
+  BF_LOOP_STORES,         // Store instructions executed
+  BF_LOOP_NUM_COUNTERS
+};
+
+// Define a type for communicating from the plugin to the run-time library
+// the static characteristics of an inner loop and where its dynamic
+// characteristics are tallied.
+typedef struct {
+  const char *function;   // Name of the function containing the loop
+  const char *file;       // Name of directory+file containing the loop header
+  uint64_t line;          // Line number of the loop header
+  uint64_t first_line;    // Lowest line number appearing in the loop
+  uint64_t last_line;     // Highest line number appearing in the loop
+  uint64_t calls;         // Number of calls to non-intrinsic functions
+  uint64_t recurrences;   // Number of loop-carried scalars other than induction variables
+  uint64_t *counters;     // BF_LOOP_NUM_COUNTERS tallies, indexed by BF_LOOP_*
+} bf_loop_info_t;
+
+// Distinguish the masked vector memory operations whose lane usage we tally.
+enum {
+  BF_VECLANE_MASKED_LOAD,       // llvm.masked.load.*
+  BF_VECLANE_MASKED_STORE,      // llvm.masked.store.*
+  BF_VECLANE_GATHER,            // llvm.masked.gather.*
+  BF_VECLANE_SCATTER,           // llvm.masked.scatter.*
+  BF_VECLANE_EXPAND_LOAD,       // llvm.masked.expandload.*
+  BF_VECLANE_COMPRESS_STORE,    // llvm.masked.compressstore.*
+  BF_VECLANE_NUM
+};
+
+// Enumerate the hardware prefetchers the cache model can simulate.
+typedef enum {
+  BF_PREFETCH_NONE,       // Demand fetch only
+  BF_PREFETCH_NEXT_LINE,  // Fetch the lines following each line accessed
+  BF_PREFETCH_STRIDE,     // Fetch ahead along each load/store site's stride
+  BF_PREFETCH_STREAM,     // Fetch ahead along sequential streams of misses
+  BF_PREFETCH_NUM
+} bf_prefetcher_t;
+
 // Define constants for "constant operand" and "no operand" for
 // instruction-dependency reporting.
 enum {
@@ -102,6 +156,30 @@ typedef struct {
   unsigned int line;     // Line number at which the symbol appears
 } bf_symbol_info_t;
 
+// Define a type for communicating from the plugin to the run-time library
+// the operations a single source line contributes to a basic block.
+typedef struct {
+  const char *file;      // Name of directory+file containing the line
+  uint64_t line;         // Line number
+  uint64_t loads;        // Number of load instructions
+  uint64_t stores;       // Number of store instructions
+  uint64_t load_bytes;   // Number of bytes loaded
+  uint64_t store_bytes;  // Number of bytes stored
+  uint64_t flops;        // Number of floating-point operations
+  uint64_t ops;          // Number of operations of any type
+} bf_line_counts_t;
+
+// Define a type for communicating from the plugin to the run-time library
+// the shape of the vector operations a function performs and where the
+// operations of each shape are tallied.
+typedef struct {
+  const char *function;   // Name of the function performing the operations
+  uint64_t num_elements;  // Number of scalar elements in the vector operation
+  uint64_t element_bits;  // Number of bits per scalar element
+  uint64_t is_flop;       // 1=floating-point operation; 0=integer operation
+  uint64_t *tally;        // Number of operations of this shape performed
+} bf_vector_slot_t;
+
 // Map a memory-access type to an index into bf_mem_insts_count[].
 static inline uint64_t mem_type_to_index(uint64_t memop,
                                          uint64_t memref,
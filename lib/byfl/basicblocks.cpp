@@ -26,6 +26,10 @@ uint64_t  bf_fp_bits_count    = 0;    // Tally of the number of bits used by all
 uint64_t  bf_op_count         = 0;    // Tally of the number of operations performed
 uint64_t  bf_op_bits_count    = 0;    // Tally of the number of bits used by all operations except loads/stores
 
+// The instrumented code ANDs this into the increments it applies directly to
+// static tallies so that they, too, respect bf_enable_counting().
+uint64_t  bf_count_mask       = ~uint64_t(0);  // All ones=counting; zero=counting is suppressed
+
 namespace bytesflops {
 
 // The following values represent more persistent counter and other state.
@@ -331,6 +335,10 @@ void ByteFlopCounters::reset (void)
 extern "C"
 void bf_accumulate_bb_tallies (void)
 {
+  // Write a snapshot if one was requested.
+  if (__builtin_expect(bf_snapshot_requested, 0))
+    bf_service_snapshot();
+
   // Add the current values to the per-BB totals.
   if (bf_suppress_counting)
     return;
@@ -348,6 +356,8 @@ void bf_accumulate_bb_tallies (void)
                        bf_op_count,
                        bf_op_bits_count);
   global_totals.accumulate(&bb_totals);
+  if (__builtin_expect(bf_omp_active, 0))
+    bf_omp_accumulate(&bb_totals);
   const char* partition = bf_string_to_symbol(bf_categorize_counters());
   if (partition != NULL) {
     auto sm_iter = user_defined_totals().find(partition);
@@ -358,6 +368,29 @@ void bf_accumulate_bb_tallies (void)
   }
 }
 
+// Attribute the current counter variables (bf_*_count) to the calling
+// thread's OpenMP region.  This is needed only when the instrumented code
+// doesn't call bf_accumulate_bb_tallies() at the end of every basic block.
+static void omp_accumulate_counter_vars (void)
+{
+  static thread_local ByteFlopCounters counter_vars;
+  counter_vars.reset();
+  counter_vars.accumulate(bf_mem_insts_count,
+                          bf_inst_mix_histo,
+                          bf_terminator_count,
+                          bf_mem_intrin_count,
+                          bf_load_count,
+                          bf_store_count,
+                          bf_load_ins_count,
+                          bf_store_ins_count,
+                          bf_call_ins_count,
+                          bf_flop_count,
+                          bf_fp_bits_count,
+                          bf_op_count,
+                          bf_op_bits_count);
+  bf_omp_accumulate(&counter_vars);
+}
+
 // Reset the current basic block's tallies rather than requiring a push and a
 // pop for every basic block.
 extern "C"
@@ -368,6 +401,65 @@ void bf_reset_bb_tallies (void)
   bb_totals.reset();
 }
 
+// At the end of a basic block, accumulate the current counter variables
+// (bf_*_count) into the calling thread's counters and, if -bf-thread-funcs
+// was specified, into the calling thread's counters for the given function.
+extern "C"
+void bf_tally_thread_bb (const char* funcname)
+{
+  if (__builtin_expect(bf_snapshot_requested, 0))
+    bf_service_snapshot();
+  if (bf_suppress_counting)
+    return;
+  if (__builtin_expect(bf_omp_active, 0) && !bf_every_bb && !bf_per_func)
+    omp_accumulate_counter_vars();
+  bf_thread_counters()->accumulate(bf_mem_insts_count,
+                                   bf_inst_mix_histo,
+                                   bf_terminator_count,
+                                   bf_mem_intrin_count,
+                                   bf_load_count,
+                                   bf_store_count,
+                                   bf_load_ins_count,
+                                   bf_store_ins_count,
+                                   bf_call_ins_count,
+                                   bf_flop_count,
+                                   bf_fp_bits_count,
+                                   bf_op_count,
+                                   bf_op_bits_count);
+  if (bf_thread_funcs)
+    bf_thread_function_counters(funcname)->accumulate(bf_mem_insts_count,
+                                                      bf_inst_mix_histo,
+                                                      bf_terminator_count,
+                                                      bf_mem_intrin_count,
+                                                      bf_load_count,
+                                                      bf_store_count,
+                                                      bf_load_ins_count,
+                                                      bf_store_ins_count,
+                                                      bf_call_ins_count,
+                                                      bf_flop_count,
+                                                      bf_fp_bits_count,
+                                                      bf_op_count,
+                                                      bf_op_bits_count);
+
+  // The instrumented code resets the counter variables at the end of every
+  // basic block.  If nothing else accumulates them into the global totals,
+  // we need to.
+  if (!bf_every_bb && !bf_per_func)
+    global_totals.accumulate(bf_mem_insts_count,
+                             bf_inst_mix_histo,
+                             bf_terminator_count,
+                             bf_mem_intrin_count,
+                             bf_load_count,
+                             bf_store_count,
+                             bf_load_ins_count,
+                             bf_store_ins_count,
+                             bf_call_ins_count,
+                             bf_flop_count,
+                             bf_fp_bits_count,
+                             bf_op_count,
+                             bf_op_bits_count);
+}
+
 // Keep track of dynamic basic-block accesses given a unique identifier and
 // static basic-block size in instructions.
 extern "C"
@@ -570,10 +662,15 @@ void bf_report_bb_tallies (bf_symbol_info_t* syminfo)
 extern "C"
 void bf_assoc_counters_with_func (KeyType_t funcID)
 {
+  if (__builtin_expect(bf_snapshot_requested, 0))
+    bf_service_snapshot();
+
   // Ensure that per_func_totals contains an ByteFlopCounters entry
   // for funcname, then add the current counters to that entry.
   if (bf_suppress_counting)
     return;
+  if (__builtin_expect(bf_omp_active, 0) && !bf_every_bb)
+    omp_accumulate_counter_vars();
   key2bfc_t::iterator sm_iter;
   KeyType_t key;
   if (bf_call_stack) {
@@ -620,10 +717,45 @@ void bf_assoc_counters_with_func (KeyType_t funcID)
   }
 }
 
-// Finalize the basic-block tallies at the end of the run.
-void finalize_bblocks (void)
+// Reset all of the global counters to zero.
+void bf_reset_counters (void)
+{
+  global_totals.reset();
+  prev_global_totals.reset();
+  bb_totals.reset();
+  if (bf_types)
+    for (size_t i = 0; i < NUM_MEM_INSTS; i++)
+      bf_mem_insts_count[i] = 0;
+  if (bf_tally_inst_mix)
+    for (size_t i = 0; i < NUM_LLVM_OPCODES; i++)
+      bf_inst_mix_histo[i] = 0;
+  for (size_t i = 0; i < BF_END_BB_NUM; i++)
+    bf_terminator_count[i] = 0;
+  for (size_t i = 0; i < BF_NUM_MEM_INTRIN; i++)
+    bf_mem_intrin_count[i] = 0;
+  bf_load_count = 0;
+  bf_store_count = 0;
+  bf_load_ins_count = 0;
+  bf_store_ins_count = 0;
+  bf_call_ins_count = 0;
+  bf_flop_count = 0;
+  bf_fp_bits_count = 0;
+  bf_op_count = 0;
+  bf_op_bits_count = 0;
+  bf_omp_reset_counters();
+  bf_thread_reset_counters();
+  bf_perf_reset();
+}
+
+// Finalize the basic-block tallies at the end of the run (final=true) or
+// before writing a snapshot (final=false).
+void finalize_bblocks (bool final)
 {
   if (bf_every_bb) {
+    // Snapshots don't include the streamed basic-block table.
+    if (!final)
+      return;
+
     // Complete the basic-block table.
     if (num_merged > 0)
       // Flush the last set of basic blocks.
@@ -0,0 +1,236 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (profiling conditional branches with branch-predictor models)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+extern BinaryOStream* bfbin;
+
+// Define the sizes of the predictors we model.  Both are tables of 2-bit
+// saturating counters.  The bimodal predictor indexes its table by branch
+// site; the gshare predictor indexes its table by branch site XORed with the
+// global history of branch outcomes.
+static const int bimodal_bits = 12;
+static const int gshare_bits = 14;
+static const uint64_t bimodal_entries = uint64_t(1) << bimodal_bits;
+static const uint64_t gshare_entries = uint64_t(1) << gshare_bits;
+
+// Report at most this many branch sites.
+static const size_t max_sites_reported = 100;
+
+// Describe everything we know about a single conditional-branch site.
+class BranchSite {
+public:
+  bf_symbol_info_t syminfo;          // Branch-site source information
+  uint64_t taken = 0;                // Number of times the branch was taken
+  uint64_t not_taken = 0;            // Number of times the branch was not taken
+  uint64_t transitions = 0;          // Number of outcome changes from one execution to the next
+  uint64_t bimodal_mispredicts = 0;  // Mispredictions by the bimodal predictor
+  uint64_t gshare_mispredicts = 0;   // Mispredictions by the gshare predictor
+  bool last_taken = false;           // Most recent outcome
+
+  BranchSite(const bf_symbol_info_t& sinfo) : syminfo(sinfo) { }
+
+  // Incorporate another thread's tallies for the same site.
+  void merge (const BranchSite& other) {
+    taken += other.taken;
+    not_taken += other.not_taken;
+    transitions += other.transitions;
+    bimodal_mispredicts += other.bimodal_mispredicts;
+    gshare_mispredicts += other.gshare_mispredicts;
+  }
+};
+typedef unordered_map<uint64_t, BranchSite*> site_map_t;
+
+// Maintain each thread's branch predictors and per-site tallies.  Branch
+// predictors are private to a core, so each thread gets its own.
+class ThreadBranches {
+public:
+  uint8_t bimodal[bimodal_entries];  // Bimodal predictor's 2-bit counters
+  uint8_t gshare[gshare_entries];    // Gshare predictor's 2-bit counters
+  uint64_t history = 0;              // Global branch history (1=taken)
+  site_map_t sites;                  // Per-site tallies
+
+  ThreadBranches() {
+    // Initialize all counters to "weakly not taken".
+    memset(bimodal, 1, sizeof(bimodal));
+    memset(gshare, 1, sizeof(gshare));
+  }
+};
+static __thread ThreadBranches* thread_branches = nullptr;
+static vector<ThreadBranches*>* all_branches = nullptr;
+
+// Serialize all accesses to all_branches.
+static pthread_mutex_t branch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Initialize some of our variables at first use.
+void initialize_branches (void)
+{
+  all_branches = new vector<ThreadBranches*>();
+}
+
+// Update a 2-bit saturating counter and return true if it mispredicted.
+static inline bool predict_and_update (uint8_t& counter, bool taken)
+{
+  bool mispredicted = (counter >= 2) != taken;
+  if (taken) {
+    if (counter < 3)
+      counter++;
+  }
+  else
+    if (counter > 0)
+      counter--;
+  return mispredicted;
+}
+
+// Record the outcome of a conditional branch.
+extern "C"
+void bf_track_branch (const bf_symbol_info_t* syminfo, uint8_t taken)
+{
+  // Do nothing if counting is suppressed.
+  if (bf_suppress_counting)
+    return;
+
+  // Create the calling thread's predictors on first use.
+  ThreadBranches* tb = thread_branches;
+  if (__builtin_expect(tb == nullptr, 0)) {
+    tb = new ThreadBranches();
+    pthread_mutex_lock(&branch_lock);
+    all_branches->push_back(tb);
+    pthread_mutex_unlock(&branch_lock);
+    thread_branches = tb;
+  }
+
+  // Find or create the branch site.
+  BranchSite*& site = tb->sites[syminfo->ID];
+  bool first_time = site == nullptr;
+  if (first_time)
+    site = new BranchSite(*syminfo);
+
+  // Tally the outcome.
+  if (taken)
+    site->taken++;
+  else
+    site->not_taken++;
+  if (!first_time && site->last_taken != bool(taken))
+    site->transitions++;
+  site->last_taken = taken;
+
+  // Run the outcome through each predictor.
+  uint64_t pc = syminfo->ID ^ (syminfo->ID >> 32);
+  if (predict_and_update(tb->bimodal[pc & (bimodal_entries - 1)], taken))
+    site->bimodal_mispredicts++;
+  if (predict_and_update(tb->gshare[(pc ^ tb->history) & (gshare_entries - 1)], taken))
+    site->gshare_mispredicts++;
+  tb->history = (tb->history << 1) | (taken ? 1 : 0);
+}
+
+// Sort branch sites by decreasing gshare mispredictions, then by decreasing
+// bimodal mispredictions, then by ID.
+static bool compare_sites (const BranchSite* a, const BranchSite* b)
+{
+  if (a->gshare_mispredicts != b->gshare_mispredicts)
+    return a->gshare_mispredicts > b->gshare_mispredicts;
+  if (a->bimodal_mispredicts != b->bimodal_mispredicts)
+    return a->bimodal_mispredicts > b->bimodal_mispredicts;
+  return a->syminfo.ID < b->syminfo.ID;
+}
+
+// Report the most mispredicted branch sites and return program-wide totals.
+void bf_report_branches (uint64_t* branches, uint64_t* bimodal_mispredicts,
+                         uint64_t* gshare_mispredicts)
+{
+  // Merge all threads' tallies by branch site.
+  site_map_t merged;
+  pthread_mutex_lock(&branch_lock);
+  for (auto titer = all_branches->cbegin(); titer != all_branches->cend(); titer++)
+    for (auto iter = (*titer)->sites.cbegin(); iter != (*titer)->sites.cend(); iter++) {
+      BranchSite*& site = merged[iter->first];
+      if (site == nullptr)
+        site = new BranchSite(iter->second->syminfo);
+      site->merge(*iter->second);
+    }
+  pthread_mutex_unlock(&branch_lock);
+
+  // Compute program-wide totals.
+  vector<BranchSite*> sorted_sites;
+  *branches = *bimodal_mispredicts = *gshare_mispredicts = 0;
+  for (auto iter = merged.cbegin(); iter != merged.cend(); iter++) {
+    const BranchSite* site = iter->second;
+    *branches += site->taken + site->not_taken;
+    *bimodal_mispredicts += site->bimodal_mispredicts;
+    *gshare_mispredicts += site->gshare_mispredicts;
+    sorted_sites.push_back(iter->second);
+  }
+
+  // Output the most mispredicted branch sites.
+  sort(sorted_sites.begin(), sorted_sites.end(), compare_sites);
+  if (sorted_sites.size() > max_sites_reported)
+    sorted_sites.resize(max_sites_reported);
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Mispredicted branches";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Branch site ID"
+         << uint8_t(BINOUT_COL_STRING) << "Mangled function name"
+         << uint8_t(BINOUT_COL_STRING) << "Demangled function name"
+         << uint8_t(BINOUT_COL_STRING) << "File name"
+         << uint8_t(BINOUT_COL_UINT64) << "Line number"
+         << uint8_t(BINOUT_COL_UINT64) << "Taken"
+         << uint8_t(BINOUT_COL_UINT64) << "Not taken"
+         << uint8_t(BINOUT_COL_UINT64) << "Transitions"
+         << uint8_t(BINOUT_COL_UINT64) << "Bimodal mispredictions"
+         << uint8_t(BINOUT_COL_UINT64) << "Gshare mispredictions"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = sorted_sites.cbegin(); iter != sorted_sites.cend(); iter++) {
+    const BranchSite* site = *iter;
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << site->syminfo.ID
+           << site->syminfo.function
+           << demangle_func_name(site->syminfo.function)
+           << (strcmp(site->syminfo.file, "??") == 0 ? "" : site->syminfo.file)
+           << uint64_t(site->syminfo.line)
+           << site->taken
+           << site->not_taken
+           << site->transitions
+           << site->bimodal_mispredicts
+           << site->gshare_mispredicts;
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Output a summary of the predictors we modeled.
+  *bfbin << uint8_t(BINOUT_TABLE_KEYVAL) << "Branch-predictor model"
+         << uint8_t(BINOUT_COL_UINT64) << "Conditional branches" << *branches
+         << uint8_t(BINOUT_COL_UINT64) << "Conditional-branch sites" << uint64_t(merged.size())
+         << uint8_t(BINOUT_COL_UINT64) << "Bimodal table entries" << bimodal_entries
+         << uint8_t(BINOUT_COL_UINT64) << "Bimodal mispredictions" << *bimodal_mispredicts
+         << uint8_t(BINOUT_COL_UINT64) << "Gshare table entries" << gshare_entries
+         << uint8_t(BINOUT_COL_UINT64) << "Gshare mispredictions" << *gshare_mispredicts
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = merged.begin(); iter != merged.end(); iter++)
+    delete iter->second;
+}
+
+// Return program-wide branch statistics without producing a report.
+void bf_get_branch_summary (uint64_t* branches, uint64_t* transitions,
+                            uint64_t* bimodal_mispredicts,
+                            uint64_t* gshare_mispredicts)
+{
+  pthread_mutex_lock(&branch_lock);
+  *branches = *transitions = *bimodal_mispredicts = *gshare_mispredicts = 0;
+  for (auto titer = all_branches->cbegin(); titer != all_branches->cend(); titer++)
+    for (auto iter = (*titer)->sites.cbegin(); iter != (*titer)->sites.cend(); iter++) {
+      const BranchSite* site = iter->second;
+      *branches += site->taken + site->not_taken;
+      *transitions += site->transitions;
+      *bimodal_mispredicts += site->bimodal_mispredicts;
+      *gshare_mispredicts += site->gshare_mispredicts;
+    }
+  pthread_mutex_unlock(&branch_lock);
+}
+
+} // namespace bytesflops
@@ -7,6 +7,7 @@
  *    Rob Aulwes <rta@lanl.gov>
  */
 
+#include <sys/resource.h>
 #include "byfl.h"
 #include "byfl-common.h"
 #include "callstack.h"
@@ -170,6 +171,7 @@ void bf_initialize_if_necessary (void)
   static bool initialized = false;
   if (!__builtin_expect(initialized, true)) {
     initialized = true;
+    initialize_memusage();
     initialize_byfl();
     initialize_bblocks();
     initialize_reuse();
@@ -181,6 +183,17 @@ void bf_initialize_if_necessary (void)
     initialize_data_structures();
     initialize_strides();
     initialize_cache();
+    initialize_snapshots();
+    initialize_perf_events();
+    initialize_numa();
+    initialize_sharing();
+    initialize_tlb();
+    initialize_mem_intrinsics();
+    initialize_branches();
+    initialize_call_targets();
+    initialize_redundancy();
+    initialize_struct_fields();
+    initialize_source_lines();
   }
 }
 
@@ -197,6 +210,9 @@ void bf_enable_counting (int enable)
 {
   bf_reset_bb_tallies();
   bf_suppress_counting = !bool(enable);
+  bf_count_mask = enable ? ~uint64_t(0) : 0;
+  if (enable && bf_perf_active)
+    bf_perf_resume();
 }
 
 // Tally the number of calls to each function.  Store the function's symbol
@@ -226,6 +242,8 @@ void bf_record_funcs2keys(uint32_t cnt, const uint64_t* keys,
 extern "C"
 void bf_push_function (const char* funcname, KeyType_t keyID, bf_symbol_info_t* syminfo)
 {
+  if (__builtin_expect(bf_perf_active, 0) && !bf_suppress_counting)
+    bf_perf_sample(bf_func_and_parents_id);
   bf_current_func_key = keyID;
   bf_func_and_parents =  call_stack->push_function(funcname, keyID);
   uint64_t depth = 1 << call_stack->depth();
@@ -244,6 +262,8 @@ void bf_push_function (const char* funcname, KeyType_t keyID, bf_symbol_info_t*
 extern "C"
 void bf_pop_function (void)
 {
+  if (__builtin_expect(bf_perf_active, 0) && !bf_suppress_counting)
+    bf_perf_sample(bf_func_and_parents_id);
   uint64_t depth = 1 << call_stack->depth();
   CallStack::StackItem_t item = call_stack->pop_function();
   bf_func_and_parents = item.first;
@@ -342,6 +362,18 @@ bool suppress_output (void)
     // Number warning messages.
     int num_warnings = 0;
 
+    // Warn the user if we can't measure the requested events.
+    if (bf_perf_warning != nullptr)
+      *bfout << "BYFL_WARNING: (" << ++num_warnings << ") " << bf_perf_warning << ".\n";
+
+    // Warn the user if we can't attribute counts to OpenMP regions.
+    if (bf_omp_warning != nullptr)
+      *bfout << "BYFL_WARNING: (" << ++num_warnings << ") " << bf_omp_warning << ".\n";
+
+    // Warn the user if we can't take the requested snapshots.
+    if (bf_snapshot_warning != nullptr)
+      *bfout << "BYFL_WARNING: (" << ++num_warnings << ") " << bf_snapshot_warning << ".\n";
+
     // Warn the user if he defined bf_categorize_counters() but didn't compile
     // with -bf-every-bb.
 #ifdef HAVE_WEAK_ALIASES
@@ -362,6 +394,7 @@ private:
   static void aggregate_call_tallies() {
     key2num_t & fmap = func_call_tallies();
     str2num_t & final_map = final_call_tallies();
+    final_map.clear();
     for (auto it = fmap.begin(); it != fmap.end(); it++) {
       auto kiter = key_to_func().find(it->first);
       if (kiter == key_to_func().end())
@@ -450,6 +483,9 @@ private:
              << uint8_t(BINOUT_COL_STRING) << "Demangled function name"
              << uint8_t(BINOUT_COL_STRING) << "File name"
              << uint8_t(BINOUT_COL_UINT64) << "Line number";
+    size_t num_perf_events = bf_perf_num_events();
+    for (size_t i = 0; i < num_perf_events; i++)
+      *bfbin << uint8_t(BINOUT_COL_UINT64) << bf_perf_event_name(i);
     *bfbin << uint8_t(BINOUT_COL_NONE);
 
     // Output the data by sorted function name in both textual and
@@ -506,6 +542,11 @@ private:
         *bfbin << "" << uint64_t(0);
       else
         *bfbin << symiter->second.file << uint64_t(symiter->second.line);
+      if (num_perf_events > 0) {
+        const uint64_t* perf_events = bf_perf_function_events(*fn_iter);
+        for (size_t i = 0; i < num_perf_events; i++)
+          *bfbin << (perf_events == nullptr ? uint64_t(0) : perf_events[i]);
+      }
     }
     *bfbin << uint8_t(BINOUT_ROW_NONE);
     delete all_funcs;
@@ -1213,6 +1254,9 @@ private:
       dumpfile.close();
     }
 
+    // Write cache information by function and by partition.
+    bf_report_cache_by_key();
+
     // Output textual summary information.
     string tag(bf_output_prefix + "BYFL_SUMMARY");
     uint64_t global_mem_ops = counter_totals.load_ins + counter_totals.store_ins;
@@ -1221,6 +1265,18 @@ private:
            << global_mem_ops - misaligned_mem_ops[0] << " aligned + "
            << misaligned_mem_ops[0] << " misaligned memory ops; "
            << "line size = " << bf_line_size << " bytes)\n";
+    if (bf_prefetcher != BF_PREFETCH_NONE) {
+      uint64_t demand_misses, prefetches, prefetch_hits, useless_prefetches;
+      bf_report_prefetching(&demand_misses, &prefetches, &prefetch_hits, &useless_prefetches);
+      *bfout << tag << ": " << setw(25) << demand_misses << " demand misses with a "
+             << bf_prefetcher_name() << " prefetcher (degree = " << bf_prefetch_degree
+             << ", distance = " << bf_prefetch_distance
+             << ", cache = " << bf_prefetch_cache << " lines)\n"
+             << tag << ": " << setw(25) << prefetch_hits << " prefetch hits ("
+             << prefetches << " lines prefetched)\n"
+             << tag << ": " << setw(25) << useless_prefetches << " useless prefetches ("
+             << useless_prefetches*bf_line_size << " extra bytes transferred)\n";
+    }
     *bfout << tag << ": " << separator << '\n';
 
     // Output binary summary information.
@@ -1232,6 +1288,80 @@ private:
            << uint8_t(BINOUT_COL_NONE);
   }
 
+  // Report how much memory Byfl itself consumed, broken down by subsystem,
+  // so users can tell what to disable when an instrumented run exhausts
+  // memory.
+  void report_self_overhead() {
+    // Acquire the application's peak RSS (which includes Byfl's overhead).
+    struct rusage usage;
+    uint64_t peak_rss = 0;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+      peak_rss = uint64_t(usage.ru_maxrss)*1024;
+    uint64_t total_current, total_peak;
+    bf_get_total_mem_usage(&total_current, &total_peak);
+
+    // Output the overhead of each subsystem in binary format.
+    *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Byfl overhead";
+    *bfbin << uint8_t(BINOUT_COL_STRING) << "Subsystem"
+           << uint8_t(BINOUT_COL_UINT64) << "Peak bytes"
+           << uint8_t(BINOUT_COL_UINT64) << "Final bytes"
+           << uint8_t(BINOUT_COL_BOOL) << "Approximate"
+           << uint8_t(BINOUT_COL_NONE);
+    vector<string> approximations;
+    for (int i = 0; i < BF_MEM_NUM_SUBSYSTEMS; i++) {
+      bf_mem_subsystem_t subsystem = bf_mem_subsystem_t(i);
+      uint64_t current, peak;
+      bf_get_mem_usage(subsystem, &current, &peak);
+      string approx = bf_mem_approximation(subsystem);
+      if (approx != "")
+        approximations.push_back(approx);
+      *bfbin << uint8_t(BINOUT_ROW_DATA)
+             << bf_mem_subsystem_name(subsystem) << peak << current << (approx != "");
+    }
+    *bfbin << uint8_t(BINOUT_ROW_NONE);
+    *bfbin << uint8_t(BINOUT_TABLE_KEYVAL) << "Byfl overhead summary";
+    *bfbin << uint8_t(BINOUT_COL_UINT64) << "Peak Byfl bytes" << total_peak
+           << uint8_t(BINOUT_COL_UINT64) << "Final Byfl bytes" << total_current
+           << uint8_t(BINOUT_COL_UINT64) << "Peak RSS bytes" << peak_rss
+           << uint8_t(BINOUT_COL_UINT64) << "Memory budget bytes" << bf_mem_budget
+           << uint8_t(BINOUT_COL_NONE);
+
+    // List every analysis that fell back to an approximation to stay within
+    // the BF_MAX_MEMORY budget.
+    if (!approximations.empty()) {
+      *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Approximations";
+      *bfbin << uint8_t(BINOUT_COL_STRING) << "Description"
+             << uint8_t(BINOUT_COL_NONE);
+      for (auto iter = approximations.cbegin(); iter != approximations.cend(); iter++)
+        *bfbin << uint8_t(BINOUT_ROW_DATA) << *iter;
+      *bfbin << uint8_t(BINOUT_ROW_NONE);
+    }
+
+    // Output the same information textually, omitting unused subsystems.
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    for (int i = 0; i < BF_MEM_NUM_SUBSYSTEMS; i++) {
+      bf_mem_subsystem_t subsystem = bf_mem_subsystem_t(i);
+      uint64_t current, peak;
+      bf_get_mem_usage(subsystem, &current, &peak);
+      if (peak == 0)
+        continue;
+      string name(bf_mem_subsystem_name(subsystem));
+      transform(name.begin(), name.end(), name.begin(), ::tolower);
+      *bfout << tag << ": " << setw(25) << peak << " peak bytes of Byfl "
+             << name << " (" << current << " at exit)\n";
+    }
+    *bfout << tag << ": " << setw(25) << total_peak << " peak bytes of Byfl overhead";
+    if (peak_rss > 0)
+      *bfout << " (" << fixed << setprecision(1)
+             << 100.0*double(total_peak)/double(peak_rss) << "% of "
+             << peak_rss << " bytes peak RSS)";
+    *bfout << '\n';
+    *bfout << tag << ": " << separator << '\n';
+    for (auto iter = approximations.cbegin(); iter != approximations.cend(); iter++)
+      *bfout << "BYFL_WARNING: " << *iter << " to remain within BF_MAX_MEMORY="
+             << bf_mem_budget << " bytes.\n";
+  }
+
   // Report miscellaneous information in the binary output file.
   void report_misc_info() {
     // Report the list of environment variables that are currently active.
@@ -1330,19 +1460,241 @@ private:
     *bfbin << uint8_t(BINOUT_COL_NONE);
   }
 
-public:
-  RunAtEndOfProgram() {
-    separator = "-----------------------------------------------------------------";
+  // Report program-wide hardware and software event counts measured via
+  // BF_PERF_EVENTS.
+  void report_measured_events (void) {
+    size_t num_perf_events = bf_perf_num_events();
+    const uint64_t* perf_events = bf_perf_program_events();
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    *bfbin << uint8_t(BINOUT_TABLE_KEYVAL) << "Measured events";
+    for (size_t i = 0; i < num_perf_events; i++) {
+      string name(bf_perf_event_name(i));
+      *bfbin << uint8_t(BINOUT_COL_UINT64) << name << perf_events[i];
+      name[0] = tolower(name[0]);
+      *bfout << tag << ": " << setw(25) << perf_events[i] << ' ' << name << '\n';
+    }
+    *bfbin << uint8_t(BINOUT_COL_NONE);
+    *bfout << tag << ": " << separator << '\n';
   }
 
-  ~RunAtEndOfProgram() {
-    // Do nothing if our output is suppressed.
-    bf_initialize_if_necessary();
-    if (suppress_output() || bf_abnormal_exit)
-      return;
+  // Report how many pages were shared across threads and warn about data
+  // that were initialized serially but accessed in parallel.
+  void report_numa_summary (void) {
+    uint64_t page_size, threads, pages_touched, pages_shared, initial_pages_shared;
+    bf_get_numa_summary(&page_size, &threads, &pages_touched, &pages_shared, &initial_pages_shared);
+    *bfbin << uint8_t(BINOUT_TABLE_KEYVAL) << "NUMA page summary"
+           << uint8_t(BINOUT_COL_UINT64) << "Page size" << page_size
+           << uint8_t(BINOUT_COL_UINT64) << "Threads touching memory" << threads
+           << uint8_t(BINOUT_COL_UINT64) << "Pages touched" << pages_touched
+           << uint8_t(BINOUT_COL_UINT64) << "Pages shared by multiple threads" << pages_shared
+           << uint8_t(BINOUT_COL_UINT64) << "Shared pages first touched by the initial thread" << initial_pages_shared
+           << uint8_t(BINOUT_COL_NONE);
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    *bfout << tag << ": " << setw(25) << threads << " threads touching memory\n"
+           << tag << ": " << setw(25) << pages_touched << " " << page_size << "-byte pages touched\n"
+           << tag << ": " << setw(25) << pages_shared << " pages shared by multiple threads\n"
+           << tag << ": " << setw(25) << initial_pages_shared << " shared pages first touched by the initial thread\n"
+           << tag << ": " << separator << '\n';
+
+    // Warn about the worst cases of serial initialization.
+    const size_t max_warnings = 10;
+    const vector<string>& serial_init = bf_numa_serial_init();
+    for (size_t i = 0; i < serial_init.size() && i < max_warnings; i++)
+      *bfout << "BYFL_WARNING: " << serial_init[i] << ".\n";
+    if (serial_init.size() > max_warnings)
+      *bfout << "BYFL_WARNING: ...and " << serial_init.size() - max_warnings
+             << " more serially initialized functions or data structures.\n";
+  }
+
+  // Report how many coherence misses were due to true and to false sharing.
+  void report_sharing_summary (void) {
+    uint64_t true_misses, false_misses, true_lines, false_lines;
+    bf_get_sharing_summary(&true_misses, &false_misses, &true_lines, &false_lines);
+    *bfbin << uint8_t(BINOUT_TABLE_KEYVAL) << "Cache-line sharing summary"
+           << uint8_t(BINOUT_COL_UINT64) << "Line size" << bf_line_size
+           << uint8_t(BINOUT_COL_UINT64) << "True-sharing misses" << true_misses
+           << uint8_t(BINOUT_COL_UINT64) << "False-sharing misses" << false_misses
+           << uint8_t(BINOUT_COL_UINT64) << "Lines with true sharing" << true_lines
+           << uint8_t(BINOUT_COL_UINT64) << "Lines with false sharing" << false_lines
+           << uint8_t(BINOUT_COL_NONE);
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    *bfout << tag << ": " << setw(25) << true_misses << " true-sharing misses ("
+           << true_lines << " lines)\n"
+           << tag << ": " << setw(25) << false_misses << " false-sharing misses ("
+           << false_lines << " lines)\n"
+           << tag << ": " << separator << '\n';
+  }
+
+  // Report TLB miss counts for each page size.
+  void report_tlb_summary (void) {
+    vector<uint64_t> accesses, misses;
+    bf_report_tlb(accesses, misses);
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    uint64_t entries = bf_tlb_summary_entries();
+    for (size_t i = 0; i < accesses.size(); i++)
+      *bfout << tag << ": " << setw(25) << misses[i] << ' ' << entries
+             << "-entry TLB misses with " << bf_tlb_page_size_name(i) << " pages ("
+             << accesses[i] << " page accesses)\n";
+    *bfout << tag << ": " << separator << '\n';
+  }
+
+  // Report how many memory-intrinsic call sites were dominated by tiny or
+  // unaligned calls and warn about the worst of them.
+  void report_mem_intrinsic_summary (void) {
+    const vector<string>& flagged = bf_mem_intrinsics_flagged();
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    *bfout << tag << ": " << setw(25) << flagged.size()
+           << " memset/memcpy/memmove call sites dominated by tiny or unaligned calls\n"
+           << tag << ": " << separator << '\n';
+    const size_t max_warnings = 10;
+    for (size_t i = 0; i < flagged.size() && i < max_warnings; i++)
+      *bfout << "BYFL_WARNING: " << flagged[i] << ".\n";
+    if (flagged.size() > max_warnings)
+      *bfout << "BYFL_WARNING: ...and " << flagged.size() - max_warnings
+             << " more call sites dominated by tiny or unaligned calls.\n";
+  }
 
+  // Report the most mispredicted branch sites and the program-wide
+  // misprediction counts of each branch-predictor model.
+  void report_branch_summary (void) {
+    uint64_t branches, bimodal_mispredicts, gshare_mispredicts;
+    bf_report_branches(&branches, &bimodal_mispredicts, &gshare_mispredicts);
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    *bfout << tag << ": " << setw(25) << branches << " conditional branches executed\n"
+           << tag << ": " << setw(25) << bimodal_mispredicts << " bimodal-predictor mispredictions\n"
+           << tag << ": " << setw(25) << gshare_mispredicts << " gshare-predictor mispredictions\n"
+           << tag << ": " << separator << '\n';
+  }
+
+  // Report the target distribution of each indirect-call site and summarize
+  // how many sites could be devirtualized.
+  void report_call_target_summary (void) {
+    uint64_t indirect_calls, num_sites, monomorphic_sites;
+    bf_report_call_targets(&indirect_calls, &num_sites, &monomorphic_sites);
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    *bfout << tag << ": " << setw(25) << indirect_calls << " indirect calls ("
+           << num_sites << " call sites)\n"
+           << tag << ": " << setw(25) << monomorphic_sites
+           << " indirect-call sites with a single target\n"
+           << tag << ": " << separator << '\n';
+  }
+
+  // Report the sites that wasted the most bytes on redundant loads or silent
+  // stores and summarize the waste program-wide.
+  void report_redundancy_summary (void) {
+    uint64_t loads, redundant_loads, stores, silent_stores, wasted_bytes;
+    bf_report_redundancy(&loads, &redundant_loads, &stores, &silent_stores, &wasted_bytes);
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    *bfout << tag << ": " << setw(25) << redundant_loads << " redundant loads (of "
+           << loads << ")\n"
+           << tag << ": " << setw(25) << silent_stores << " silent stores (of "
+           << stores << ")\n"
+           << tag << ": " << setw(25) << wasted_bytes
+           << " bytes loaded or stored redundantly\n"
+           << tag << ": " << separator << '\n';
+  }
+
+  // Report how many structures would benefit from a hot/cold split and warn
+  // about the worst of them.
+  void report_struct_field_summary (void) {
+    const vector<string>& candidates = bf_struct_split_candidates();
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    *bfout << tag << ": " << setw(25) << candidates.size()
+           << " structures with candidates for hot/cold splitting\n"
+           << tag << ": " << separator << '\n';
+    const size_t max_warnings = 10;
+    for (size_t i = 0; i < candidates.size() && i < max_warnings; i++)
+      *bfout << "BYFL_WARNING: " << candidates[i] << ".\n";
+    if (candidates.size() > max_warnings)
+      *bfout << "BYFL_WARNING: ...and " << candidates.size() - max_warnings
+             << " more structures with candidates for hot/cold splitting.\n";
+  }
+
+  // Report how evenly the work was divided among threads.
+  void report_thread_summary (void) {
+    uint64_t threads, max_ops, total_ops, max_flops, total_flops, max_bytes, total_bytes;
+    bf_get_thread_summary(&threads, &max_ops, &total_ops, &max_flops, &total_flops,
+                          &max_bytes, &total_bytes);
+    uint64_t mean_ops = threads == 0 ? 0 : total_ops/threads;
+    uint64_t mean_flops = threads == 0 ? 0 : total_flops/threads;
+    uint64_t mean_bytes = threads == 0 ? 0 : total_bytes/threads;
+    *bfbin << uint8_t(BINOUT_TABLE_KEYVAL) << "Thread summary"
+           << uint8_t(BINOUT_COL_UINT64) << "Threads" << threads
+           << uint8_t(BINOUT_COL_UINT64) << "Maximum operations per thread" << max_ops
+           << uint8_t(BINOUT_COL_UINT64) << "Mean operations per thread" << mean_ops
+           << uint8_t(BINOUT_COL_UINT64) << "Maximum flops per thread" << max_flops
+           << uint8_t(BINOUT_COL_UINT64) << "Mean flops per thread" << mean_flops
+           << uint8_t(BINOUT_COL_UINT64) << "Maximum bytes per thread" << max_bytes
+           << uint8_t(BINOUT_COL_UINT64) << "Mean bytes per thread" << mean_bytes
+           << uint8_t(BINOUT_COL_NONE);
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    *bfout << tag << ": " << setw(25) << threads << " threads executing instrumented code\n";
+    if (total_ops > 0)
+      *bfout << tag << ": " << fixed << setw(25) << setprecision(4)
+             << double(max_ops)*double(threads)/double(total_ops)
+             << " max/mean operations per thread\n";
+    if (total_flops > 0)
+      *bfout << tag << ": " << fixed << setw(25) << setprecision(4)
+             << double(max_flops)*double(threads)/double(total_flops)
+             << " max/mean flops per thread\n";
+    if (total_bytes > 0)
+      *bfout << tag << ": " << fixed << setw(25) << setprecision(4)
+             << double(max_bytes)*double(threads)/double(total_bytes)
+             << " max/mean bytes per thread\n";
+    *bfout << tag << ": " << separator << '\n';
+  }
+
+  // Report how many inner loops appear to be good candidates for
+  // vectorization and warn about the most promising of them.
+  void report_loop_summary (void) {
+    const vector<string>& candidates = bf_loop_candidates();
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    *bfout << tag << ": " << setw(25) << candidates.size()
+           << " scalar inner loops that are candidates for vectorization\n"
+           << tag << ": " << separator << '\n';
+    const size_t max_warnings = 10;
+    for (size_t i = 0; i < candidates.size() && i < max_warnings; i++)
+      *bfout << "BYFL_WARNING: " << candidates[i] << ".\n";
+    if (candidates.size() > max_warnings)
+      *bfout << "BYFL_WARNING: ...and " << candidates.size() - max_warnings
+             << " more scalar inner loops that are candidates for vectorization.\n";
+  }
+
+  // Report the fraction of vector lanes that masked vector memory operations
+  // actually used, gather locality, and scatter conflicts.
+  void report_vector_lane_summary (void) {
+    uint64_t operations[BF_VECLANE_NUM], lanes[BF_VECLANE_NUM];
+    uint64_t active_lanes[BF_VECLANE_NUM], lines[BF_VECLANE_NUM];
+    uint64_t conflicts[BF_VECLANE_NUM];
+    bf_get_vector_lane_statistics(operations, lanes, active_lanes, lines, conflicts);
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    bool any_ops = false;
+    for (int k = 0; k < BF_VECLANE_NUM; k++) {
+      if (operations[k] == 0)
+        continue;
+      any_ops = true;
+      *bfout << tag << ": " << setw(25) << operations[k] << ' '
+             << bf_vector_lane_op_name(k) << " operations\n"
+             << tag << ": " << fixed << setw(25) << setprecision(4)
+             << 100.0*double(active_lanes[k])/double(lanes[k])
+             << "% of " << bf_vector_lane_op_name(k) << " lanes active\n";
+      if (k == BF_VECLANE_GATHER || k == BF_VECLANE_SCATTER)
+        *bfout << tag << ": " << fixed << setw(25) << setprecision(4)
+               << double(lines[k])/double(operations[k])
+               << " distinct cache lines per " << bf_vector_lane_op_name(k) << '\n';
+      if (k == BF_VECLANE_SCATTER)
+        *bfout << tag << ": " << setw(25) << conflicts[k]
+               << " conflicting scatter lanes\n";
+    }
+    if (any_ops)
+      *bfout << tag << ": " << separator << '\n';
+  }
+
+  // Report everything we measured.  final is false when writing a snapshot
+  // while the program continues to run.
+  void report_everything (bool final) {
     // Complete the basic-block table.
-    finalize_bblocks();
+    finalize_bblocks(final);
 
     // Report the number of times each basic block was executed.
     if (bf_every_bb)
@@ -1365,6 +1717,38 @@ public:
     if (bf_strides)
       bf_report_strides_by_call_point();
 
+    // Report per-OpenMP-region counts if an OpenMP run time is active.
+    if (bf_omp_active)
+      bf_report_openmp_regions();
+
+    // Report page first-touch and sharing if requested.
+    if (bf_numa)
+      bf_report_numa_pages();
+
+    // Report the most falsely shared cache lines if requested.
+    if (bf_false_sharing)
+      bf_report_false_sharing();
+
+    // Report memory-intrinsic call sites if requested.
+    if (bf_mem_intrinsics)
+      bf_report_mem_intrinsics();
+
+    // Report per-structure-field accesses if requested.
+    if (bf_struct_fields)
+      bf_report_struct_fields();
+
+    // Report per-source-line counts if requested.
+    if (bf_by_line)
+      bf_report_source_lines();
+
+    // Report inner loops that are candidates for vectorization if requested.
+    if (bf_loops)
+      bf_report_loops();
+
+    // Report per-thread counts if requested.
+    if (bf_threads)
+      bf_report_threads();
+
     // Report user-defined counter totals, if any.
     vector<const char*>* all_tag_names = user_defined_totals().sorted_keys(compare_char_stars);
     for (vector<const char*>::const_iterator tag_iter = all_tag_names->cbegin();
@@ -1377,12 +1761,81 @@ public:
     // Report the global counter totals across all basic blocks.
     report_totals(NULL, global_totals, uninstrumented_calls);
 
+    // Report measured events if any were requested and available.
+    if (bf_perf_active)
+      report_measured_events();
+
+    // Report load imbalance across threads if requested.
+    if (bf_threads)
+      report_thread_summary();
+
+    // Report page sharing if requested.
+    if (bf_numa)
+      report_numa_summary();
+
+    // Report true and false sharing if requested.
+    if (bf_false_sharing)
+      report_sharing_summary();
+
     // Report the cache performance if it was turned on.
     if (bf_cache_model)
       report_cache(global_totals);
 
+    // Report TLB reach if requested.
+    if (bf_tlb)
+      report_tlb_summary();
+
+    // Report tiny and unaligned memory-intrinsic calls if requested.
+    if (bf_mem_intrinsics)
+      report_mem_intrinsic_summary();
+
+    // Report modeled branch mispredictions if requested.
+    if (bf_branches)
+      report_branch_summary();
+
+    // Report indirect-call targets if requested.
+    if (bf_call_targets)
+      report_call_target_summary();
+
+    // Report redundant loads and silent stores if requested.
+    if (bf_redundancy)
+      report_redundancy_summary();
+
+    // Report vector-lane utilization if requested.
+    if (bf_vectors)
+      report_vector_lane_summary();
+
+    // Report inner loops that are candidates for vectorization if requested.
+    if (bf_loops)
+      report_loop_summary();
+
+    // Report structures with candidates for hot/cold splitting if requested.
+    if (bf_struct_fields)
+      report_struct_field_summary();
+
+    // Report the memory Byfl itself consumed.
+    report_self_overhead();
+
     // Report anything else we can think to report.
     report_misc_info();
+  }
+
+public:
+  RunAtEndOfProgram() {
+    separator = "-----------------------------------------------------------------";
+  }
+
+  ~RunAtEndOfProgram() {
+    // Do nothing if our output is suppressed.
+    bf_initialize_if_necessary();
+    if (suppress_output() || bf_abnormal_exit)
+      return;
+
+    // Wait for any in-progress snapshot to complete, and prevent new ones.
+    bf_disable_snapshots();
+
+    // Report everything we measured.
+    report_everything(true);
 
     // Tell the user where to look for more information.
     if (bfbin_filename != "")
@@ -1393,6 +1846,61 @@ public:
     *bfbin << uint8_t(BINOUT_TABLE_NONE);
     bfbin->flush();
   }
+
+  // Write a snapshot of everything we've measured so far to a given .byfl
+  // file, discarding textual output.  Optionally reset all counters
+  // afterwards.  The caller is responsible for quiescing counting.
+  void write_snapshot (const string& filename, uint64_t sequence, bool reset) {
+    // Redirect our output to the snapshot file.
+    ofstream snapfile(filename, ios_base::out | ios_base::trunc | ios_base::binary);
+    if (snapfile.fail()) {
+      cerr << "Failed to create snapshot file " << filename << '\n';
+      return;
+    }
+    BinaryOStreamReal snapbin(snapfile);
+    ostream discard(nullptr);
+    BinaryOStream* saved_bfbin = bfbin;
+    ostream* saved_bfout = bfout;
+    bfbin = &snapbin;
+    bfout = &discard;
+    *bfbin << uint8_t('B') << uint8_t('Y') << uint8_t('F') << uint8_t('L')
+           << uint8_t('B') << uint8_t('I') << uint8_t('N');
+
+    // Report everything we measured, taking care not to disturb the global
+    // totals, which are completed only at the end of the run.
+    ByteFlopCounters saved_totals(global_totals);
+    report_everything(false);
+    global_totals = saved_totals;
+    *bfbin << uint8_t(BINOUT_TABLE_KEYVAL) << "Snapshot";
+    *bfbin << uint8_t(BINOUT_COL_UINT64) << "Sequence number" << sequence
+           << uint8_t(BINOUT_COL_STRING) << "Time" << current_local_time("%F %T")
+           << uint8_t(BINOUT_COL_BOOL) << "Counters reset" << reset
+           << uint8_t(BINOUT_COL_NONE);
+    *bfbin << uint8_t(BINOUT_TABLE_NONE);
+    bfbin->flush();
+
+    // Restore our original output streams.
+    bfbin = saved_bfbin;
+    bfout = saved_bfout;
+
+    // Optionally start counting afresh.
+    if (reset) {
+      for (auto iter = per_func_totals().begin(); iter != per_func_totals().end(); iter++)
+        iter->second->reset();
+      for (auto iter = user_defined_totals().begin(); iter != user_defined_totals().end(); iter++)
+        iter->second->reset();
+      for (auto iter = func_call_tallies().begin(); iter != func_call_tallies().end(); iter++)
+        iter->second = 0;
+      bf_reset_counters();
+    }
+  }
+
 } run_at_end_of_program;
 
+// Write a snapshot of everything we've measured so far.
+void bf_write_snapshot (const string& filename, uint64_t sequence, bool reset)
+{
+  run_at_end_of_program.write_snapshot(filename, sequence, reset);
+}
+
 } // namespace bytesflops
@@ -9,6 +9,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <csignal>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
@@ -25,6 +26,7 @@
 #include <unistd.h>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <tuple>
 #include <wordexp.h>
@@ -35,6 +37,8 @@ namespace bytesflops {
 }
 
 #include "byfl-common.h"
+#include "memusage.h"
+#include "sketch.h"
 #include "cachemap.h"
 #include "pagetable.h"
 #include "binaryoutput.h"
@@ -58,12 +62,32 @@ extern uint8_t  bf_vectors;          // 1=bin then output vector characteristics
 extern uint8_t  bf_cache_model;      // 1=use the simple cache model
 extern uint8_t  bf_data_structs;     // 1=tally and output counters by data structure
 extern uint8_t  bf_strides;          // 1=tally and output information about access strides
+extern uint8_t  bf_numa;             // 1=track first touch and sharing of memory pages
+extern uint8_t  bf_false_sharing;    // 1=detect true and false sharing of cache lines
+extern uint8_t  bf_tlb;              // 1=model TLB reach for various page sizes
+extern uint8_t  bf_mem_intrinsics;   // 1=histogram memset/memcpy/memmove sizes by call site
+extern uint8_t  bf_branches;         // 1=model branch mispredictions by branch site
+extern uint8_t  bf_call_targets;     // 1=tally the targets of each indirect-call site
+extern uint8_t  bf_redundancy;       // 1=tally redundant loads and silent stores by site
+extern uint8_t  bf_struct_fields;    // 1=tally loads and stores by structure field
+extern uint8_t  bf_by_line;          // 1=tally counters by source line
+extern uint8_t  bf_loops;            // 1=rank inner loops by estimated vectorization benefit
+extern uint8_t  bf_threads;          // 1=tally and output per-thread counters
+extern uint8_t  bf_thread_funcs;     // 1=tally and output per-function, per-thread counters
 extern uint64_t bf_line_size;        // cache line size in bytes
 extern uint64_t bf_max_set_bits;     // log base 2 of max number of sets to model
+extern uint64_t bf_prefetcher;       // hardware prefetcher to model (BF_PREFETCH_*)
+extern uint64_t bf_prefetch_degree;  // number of lines to prefetch per trigger
+extern uint64_t bf_prefetch_distance; // number of lines ahead to prefetch
+extern uint64_t bf_prefetch_cache;   // number of lines in the cache prefetched into
 
 // The following globals are defined by the instrumented code.
 extern uint64_t bf_fmap_cnt;
 
+// The following global is defined by the run-time library and read by the
+// instrumented code.
+extern uint64_t bf_count_mask;       // All ones=counting; zero=counting is suppressed
+
 // The following function is expected to be overridden by user code.
 extern "C" {
   extern const char* bf_categorize_counters (void);   // Return a category in which to partition data.
@@ -82,10 +106,46 @@ namespace bytesflops {
   extern void bf_get_vector_statistics(uint64_t* num_ops, uint64_t* total_elts, uint64_t* total_bits);
   extern void bf_abend(void) __attribute__ ((noreturn));
   extern void bf_report_vector_operations(void);
+  extern void bf_get_vector_lane_statistics(uint64_t* operations, uint64_t* lanes, uint64_t* active_lanes, uint64_t* lines, uint64_t* conflicts);
+  extern const char* bf_vector_lane_op_name(uint8_t kind);
   extern void bf_report_data_struct_counts(void);
   extern void bf_report_bb_execution(void);
   extern void bf_partition_unique_addresses(uint64_t* uti, uint64_t *mti);
   extern void bf_report_strides_by_call_point(void);
+  extern void bf_report_openmp_regions(void);
+  extern void bf_omp_assoc_addresses(uint64_t baseaddr, uint64_t numaddrs);
+  extern void bf_omp_reset_counters(void);
+  extern void bf_report_numa_pages(void);
+  extern void bf_numa_assoc_data_struct(uint64_t baseaddr, uint64_t numaddrs, const void* dstruct);
+  extern void bf_get_numa_summary(uint64_t* page_size, uint64_t* threads, uint64_t* pages_touched, uint64_t* pages_shared, uint64_t* initial_pages_shared);
+  extern const vector<string>& bf_numa_serial_init(void);
+  extern string bf_describe_data_struct(const void* dstruct);
+  extern const void* bf_find_data_struct(uint64_t address);
+  extern void bf_report_false_sharing(void);
+  extern void bf_get_sharing_summary(uint64_t* true_misses, uint64_t* false_misses, uint64_t* true_lines, uint64_t* false_lines);
+  extern void initialize_sharing(void);
+  extern void bf_report_tlb(vector<uint64_t>& accesses, vector<uint64_t>& misses);
+  extern const char* bf_tlb_page_size_name(size_t idx);
+  extern uint64_t bf_tlb_summary_entries(void);
+  extern void initialize_tlb(void);
+  extern void bf_report_mem_intrinsics(void);
+  extern const vector<string>& bf_mem_intrinsics_flagged(void);
+  extern void initialize_mem_intrinsics(void);
+  extern void bf_report_branches(uint64_t* branches, uint64_t* bimodal_mispredicts, uint64_t* gshare_mispredicts);
+  extern void bf_get_branch_summary(uint64_t* branches, uint64_t* transitions, uint64_t* bimodal_mispredicts, uint64_t* gshare_mispredicts);
+  extern void initialize_branches(void);
+  extern void bf_report_call_targets(uint64_t* indirect_calls, uint64_t* num_sites, uint64_t* monomorphic_sites);
+  extern void initialize_call_targets(void);
+  extern void bf_report_redundancy(uint64_t* loads, uint64_t* redundant_loads, uint64_t* stores, uint64_t* silent_stores, uint64_t* wasted_bytes);
+  extern void initialize_redundancy(void);
+  extern void bf_report_struct_fields(void);
+  extern const vector<string>& bf_struct_split_candidates(void);
+  extern void initialize_struct_fields(void);
+  extern void bf_report_source_lines(void);
+  extern void initialize_source_lines(void);
+  extern void bf_get_strides_in_lines(const char* function, const char* file, uint64_t first_line, uint64_t last_line, uint64_t* unit_strides, uint64_t* zero_strides, uint64_t* total_strides);
+  extern void bf_report_loops(void);
+  extern const vector<string>& bf_loop_candidates(void);
   extern uint64_t bf_tally_unique_addresses(const char* funcname);
   extern uint64_t bf_tally_unique_addresses_tb(const char* funcname);
   extern uint64_t bf_tally_unique_addresses_tb(void);
@@ -102,7 +162,22 @@ namespace bytesflops {
   extern void initialize_data_structures(void);
   extern void initialize_strides(void);
   extern void initialize_cache(void);
-  extern void finalize_bblocks(void);
+  extern void initialize_memusage(void);
+  extern void initialize_snapshots(void);
+  extern void initialize_perf_events(void);
+  extern void initialize_numa(void);
+  extern void finalize_bblocks(bool final);
+  extern void bf_reset_counters(void);
+  extern void bf_write_snapshot(const string& filename, uint64_t sequence, bool reset);
+  extern void bf_disable_snapshots(void);
+  extern void bf_service_snapshot(void);
+  extern void bf_perf_sample(KeyType_t key);
+  extern void bf_perf_resume(void);
+  extern size_t bf_perf_num_events(void);
+  extern const char* bf_perf_event_name(size_t idx);
+  extern const uint64_t* bf_perf_function_events(KeyType_t key);
+  extern const uint64_t* bf_perf_program_events(void);
+  extern void bf_perf_reset(void);
   extern uint64_t bf_get_private_cache_accesses(void);
   extern vector<unordered_map<uint64_t,uint64_t> > bf_get_private_cache_hits(void);
   extern uint64_t bf_get_private_cold_misses(void);
@@ -111,8 +186,16 @@ namespace bytesflops {
   extern vector<unordered_map<uint64_t,uint64_t> > bf_get_shared_cache_hits(void);
   extern uint64_t bf_get_shared_cold_misses(void);
   extern uint64_t bf_get_shared_misaligned_mem_ops(void);
+  extern void bf_report_prefetching(uint64_t* demand_misses, uint64_t* prefetches, uint64_t* prefetch_hits, uint64_t* useless_prefetches);
+  extern const char* bf_prefetcher_name(void);
+  extern void bf_report_cache_by_key(void);
   extern vector<unordered_map<uint64_t,uint64_t> > bf_get_remote_shared_cache_hits(void);
   extern bool suppress_output(void);
+  extern uint32_t bf_thread_number(void);
+  extern void bf_thread_assoc_addresses(uint64_t baseaddr, uint64_t numaddrs);
+  extern void bf_thread_reset_counters(void);
+  extern void bf_report_threads(void);
+  extern void bf_get_thread_summary(uint64_t* threads, uint64_t* max_ops, uint64_t* total_ops, uint64_t* max_flops, uint64_t* total_flops, uint64_t* max_bytes, uint64_t* total_bytes);
 
   // The following library variables are used in files other than the
   // one in which they're defined.
@@ -121,6 +204,12 @@ namespace bytesflops {
   extern const char* opcode2name[];         // Map from an LLVM opcode to its name
   extern KeyType_t bf_func_and_parents_id;  // Top of the complete_call_stack stack
   extern bool bf_suppress_counting;         // Whether to update Byfl data structures
+  extern bool bf_omp_active;                // Whether to attribute counts to OpenMP regions
+  extern const char* bf_omp_warning;        // Reason we can't attribute counts to OpenMP regions
+  extern bool bf_perf_active;               // Whether to measure events at function boundaries
+  extern const char* bf_perf_warning;       // Reason we can't measure the requested events
+  extern volatile sig_atomic_t bf_snapshot_requested;  // Whether a snapshot signal arrived
+  extern const char* bf_snapshot_warning;   // Reason we can't take snapshots
 
   // Encapsulate of all of our basic-block counters into a single structure.
   class ByteFlopCounters {
@@ -205,6 +294,9 @@ typedef str2bfc_t::iterator counter_iterator;
 extern ByteFlopCounters global_totals;    // Global tallies of all of our counters
 extern key2bfc_t& per_func_totals(void);
 extern str2bfc_t& user_defined_totals(void);
+extern void bf_omp_accumulate(ByteFlopCounters* bb_counters);
+extern ByteFlopCounters* bf_thread_counters(void);
+extern ByteFlopCounters* bf_thread_function_counters(const char* funcname);
 
 }
 
@@ -11,106 +11,60 @@
 #include <fstream>
 
 #include "byfl.h"
+#include "cache-model.h"
 
 namespace bytesflops {
+extern BinaryOStream* bfbin;
 static __thread unsigned cache_id = 0;
 }
 using namespace bytesflops;
 using namespace std;
 
-class Cache {
-  public:
-    void access(uint64_t baseaddr, uint64_t numaddrs);
-    Cache(uint64_t line_size, uint64_t max_set_bits, bool record_thread_id) :
-      line_size_{line_size}, accesses_{0}, misaligned_mem_ops_{0},
-      log2_line_size_{0}, max_set_bits_{max_set_bits}, cold_misses_{0},
-      hits_(max_set_bits_), record_thread_id_{record_thread_id},
-      remote_hits_(max_set_bits_) {
-        auto lsize = line_size_;
-        while(lsize >>= 1) ++log2_line_size_;
-    }
-    uint64_t getAccesses() const { return accesses_; }
-    vector<unordered_map<uint64_t,uint64_t> > getHits() const { return hits_; }
-    uint64_t getColdMisses() const { return cold_misses_; }
-    uint64_t getMisalignedMemOps() const { return misaligned_mem_ops_; }
-    int getRightMatch(uint64_t a, uint64_t b);
-    vector<unordered_map<uint64_t,uint64_t> > getRemoteHits() const { return remote_hits_; }
-
-  private:
-    vector<uint64_t> lines_; // back is mru, front is lru
-    uint64_t line_size_;
-    uint64_t accesses_;
-    uint64_t misaligned_mem_ops_;  // Number of loads and stores resulting in misaligned cache accesses
-    uint64_t log2_line_size_; // log base 2 of line size
-    uint64_t max_set_bits_; // log base 2 of max number of sets
-    uint64_t cold_misses_;
-    // for each set count, a map of distance to access count
-    vector<unordered_map<uint64_t,uint64_t> > hits_;  // back is lru, front is mru
-    bool record_thread_id_;
-    // associate thread id with each line in cache. only used if record_thread_id_.
-    vector<unsigned> thread_ids_;
-    // for each set count, a map of distance to access count
-    vector<unordered_map<uint64_t,uint64_t> > remote_hits_;  // back is lru, front is mru
-};
-
-inline int Cache::getRightMatch(uint64_t a, uint64_t b){
-  // number of 0s, counting from left, ignoring all line bits.
-  // also need to mask off all bits higher than max_set_bits_.
-  auto diff_bits = ((a ^ b) >> log2_line_size_) | (1 << (max_set_bits_ - 1));
-  return __builtin_ctzll(diff_bits);
-}
-
-void Cache::access(uint64_t baseaddr, uint64_t numaddrs){
+// Attribute the accesses to each non-null element of tallies, which is either
+// nullptr or an array of max_cache_tallies elements.
+void Cache::access(uint64_t baseaddr, uint64_t numaddrs, uint64_t site, PrefetchCounters* who,
+                   CacheCounters* const* tallies){
   uint64_t num_accesses = 0; // running total of number of lines accessed
+  if(tallies != nullptr){
+    for(int t = 0; t < max_cache_tallies; ++t){
+      if(tallies[t] != nullptr && tallies[t]->hits.empty()){
+        tallies[t]->hits.resize(max_set_bits_);
+      }
+    }
+  }
+  last_prefetches_.clear();
+  last_distances_.clear();
   for(uint64_t addr = baseaddr / line_size_ * line_size_;
       addr <= (baseaddr + numaddrs - 1) / line_size_ * line_size_;
       addr += line_size_){
     ++num_accesses;
-    bool found = false;
-    unsigned last_thread = 0;
-    vector<uint64_t> right_match_tally(max_set_bits_, 0);
-    for(int line_idx = lines_.size() - 1; line_idx >= 0; --line_idx){
-      auto& line = lines_[line_idx];
-      int right_match = getRightMatch(addr, line); // returns 0 <= val = max_set_bits_
-      ++right_match_tally[right_match];
-      if(addr == line){
-        found = true;
-        // erase this line.
-        lines_.erase(begin(lines_) + line_idx);
-        if(record_thread_id_){
-          last_thread = thread_ids_[line_idx];
-          thread_ids_.erase(begin(thread_ids_) + line_idx);
-        }
-        break;
+    LineOutcome outcome = accessLine(addr, tallies);
+    if(who != nullptr){
+      ++who->demand_accesses;
+      if(outcome == LINE_MISS){
+        ++who->demand_misses;
+      } else if(outcome == LINE_PREFETCH_HIT){
+        ++who->prefetch_hits;
       }
     }
 
-    if(found){
-      // rolling sum of right match tally for reuse dists
-      uint64_t sum = 0;
-      for(auto tally = right_match_tally.rbegin();
-          tally != right_match_tally.rend();
-          ++tally){
-        *tally += sum;
-        sum = *tally;
-      }
-      for(uint64_t set = 0; set < max_set_bits_; ++set){
-        auto idx = right_match_tally[set];
-        ++hits_[set][idx];
-        if(record_thread_id_ &&
-           last_thread != cache_id){
-          ++remote_hits_[set][idx];
+    // let the prefetcher react to this access.
+    if(prefetcher_ != nullptr){
+      prefetch_targets_.clear();
+      prefetcher_->observe(site, addr, outcome, prefetch_targets_);
+      for(auto target : prefetch_targets_){
+        if(target != addr && prefetchLine(target, who)){
+          last_prefetches_.push_back(target);
         }
       }
-    } else {
-      ++cold_misses_;
     }
+  }
 
-    // move up this address to mru position
-    lines_.push_back(addr);
-    if(record_thread_id_){
-      thread_ids_.push_back(cache_id);
-    }
+  // if we've exceeded our share of the BF_MAX_MEMORY budget, retain only the
+  // more recently used half of the lines.  caches of fixed capacity are
+  // already bounded in size.
+  if(!fixed_capacity_ && bf_mem_over_budget(BF_MEM_CACHE_MODEL) && lines_.size() > 1){
+    limitLines(lines_.size() / 2);
   }
 
   // we've made all our accesses
@@ -118,6 +72,352 @@ void Cache::access(uint64_t baseaddr, uint64_t numaddrs){
   uint64_t expected_accesses = (numaddrs + line_size_ - 1)/line_size_;
   if (num_accesses != expected_accesses)
     ++misaligned_mem_ops_;
+  if(tallies != nullptr){
+    for(int t = 0; t < max_cache_tallies; ++t){
+      if(tallies[t] != nullptr){
+        tallies[t]->accesses += num_accesses;
+        if(num_accesses != expected_accesses){
+          ++tallies[t]->misaligned_mem_ops;
+        }
+      }
+    }
+  }
+}
+
+// Access a single line on demand and move it to the mru position.
+LineOutcome Cache::accessLine(uint64_t addr, CacheCounters* const* tallies){
+  bool found = false;
+  unsigned last_thread = 0;
+  PrefetchCounters* prefetched_by = nullptr;
+  vector<uint64_t> right_match_tally(max_set_bits_, 0);
+  for(int line_idx = lines_.size() - 1; line_idx >= 0; --line_idx){
+    auto& line = lines_[line_idx];
+    int right_match = getRightMatch(addr, line); // returns 0 <= val = max_set_bits_
+    ++right_match_tally[right_match];
+    if(addr == line){
+      found = true;
+      // erase this line.
+      lines_.erase(begin(lines_) + line_idx);
+      if(record_thread_id_){
+        last_thread = thread_ids_[line_idx];
+        thread_ids_.erase(begin(thread_ids_) + line_idx);
+      }
+      if(track_prefetches_){
+        prefetched_by = prefetch_tags_[line_idx];
+        prefetch_tags_.erase(begin(prefetch_tags_) + line_idx);
+      }
+      break;
+    }
+  }
+
+  bool beyond_capacity = false;
+  if(found){
+    // rolling sum of right match tally for reuse dists
+    uint64_t sum = 0;
+    for(auto tally = right_match_tally.rbegin();
+        tally != right_match_tally.rend();
+        ++tally){
+      *tally += sum;
+      sum = *tally;
+    }
+
+    // a line that fell out of the prefetch cache misses there, and if it was
+    // prefetched, the prefetch was useless.
+    if(prefetch_capacity_ != 0 && right_match_tally[0] > prefetch_capacity_){
+      beyond_capacity = true;
+      if(prefetched_by != nullptr){
+        ++prefetched_by->useless_prefetches;
+      }
+    }
+    for(uint64_t set = 0; set < max_set_bits_; ++set){
+      auto idx = right_match_tally[set];
+      ++hits_[set][idx];
+      if(tallies != nullptr){
+        for(int t = 0; t < max_cache_tallies; ++t){
+          if(tallies[t] != nullptr){
+            ++tallies[t]->hits[set][idx];
+          }
+        }
+      }
+      if(record_thread_id_ &&
+         last_thread != cache_id){
+        ++remote_hits_[set][idx];
+      }
+    }
+    if(record_distances_){
+      last_distances_.push_back(right_match_tally[0]);
+    }
+  } else {
+    ++cold_misses_;
+    if(tallies != nullptr){
+      for(int t = 0; t < max_cache_tallies; ++t){
+        if(tallies[t] != nullptr){
+          ++tallies[t]->cold_misses;
+        }
+      }
+    }
+    if(record_distances_){
+      last_distances_.push_back(0);
+    }
+  }
+
+  // move up this address to mru position
+  lines_.push_back(addr);
+  if(record_thread_id_){
+    thread_ids_.push_back(cache_id);
+  }
+  if(track_prefetches_){
+    prefetch_tags_.push_back(nullptr);
+  }
+  if(index_lines_ && !found){
+    resident_.insert(addr);
+  }
+
+  // forget the lru line if we're limited in size
+  if(max_lines_ != 0 && lines_.size() > max_lines_){
+    evictLines(lines_.size() - max_lines_);
+  }
+
+  if(!found || beyond_capacity){
+    return LINE_MISS;
+  }
+  return prefetched_by == nullptr ? LINE_HIT : LINE_PREFETCH_HIT;
+}
+
+// Bring a line into the mru position ahead of demand unless it's already
+// among the prefetch_capacity_ most recently used lines.  Return true if the
+// line was prefetched.
+bool Cache::prefetchLine(uint64_t lineaddr, PrefetchCounters* who){
+  if(!index_lines_ || resident_.count(lineaddr) != 0){
+    // search for the line only if we know it's somewhere in the stack.
+    for(int line_idx = lines_.size() - 1; line_idx >= 0; --line_idx){
+      if(lines_[line_idx] != lineaddr){
+        continue;
+      }
+      if(prefetch_capacity_ == 0 || lines_.size() - line_idx <= prefetch_capacity_){
+        return false;
+      }
+
+      // the line fell out of the prefetch cache so remove it from the stack
+      // before prefetching it again.
+      lines_.erase(begin(lines_) + line_idx);
+      if(record_thread_id_){
+        thread_ids_.erase(begin(thread_ids_) + line_idx);
+      }
+      if(track_prefetches_){
+        if(prefetch_tags_[line_idx] != nullptr){
+          ++prefetch_tags_[line_idx]->useless_prefetches;
+        }
+        prefetch_tags_.erase(begin(prefetch_tags_) + line_idx);
+      }
+      if(index_lines_){
+        resident_.erase(lineaddr);
+      }
+      break;
+    }
+  }
+  lines_.push_back(lineaddr);
+  if(index_lines_){
+    resident_.insert(lineaddr);
+  }
+  if(record_thread_id_){
+    thread_ids_.push_back(cache_id);
+  }
+  if(track_prefetches_){
+    prefetch_tags_.push_back(who);
+    if(who != nullptr){
+      ++who->prefetches;
+    }
+  }
+  if(max_lines_ != 0 && lines_.size() > max_lines_){
+    evictLines(lines_.size() - max_lines_);
+  }
+  return true;
+}
+
+// Evict the num_lines least recently used lines.  Prefetched lines that were
+// never used count as useless prefetches.
+void Cache::evictLines(uint64_t num_lines){
+  if(index_lines_){
+    for(uint64_t i = 0; i < num_lines; ++i){
+      resident_.erase(lines_[i]);
+    }
+  }
+  lines_.erase(begin(lines_), begin(lines_) + num_lines);
+  if(record_thread_id_){
+    thread_ids_.erase(begin(thread_ids_), begin(thread_ids_) + num_lines);
+  }
+  if(track_prefetches_){
+    for(uint64_t i = 0; i < num_lines; ++i){
+      if(prefetch_tags_[i] != nullptr){
+        ++prefetch_tags_[i]->useless_prefetches;
+      }
+    }
+    prefetch_tags_.erase(begin(prefetch_tags_), begin(prefetch_tags_) + num_lines);
+  }
+}
+
+// Discard all but the max_lines most recently used lines, both now and in the
+// future.  Accesses to discarded lines are subsequently counted as cold misses.
+void Cache::limitLines(uint64_t max_lines){
+  max_lines_ = max_lines;
+  if(lines_.size() > max_lines_){
+    evictLines(lines_.size() - max_lines_);
+  }
+  lines_.shrink_to_fit();
+  thread_ids_.shrink_to_fit();
+  prefetch_tags_.shrink_to_fit();
+  bf_mem_degraded(BF_MEM_CACHE_MODEL,
+                  "The cache model retains only the " + to_string(max_lines_) +
+                  " most recently used lines");
+}
+
+// Count, for each function, the prefetched lines that are still resident but
+// have not yet been used.
+void Cache::tallyPendingPrefetches(unordered_map<PrefetchCounters*, uint64_t>& pending) const{
+  for(auto tag : prefetch_tags_){
+    if(tag != nullptr){
+      ++pending[tag];
+    }
+  }
+}
+
+// Prefetch the next degree lines starting distance lines past each missing
+// line or first use of a prefetched line (i.e., tagged next-line prefetching).
+class NextLinePrefetcher : public Prefetcher {
+  public:
+    NextLinePrefetcher(uint64_t line_size, uint64_t degree, uint64_t distance) :
+      line_size_{line_size}, degree_{degree}, distance_{distance} {}
+    void observe(uint64_t site, uint64_t lineaddr, LineOutcome outcome,
+                 vector<uint64_t>& targets) override {
+      if(outcome == LINE_HIT){
+        return;
+      }
+      for(uint64_t i = 0; i < degree_; ++i){
+        targets.push_back(lineaddr + (distance_ + i)*line_size_);
+      }
+    }
+
+  private:
+    uint64_t line_size_;
+    uint64_t degree_;
+    uint64_t distance_;
+};
+
+// Learn the line-granularity stride of each load/store site and, once a
+// stride repeats, prefetch degree lines starting distance strides ahead.
+class StridePrefetcher : public Prefetcher {
+  public:
+    StridePrefetcher(uint64_t degree, uint64_t distance) :
+      degree_{degree}, distance_{distance} {}
+    void observe(uint64_t site, uint64_t lineaddr, LineOutcome outcome,
+                 vector<uint64_t>& targets) override {
+      auto iter = sites_.find(site);
+      if(iter == end(sites_)){
+        sites_[site] = SiteState{lineaddr, 0, false};
+        return;
+      }
+      SiteState& state = iter->second;
+      int64_t stride = int64_t(lineaddr - state.last_line);
+      if(stride == 0){
+        return;
+      }
+      state.confident = stride == state.stride;
+      state.stride = stride;
+      state.last_line = lineaddr;
+      if(!state.confident){
+        return;
+      }
+      for(uint64_t i = 0; i < degree_; ++i){
+        targets.push_back(lineaddr + uint64_t(stride*int64_t(distance_ + i)));
+      }
+    }
+
+  private:
+    struct SiteState {
+      uint64_t last_line;  // most recent line the site accessed
+      int64_t stride;      // most recent stride in bytes
+      bool confident;      // true=the stride repeated
+    };
+    unordered_map<uint64_t, SiteState> sites_;
+    uint64_t degree_;
+    uint64_t distance_;
+};
+
+// Track a small number of ascending or descending streams of missing lines
+// and, once a stream is confirmed, prefetch degree lines starting distance
+// lines ahead of it.
+class StreamPrefetcher : public Prefetcher {
+  public:
+    StreamPrefetcher(uint64_t line_size, uint64_t degree, uint64_t distance) :
+      line_size_{line_size}, degree_{degree}, distance_{distance},
+      streams_(max_streams) {}
+    void observe(uint64_t site, uint64_t lineaddr, LineOutcome outcome,
+                 vector<uint64_t>& targets) override {
+      if(outcome == LINE_HIT){
+        return;
+      }
+      ++clock_;
+
+      // advance a matching stream.
+      for(auto& stream : streams_){
+        if(stream.last_use == 0){
+          continue;
+        }
+        int64_t direction = stream.direction;
+        if(direction == 0){
+          // a training stream accepts a neighbor in either direction.
+          if(lineaddr == stream.last_line + line_size_){
+            direction = 1;
+          } else if(lineaddr == stream.last_line - line_size_){
+            direction = -1;
+          } else {
+            continue;
+          }
+        } else if(lineaddr != stream.last_line + direction*line_size_){
+          continue;
+        }
+        stream.direction = direction;
+        stream.last_line = lineaddr;
+        stream.last_use = clock_;
+        for(uint64_t i = 0; i < degree_; ++i){
+          targets.push_back(lineaddr + direction*int64_t((distance_ + i)*line_size_));
+        }
+        return;
+      }
+
+      // replace the least recently used stream with a new training stream.
+      auto victim = min_element(begin(streams_), end(streams_),
+                                [](const Stream& a, const Stream& b){ return a.last_use < b.last_use; });
+      *victim = Stream{lineaddr, 0, clock_};
+    }
+
+  private:
+    static const size_t max_streams = 16;
+    struct Stream {
+      uint64_t last_line = 0;   // most recent line in the stream
+      int64_t direction = 0;    // +1=ascending, -1=descending, 0=training
+      uint64_t last_use = 0;    // "time" of last use (0=unused)
+    };
+    uint64_t line_size_;
+    uint64_t degree_;
+    uint64_t distance_;
+    vector<Stream> streams_;
+    uint64_t clock_ = 0;
+};
+
+Prefetcher* make_prefetcher(int type, uint64_t line_size,
+                            uint64_t degree, uint64_t distance){
+  switch(type){
+    case BF_PREFETCH_NEXT_LINE:
+      return new NextLinePrefetcher(line_size, degree, distance);
+    case BF_PREFETCH_STRIDE:
+      return new StridePrefetcher(degree, distance);
+    case BF_PREFETCH_STREAM:
+      return new StreamPrefetcher(line_size, degree, distance);
+    default:
+      return nullptr;
+  }
 }
 
 namespace bytesflops{
@@ -128,25 +428,204 @@ static Cache* global_cache = nullptr;
 static mutex cache_vector_mutex, global_cache_mutex;
 static unsigned thread_counter = 0;
 
+// Tally prefetcher effectiveness per function.  Each thread maintains its own
+// counters, which we merge when reporting.
+typedef unordered_map<const char*, PrefetchCounters*> func_to_prefetch_t;
+static __thread func_to_prefetch_t* prefetch_counters = nullptr;
+static vector<pair<const char*, PrefetchCounters*> >* all_prefetch_counters = nullptr;
+
+// Tally cache-model statistics per function and per user-defined partition,
+// separately for the private and the shared cache.  Each thread maintains its
+// own private-cache counters, which we merge when reporting.
+typedef unordered_map<const char*, CacheCounters*> name_to_cache_counters_t;
+class CacheTallies {
+  public:
+    name_to_cache_counters_t by_func;
+    name_to_cache_counters_t by_partition;
+};
+static __thread CacheTallies* private_tallies = nullptr;
+static vector<CacheTallies*>* all_private_tallies = nullptr;
+static CacheTallies* shared_tallies = nullptr;   // Protected by global_cache_mutex
+
+// Name each prefetcher type.
+static const char* prefetcher_names[BF_PREFETCH_NUM] = {
+  "none",
+  "next-line",
+  "stride",
+  "stream"
+};
+
 void initialize_cache(void){
   if(caches == nullptr){
     caches = new vector<Cache*>();
   }
   global_cache = new Cache(bf_line_size, bf_max_set_bits, true);
+  if(bf_prefetcher != BF_PREFETCH_NONE){
+    global_cache->setPrefetchCapacity(bf_prefetch_cache);
+  }
+  all_prefetch_counters = new vector<pair<const char*, PrefetchCounters*> >();
+  all_private_tallies = new vector<CacheTallies*>();
+  shared_tallies = new CacheTallies();
 }
 
-// Access the cache model with this address.
-void bf_touch_cache(uint64_t baseaddr, uint64_t numaddrs){
+// Return the counters associated with a name, creating them if necessary.
+static CacheCounters* find_cache_counters(name_to_cache_counters_t& counters, const char* name){
+  CacheCounters*& found = counters[name];
+  if(found == nullptr){
+    found = new CacheCounters();
+  }
+  return found;
+}
+
+// Select the counters to which to attribute the current access: the current
+// function (or call stack) if we're tallying by function and the current
+// user-defined partition if any.
+static CacheCounters* const* select_tallies(CacheTallies* all_tallies, const char* funcname,
+                                            const char* partition, CacheCounters** tallies){
+  tallies[0] = bf_per_func ? find_cache_counters(all_tallies->by_func, funcname) : nullptr;
+  tallies[1] = partition != nullptr ? find_cache_counters(all_tallies->by_partition, partition) : nullptr;
+  return tallies[0] == nullptr && tallies[1] == nullptr ? nullptr : tallies;
+}
+
+// Access the cache model with this address on behalf of a given load/store
+// site.  Prefetches issued by the thread's prefetcher are mirrored into the
+// shared cache.
+static void touch_cache(const bf_symbol_info_t* syminfo, uint64_t baseaddr, uint64_t numaddrs){
   if(cache == nullptr){
     // Only let one thread update caches at a time.
     lock_guard<mutex> guard(cache_vector_mutex);
     cache = new Cache(bf_line_size, bf_max_set_bits, false);
+    if(bf_prefetcher != BF_PREFETCH_NONE){
+      cache->setPrefetcher(make_prefetcher(bf_prefetcher, bf_line_size,
+                                           bf_prefetch_degree, bf_prefetch_distance),
+                           bf_prefetch_cache);
+      prefetch_counters = new func_to_prefetch_t();
+    }
+    private_tallies = new CacheTallies();
+    all_private_tallies->push_back(private_tallies);
     caches->push_back(cache);
     cache_id = thread_counter++;
   }
-  cache->access(baseaddr, numaddrs);
+
+  // Determine the function and partition to charge for the access.  As with
+  // the other partitioned counters, bf_categorize_counters() is consulted
+  // only with -bf-every-bb.
+  const char* funcname = syminfo == nullptr ? nullptr : syminfo->function;
+  const char* tally_name = bf_call_stack ? bf_func_and_parents : funcname;
+  const char* partition = nullptr;
+  if(bf_every_bb){
+    partition = bf_categorize_counters();
+    if(partition != nullptr){
+      partition = bf_string_to_symbol(partition);
+    }
+  }
+  CacheCounters* tallies[max_cache_tallies];
+
+  // Find the function's prefetch counters.
+  PrefetchCounters* who = nullptr;
+  if(bf_prefetcher != BF_PREFETCH_NONE){
+    PrefetchCounters*& func_who = (*prefetch_counters)[funcname];
+    if(func_who == nullptr){
+      func_who = new PrefetchCounters();
+      lock_guard<mutex> guard(cache_vector_mutex);
+      all_prefetch_counters->push_back(make_pair(funcname, func_who));
+    }
+    who = func_who;
+  }
+
+  // Access the private then the shared cache.
+  cache->access(baseaddr, numaddrs, syminfo == nullptr ? 0 : syminfo->ID, who,
+                select_tallies(private_tallies, tally_name, partition, tallies));
   lock_guard<mutex> guard(global_cache_mutex);
-  global_cache->access(baseaddr, numaddrs);
+  global_cache->access(baseaddr, numaddrs, 0, nullptr,
+                       select_tallies(shared_tallies, tally_name, partition, tallies));
+  for(auto lineaddr : cache->getLastPrefetches()){
+    global_cache->prefetchLine(lineaddr, nullptr);
+  }
+}
+
+// Access the cache model with this address.
+void bf_touch_cache(uint64_t baseaddr, uint64_t numaddrs){
+  touch_cache(nullptr, baseaddr, numaddrs);
+}
+
+// Access the cache model with this address, identifying the load or store
+// site for the sake of the prefetcher model and per-function tallies.
+extern "C"
+void bf_touch_cache_site(const bf_symbol_info_t* syminfo, uint64_t baseaddr, uint64_t numaddrs){
+  touch_cache(syminfo, baseaddr, numaddrs);
+}
+
+// Report prefetcher effectiveness by function and return program-wide
+// totals.
+void bf_report_prefetching(uint64_t* demand_misses, uint64_t* prefetches,
+                           uint64_t* prefetch_hits, uint64_t* useless_prefetches){
+  // Count the prefetched lines that are still unused.
+  unordered_map<PrefetchCounters*, uint64_t> pending;
+  lock_guard<mutex> guard(cache_vector_mutex);
+  for(auto& cache: *caches){
+    cache->tallyPendingPrefetches(pending);
+  }
+
+  // Merge all threads' counters by function name.
+  map<string, PrefetchCounters> by_func;
+  for(auto& elem : *all_prefetch_counters){
+    PrefetchCounters& total = by_func[elem.first == nullptr ? "" : elem.first];
+    const PrefetchCounters* counters = elem.second;
+    total.demand_accesses += counters->demand_accesses;
+    total.demand_misses += counters->demand_misses;
+    total.prefetches += counters->prefetches;
+    total.prefetch_hits += counters->prefetch_hits;
+    total.useless_prefetches += counters->useless_prefetches + pending[elem.second];
+  }
+
+  // Output a table of per-function prefetcher effectiveness.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Prefetching by function";
+  *bfbin << uint8_t(BINOUT_COL_STRING) << "Mangled function name"
+         << uint8_t(BINOUT_COL_STRING) << "Demangled function name"
+         << uint8_t(BINOUT_COL_UINT64) << "Demand line accesses"
+         << uint8_t(BINOUT_COL_UINT64) << "Demand misses"
+         << uint8_t(BINOUT_COL_UINT64) << "Prefetches"
+         << uint8_t(BINOUT_COL_UINT64) << "Prefetch hits"
+         << uint8_t(BINOUT_COL_UINT64) << "Useless prefetches"
+         << uint8_t(BINOUT_COL_UINT64) << "Extra bytes transferred"
+         << uint8_t(BINOUT_COL_NONE);
+  *demand_misses = *prefetches = *prefetch_hits = *useless_prefetches = 0;
+  for(auto& elem : by_func){
+    const PrefetchCounters& counters = elem.second;
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << elem.first
+           << demangle_func_name(elem.first)
+           << counters.demand_accesses
+           << counters.demand_misses
+           << counters.prefetches
+           << counters.prefetch_hits
+           << counters.useless_prefetches
+           << counters.useless_prefetches*bf_line_size;
+    *demand_misses += counters.demand_misses;
+    *prefetches += counters.prefetches;
+    *prefetch_hits += counters.prefetch_hits;
+    *useless_prefetches += counters.useless_prefetches;
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Output a summary of the prefetcher and its effectiveness.
+  *bfbin << uint8_t(BINOUT_TABLE_KEYVAL) << "Prefetcher model"
+         << uint8_t(BINOUT_COL_STRING) << "Prefetcher" << prefetcher_names[bf_prefetcher]
+         << uint8_t(BINOUT_COL_UINT64) << "Degree" << bf_prefetch_degree
+         << uint8_t(BINOUT_COL_UINT64) << "Distance" << bf_prefetch_distance
+         << uint8_t(BINOUT_COL_UINT64) << "Cache lines" << bf_prefetch_cache
+         << uint8_t(BINOUT_COL_UINT64) << "Demand misses" << *demand_misses
+         << uint8_t(BINOUT_COL_UINT64) << "Prefetches" << *prefetches
+         << uint8_t(BINOUT_COL_UINT64) << "Prefetch hits" << *prefetch_hits
+         << uint8_t(BINOUT_COL_UINT64) << "Useless prefetches" << *useless_prefetches
+         << uint8_t(BINOUT_COL_UINT64) << "Extra bytes transferred" << *useless_prefetches*bf_line_size
+         << uint8_t(BINOUT_COL_NONE);
+}
+
+// Return the name of the prefetcher being modeled.
+const char* bf_prefetcher_name(void){
+  return prefetcher_names[bf_prefetcher];
 }
 
 // Get cache accesses
@@ -227,4 +706,105 @@ uint64_t bf_get_shared_misaligned_mem_ops(void){
   return global_cache->getMisalignedMemOps();
 }
 
+// Add one set of cache counters into another.
+static void merge_cache_counters(CacheCounters& total, const CacheCounters& counters){
+  total.accesses += counters.accesses;
+  total.cold_misses += counters.cold_misses;
+  total.misaligned_mem_ops += counters.misaligned_mem_ops;
+  if(total.hits.size() < counters.hits.size()){
+    total.hits.resize(counters.hits.size());
+  }
+  transform(begin(counters.hits), end(counters.hits), begin(total.hits), begin(total.hits),
+            mapsum<unordered_map<uint64_t,uint64_t> >);
+}
+
+// Output cache statistics for a set of named private/shared counter pairs.
+// Functions are reported by mangled and demangled name; partitions by name.
+typedef map<string, pair<CacheCounters, CacheCounters> > named_cache_counters_t;
+static void report_cache_counters(const string& kind, bool is_func,
+                                  const named_cache_counters_t& counters){
+  // Output a summary of each function or partition.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Cache model by " + kind;
+  if(is_func){
+    *bfbin << uint8_t(BINOUT_COL_STRING) << "Mangled function name"
+           << uint8_t(BINOUT_COL_STRING) << "Demangled function name";
+  } else {
+    *bfbin << uint8_t(BINOUT_COL_STRING) << "Partition";
+  }
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Cache accesses"
+         << uint8_t(BINOUT_COL_UINT64) << "Misaligned memory operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Private cold misses"
+         << uint8_t(BINOUT_COL_UINT64) << "Shared cold misses"
+         << uint8_t(BINOUT_COL_NONE);
+  for(auto& elem : counters){
+    *bfbin << uint8_t(BINOUT_ROW_DATA) << elem.first;
+    if(is_func){
+      *bfbin << demangle_func_name(elem.first);
+    }
+    *bfbin << elem.second.first.accesses
+           << elem.second.first.misaligned_mem_ops
+           << elem.second.first.cold_misses
+           << elem.second.second.cold_misses;
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Dump {lines searched, tally} pairs for each set size for each function
+  // or partition in both the private and the shared cache.
+  for(int shared = 0; shared < 2; ++shared){
+    *bfbin << uint8_t(BINOUT_TABLE_BASIC)
+           << string(shared ? "Shared" : "Private") + " cache model data by " + kind;
+    *bfbin << uint8_t(BINOUT_COL_STRING) << (is_func ? "Mangled function name" : "Partition")
+           << uint8_t(BINOUT_COL_UINT64) << "Set size"
+           << uint8_t(BINOUT_COL_UINT64) << "LRU search distance"
+           << uint8_t(BINOUT_COL_UINT64) << "Tally"
+           << uint8_t(BINOUT_COL_NONE);
+    for(auto& elem : counters){
+      const CacheCounters& tally = shared ? elem.second.second : elem.second.first;
+      for(uint64_t set = 0; set < tally.hits.size(); ++set){
+        uint64_t num_sets = 1<<set;
+        for(const auto& hit : tally.hits[set]){
+          *bfbin << uint8_t(BINOUT_ROW_DATA)
+                 << elem.first << num_sets << hit.first << hit.second;
+        }
+      }
+    }
+    *bfbin << uint8_t(BINOUT_ROW_NONE);
+  }
+}
+
+// Report cache statistics by function and by user-defined partition.
+void bf_report_cache_by_key(void){
+  // Merge all threads' private-cache counters and the shared-cache counters
+  // by name.
+  named_cache_counters_t by_func, by_partition;
+  {
+    lock_guard<mutex> guard(cache_vector_mutex);
+    for(auto& tallies : *all_private_tallies){
+      for(auto& elem : tallies->by_func){
+        merge_cache_counters(by_func[elem.first == nullptr ? "" : elem.first].first, *elem.second);
+      }
+      for(auto& elem : tallies->by_partition){
+        merge_cache_counters(by_partition[elem.first].first, *elem.second);
+      }
+    }
+  }
+  {
+    lock_guard<mutex> guard(global_cache_mutex);
+    for(auto& elem : shared_tallies->by_func){
+      merge_cache_counters(by_func[elem.first == nullptr ? "" : elem.first].second, *elem.second);
+    }
+    for(auto& elem : shared_tallies->by_partition){
+      merge_cache_counters(by_partition[elem.first].second, *elem.second);
+    }
+  }
+
+  // Output a set of tables for each.
+  if(bf_per_func){
+    report_cache_counters("function", true, by_func);
+  }
+  if(!by_partition.empty()){
+    report_cache_counters("partition", false, by_partition);
+  }
+}
+
 } // namespace bytesflops
@@ -0,0 +1,138 @@
+/*
+ * Simple cache model for predicting miss rates
+ * (class definition)
+ *
+ * By Eric Anger <eanger@lanl.gov>
+ */
+
+#ifndef _CACHE_MODEL_H_
+#define _CACHE_MODEL_H_
+
+#include "byfl.h"
+
+// Classify the outcome of a demand access to a single cache line.
+enum LineOutcome {
+  LINE_MISS,          // Line was not resident
+  LINE_HIT,           // Line was resident due to an earlier demand access
+  LINE_PREFETCH_HIT   // Line was resident due to a not-yet-used prefetch
+};
+
+// Tally prefetcher effectiveness for a single function.
+struct PrefetchCounters {
+  uint64_t demand_accesses = 0;     // Lines accessed on demand
+  uint64_t demand_misses = 0;       // Demand accesses to nonresident lines
+  uint64_t prefetches = 0;          // Lines brought in by the prefetcher
+  uint64_t prefetch_hits = 0;       // Demand accesses to not-yet-used prefetched lines
+  uint64_t useless_prefetches = 0;  // Prefetched lines evicted before being used
+};
+
+// Tally cache-model statistics for a single function or partition.
+struct CacheCounters {
+  uint64_t accesses = 0;             // Lines accessed
+  uint64_t cold_misses = 0;          // Accesses to lines not in the LRU stack
+  uint64_t misaligned_mem_ops = 0;   // Loads and stores touching an extra line
+  vector<unordered_map<uint64_t,uint64_t> > hits;  // For each set count, a map of distance to access count
+};
+
+// Attribute each access to at most this many sets of counters (e.g., a
+// function and a user-defined partition).
+static const int max_cache_tallies = 2;
+
+// Define the interface to a hardware prefetcher.  observe() is told about
+// each demand access to a cache line and appends to targets the addresses of
+// the lines to prefetch in response.
+class Prefetcher {
+  public:
+    virtual ~Prefetcher() { }
+    virtual void observe(uint64_t site, uint64_t lineaddr, LineOutcome outcome,
+                         vector<uint64_t>& targets) = 0;
+};
+
+// Construct a prefetcher of a given type (one of the BF_PREFETCH_* values).
+extern Prefetcher* make_prefetcher(int type, uint64_t line_size,
+                                   uint64_t degree, uint64_t distance);
+
+class Cache {
+  public:
+    void access(uint64_t baseaddr, uint64_t numaddrs) { access(baseaddr, numaddrs, 0, nullptr, nullptr); }
+    void access(uint64_t baseaddr, uint64_t numaddrs, uint64_t site, PrefetchCounters* who,
+                CacheCounters* const* tallies);
+    bool prefetchLine(uint64_t lineaddr, PrefetchCounters* who);
+    void setPrefetcher(Prefetcher* prefetcher, uint64_t capacity) {
+      prefetcher_ = prefetcher;
+      track_prefetches_ = true;
+      setPrefetchCapacity(capacity);
+    }
+    void setPrefetchCapacity(uint64_t capacity) { prefetch_capacity_ = capacity; index_lines_ = true; }
+    const vector<uint64_t>& getLastPrefetches() const { return last_prefetches_; }
+    void tallyPendingPrefetches(unordered_map<PrefetchCounters*, uint64_t>& pending) const;
+    void recordDistances() { record_distances_ = true; }
+    const vector<uint64_t>& getLastDistances() const { return last_distances_; }
+    void setCapacity(uint64_t max_lines) { max_lines_ = max_lines; fixed_capacity_ = true; }
+    Cache(uint64_t line_size, uint64_t max_set_bits, bool record_thread_id) :
+      line_size_{line_size}, accesses_{0}, misaligned_mem_ops_{0},
+      log2_line_size_{0}, max_set_bits_{max_set_bits}, cold_misses_{0},
+      hits_(max_set_bits_), record_thread_id_{record_thread_id},
+      remote_hits_(max_set_bits_) {
+        auto lsize = line_size_;
+        while(lsize >>= 1) ++log2_line_size_;
+    }
+    uint64_t getAccesses() const { return accesses_; }
+    vector<unordered_map<uint64_t,uint64_t> > getHits() const { return hits_; }
+    uint64_t getColdMisses() const { return cold_misses_; }
+    uint64_t getMisalignedMemOps() const { return misaligned_mem_ops_; }
+    int getRightMatch(uint64_t a, uint64_t b);
+    vector<unordered_map<uint64_t,uint64_t> > getRemoteHits() const { return remote_hits_; }
+
+  private:
+    vector<uint64_t, bytesflops::CountingAllocator<uint64_t, bytesflops::BF_MEM_CACHE_MODEL> > lines_; // back is mru, front is lru
+    uint64_t line_size_;
+    uint64_t accesses_;
+    uint64_t misaligned_mem_ops_;  // Number of loads and stores resulting in misaligned cache accesses
+    uint64_t log2_line_size_; // log base 2 of line size
+    uint64_t max_set_bits_; // log base 2 of max number of sets
+    uint64_t cold_misses_;
+    // for each set count, a map of distance to access count
+    vector<unordered_map<uint64_t,uint64_t> > hits_;  // back is lru, front is mru
+    bool record_thread_id_;
+    // associate thread id with each line in cache. only used if record_thread_id_.
+    vector<unsigned, bytesflops::CountingAllocator<unsigned, bytesflops::BF_MEM_CACHE_MODEL> > thread_ids_;
+    // for each set count, a map of distance to access count
+    vector<unordered_map<uint64_t,uint64_t> > remote_hits_;  // back is lru, front is mru
+    // maximum number of lines to retain (0=unlimited); set when memory is tight.
+    uint64_t max_lines_ = 0;
+    // true=max_lines_ is part of what's being modeled (e.g., a TLB's
+    // capacity) so it mustn't be reduced to save memory.
+    bool fixed_capacity_ = false;
+    void limitLines(uint64_t max_lines);
+    // prefetcher state.  prefetch_tags_ parallels lines_ and names the
+    // function that prefetched each not-yet-used line (nullptr=none).
+    Prefetcher* prefetcher_ = nullptr;
+    bool track_prefetches_ = false;
+    vector<PrefetchCounters*, bytesflops::CountingAllocator<PrefetchCounters*, bytesflops::BF_MEM_CACHE_MODEL> > prefetch_tags_;
+    vector<uint64_t> prefetch_targets_;  // lines the prefetcher requested for the current line
+    // a prefetched line is useful only if it's used before it falls out of
+    // the prefetch_capacity_ most recently used lines (0=unlimited).
+    // resident_ holds every line in lines_ and is maintained only if
+    // index_lines_.
+    uint64_t prefetch_capacity_ = 0;
+    bool index_lines_ = false;
+    unordered_set<uint64_t, hash<uint64_t>, equal_to<uint64_t>,
+                  bytesflops::CountingAllocator<uint64_t, bytesflops::BF_MEM_CACHE_MODEL> > resident_;
+    vector<uint64_t> last_prefetches_;   // lines actually prefetched by the last access
+    // LRU stack distance of each line touched by the last access (0=miss).
+    // only used if record_distances_.
+    bool record_distances_ = false;
+    vector<uint64_t> last_distances_;
+    LineOutcome accessLine(uint64_t addr, CacheCounters* const* tallies);
+    void evictLines(uint64_t num_lines);
+};
+
+inline int Cache::getRightMatch(uint64_t a, uint64_t b){
+  // number of 0s, counting from left, ignoring all line bits.
+  // also need to mask off all bits higher than max_set_bits_.
+  auto diff_bits = ((a ^ b) >> log2_line_size_) | (1 << (max_set_bits_ - 1));
+  return __builtin_ctzll(diff_bits);
+}
+
+#endif
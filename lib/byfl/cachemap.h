@@ -108,6 +108,17 @@ public:
     return the_map->erase(key);
   }
 
+  // The clear() method removes all key:value pairs from both the cache and
+  // the underlying map and releases the underlying map's storage.
+  void clear () {
+    for (size_t i = 0; i < cache_size; i++) {
+      delete cache[i];
+      cache[i] = nullptr;
+    }
+    null_entries = cache_size;
+    map_type().swap(*the_map);
+  }
+
   // operator[] uses find() to find or create a key:value pair.
   T& operator[] (const Key& key) {
     iterator iter = find(key);
@@ -0,0 +1,209 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (profiling the targets of indirect calls)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include <dlfcn.h>
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+extern BinaryOStream* bfbin;
+
+// Report at most this many targets per call site.  Calls to any additional
+// targets are lumped together.
+static const size_t max_site_targets = 8;
+
+// Describe everything we know about a single indirect-call site.  Targets
+// are tallied exactly; only the report is limited to the most common few.
+class CallTargetSite {
+public:
+  bf_symbol_info_t syminfo;                   // Call-site source information
+  uint64_t calls = 0;                         // Number of calls made
+  unordered_map<uint64_t, uint64_t> targets;  // Map from target address to calls
+
+  CallTargetSite(const bf_symbol_info_t& sinfo) : syminfo(sinfo) { }
+
+  // Tally a given number of calls to a target.
+  void add (uint64_t target, uint64_t ncalls) {
+    calls += ncalls;
+    targets[target] += ncalls;
+  }
+
+  // Incorporate another thread's tallies for the same site.
+  void merge (const CallTargetSite& other) {
+    for (auto iter = other.targets.cbegin(); iter != other.targets.cend(); iter++)
+      add(iter->first, iter->second);
+  }
+
+  // Return the most frequently called targets as {calls, address} pairs
+  // sorted by decreasing number of calls.
+  vector<pair<uint64_t, uint64_t> > top_targets (void) const {
+    vector<pair<uint64_t, uint64_t> > top;
+    for (auto iter = targets.cbegin(); iter != targets.cend(); iter++)
+      top.push_back(make_pair(iter->second, iter->first));
+    size_t ntop = min(top.size(), max_site_targets);
+    partial_sort(top.begin(), top.begin() + ntop, top.end(),
+                 greater<pair<uint64_t, uint64_t> >());
+    top.resize(ntop);
+    return top;
+  }
+};
+typedef unordered_map<uint64_t, CallTargetSite*> site_map_t;
+
+// Maintain per-thread site maps so the common case requires no locking.
+static __thread site_map_t* thread_sites = nullptr;
+static vector<site_map_t*>* all_sites = nullptr;
+
+// Serialize all accesses to all_sites.
+static pthread_mutex_t call_target_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Initialize some of our variables at first use.
+void initialize_call_targets (void)
+{
+  all_sites = new vector<site_map_t*>();
+}
+
+// Tally a single indirect call to a given target address.
+extern "C"
+void bf_track_call_target (const bf_symbol_info_t* syminfo, uint64_t target)
+{
+  // Do nothing if counting is suppressed.
+  if (bf_suppress_counting)
+    return;
+
+  // Create the calling thread's site map on first use.
+  site_map_t* sites = thread_sites;
+  if (__builtin_expect(sites == nullptr, 0)) {
+    sites = new site_map_t();
+    pthread_mutex_lock(&call_target_lock);
+    all_sites->push_back(sites);
+    pthread_mutex_unlock(&call_target_lock);
+    thread_sites = sites;
+  }
+
+  // Find or create the call site and tally the target.
+  CallTargetSite*& site = (*sites)[syminfo->ID];
+  if (site == nullptr)
+    site = new CallTargetSite(*syminfo);
+  site->add(target, 1);
+}
+
+// Map a target address to a symbol name and an offset from that symbol.
+static void resolve_target (uint64_t target, string& symbol, uint64_t& offset)
+{
+  Dl_info info;
+  if (dladdr((const void*)target, &info) != 0 && info.dli_sname != nullptr) {
+    symbol = info.dli_sname;
+    offset = target - uint64_t(info.dli_saddr);
+  }
+  else {
+    symbol = "";
+    offset = 0;
+  }
+}
+
+// Sort call sites by decreasing number of calls then by ID.
+static bool compare_sites (const CallTargetSite* a, const CallTargetSite* b)
+{
+  if (a->calls != b->calls)
+    return a->calls > b->calls;
+  return a->syminfo.ID < b->syminfo.ID;
+}
+
+// Report the distribution of targets at each indirect-call site.  Return the
+// number of indirect calls and the number of sites that always called the
+// same target.
+void bf_report_call_targets (uint64_t* indirect_calls, uint64_t* num_sites,
+                             uint64_t* monomorphic_sites)
+{
+  // Merge all threads' tallies by call site.
+  site_map_t merged;
+  pthread_mutex_lock(&call_target_lock);
+  for (auto titer = all_sites->cbegin(); titer != all_sites->cend(); titer++)
+    for (auto iter = (*titer)->cbegin(); iter != (*titer)->cend(); iter++) {
+      CallTargetSite*& site = merged[iter->first];
+      if (site == nullptr)
+        site = new CallTargetSite(iter->second->syminfo);
+      site->merge(*iter->second);
+    }
+  pthread_mutex_unlock(&call_target_lock);
+  vector<CallTargetSite*> sorted_sites;
+  *indirect_calls = *monomorphic_sites = 0;
+  *num_sites = merged.size();
+  for (auto iter = merged.cbegin(); iter != merged.cend(); iter++) {
+    CallTargetSite* site = iter->second;
+    *indirect_calls += site->calls;
+    if (site->targets.size() == 1)
+      (*monomorphic_sites)++;
+    sorted_sites.push_back(site);
+  }
+  sort(sorted_sites.begin(), sorted_sites.end(), compare_sites);
+
+  // Output a summary of each call site.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Indirect-call sites";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Call site ID"
+         << uint8_t(BINOUT_COL_STRING) << "Mangled function name"
+         << uint8_t(BINOUT_COL_STRING) << "Demangled function name"
+         << uint8_t(BINOUT_COL_STRING) << "File name"
+         << uint8_t(BINOUT_COL_UINT64) << "Line number"
+         << uint8_t(BINOUT_COL_UINT64) << "Calls"
+         << uint8_t(BINOUT_COL_UINT64) << "Distinct targets"
+         << uint8_t(BINOUT_COL_UINT64) << "Calls to the most common target"
+         << uint8_t(BINOUT_COL_UINT64) << "Calls to unlisted targets"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = sorted_sites.cbegin(); iter != sorted_sites.cend(); iter++) {
+    const CallTargetSite* site = *iter;
+    vector<pair<uint64_t, uint64_t> > targets(site->top_targets());
+    uint64_t listed_calls = 0;
+    for (auto titer = targets.cbegin(); titer != targets.cend(); titer++)
+      listed_calls += titer->first;
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << site->syminfo.ID
+           << site->syminfo.function
+           << demangle_func_name(site->syminfo.function)
+           << (strcmp(site->syminfo.file, "??") == 0 ? "" : site->syminfo.file)
+           << uint64_t(site->syminfo.line)
+           << site->calls
+           << uint64_t(site->targets.size())
+           << (targets.empty() ? 0 : targets[0].first)
+           << site->calls - listed_calls;
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Output each call site's target distribution, resolving each target
+  // address to a symbol.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Indirect-call targets";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Call site ID"
+         << uint8_t(BINOUT_COL_UINT64) << "Target address"
+         << uint8_t(BINOUT_COL_STRING) << "Mangled target name"
+         << uint8_t(BINOUT_COL_STRING) << "Demangled target name"
+         << uint8_t(BINOUT_COL_UINT64) << "Offset from target symbol"
+         << uint8_t(BINOUT_COL_UINT64) << "Calls"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = sorted_sites.cbegin(); iter != sorted_sites.cend(); iter++) {
+    const CallTargetSite* site = *iter;
+    vector<pair<uint64_t, uint64_t> > targets(site->top_targets());
+    for (auto titer = targets.cbegin(); titer != targets.cend(); titer++) {
+      string symbol;
+      uint64_t offset;
+      resolve_target(titer->second, symbol, offset);
+      *bfbin << uint8_t(BINOUT_ROW_DATA)
+             << site->syminfo.ID
+             << titer->second
+             << symbol
+             << (symbol == "" ? string("") : demangle_func_name(symbol))
+             << offset
+             << titer->first;
+    }
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+  for (auto iter = merged.begin(); iter != merged.end(); iter++)
+    delete iter->second;
+}
+
+} // namespace bytesflops
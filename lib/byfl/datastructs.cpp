@@ -70,7 +70,7 @@ public:
 
 // Define all of the counters and other information we keep track of
 // per data structure.
-class DataStructCounters
+class DataStructCounters : public CountedObject<BF_MEM_DATA_STRUCTS>
 {
 public:
   bf_symbol_info_t syminfo;   // Dynamic data structure source information
@@ -131,16 +131,20 @@ string DataStructCounters::generate_symbol_desc (void) const
 }
 
 // Define this file's two main data structures.
-static CachedOrderedMap<Interval<uint64_t>, DataStructCounters*>* data_structs;  // Interval tree with information about each data structure
-static CachedUnorderedMap<ID_tag, DataStructCounters*>* id_tag_to_counters;  // Map from a symbol identifier to data-structure counters
+typedef CachedOrderedMap<Interval<uint64_t>, DataStructCounters*, less<Interval<uint64_t> >,
+                         CountingAllocator<pair<const Interval<uint64_t>, DataStructCounters*>, BF_MEM_DATA_STRUCTS> > interval_to_counters_t;
+typedef CachedUnorderedMap<ID_tag, DataStructCounters*, hash<ID_tag>, equal_to<ID_tag>,
+                           CountingAllocator<pair<const ID_tag, DataStructCounters*>, BF_MEM_DATA_STRUCTS> > id_tag_to_counters_t;
+static interval_to_counters_t* data_structs;  // Interval tree with information about each data structure
+static id_tag_to_counters_t* id_tag_to_counters;  // Map from a symbol identifier to data-structure counters
 
 // Construct an interval tree of symbol addresses.
 void initialize_data_structures (void)
 {
   if (data_structs != nullptr)
     return;    // Already initialized
-  data_structs = new CachedOrderedMap<Interval<uint64_t>, DataStructCounters*>;
-  id_tag_to_counters = new CachedUnorderedMap<ID_tag, DataStructCounters*>;
+  data_structs = new interval_to_counters_t;
+  id_tag_to_counters = new id_tag_to_counters_t;
 }
 
 // Disassociate a range of previously allocated addresses (given the address
@@ -353,6 +357,25 @@ void bf_access_data_struct (const bf_symbol_info_t* syminfo, uint64_t baseaddr,
   if (counters->access1_time == 0)
     counters->access1_time = dstruct_time;
   counters->accessN_time = dstruct_time++;
+
+  // Let the NUMA page tracker know which data structure it's looking at.
+  if (bf_numa)
+    bf_numa_assoc_data_struct(baseaddr, numaddrs, counters);
+}
+
+// Return an opaque pointer to the data structure containing a given address
+// or nullptr if the address doesn't belong to a known data structure.
+const void* bf_find_data_struct (uint64_t address)
+{
+  Interval<uint64_t> search_addr(address, address);
+  auto iter = data_structs->find(search_addr);
+  return iter == data_structs->end() ? nullptr : iter->second;
+}
+
+// Describe a data structure given an opaque pointer to its counters.
+string bf_describe_data_struct (const void* dstruct)
+{
+  return static_cast<const DataStructCounters*>(dstruct)->generate_symbol_desc();
 }
 
 // Associate an arbitrary tag with a fragment of a data structure, given an
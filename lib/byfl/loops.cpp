@@ -0,0 +1,199 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (ranking inner loops by estimated benefit from vectorization)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+extern BinaryOStream* bfbin;
+
+// Assume vectorized code operates on this many elements at once (e.g., four
+// doubles in a 256-bit vector register).
+static const uint64_t assumed_vector_lanes = 4;
+
+// Report at most this many loops.
+static const size_t max_loops_reported = 100;
+
+// Warn about loops whose estimated speedup is at least this large.
+static const double min_flagged_speedup = 2.0;
+
+// Keep track of the inner-loop tables registered by each instrumented
+// module.  Module constructors may run before the library is initialized so
+// allocate the list on first use.
+typedef pair<const bf_loop_info_t*, uint64_t> loop_table_t;
+static vector<loop_table_t>& loop_tables (void)
+{
+  static vector<loop_table_t>* tables = new vector<loop_table_t>();
+  return *tables;
+}
+
+// Describe each loop we flag as a good candidate for vectorization.
+static vector<string>* candidates = nullptr;
+
+// Record a module's table of inner loops.  The instrumented code updates
+// each loop's counters directly; we read them only at report time.
+extern "C"
+void bf_register_loops (const bf_loop_info_t* loops, uint64_t num_loops)
+{
+  loop_tables().push_back(loop_table_t(loops, num_loops));
+}
+
+// Combine a loop's static and dynamic characteristics and estimate the
+// speedup vectorization would provide.
+class LoopReport {
+public:
+  const bf_loop_info_t* info;   // Static loop information plus counters
+  uint64_t trip_count;          // Mean iterations per entry (0=unknown)
+  uint64_t unit_strides;        // Unit-stride accesses within the loop
+  uint64_t zero_strides;        // Zero-stride accesses within the loop
+  uint64_t total_strides;       // All strides observed within the loop
+  double speedup;               // Estimated speedup from vectorization
+  double flops_saved;           // Estimated scalar flops eliminated
+
+  LoopReport(const bf_loop_info_t* loop) : info(loop) {
+    // Compute the mean trip count.
+    const uint64_t* counters = info->counters;
+    trip_count = 0;
+    if (counters[BF_LOOP_ENTRIES] > 0)
+      trip_count = counters[BF_LOOP_ITERATIONS]/counters[BF_LOOP_ENTRIES];
+
+    // Determine the fraction of memory accesses that are vector-friendly.
+    // Without stride data, optimistically assume all of them are.
+    unit_strides = zero_strides = total_strides = 0;
+    if (bf_strides)
+      bf_get_strides_in_lines(info->function, info->file,
+                              info->first_line, info->last_line,
+                              &unit_strides, &zero_strides, &total_strides);
+    double vectorizable = 1.0;
+    if (total_strides > 0)
+      vectorizable = double(unit_strides + zero_strides)/double(total_strides);
+
+    // Assume leftover iterations run in scalar mode.
+    if (counters[BF_LOOP_ENTRIES] > 0)
+      vectorizable *= double(trip_count - trip_count%assumed_vector_lanes)/double(max(trip_count, uint64_t(1)));
+
+    // Apply Amdahl's law.
+    speedup = 1.0/((1.0 - vectorizable) + vectorizable/assumed_vector_lanes);
+    flops_saved = double(counters[BF_LOOP_SCALAR_FLOPS])*(1.0 - 1.0/speedup);
+  }
+
+  // Describe the loop in words.
+  string describe (void) const {
+    string desc("Loop");
+    if (strcmp(info->file, "??") != 0)
+      desc += " at " + string(info->file) + ':' + to_string(info->line);
+    desc += " in " + demangle_func_name(info->function);
+    return desc;
+  }
+};
+
+// Sort loops by decreasing estimated flops saved then by location.
+static bool compare_loops (const LoopReport& a, const LoopReport& b)
+{
+  if (a.flops_saved != b.flops_saved)
+    return a.flops_saved > b.flops_saved;
+  int cmp = strcmp(a.info->file, b.info->file);
+  if (cmp != 0)
+    return cmp < 0;
+  return a.info->line < b.info->line;
+}
+
+// Report the inner loops that perform scalar floating-point operations,
+// ranked by the estimated number of flops vectorization would eliminate.
+void bf_report_loops (void)
+{
+  // Gather all loops that executed scalar flops.
+  vector<LoopReport> loops;
+  vector<loop_table_t>& tables = loop_tables();
+  for (auto titer = tables.cbegin(); titer != tables.cend(); titer++)
+    for (uint64_t i = 0; i < titer->second; i++)
+      if (titer->first[i].counters[BF_LOOP_SCALAR_FLOPS] > 0)
+        loops.push_back(LoopReport(&titer->first[i]));
+  sort(loops.begin(), loops.end(), compare_loops);
+
+  // Flag loops that are likely to benefit from vectorization.
+  if (candidates == nullptr)
+    candidates = new vector<string>();
+  candidates->clear();
+  for (auto iter = loops.cbegin(); iter != loops.cend(); iter++) {
+    if (iter->speedup < min_flagged_speedup)
+      continue;
+    char speedup_str[25];
+    snprintf(speedup_str, sizeof(speedup_str), "%.2fx", iter->speedup);
+    string desc(iter->describe() + " performed " +
+                to_string(iter->info->counters[BF_LOOP_SCALAR_FLOPS]) +
+                " scalar flops; vectorizing it could yield an estimated " +
+                speedup_str + " speedup");
+    if (iter->info->calls > 0)
+      desc += " but it contains " + to_string(iter->info->calls) + " function call" +
+        (iter->info->calls == 1 ? "" : "s");
+    if (iter->info->recurrences > 0)
+      desc += string(iter->info->calls > 0 ? " and" : " but") + " it carries " +
+        to_string(iter->info->recurrences) + " scalar" +
+        (iter->info->recurrences == 1 ? "" : "s") + " across iterations";
+    candidates->push_back(desc);
+  }
+
+  // Output the most promising loops.
+  if (loops.size() > max_loops_reported)
+    loops.erase(loops.begin() + max_loops_reported, loops.end());
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Vectorization opportunities";
+  *bfbin << uint8_t(BINOUT_COL_STRING) << "Mangled function name"
+         << uint8_t(BINOUT_COL_STRING) << "Demangled function name"
+         << uint8_t(BINOUT_COL_STRING) << "File name"
+         << uint8_t(BINOUT_COL_UINT64) << "Line number"
+         << uint8_t(BINOUT_COL_UINT64) << "Iterations"
+         << uint8_t(BINOUT_COL_UINT64) << "Entries"
+         << uint8_t(BINOUT_COL_UINT64) << "Mean trip count"
+         << uint8_t(BINOUT_COL_UINT64) << "Scalar flops"
+         << uint8_t(BINOUT_COL_UINT64) << "Vector flops"
+         << uint8_t(BINOUT_COL_UINT64) << "Loads"
+         << uint8_t(BINOUT_COL_UINT64) << "Stores"
+         << uint8_t(BINOUT_COL_UINT64) << "Unit strides"
+         << uint8_t(BINOUT_COL_UINT64) << "Zero strides"
+         << uint8_t(BINOUT_COL_UINT64) << "Total strides"
+         << uint8_t(BINOUT_COL_UINT64) << "Function calls"
+         << uint8_t(BINOUT_COL_UINT64) << "Loop-carried scalars"
+         << uint8_t(BINOUT_COL_UINT64) << "Estimated speedup (percent)"
+         << uint8_t(BINOUT_COL_UINT64) << "Estimated scalar flops saved"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = loops.cbegin(); iter != loops.cend(); iter++) {
+    const bf_loop_info_t* info = iter->info;
+    const uint64_t* counters = info->counters;
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << info->function
+           << demangle_func_name(info->function)
+           << (strcmp(info->file, "??") == 0 ? "" : info->file)
+           << info->line
+           << counters[BF_LOOP_ITERATIONS]
+           << counters[BF_LOOP_ENTRIES]
+           << iter->trip_count
+           << counters[BF_LOOP_SCALAR_FLOPS]
+           << counters[BF_LOOP_VECTOR_FLOPS]
+           << counters[BF_LOOP_LOADS]
+           << counters[BF_LOOP_STORES]
+           << iter->unit_strides
+           << iter->zero_strides
+           << iter->total_strides
+           << info->calls
+           << info->recurrences
+           << uint64_t(iter->speedup*100.0 + 0.5)
+           << uint64_t(iter->flops_saved + 0.5);
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+}
+
+// Return a description of each loop we consider a good candidate for
+// vectorization.  This is valid only after bf_report_loops() is called.
+const vector<string>& bf_loop_candidates (void)
+{
+  return *candidates;
+}
+
+} // namespace bytesflops
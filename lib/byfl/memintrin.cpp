@@ -0,0 +1,197 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (histogramming memset/memcpy/memmove sizes by call site)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+extern BinaryOStream* bfbin;
+
+// Name each memory intrinsic.
+static const char* intrinsic_names[BF_MEMINTRIN_NUM] = {
+  "memset",
+  "memcpy",
+  "memmove"
+};
+
+// Consider calls that operate on fewer than this many bytes to be tiny.
+static const uint64_t tiny_bytes = 64;
+
+// Consider addresses that are not a multiple of this many bytes to be
+// unaligned.
+static const uint64_t aligned_bytes = 8;
+
+// Flag a call site if at least this many calls were made and at least half of
+// them were tiny or unaligned.
+static const uint64_t min_flagged_calls = 100;
+
+// Number of size bins: bin 0 holds zero-byte calls, and bin b>0 holds calls of
+// [2^(b-1), 2^b) bytes.
+static const int num_size_bins = 65;
+
+// Describe everything we know about a single memory-intrinsic call site.
+class MemIntrinSite {
+public:
+  bf_symbol_info_t syminfo;        // Call-site source information
+  uint8_t kind;                    // One of the BF_MEMINTRIN_* values
+  uint64_t calls = 0;              // Number of calls made
+  uint64_t bytes = 0;              // Total bytes set or copied
+  uint64_t tiny_calls = 0;         // Calls on fewer than tiny_bytes bytes
+  uint64_t unaligned_calls = 0;    // Calls with an unaligned source or destination
+  uint64_t size_hist[num_size_bins];  // Calls binned by log2 size
+
+  MemIntrinSite(const bf_symbol_info_t& sinfo, uint8_t k) : syminfo(sinfo), kind(k) {
+    memset(size_hist, 0, sizeof(size_hist));
+  }
+
+  // Say whether the site is dominated by tiny or unaligned calls.
+  bool flagged (void) const {
+    return calls >= min_flagged_calls
+      && (tiny_calls*2 >= calls || unaligned_calls*2 >= calls);
+  }
+};
+typedef unordered_map<uint64_t, MemIntrinSite*> site_map_t;
+static site_map_t* sites = nullptr;
+
+// Serialize all accesses to the site map.
+static pthread_mutex_t site_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Describe each call site we flag as dominated by tiny or unaligned calls.
+static vector<string>* flagged_sites = nullptr;
+
+// Initialize some of our variables at first use.
+void initialize_mem_intrinsics (void)
+{
+  sites = new site_map_t();
+  flagged_sites = new vector<string>();
+}
+
+// Tally a single call to llvm.memset.*, llvm.memcpy.*, or llvm.memmove.*.
+// For memset, src is the same as dest.
+extern "C"
+void bf_tally_mem_intrinsic (const bf_symbol_info_t* syminfo, uint8_t kind,
+                             uint64_t dest, uint64_t src, uint64_t length)
+{
+  // Do nothing if counting is suppressed.
+  if (bf_suppress_counting)
+    return;
+
+  // Find or create the call site.
+  pthread_mutex_lock(&site_lock);
+  MemIntrinSite*& site = (*sites)[syminfo->ID];
+  if (site == nullptr)
+    site = new MemIntrinSite(*syminfo, kind);
+
+  // Update the call site's tallies.
+  site->calls++;
+  site->bytes += length;
+  if (length < tiny_bytes)
+    site->tiny_calls++;
+  if (((dest | src) & (aligned_bytes - 1)) != 0)
+    site->unaligned_calls++;
+  site->size_hist[length == 0 ? 0 : 64 - __builtin_clzll(length)]++;
+  pthread_mutex_unlock(&site_lock);
+}
+
+// Describe a call site.
+static string describe_site (const MemIntrinSite* site)
+{
+  string desc(intrinsic_names[site->kind]);
+  desc += "() in ";
+  desc += demangle_func_name(site->syminfo.function);
+  if (strcmp(site->syminfo.file, "??") != 0)
+    desc += " at " + string(site->syminfo.file) + ':' + to_string(site->syminfo.line);
+  return desc;
+}
+
+// Sort call sites by decreasing number of calls then by ID.
+static bool compare_sites (const MemIntrinSite* a, const MemIntrinSite* b)
+{
+  if (a->calls != b->calls)
+    return a->calls > b->calls;
+  return a->syminfo.ID < b->syminfo.ID;
+}
+
+// Report per-call-site memory-intrinsic statistics and size histograms.
+void bf_report_mem_intrinsics (void)
+{
+  pthread_mutex_lock(&site_lock);
+  vector<const MemIntrinSite*> all_sites;
+  for (auto iter = sites->cbegin(); iter != sites->cend(); iter++)
+    all_sites.push_back(iter->second);
+  pthread_mutex_unlock(&site_lock);
+  sort(all_sites.begin(), all_sites.end(), compare_sites);
+
+  // Output a summary of each call site.
+  flagged_sites->clear();
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Memory-intrinsic call sites";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Call site ID"
+         << uint8_t(BINOUT_COL_STRING) << "Intrinsic"
+         << uint8_t(BINOUT_COL_STRING) << "Mangled function name"
+         << uint8_t(BINOUT_COL_STRING) << "Demangled function name"
+         << uint8_t(BINOUT_COL_STRING) << "File name"
+         << uint8_t(BINOUT_COL_UINT64) << "Line number"
+         << uint8_t(BINOUT_COL_UINT64) << "Calls"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes"
+         << uint8_t(BINOUT_COL_UINT64) << ("Calls on fewer than " + to_string(tiny_bytes) + " bytes")
+         << uint8_t(BINOUT_COL_UINT64) << "Unaligned calls"
+         << uint8_t(BINOUT_COL_BOOL)   << "Dominated by tiny or unaligned calls"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = all_sites.cbegin(); iter != all_sites.cend(); iter++) {
+    const MemIntrinSite* site = *iter;
+    bool flagged = site->flagged();
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << site->syminfo.ID
+           << intrinsic_names[site->kind]
+           << site->syminfo.function
+           << demangle_func_name(site->syminfo.function)
+           << (strcmp(site->syminfo.file, "??") == 0 ? "" : site->syminfo.file)
+           << uint64_t(site->syminfo.line)
+           << site->calls
+           << site->bytes
+           << site->tiny_calls
+           << site->unaligned_calls
+           << flagged;
+    if (flagged)
+      flagged_sites->push_back(describe_site(site) + " made " + to_string(site->calls) +
+                               " calls, of which " + to_string(site->tiny_calls) +
+                               " were on fewer than " + to_string(tiny_bytes) +
+                               " bytes and " + to_string(site->unaligned_calls) +
+                               " were unaligned");
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Output each call site's size histogram.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Memory-intrinsic sizes";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Call site ID"
+         << uint8_t(BINOUT_COL_UINT64) << "Minimum bytes"
+         << uint8_t(BINOUT_COL_UINT64) << "Maximum bytes"
+         << uint8_t(BINOUT_COL_UINT64) << "Calls"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = all_sites.cbegin(); iter != all_sites.cend(); iter++) {
+    const MemIntrinSite* site = *iter;
+    for (int b = 0; b < num_size_bins; b++)
+      if (site->size_hist[b] > 0)
+        *bfbin << uint8_t(BINOUT_ROW_DATA)
+               << site->syminfo.ID
+               << (b == 0 ? uint64_t(0) : uint64_t(1) << (b - 1))
+               << (b == 0 ? uint64_t(0) : (uint64_t(1) << (b - 1))*2 - 1)
+               << site->size_hist[b];
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+}
+
+// Return a description of each call site dominated by tiny or unaligned
+// calls.  This is valid only after bf_report_mem_intrinsics() is called.
+const vector<string>& bf_mem_intrinsics_flagged (void)
+{
+  return *flagged_sites;
+}
+
+} // namespace bytesflops
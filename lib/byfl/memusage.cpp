@@ -0,0 +1,166 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (accounting for Byfl's own memory usage)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include <atomic>
+#include <mutex>
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+// Keep track of the current and peak number of bytes held by each subsystem.
+// The extra, final entry tallies all subsystems together.  These are
+// constant-initialized so they can be updated by allocations that occur
+// during static construction.
+static atomic<uint64_t> current_bytes[BF_MEM_NUM_SUBSYSTEMS + 1];
+static atomic<uint64_t> peak_bytes[BF_MEM_NUM_SUBSYSTEMS + 1];
+
+// Don't let a subsystem degrade again until it has grown by this fraction of
+// the memory budget.
+static const uint64_t rearm_fraction = 16;
+
+// Define our memory budget and, for each subsystem, the number of bytes below
+// which it won't be asked to degrade.
+uint64_t bf_mem_budget = 0;
+static atomic<uint64_t> rearm_bytes[BF_MEM_NUM_SUBSYSTEMS];
+
+// Describe the approximations each subsystem has made, being careful to work
+// around the "C++ static initialization order fiasco" (cf. the C++ FAQ) as
+// these are needed at the end of the program.
+static string* approximations (void)
+{
+  static string* descriptions = new string[BF_MEM_NUM_SUBSYSTEMS];
+  return descriptions;
+}
+static mutex approximations_mutex;
+
+// Map each subsystem to a description.
+static const char* subsystem_names[BF_MEM_NUM_SUBSYSTEMS] = {
+  "Program page tables",
+  "Per-function page tables",
+  "Reuse-distance tree",
+  "Data-structure map",
+  "Symbol table",
+  "Cache model",
+  "OpenMP regions",
+  "NUMA page map",
+  "False-sharing detector",
+  "Per-thread counters"
+};
+
+// Parse BF_MAX_MEMORY, which accepts an optional K, M, G, or T suffix.
+void initialize_memusage (void)
+{
+  const char* budget_str = getenv("BF_MAX_MEMORY");
+  if (budget_str == nullptr || budget_str[0] == '\0')
+    return;
+  char* suffix;
+  uint64_t budget = strtoull(budget_str, &suffix, 10);
+  switch (toupper(*suffix)) {
+    case 'T':
+      budget *= 1024;
+      /* FALLTHROUGH */
+    case 'G':
+      budget *= 1024;
+      /* FALLTHROUGH */
+    case 'M':
+      budget *= 1024;
+      /* FALLTHROUGH */
+    case 'K':
+      budget *= 1024;
+      suffix++;
+      break;
+
+    default:
+      break;
+  }
+  if (suffix == budget_str || *suffix != '\0') {
+    cerr << "Failed to parse BF_MAX_MEMORY (\"" << budget_str << "\")\n";
+    bf_abend();
+  }
+  bf_mem_budget = budget;
+}
+
+// Add to a counter and raise its associated peak if necessary.
+static void add_and_update_peak (size_t idx, size_t bytes)
+{
+  uint64_t now = current_bytes[idx].fetch_add(bytes, memory_order_relaxed) + bytes;
+  uint64_t peak = peak_bytes[idx].load(memory_order_relaxed);
+  while (now > peak &&
+         !peak_bytes[idx].compare_exchange_weak(peak, now, memory_order_relaxed))
+    ;
+}
+
+// Record that a subsystem allocated a given number of bytes.
+void bf_mem_allocated (bf_mem_subsystem_t subsystem, size_t bytes)
+{
+  add_and_update_peak(subsystem, bytes);
+  add_and_update_peak(BF_MEM_NUM_SUBSYSTEMS, bytes);
+}
+
+// Record that a subsystem freed a given number of bytes.
+void bf_mem_freed (bf_mem_subsystem_t subsystem, size_t bytes)
+{
+  current_bytes[subsystem].fetch_sub(bytes, memory_order_relaxed);
+  current_bytes[BF_MEM_NUM_SUBSYSTEMS].fetch_sub(bytes, memory_order_relaxed);
+}
+
+// Say whether a subsystem has exceeded its share of the memory budget.  A
+// subsystem's share is an equal split of the budget across all subsystems
+// currently holding memory, and we consider it only when Byfl as a whole is
+// over budget.
+bool bf_mem_over_share (bf_mem_subsystem_t subsystem)
+{
+  if (current_bytes[BF_MEM_NUM_SUBSYSTEMS].load(memory_order_relaxed) <= bf_mem_budget)
+    return false;
+  uint64_t used = current_bytes[subsystem].load(memory_order_relaxed);
+  if (used < rearm_bytes[subsystem].load(memory_order_relaxed))
+    return false;
+  uint64_t num_active = 0;
+  for (int i = 0; i < BF_MEM_NUM_SUBSYSTEMS; i++)
+    if (current_bytes[i].load(memory_order_relaxed) > 0)
+      num_active++;
+  return used > bf_mem_budget/num_active;
+}
+
+// Record that a subsystem switched to an approximate representation.
+void bf_mem_degraded (bf_mem_subsystem_t subsystem, const string& description)
+{
+  lock_guard<mutex> guard(approximations_mutex);
+  approximations()[subsystem] = description;
+  rearm_bytes[subsystem] = current_bytes[subsystem].load() + bf_mem_budget/rearm_fraction;
+}
+
+// Describe how a subsystem's results are approximate.
+string bf_mem_approximation (bf_mem_subsystem_t subsystem)
+{
+  lock_guard<mutex> guard(approximations_mutex);
+  return approximations()[subsystem];
+}
+
+// Return a subsystem's current and peak memory usage in bytes.
+void bf_get_mem_usage (bf_mem_subsystem_t subsystem, uint64_t* current, uint64_t* peak)
+{
+  *current = current_bytes[subsystem].load();
+  *peak = peak_bytes[subsystem].load();
+}
+
+// Return the current and peak memory usage in bytes across all subsystems.
+void bf_get_total_mem_usage (uint64_t* current, uint64_t* peak)
+{
+  *current = current_bytes[BF_MEM_NUM_SUBSYSTEMS].load();
+  *peak = peak_bytes[BF_MEM_NUM_SUBSYSTEMS].load();
+}
+
+// Return a human-readable description of a subsystem.
+const char* bf_mem_subsystem_name (bf_mem_subsystem_t subsystem)
+{
+  return subsystem_names[subsystem];
+}
+
+} // namespace bytesflops
@@ -0,0 +1,108 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (accounting for Byfl's own memory usage)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#ifndef _MEMUSAGE_H_
+#define _MEMUSAGE_H_
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+// Enumerate the run-time-library subsystems whose memory consumption we
+// track individually.
+typedef enum {
+  BF_MEM_PAGE_TABLES,       // Program-wide unique-byte and byte-tally page tables
+  BF_MEM_FUNC_PAGE_TABLES,  // Per-function unique-byte and byte-tally page tables
+  BF_MEM_REUSE_DIST,        // Reuse-distance splay tree and last-access map
+  BF_MEM_DATA_STRUCTS,      // Data-structure interval map and counters
+  BF_MEM_SYMBOL_TABLE,      // Interned strings
+  BF_MEM_CACHE_MODEL,       // Cache-model LRU stacks
+  BF_MEM_OPENMP,            // Per-region, per-thread OpenMP counters
+  BF_MEM_NUMA,              // Page first-touch and sharing map
+  BF_MEM_SHARING,           // Per-cache-line sharing state
+  BF_MEM_THREADS,           // Per-thread and per-function, per-thread counters
+  BF_MEM_NUM_SUBSYSTEMS
+} bf_mem_subsystem_t;
+
+// Record that a subsystem allocated or freed a given number of bytes.
+extern void bf_mem_allocated(bf_mem_subsystem_t subsystem, size_t bytes);
+extern void bf_mem_freed(bf_mem_subsystem_t subsystem, size_t bytes);
+
+// Return a subsystem's current and peak memory usage in bytes.
+extern void bf_get_mem_usage(bf_mem_subsystem_t subsystem, uint64_t* current, uint64_t* peak);
+
+// Return the current and peak memory usage in bytes across all subsystems.
+extern void bf_get_total_mem_usage(uint64_t* current, uint64_t* peak);
+
+// Return a human-readable description of a subsystem.
+extern const char* bf_mem_subsystem_name(bf_mem_subsystem_t subsystem);
+
+// Byfl's memory budget in bytes (0=unlimited), taken from BF_MAX_MEMORY.
+extern uint64_t bf_mem_budget;
+
+// Say whether a subsystem has exceeded its share of the memory budget and
+// ought to switch to a cheaper, approximate representation.
+extern bool bf_mem_over_share(bf_mem_subsystem_t subsystem);
+static inline bool bf_mem_over_budget(bf_mem_subsystem_t subsystem) {
+  return __builtin_expect(bf_mem_budget != 0, 0) && bf_mem_over_share(subsystem);
+}
+
+// Record that a subsystem switched to an approximate representation.
+extern void bf_mem_degraded(bf_mem_subsystem_t subsystem, const string& description);
+
+// Describe how a subsystem's results are approximate or return the empty
+// string if they're exact.
+extern string bf_mem_approximation(bf_mem_subsystem_t subsystem);
+
+// Define an STL allocator that charges all of its allocations to a given
+// subsystem.
+template<class T, bf_mem_subsystem_t S>
+class CountingAllocator {
+public:
+  typedef T value_type;
+  template<class U> struct rebind { typedef CountingAllocator<U, S> other; };
+
+  CountingAllocator() noexcept { }
+  template<class U> CountingAllocator(const CountingAllocator<U, S>&) noexcept { }
+
+  T* allocate (size_t n) {
+    T* p = std::allocator<T>().allocate(n);
+    bf_mem_allocated(S, n*sizeof(T));
+    return p;
+  }
+
+  void deallocate (T* p, size_t n) {
+    bf_mem_freed(S, n*sizeof(T));
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template<class U> bool operator== (const CountingAllocator<U, S>&) const noexcept { return true; }
+  template<class U> bool operator!= (const CountingAllocator<U, S>&) const noexcept { return false; }
+};
+
+// Classes that derive from CountedObject charge each instance allocated with
+// new to a given subsystem.
+template<bf_mem_subsystem_t S>
+class CountedObject {
+public:
+  static void* operator new (size_t bytes) {
+    void* p = ::operator new(bytes);
+    bf_mem_allocated(S, bytes);
+    return p;
+  }
+
+  static void operator delete (void* p, size_t bytes) {
+    bf_mem_freed(S, bytes);
+    ::operator delete(p);
+  }
+};
+
+} // namespace bytesflops
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (tracking first touch and cross-thread sharing of memory pages)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include <atomic>
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+extern BinaryOStream* bfbin;
+
+// Describe everything we know about a single page of memory.  Threads are
+// numbered in the order in which they first touch memory; thread masks record
+// thread numbers modulo 64.
+class NumaPage {
+public:
+  uint64_t threads = 0;              // Mask of threads that accessed the page
+  uint32_t first_thread = 0;         // Thread that first touched the page
+  const char* first_func = nullptr;  // Function that first touched the page
+  const void* dstruct = nullptr;     // Data structure first seen on the page
+};
+typedef unordered_map<uint64_t, NumaPage, hash<uint64_t>, equal_to<uint64_t>,
+                      CountingAllocator<pair<const uint64_t, NumaPage>, BF_MEM_NUMA> > page_map_t;
+static page_map_t* pages = nullptr;
+
+// Serialize all accesses to the page map.
+static pthread_mutex_t page_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Define the page size as a power of two.  This grows if we exceed our share
+// of BF_MAX_MEMORY.
+static uint64_t page_bits = 12;
+
+// Count the threads that touched memory (one more than the largest thread
+// number seen).
+static uint32_t num_threads = 0;
+
+// Let each thread skip the page map when it repeatedly touches the same page.
+// map_epoch changes whenever pages change meaning.
+static atomic<uint64_t> map_epoch(1);
+static thread_local uint64_t recent_page = 0;
+static thread_local uint64_t recent_epoch = 0;
+
+// Summarize a set of pages that share a first-touch function or a data
+// structure.
+class NumaGroup {
+public:
+  uint64_t pages = 0;           // Number of pages in the group
+  uint64_t shared_pages = 0;    // Number of pages accessed by more than one thread
+  uint64_t first_threads = 0;   // Mask of threads that first touched a page
+  uint64_t threads = 0;         // Mask of threads that accessed any page
+
+  // Incorporate a page into the group.
+  void add (const NumaPage& page) {
+    pages++;
+    if (__builtin_popcountll(page.threads) > 1)
+      shared_pages++;
+    first_threads |= uint64_t(1) << (page.first_thread%64);
+    threads |= page.threads;
+  }
+
+  // Say whether a single thread first touched every page but other threads
+  // subsequently accessed some of them.
+  bool serially_initialized (void) const {
+    return shared_pages > 0 && __builtin_popcountll(first_threads) == 1;
+  }
+};
+
+// Describe each function or data structure we flag as serially initialized
+// but accessed in parallel.
+static vector<string>* serial_init = nullptr;
+
+// Initialize some of our variables at first use.
+void initialize_numa (void)
+{
+  long sys_page_size = sysconf(_SC_PAGESIZE);
+  if (sys_page_size > 0)
+    page_bits = 63 - __builtin_clzll(uint64_t(sys_page_size));
+  pages = new page_map_t();
+  serial_init = new vector<string>();
+}
+
+// Halve the number of pages we track by doubling the page size.  The caller
+// must hold page_lock.
+static void coarsen_pages (void)
+{
+  page_map_t* coarse = new page_map_t();
+  for (auto iter = pages->cbegin(); iter != pages->cend(); iter++) {
+    const NumaPage& fine_page = iter->second;
+    NumaPage& coarse_page = (*coarse)[iter->first >> 1];
+    if (coarse_page.threads == 0) {
+      coarse_page.first_thread = fine_page.first_thread;
+      coarse_page.first_func = fine_page.first_func;
+    }
+    coarse_page.threads |= fine_page.threads;
+    if (coarse_page.dstruct == nullptr)
+      coarse_page.dstruct = fine_page.dstruct;
+  }
+  delete pages;
+  pages = coarse;
+  page_bits++;
+  map_epoch++;
+  bf_mem_degraded(BF_MEM_NUMA,
+                  "Page sharing is tracked in " + to_string(uint64_t(1) << page_bits) +
+                  "-byte units instead of per page");
+}
+
+// Record that the calling thread accessed a range of addresses.
+extern "C"
+void bf_numa_touch (const char* funcname, uint64_t baseaddr, uint64_t numaddrs)
+{
+  // Do nothing if counting is suppressed.
+  if (bf_suppress_counting || numaddrs == 0)
+    return;
+
+  // Do nothing if we're touching the same page as last time.
+  uint64_t first_page = baseaddr >> page_bits;
+  uint64_t last_page = (baseaddr + numaddrs - 1) >> page_bits;
+  if (first_page == recent_page && last_page == recent_page &&
+      recent_epoch == map_epoch.load(memory_order_relaxed))
+    return;
+
+  // Mark each page as accessed by the calling thread.
+  uint32_t thread = bf_thread_number();
+  uint64_t thread_bit = uint64_t(1) << (thread%64);
+  pthread_mutex_lock(&page_lock);
+  if (thread >= num_threads)
+    num_threads = thread + 1;
+  first_page = baseaddr >> page_bits;   // Another thread may have coarsened the pages.
+  last_page = (baseaddr + numaddrs - 1) >> page_bits;
+  for (uint64_t pg = first_page; pg <= last_page; pg++) {
+    NumaPage& page = (*pages)[pg];
+    if (page.threads == 0) {
+      // First touch
+      page.first_thread = thread;
+      page.first_func = bf_call_stack ? bf_func_and_parents : bf_string_to_symbol(funcname);
+    }
+    page.threads |= thread_bit;
+  }
+  recent_page = last_page;
+  recent_epoch = map_epoch.load(memory_order_relaxed);
+  if (bf_mem_over_budget(BF_MEM_NUMA))
+    coarsen_pages();
+  pthread_mutex_unlock(&page_lock);
+}
+
+// Associate a range of addresses with a data structure, which is an opaque
+// pointer that bf_describe_data_struct() knows how to describe.  Only the
+// first data structure seen on each page is retained.
+void bf_numa_assoc_data_struct (uint64_t baseaddr, uint64_t numaddrs, const void* dstruct)
+{
+  if (bf_suppress_counting || numaddrs == 0)
+    return;
+  pthread_mutex_lock(&page_lock);
+  uint64_t first_page = baseaddr >> page_bits;
+  uint64_t last_page = (baseaddr + numaddrs - 1) >> page_bits;
+  for (uint64_t pg = first_page; pg <= last_page; pg++) {
+    NumaPage& page = (*pages)[pg];
+    if (page.dstruct == nullptr)
+      page.dstruct = dstruct;
+  }
+  pthread_mutex_unlock(&page_lock);
+}
+
+// Sort groups by decreasing number of pages then by name.
+typedef pair<string, NumaGroup> named_group_t;
+static bool compare_named_groups (const named_group_t& a, const named_group_t& b)
+{
+  if (a.second.pages != b.second.pages)
+    return a.second.pages > b.second.pages;
+  return a.first < b.first;
+}
+
+// Output a table of page-sharing information for a list of groups.
+static void report_numa_groups (const char* table_name, const char* column_name,
+                                const char* kind, vector<named_group_t>& groups)
+{
+  sort(groups.begin(), groups.end(), compare_named_groups);
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << table_name;
+  *bfbin << uint8_t(BINOUT_COL_STRING) << column_name
+         << uint8_t(BINOUT_COL_UINT64) << "Pages first touched"
+         << uint8_t(BINOUT_COL_UINT64) << "Pages shared by multiple threads"
+         << uint8_t(BINOUT_COL_UINT64) << "First-touching threads"
+         << uint8_t(BINOUT_COL_UINT64) << "Accessing threads"
+         << uint8_t(BINOUT_COL_BOOL)   << "Serially initialized"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = groups.cbegin(); iter != groups.cend(); iter++) {
+    const NumaGroup& group = iter->second;
+    bool serial = group.serially_initialized();
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << iter->first
+           << group.pages
+           << group.shared_pages
+           << uint64_t(__builtin_popcountll(group.first_threads))
+           << uint64_t(__builtin_popcountll(group.threads))
+           << serial;
+    if (serial)
+      serial_init->push_back(to_string(group.shared_pages) + " of " + to_string(group.pages) +
+                             " pages associated with " + kind + iter->first +
+                             " were first touched by a single thread but shared by " +
+                             to_string(__builtin_popcountll(group.threads)) + " threads");
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+}
+
+// Report page sharing by first-touching function and, if data structures are
+// being tracked, by data structure.
+void bf_report_numa_pages (void)
+{
+  pthread_mutex_lock(&page_lock);
+  serial_init->clear();
+
+  // Group pages by the function that first touched them.
+  unordered_map<const char*, NumaGroup> by_func;
+  for (auto iter = pages->cbegin(); iter != pages->cend(); iter++)
+    if (iter->second.threads != 0)
+      by_func[iter->second.first_func].add(iter->second);
+  vector<named_group_t> func_groups;
+  for (auto iter = by_func.cbegin(); iter != by_func.cend(); iter++)
+    func_groups.push_back(named_group_t(iter->first == nullptr ? "" : demangle_func_name(iter->first),
+                                        iter->second));
+  report_numa_groups("NUMA pages by function", "Function", "function ", func_groups);
+
+  // Group pages by the data structure they contain.
+  if (bf_data_structs) {
+    unordered_map<const void*, NumaGroup> by_dstruct;
+    for (auto iter = pages->cbegin(); iter != pages->cend(); iter++)
+      if (iter->second.threads != 0 && iter->second.dstruct != nullptr)
+        by_dstruct[iter->second.dstruct].add(iter->second);
+    vector<named_group_t> dstruct_groups;
+    for (auto iter = by_dstruct.cbegin(); iter != by_dstruct.cend(); iter++)
+      dstruct_groups.push_back(named_group_t(bf_describe_data_struct(iter->first), iter->second));
+    report_numa_groups("NUMA pages by data structure", "Data structure", "",
+                       dstruct_groups);
+  }
+  pthread_mutex_unlock(&page_lock);
+}
+
+// Return program-wide page-sharing statistics.
+void bf_get_numa_summary (uint64_t* page_size, uint64_t* threads, uint64_t* pages_touched,
+                          uint64_t* pages_shared, uint64_t* initial_pages_shared)
+{
+  pthread_mutex_lock(&page_lock);
+  *page_size = uint64_t(1) << page_bits;
+  *threads = num_threads;
+  *pages_touched = *pages_shared = *initial_pages_shared = 0;
+  for (auto iter = pages->cbegin(); iter != pages->cend(); iter++) {
+    const NumaPage& page = iter->second;
+    if (page.threads == 0)
+      continue;
+    (*pages_touched)++;
+    if (__builtin_popcountll(page.threads) > 1) {
+      (*pages_shared)++;
+      if (page.first_thread == 0)
+        (*initial_pages_shared)++;
+    }
+  }
+  pthread_mutex_unlock(&page_lock);
+}
+
+// Return a description of each function or data structure that was
+// initialized serially but accessed in parallel.  This is valid only after
+// bf_report_numa_pages() is called.
+const vector<string>& bf_numa_serial_init (void)
+{
+  return *serial_init;
+}
+
+} // namespace bytesflops
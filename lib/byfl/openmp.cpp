@@ -0,0 +1,460 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (attributing counts to OpenMP parallel regions)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+#ifdef OMP_TOOLS_H
+# include OMP_TOOLS_H
+#endif
+
+using namespace std;
+
+namespace bytesflops {
+
+// bf_omp_active is true if an OpenMP run time accepted us as its OMPT tool.
+bool bf_omp_active = false;
+const char* bf_omp_warning = nullptr;  // Reason we can't attribute counts to OpenMP regions
+
+#ifdef OMP_TOOLS_H
+
+extern BinaryOStream* bfbin;
+extern "C" void bf_initialize_if_necessary(void);
+
+class OmpRegion;
+
+// Maintain counters for one thread's share of one parallel region.
+class OmpThreadCounters : public CountedObject<BF_MEM_OPENMP> {
+public:
+  OmpRegion* region;          // Region to which these counters belong
+  ByteFlopCounters counters;  // Operation and byte tallies
+  uint64_t tasks;             // Number of explicit tasks executed
+  uint64_t loops;             // Number of worksharing loops entered
+  uint64_t barriers;          // Number of barriers encountered
+
+  OmpThreadCounters(OmpRegion* owner) :
+    region(owner), tasks(0), loops(0), barriers(0) { }
+
+  // Reset all of our counters to zero.
+  void reset (void) {
+    counters.reset();
+    tasks = 0;
+    loops = 0;
+    barriers = 0;
+  }
+};
+
+// Maintain information about one parallel region, identified by the address
+// of the code that launches it.  Region 0 represents all code that runs
+// outside of any parallel region.
+class OmpRegion : public CountedObject<BF_MEM_OPENMP> {
+public:
+  uint64_t id;                // Sequential region ID (0=serial code)
+  const void* codeptr;        // Return address of the call that created the region (nullptr=unknown)
+  uint64_t instances;         // Number of times the region was entered
+  vector<OmpThreadCounters*, CountingAllocator<OmpThreadCounters*, BF_MEM_OPENMP> > threads;  // Counters for each thread number
+  UniqueSketch<BF_MEM_OPENMP> unique_addrs;  // Distinct addresses accessed by any thread
+
+  OmpRegion(uint64_t new_id, const void* new_codeptr) :
+    id(new_id), codeptr(new_codeptr), instances(0) { }
+
+  // Return the counters for a given thread number, creating them if
+  // necessary.  The caller must hold regions_lock.
+  OmpThreadCounters* thread_counters (unsigned int tnum) {
+    if (tnum >= threads.size())
+      threads.resize(tnum + 1, nullptr);
+    if (threads[tnum] == nullptr)
+      threads[tnum] = new OmpThreadCounters(this);
+    return threads[tnum];
+  }
+};
+
+// Map a parallel region's code address to its region information.
+typedef unordered_map<const void*, OmpRegion*, hash<const void*>, equal_to<const void*>,
+                      CountingAllocator<pair<const void* const, OmpRegion*>, BF_MEM_OPENMP> > codeptr_to_region_t;
+static codeptr_to_region_t* regions = nullptr;
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Point to the region representing serial code, to its (sole) set of
+// counters, and, for each thread, to the counters for the region the thread
+// is currently executing (nullptr=serial code).
+static OmpRegion* serial_region = nullptr;
+static OmpThreadCounters* serial_counters = nullptr;
+static thread_local OmpThreadCounters* current_counters = nullptr;
+
+// Tag explicit tasks so we can distinguish them from implicit tasks when they
+// are scheduled.
+static char explicit_task_tag;
+
+// Return the counters to which the calling thread should attribute its
+// activity.
+static inline OmpThreadCounters* my_counters (void)
+{
+  OmpThreadCounters* tc = current_counters;
+  return tc == nullptr ? serial_counters : tc;
+}
+
+// Find or create the parallel region associated with a code address.  The
+// caller must hold regions_lock.
+static OmpRegion* find_region (const void* codeptr)
+{
+  auto iter = regions->find(codeptr);
+  if (iter != regions->end())
+    return iter->second;
+  OmpRegion* region = new OmpRegion(regions->size() + 1, codeptr);
+  (*regions)[codeptr] = region;
+  return region;
+}
+
+// Tally a new instance of a parallel region.
+static void on_parallel_begin (ompt_data_t* encountering_task_data,
+                               const ompt_frame_t* encountering_task_frame,
+                               ompt_data_t* parallel_data,
+                               unsigned int requested_parallelism,
+                               int flags,
+                               const void* codeptr_ra)
+{
+  pthread_mutex_lock(&regions_lock);
+  OmpRegion* region = find_region(codeptr_ra);
+  region->instances++;
+  pthread_mutex_unlock(&regions_lock);
+  parallel_data->ptr = region;
+}
+
+// Direct a thread's counters to a parallel region on entry and back to the
+// enclosing region on exit.  We stash the enclosing region's counters in the
+// implicit task's data.
+static void on_implicit_task (ompt_scope_endpoint_t endpoint,
+                              ompt_data_t* parallel_data,
+                              ompt_data_t* task_data,
+                              unsigned int actual_parallelism,
+                              unsigned int index,
+                              int flags)
+{
+  if (flags & ompt_task_initial)
+    return;
+  switch (endpoint) {
+    case ompt_scope_begin: {
+      pthread_mutex_lock(&regions_lock);
+      OmpRegion* region = (OmpRegion*) parallel_data->ptr;
+      if (region == nullptr)
+        region = find_region(nullptr);
+      OmpThreadCounters* tc = region->thread_counters(index);
+      pthread_mutex_unlock(&regions_lock);
+      task_data->ptr = current_counters;
+      current_counters = tc;
+      break;
+    }
+
+    case ompt_scope_end:
+      current_counters = (OmpThreadCounters*) task_data->ptr;
+      break;
+
+    default:
+      break;
+  }
+}
+
+// Mark explicit tasks as such.
+static void on_task_create (ompt_data_t* encountering_task_data,
+                            const ompt_frame_t* encountering_task_frame,
+                            ompt_data_t* new_task_data,
+                            int flags,
+                            int has_dependences,
+                            const void* codeptr_ra)
+{
+  if (flags & ompt_task_explicit)
+    new_task_data->ptr = &explicit_task_tag;
+}
+
+// Tally each explicit task a thread begins executing.
+static void on_task_schedule (ompt_data_t* prior_task_data,
+                              ompt_task_status_t prior_task_status,
+                              ompt_data_t* next_task_data)
+{
+  if (bf_suppress_counting)
+    return;
+  if (next_task_data != nullptr && next_task_data->ptr == &explicit_task_tag)
+    my_counters()->tasks++;
+}
+
+// Tally each worksharing loop a thread enters.
+static void on_work (ompt_work_t wstype,
+                     ompt_scope_endpoint_t endpoint,
+                     ompt_data_t* parallel_data,
+                     ompt_data_t* task_data,
+                     uint64_t count,
+                     const void* codeptr_ra)
+{
+  if (bf_suppress_counting)
+    return;
+  if (wstype == ompt_work_loop && endpoint == ompt_scope_begin)
+    my_counters()->loops++;
+}
+
+// Tally each barrier a thread encounters, whether implicit or explicit.
+static void on_sync_region (ompt_sync_region_t kind,
+                            ompt_scope_endpoint_t endpoint,
+                            ompt_data_t* parallel_data,
+                            ompt_data_t* task_data,
+                            const void* codeptr_ra)
+{
+  if (bf_suppress_counting || endpoint != ompt_scope_begin)
+    return;
+  switch (kind) {
+    case ompt_sync_region_barrier:
+    case ompt_sync_region_barrier_implicit:
+    case ompt_sync_region_barrier_explicit:
+    case ompt_sync_region_barrier_implementation:
+      my_counters()->barriers++;
+      break;
+
+    default:
+      break;
+  }
+}
+
+// Register our callbacks with the OpenMP run time.
+static int initialize_ompt (ompt_function_lookup_t lookup,
+                            int initial_device_num,
+                            ompt_data_t* tool_data)
+{
+  bf_initialize_if_necessary();
+
+  // Only the calls the instrumented code makes at the end of each basic block
+  // under -bf-every-bb, -bf-by-func, or -bf-threads tell us what each region
+  // did.  Without any of those, decline to be the OMPT tool.
+  if (!bf_every_bb && !bf_per_func && !bf_threads) {
+    bf_omp_warning = "OpenMP regions are not reported without -bf-every-bb, -bf-by-func, or -bf-threads";
+    return 0;
+  }
+  ompt_set_callback_t set_callback = (ompt_set_callback_t) lookup("ompt_set_callback");
+  if (set_callback == nullptr)
+    return 0;
+  regions = new codeptr_to_region_t;
+  serial_region = new OmpRegion(0, nullptr);
+  serial_region->instances = 1;
+  serial_counters = serial_region->thread_counters(0);
+  serial_counters->counters.accumulate(&global_totals);  // Everything up to now was serial.
+  set_callback(ompt_callback_parallel_begin, (ompt_callback_t) on_parallel_begin);
+  set_callback(ompt_callback_implicit_task, (ompt_callback_t) on_implicit_task);
+  set_callback(ompt_callback_task_create, (ompt_callback_t) on_task_create);
+  set_callback(ompt_callback_task_schedule, (ompt_callback_t) on_task_schedule);
+  set_callback(ompt_callback_work, (ompt_callback_t) on_work);
+  set_callback(ompt_callback_sync_region, (ompt_callback_t) on_sync_region);
+  bf_omp_active = true;
+  return 1;
+}
+
+// Do nothing when the OpenMP run time shuts down.  We report our data at the
+// end of the program.
+static void finalize_ompt (ompt_data_t* tool_data)
+{
+}
+
+// Attribute a basic block's counters to the calling thread's current region.
+void bf_omp_accumulate (ByteFlopCounters* bb_counters)
+{
+  my_counters()->counters.accumulate(bb_counters);
+}
+
+// Attribute a set of addresses to the calling thread's current region.
+void bf_omp_assoc_addresses (uint64_t baseaddr, uint64_t numaddrs)
+{
+  my_counters()->region->unique_addrs.access(baseaddr, numaddrs);
+}
+
+// Reset all per-region counters to zero.  Distinct-address tallies remain
+// cumulative.
+void bf_omp_reset_counters (void)
+{
+  if (!bf_omp_active)
+    return;
+  pthread_mutex_lock(&regions_lock);
+  serial_counters->reset();
+  for (auto iter = regions->begin(); iter != regions->end(); iter++)
+    for (auto titer = iter->second->threads.begin(); titer != iter->second->threads.end(); titer++)
+      if (*titer != nullptr)
+        (*titer)->reset();
+  pthread_mutex_unlock(&regions_lock);
+}
+
+// Compare two regions by ID.
+static bool compare_region_ids (const OmpRegion* one, const OmpRegion* two)
+{
+  return one->id < two->id;
+}
+
+// Return how far a maximum exceeds a mean, as a percentage of the mean.
+static uint64_t imbalance_percent (uint64_t max_value, uint64_t total, uint64_t num_values)
+{
+  if (total == 0)
+    return 0;
+  double mean = double(total)/double(num_values);
+  return uint64_t(100.0*(double(max_value) - mean)/mean + 0.5);
+}
+
+// Report per-region and per-region, per-thread counters.
+void bf_report_openmp_regions (void)
+{
+  if (!bf_omp_active)
+    return;
+
+  // Sort the regions by ID.
+  pthread_mutex_lock(&regions_lock);
+  vector<OmpRegion*> all_regions(1, serial_region);
+  for (auto iter = regions->begin(); iter != regions->end(); iter++)
+    all_regions.push_back(iter->second);
+  sort(all_regions.begin(), all_regions.end(), compare_region_ids);
+
+  // Output a table of per-region totals and load imbalance.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "OpenMP regions";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Region ID"
+         << uint8_t(BINOUT_COL_STRING) << "Code address"
+         << uint8_t(BINOUT_COL_UINT64) << "Instances"
+         << uint8_t(BINOUT_COL_UINT64) << "Threads"
+         << uint8_t(BINOUT_COL_UINT64) << "Operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Floating-point operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes loaded"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes stored";
+  if (bf_unique_bytes)
+    *bfbin << uint8_t(BINOUT_COL_UINT64) << "Unique bytes (estimated)";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Minimum operations per thread"
+         << uint8_t(BINOUT_COL_UINT64) << "Maximum operations per thread"
+         << uint8_t(BINOUT_COL_UINT64) << "Operation imbalance (%)"
+         << uint8_t(BINOUT_COL_UINT64) << "Minimum bytes per thread"
+         << uint8_t(BINOUT_COL_UINT64) << "Maximum bytes per thread"
+         << uint8_t(BINOUT_COL_UINT64) << "Byte imbalance (%)"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto riter = all_regions.cbegin(); riter != all_regions.cend(); riter++) {
+    const OmpRegion* region = *riter;
+    uint64_t num_threads = 0;
+    uint64_t ops = 0, flops = 0, loads = 0, stores = 0;
+    uint64_t min_ops = ~uint64_t(0), max_ops = 0;
+    uint64_t min_bytes = ~uint64_t(0), max_bytes = 0;
+    for (auto titer = region->threads.cbegin(); titer != region->threads.cend(); titer++) {
+      if (*titer == nullptr)
+        continue;
+      const ByteFlopCounters& counters = (*titer)->counters;
+      uint64_t bytes = counters.loads + counters.stores;
+      num_threads++;
+      ops += counters.ops;
+      flops += counters.flops;
+      loads += counters.loads;
+      stores += counters.stores;
+      min_ops = min(min_ops, counters.ops);
+      max_ops = max(max_ops, counters.ops);
+      min_bytes = min(min_bytes, bytes);
+      max_bytes = max(max_bytes, bytes);
+    }
+    if (num_threads == 0)
+      continue;
+    char codeptr_str[25];
+    if (region->codeptr == nullptr)
+      codeptr_str[0] = '\0';
+    else
+      sprintf(codeptr_str, "%p", region->codeptr);
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << region->id
+           << codeptr_str
+           << region->instances
+           << num_threads
+           << ops
+           << flops
+           << loads
+           << stores;
+    if (bf_unique_bytes)
+      *bfbin << region->unique_addrs.estimate();
+    *bfbin << min_ops
+           << max_ops
+           << imbalance_percent(max_ops, ops, num_threads)
+           << min_bytes
+           << max_bytes
+           << imbalance_percent(max_bytes, loads + stores, num_threads);
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Output a table of per-region, per-thread counters.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "OpenMP region threads";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Region ID"
+         << uint8_t(BINOUT_COL_UINT64) << "Thread number"
+         << uint8_t(BINOUT_COL_UINT64) << "Load operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Store operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Floating-point operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Integer operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Function-call operations (non-exception-throwing)"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes loaded"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes stored"
+         << uint8_t(BINOUT_COL_UINT64) << "Explicit tasks executed"
+         << uint8_t(BINOUT_COL_UINT64) << "Worksharing loops entered"
+         << uint8_t(BINOUT_COL_UINT64) << "Barriers encountered"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto riter = all_regions.cbegin(); riter != all_regions.cend(); riter++) {
+    const OmpRegion* region = *riter;
+    for (size_t tnum = 0; tnum < region->threads.size(); tnum++) {
+      const OmpThreadCounters* tc = region->threads[tnum];
+      if (tc == nullptr)
+        continue;
+      const ByteFlopCounters& counters = tc->counters;
+      *bfbin << uint8_t(BINOUT_ROW_DATA)
+             << region->id
+             << uint64_t(tnum)
+             << counters.load_ins
+             << counters.store_ins
+             << counters.flops
+             << counters.ops - counters.flops - counters.load_ins - counters.store_ins - counters.terminators[BF_END_BB_ANY]
+             << counters.call_ins
+             << counters.loads
+             << counters.stores
+             << tc->tasks
+             << tc->loops
+             << tc->barriers;
+    }
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+  pthread_mutex_unlock(&regions_lock);
+}
+
+#else
+
+// Without the OpenMP tools interface, OpenMP regions can't be tracked.
+void bf_omp_accumulate (ByteFlopCounters* bb_counters)
+{
+}
+
+void bf_omp_assoc_addresses (uint64_t baseaddr, uint64_t numaddrs)
+{
+}
+
+void bf_omp_reset_counters (void)
+{
+}
+
+void bf_report_openmp_regions (void)
+{
+}
+
+#endif
+
+} // namespace bytesflops
+
+#ifdef OMP_TOOLS_H
+
+// An OpenMP run time that supports OMPT (e.g., LLVM's libomp) invokes
+// ompt_start_tool() when it initializes.  Volunteer to be its tool unless the
+// user disabled tools via OMP_TOOL=disabled.
+extern "C"
+ompt_start_tool_result_t* ompt_start_tool (unsigned int omp_version,
+                                           const char* runtime_version)
+{
+  static ompt_start_tool_result_t result = {
+    bytesflops::initialize_ompt,
+    bytesflops::finalize_ompt,
+    {0}
+  };
+  return &result;
+}
+
+#endif
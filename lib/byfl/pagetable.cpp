@@ -12,26 +12,46 @@ using namespace std;
 namespace bytesflops {
 
 // Construct a page-table entry for bit-sized counters.
-BitPageTableEntry::BitPageTableEntry(size_t pg_size) : BasePageTableEntry(pg_size)
+BitPageTableEntry::BitPageTableEntry(size_t pg_size, bf_mem_subsystem_t owner) :
+  BasePageTableEntry(pg_size, owner)
 {
   bytes_touched = 0;
   bit_vector = new uint64_t[logical_page_size/64];
+  bf_mem_allocated(subsystem, sizeof(*this) + sizeof(uint64_t)*logical_page_size/64);
   memset((void *)bit_vector, 0, sizeof(uint64_t)*logical_page_size/64);
 }
 
 // Copy an existing page-table entry.
 BitPageTableEntry::BitPageTableEntry(const BitPageTableEntry& other) : BasePageTableEntry(other)
 {
+  if (other.bit_vector == nullptr) {
+    bit_vector = nullptr;
+    bf_mem_allocated(subsystem, sizeof(*this));
+    return;
+  }
   bit_vector = new uint64_t[logical_page_size/64];
   memcpy((void *)bit_vector, other.bit_vector, sizeof(uint64_t)*logical_page_size/64);
+  bf_mem_allocated(subsystem, sizeof(*this) + sizeof(uint64_t)*logical_page_size/64);
 }
 
 // Destruct a bit-sized page-table entry.
 BitPageTableEntry::~BitPageTableEntry()
 {
+  if (bit_vector != nullptr)
+    bf_mem_freed(subsystem, sizeof(uint64_t)*logical_page_size/64);
+  bf_mem_freed(subsystem, sizeof(*this));
   delete[] bit_vector;
 }
 
+// Return the number of bytes of memory a bit-sized page-table entry consumes.
+size_t BitPageTableEntry::footprint() const
+{
+  size_t bytes = sizeof(*this);
+  if (bit_vector != nullptr)
+    bytes += sizeof(uint64_t)*logical_page_size/64;
+  return bytes;
+}
+
 // Increment the tallies associated with a range of bytes, clamping each at 1.
 void BitPageTableEntry::increment(size_t pos1, size_t pos2)
 {
@@ -71,6 +91,7 @@ void BitPageTableEntry::increment(size_t pos1, size_t pos2)
   // If we filled the page, deallocate the memory used by the bit
   // vector, as we won't be setting any more bits.
   if (bytes_touched == logical_page_size) {
+    bf_mem_freed(subsystem, sizeof(uint64_t)*logical_page_size/64);
     delete[] bit_vector;
     bit_vector = NULL;
   }
@@ -118,10 +139,12 @@ void BitPageTableEntry::merge(BitPageTableEntry* other)
 }
 
 // Construct a page-table entry for word-sized counters.
-WordPageTableEntry::WordPageTableEntry(size_t pg_size) : BasePageTableEntry(pg_size)
+WordPageTableEntry::WordPageTableEntry(size_t pg_size, bf_mem_subsystem_t owner) :
+  BasePageTableEntry(pg_size, owner)
 {
   bytes_touched = 0;
   byte_counter = new bytecount_t[logical_page_size];
+  bf_mem_allocated(subsystem, sizeof(*this) + sizeof(bytecount_t)*logical_page_size);
   memset((void *)byte_counter, 0, sizeof(bytecount_t)*logical_page_size);
 }
 
@@ -130,14 +153,22 @@ WordPageTableEntry::WordPageTableEntry(const WordPageTableEntry& other) : BasePa
 {
   byte_counter = new bytecount_t[logical_page_size];
   memcpy((void *)byte_counter, other.byte_counter, sizeof(bytecount_t)*logical_page_size);
+  bf_mem_allocated(subsystem, sizeof(*this) + sizeof(bytecount_t)*logical_page_size);
 }
 
 // Destruct a word-sized page-table entry.
 WordPageTableEntry::~WordPageTableEntry()
 {
+  bf_mem_freed(subsystem, sizeof(*this) + sizeof(bytecount_t)*logical_page_size);
   delete[] byte_counter;
 }
 
+// Return the number of bytes of memory a word-sized page-table entry consumes.
+size_t WordPageTableEntry::footprint() const
+{
+  return sizeof(*this) + sizeof(bytecount_t)*logical_page_size;
+}
+
 // Increment the tallies associated with a range of bytes, clamping each at the
 // maximum word value.
 void WordPageTableEntry::increment(size_t pos1, size_t pos2)
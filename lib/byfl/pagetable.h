@@ -20,10 +20,12 @@ class BasePageTableEntry {
 protected:
   size_t logical_page_size;    // Logical page size in bytes represented
   size_t bytes_touched;        // Number of bytes accessed at least once
+  bf_mem_subsystem_t subsystem;  // Subsystem to which to charge our memory
 
 public:
-  // Store the logical page size.
-  BasePageTableEntry(size_t pg_size) : logical_page_size(pg_size) { }
+  // Store the logical page size and the subsystem that owns us.
+  BasePageTableEntry(size_t pg_size, bf_mem_subsystem_t owner) :
+    logical_page_size(pg_size), subsystem(owner) { }
 
   // Return the number of bytes that were accessed.
   size_t count() const {
@@ -34,6 +36,12 @@ public:
   // the maximum allowed value.
   virtual void increment(size_t pos1, size_t pos2) = 0;
 
+  // Say whether a given byte was accessed.
+  virtual bool touched(size_t pos) const = 0;
+
+  // Return the number of bytes of memory we consume.
+  virtual size_t footprint() const = 0;
+
   // Ensure that we declare a virtual destructor.
   virtual ~BasePageTableEntry() { }
 };
@@ -50,8 +58,16 @@ public:
   // Merge the counts from another BitPageTableEntry into ours.
   void merge(BitPageTableEntry* other);
 
+  // Say whether a given byte was accessed.
+  bool touched(size_t pos) const override {
+    return bit_vector == nullptr || ((bit_vector[pos/64] >> (pos%64)) & 1) != 0;
+  }
+
+  // Return the number of bytes of memory we consume.
+  size_t footprint() const override;
+
   // Define a constructor, copy constructor, and destructor.
-  BitPageTableEntry(size_t pg_size);
+  BitPageTableEntry(size_t pg_size, bf_mem_subsystem_t owner);
   BitPageTableEntry(const BitPageTableEntry& other);
   ~BitPageTableEntry();
 };
@@ -72,15 +88,21 @@ public:
   // Expose the raw counts.
   bytecount_t* raw_counts() { return byte_counter; }
 
+  // Say whether a given byte was accessed.
+  bool touched(size_t pos) const override { return byte_counter[pos] != 0; }
+
+  // Return the number of bytes of memory we consume.
+  size_t footprint() const override;
+
   // Define a constructor, copy constructor, and destructor.
-  WordPageTableEntry(size_t pg_size);
+  WordPageTableEntry(size_t pg_size, bf_mem_subsystem_t owner);
   WordPageTableEntry(const WordPageTableEntry& other);
   ~WordPageTableEntry();
 };
 
 // Define a page table that associates a counter with each byte of program
-// memory.
-template<typename PTE>
+// memory.  All memory the page table consumes is charged to subsystem S.
+template<typename PTE, bf_mem_subsystem_t S = BF_MEM_PAGE_TABLES>
 class PageTable {
 private:
   // Define an equality functors for use in constructing various hash tables.
@@ -89,19 +111,23 @@ private:
   };
 
   // Define a mapping from a page number to the associated PageTableEntry.
-  typedef CachedUnorderedMap<uintptr_t, PTE*, hash<uintptr_t>, eqaddr> page_to_PTE_t;
+  typedef CachedUnorderedMap<uintptr_t, PTE*, hash<uintptr_t>, eqaddr,
+                             CountingAllocator<pair<const uintptr_t, PTE*>, S> > page_to_PTE_t;
   page_to_PTE_t mapping;
 
   // Logical page size in bytes represented
   size_t logical_page_size;
 
+  // Approximate replacement for mapping when memory is tight
+  UniqueSketch<S>* sketch = nullptr;
+
   // Given a mapping of page numbers to counter vectors and a page number,
   // return a counter vector, creating it if not found.
   PTE* find_or_create_page (page_to_PTE_t& mapping, uint64_t pagenum) {
     auto counters_iter = mapping.find(pagenum);
     if (counters_iter == mapping.end()) {
       // This is the first byte we've touched on the page.
-      mapping[pagenum] = new PTE(logical_page_size);
+      mapping[pagenum] = new PTE(logical_page_size, S);
       return mapping[pagenum];
     }
     else
@@ -113,12 +139,24 @@ public:
   // Store the logical page size.
   PageTable(size_t pg_size) : logical_page_size(pg_size) { }
 
+  // Free all of our page-table entries.
+  ~PageTable() {
+    for (auto page_iter = mapping.begin(); page_iter != mapping.end(); page_iter++)
+      delete page_iter->second;
+    delete sketch;
+  }
+
   // Expose iterators to our underlying address-to-PTE mapping.
   typename page_to_PTE_t::iterator begin() { return mapping.begin(); }
   typename page_to_PTE_t::iterator end() { return mapping.end(); }
 
   // Increment each counter in a given range.
   void access (uint64_t baseaddr, uint64_t numaddrs) {
+    if (__builtin_expect(sketch != nullptr, 0)) {
+      // We've given up on exact counts.
+      sketch->access(baseaddr, numaddrs);
+      return;
+    }
     uint64_t first_page = baseaddr / logical_page_size;
     uint64_t last_page = (baseaddr + numaddrs - 1) / logical_page_size;
     if (first_page == last_page) {
@@ -139,7 +177,7 @@ public:
   }
 
   // Merge another page table into ours.
-  void merge (PageTable<PTE>* other) {
+  void merge (PageTable<PTE, S>* other) {
     // Ensure we have a superset of the other page table's pages.
     for (auto page_iter = other->mapping.begin();
          page_iter != other->mapping.end();
@@ -147,7 +185,7 @@ public:
       uint64_t page_num = page_iter->first;
       if (mapping.find(page_num) != mapping.end())
         continue;
-      mapping[page_num] = new PTE(logical_page_size);
+      mapping[page_num] = new PTE(logical_page_size, S);
     }
 
     // Merge page-by-page.
@@ -163,8 +201,42 @@ public:
     }
   }
 
+  // Return the number of bytes of memory our page-table entries consume.
+  size_t footprint (void) const {
+    if (sketch != nullptr)
+      return UniqueSketch<S>::footprint();
+    size_t bytes = 0;
+    for (auto page_iter = mapping.begin(); page_iter != mapping.end(); page_iter++)
+      bytes += page_iter->second->footprint();
+    return bytes;
+  }
+
+  // Say whether we've replaced our exact counts with an approximation.
+  bool is_approximate (void) const {
+    return sketch != nullptr;
+  }
+
+  // Replace our per-byte counters with a fixed-size sketch that can estimate
+  // (only) the number of unique addresses accessed.
+  void convert_to_sketch (void) {
+    if (sketch != nullptr)
+      return;
+    sketch = new UniqueSketch<S>();
+    for (auto page_iter = mapping.begin(); page_iter != mapping.end(); page_iter++) {
+      uint64_t pagebase = page_iter->first*logical_page_size;
+      PTE* counters = page_iter->second;
+      for (size_t pos = 0; pos < logical_page_size; pos++)
+        if (counters->touched(pos))
+          sketch->access(pagebase + pos);
+      delete counters;
+    }
+    mapping.clear();
+  }
+
   // Return the number of unique addresses accessed.
   uint64_t tally_unique (void) {
+    if (sketch != nullptr)
+      return sketch->estimate();
     uint64_t unique_addrs = 0;
     for (auto page_iter = mapping.begin();
          page_iter != mapping.end();
@@ -176,9 +248,12 @@ public:
   }
 };
 
-// For convenience, define concrete BitPageTable and WordPageTable classes.
+// For convenience, define concrete BitPageTable and WordPageTable classes
+// plus per-function variants of each.
 typedef PageTable<BitPageTableEntry> BitPageTable;
 typedef PageTable<WordPageTableEntry> WordPageTable;
+typedef PageTable<BitPageTableEntry, BF_MEM_FUNC_PAGE_TABLES> FuncBitPageTable;
+typedef PageTable<WordPageTableEntry, BF_MEM_FUNC_PAGE_TABLES> FuncWordPageTable;
 
 } // namespace bytesflops
 
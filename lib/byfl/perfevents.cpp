@@ -0,0 +1,349 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (measuring per-function hardware and software events)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+#ifdef HAVE_LINUX_PERF_EVENT_H
+# include <linux/perf_event.h>
+# include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+namespace bytesflops {
+
+bool bf_perf_active = false;            // true=measure events at function boundaries
+const char* bf_perf_warning = nullptr;  // Reason we can't measure the requested events
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+
+static char perf_warning_buffer[100];   // Storage for bf_perf_warning
+
+// Describe each event we know how to measure.  Hardware events are measured
+// as one group and software events as another so that an unschedulable
+// hardware counter doesn't prevent software events from counting.
+static const struct {
+  const char* name;         // Name used in BF_PERF_EVENTS
+  const char* description;  // Column name used in the "Functions" table
+  uint32_t type;            // perf_event type
+  uint64_t config;          // perf_event configuration
+} event_info[] = {
+  {"cycles",           "Measured cycles",                  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"instructions",     "Measured instructions",            PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"llc-misses",       "Measured LLC misses",              PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {"task-clock",       "Measured task-clock nanoseconds",  PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+  {"page-faults",      "Measured page faults",             PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+  {"context-switches", "Measured context switches",        PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES}
+};
+static const size_t num_known_events = sizeof(event_info)/sizeof(event_info[0]);
+
+// Keep track of which events were requested and which of those we were able
+// to open in the first thread.  Other threads open the same set.
+static vector<size_t>* events = nullptr;   // Indexes into event_info[] in column order
+
+// Maintain each thread's open events and most recent readings.
+class ThreadEvents {
+public:
+  int group_fd[2];                       // Hardware and software group leaders (-1=none)
+  size_t slot[num_known_events];         // Position of each event's value within its group's read() buffer
+  int group_of[num_known_events];        // Group (0 or 1) to which each event belongs (-1=not open)
+  uint64_t previous[num_known_events];   // Previous reading of each event
+  uint64_t epoch;                        // Value of perf_epoch at the previous reading
+
+  ThreadEvents() {
+    epoch = 0;
+    group_fd[0] = group_fd[1] = -1;
+    for (size_t i = 0; i < num_known_events; i++) {
+      slot[i] = 0;
+      group_of[i] = -1;
+      previous[i] = 0;
+    }
+  }
+
+  // Close all of our events.
+  ~ThreadEvents() {
+    for (int g = 0; g < 2; g++)
+      if (group_fd[g] != -1)
+        close(group_fd[g]);
+  }
+};
+static thread_local ThreadEvents* thread_events = nullptr;
+static pthread_key_t thread_events_key;   // Used to close a thread's events when it exits
+
+// Map a function (or call-stack) key to its measured event tallies.
+typedef CachedUnorderedMap<KeyType_t, uint64_t*> key2events_t;
+static key2events_t* func_events = nullptr;
+static uint64_t* program_events = nullptr;
+
+// Serialize all threads' updates to func_events and program_events.
+static pthread_mutex_t perf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Count the number of times counting has been re-enabled.  A thread whose
+// previous reading predates the latest re-enabling discards the events
+// measured in between, as they occurred while counting was suppressed.
+static volatile uint64_t perf_epoch = 0;
+
+// Open a single event for the calling thread as part of a group.  Return the
+// file descriptor or -1 on failure.
+static int open_event (size_t which, int group_fd)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = event_info[which].type;
+  attr.config = event_info[which].config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_kernel = 1;   // Needed when perf_event_paranoid is 2
+  attr.exclude_hv = 1;
+  return int(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC));
+}
+
+// Open all requested events for the calling thread.
+static ThreadEvents* open_thread_events (void)
+{
+  ThreadEvents* te = new ThreadEvents;
+  size_t nevents = events->size();
+  size_t group_size[2] = {0, 0};
+  for (size_t i = 0; i < nevents; i++) {
+    size_t which = (*events)[i];
+    int g = event_info[which].type == PERF_TYPE_HARDWARE ? 0 : 1;
+    int fd = open_event(which, te->group_fd[g]);
+    if (fd == -1)
+      continue;
+    if (te->group_fd[g] == -1)
+      te->group_fd[g] = fd;
+    te->group_of[i] = g;
+    te->slot[i] = group_size[g]++;
+  }
+  return te;
+}
+
+// Read the current value of every event into an array.
+static void read_thread_events (ThreadEvents* te, uint64_t* values)
+{
+  uint64_t buffer[2][num_known_events + 1];   // {nr, values[nr]} per group
+  bool valid[2] = {false, false};
+  for (int g = 0; g < 2; g++)
+    if (te->group_fd[g] != -1)
+      valid[g] = read(te->group_fd[g], buffer[g], sizeof(buffer[g])) > 0;
+  for (size_t i = 0; i < events->size(); i++) {
+    int g = te->group_of[i];
+    values[i] = g != -1 && valid[g] ? buffer[g][te->slot[i] + 1] : te->previous[i];
+  }
+}
+
+// Close a thread's events when the thread exits.
+static void delete_thread_events (void* te)
+{
+  delete (ThreadEvents*) te;
+}
+
+// Open the calling thread's events and take an initial reading.
+static void start_thread_events (void)
+{
+  ThreadEvents* te = open_thread_events();
+  read_thread_events(te, te->previous);
+  te->epoch = perf_epoch;
+  thread_events = te;
+  pthread_setspecific(thread_events_key, te);
+}
+
+// Parse BF_PERF_EVENTS, which is either a comma-separated list of event names
+// or "all", and open the requested events for the calling thread.
+void initialize_perf_events (void)
+{
+  const char* env_str = getenv("BF_PERF_EVENTS");
+  if (env_str == nullptr || env_str[0] == '\0' || strcmp(env_str, "0") == 0)
+    return;
+  vector<size_t> requested;
+  if (strcmp(env_str, "all") == 0 || strcmp(env_str, "1") == 0)
+    for (size_t i = 0; i < num_known_events; i++)
+      requested.push_back(i);
+  else {
+    string names(env_str);
+    size_t start = 0;
+    while (start <= names.size()) {
+      size_t end = names.find(',', start);
+      if (end == string::npos)
+        end = names.size();
+      string name(names.substr(start, end - start));
+      size_t i;
+      for (i = 0; i < num_known_events; i++)
+        if (name == event_info[i].name)
+          break;
+      if (i == num_known_events) {
+        cerr << "Failed to parse BF_PERF_EVENTS (unknown event \"" << name << "\")\n";
+        bf_abend();
+      }
+      requested.push_back(i);
+      start = end + 1;
+    }
+  }
+
+  // Without a call stack, we don't know when functions return.
+  if (!bf_call_stack) {
+    bf_perf_warning = "BF_PERF_EVENTS has no effect without -bf-call-stack";
+    return;
+  }
+
+  // Retain only those events we can actually open.  Fall back to software
+  // events if there's no usable hardware performance-monitoring unit.
+  events = new vector<size_t>(requested);
+  ThreadEvents* te = open_thread_events();
+  vector<size_t>* usable = new vector<size_t>;
+  for (size_t i = 0; i < events->size(); i++)
+    if (te->group_of[i] != -1)
+      usable->push_back((*events)[i]);
+  delete te;
+  delete events;
+  events = usable;
+  if (usable->size() < requested.size()) {
+    if (usable->empty()) {
+      bf_perf_warning = "None of the events listed in BF_PERF_EVENTS could be measured";
+      return;
+    }
+    snprintf(perf_warning_buffer, sizeof(perf_warning_buffer),
+             "Only %zu of the %zu events listed in BF_PERF_EVENTS could be measured",
+             usable->size(), requested.size());
+    bf_perf_warning = perf_warning_buffer;
+  }
+
+  // Start measuring.
+  if (pthread_key_create(&thread_events_key, delete_thread_events) != 0) {
+    cerr << "Failed to create a thread-specific data key\n";
+    bf_abend();
+  }
+  func_events = new key2events_t;
+  program_events = new uint64_t[events->size()]();
+  start_thread_events();
+  bf_perf_active = true;
+}
+
+// Attribute all events measured since the calling thread's previous sample to
+// a given function.  The caller must not invoke this while counting is
+// suppressed.
+void bf_perf_sample (KeyType_t key)
+{
+  // Open the events the first time each thread calls us.
+  ThreadEvents* te = thread_events;
+  if (__builtin_expect(te == nullptr, 0)) {
+    start_thread_events();
+    return;
+  }
+
+  // Read all events.
+  size_t nevents = events->size();
+  uint64_t values[num_known_events];
+  read_thread_events(te, values);
+  uint64_t epoch = perf_epoch;
+  if (te->epoch == epoch) {
+    // Charge the deltas to the given function.
+    pthread_mutex_lock(&perf_lock);
+    uint64_t*& tallies = (*func_events)[key];
+    if (tallies == nullptr)
+      tallies = new uint64_t[nevents]();
+    for (size_t i = 0; i < nevents; i++) {
+      uint64_t delta = values[i] - te->previous[i];
+      tallies[i] += delta;
+      program_events[i] += delta;
+    }
+    pthread_mutex_unlock(&perf_lock);
+  }
+  memcpy(te->previous, values, nevents*sizeof(uint64_t));
+  te->epoch = epoch;
+}
+
+// Note that counting was re-enabled so that no thread charges the events it
+// measured while counting was suppressed.
+void bf_perf_resume (void)
+{
+  __atomic_add_fetch(&perf_epoch, 1, __ATOMIC_RELAXED);
+}
+
+// Return the number of events being measured.
+size_t bf_perf_num_events (void)
+{
+  return bf_perf_active ? events->size() : 0;
+}
+
+// Return the column name for a given event.
+const char* bf_perf_event_name (size_t idx)
+{
+  return event_info[(*events)[idx]].description;
+}
+
+// Return a function's measured event tallies or nullptr if none were
+// measured.
+const uint64_t* bf_perf_function_events (KeyType_t key)
+{
+  auto iter = func_events->find(key);
+  return iter == func_events->end() ? nullptr : iter->second;
+}
+
+// Return the program's measured event tallies.
+const uint64_t* bf_perf_program_events (void)
+{
+  return program_events;
+}
+
+// Reset all measured event tallies to zero.
+void bf_perf_reset (void)
+{
+  if (!bf_perf_active)
+    return;
+  size_t nevents = events->size();
+  pthread_mutex_lock(&perf_lock);
+  for (auto iter = func_events->begin(); iter != func_events->end(); iter++)
+    memset(iter->second, 0, nevents*sizeof(uint64_t));
+  memset(program_events, 0, nevents*sizeof(uint64_t));
+  pthread_mutex_unlock(&perf_lock);
+}
+
+#else
+
+// Without perf_event support, we can't measure anything.
+void initialize_perf_events (void)
+{
+  const char* env_str = getenv("BF_PERF_EVENTS");
+  if (env_str != nullptr && env_str[0] != '\0' && strcmp(env_str, "0") != 0)
+    bf_perf_warning = "BF_PERF_EVENTS is not supported on this system";
+}
+
+void bf_perf_sample (KeyType_t key)
+{
+}
+
+void bf_perf_resume (void)
+{
+}
+
+size_t bf_perf_num_events (void)
+{
+  return 0;
+}
+
+const char* bf_perf_event_name (size_t idx)
+{
+  return "";
+}
+
+const uint64_t* bf_perf_function_events (KeyType_t key)
+{
+  return nullptr;
+}
+
+const uint64_t* bf_perf_program_events (void)
+{
+  return nullptr;
+}
+
+void bf_perf_reset (void)
+{
+}
+
+#endif
+
+} // namespace bytesflops
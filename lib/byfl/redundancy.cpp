@@ -0,0 +1,199 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (detecting redundant loads and silent stores)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+extern BinaryOStream* bfbin;
+
+// Report at most this many sites.
+static const size_t max_sites_reported = 100;
+
+// Describe everything we know about a single load or store site.  A load is
+// redundant if it reads the same value from the same address as the previous
+// load from the same site.  A store is silent if it writes the value that is
+// already in memory.
+class RedundancySite {
+public:
+  bf_symbol_info_t syminfo;      // Load or store source information
+  bool is_store;                 // true=store; false=load
+  uint64_t accesses = 0;         // Number of loads or stores performed
+  uint64_t bytes = 0;            // Number of bytes loaded or stored
+  uint64_t redundant = 0;        // Number of redundant loads or silent stores
+  uint64_t wasted_bytes = 0;     // Number of bytes loaded or stored redundantly
+  uint64_t last_address = 0;     // Address of the previous load
+  uint64_t last_hash = 0;        // Hash of the value read by the previous load
+
+  RedundancySite(const bf_symbol_info_t& sinfo, bool store) :
+    syminfo(sinfo), is_store(store) { }
+
+  // Incorporate another thread's tallies for the same site.
+  void merge (const RedundancySite& other) {
+    accesses += other.accesses;
+    bytes += other.bytes;
+    redundant += other.redundant;
+    wasted_bytes += other.wasted_bytes;
+  }
+};
+typedef unordered_map<uint64_t, RedundancySite*> site_map_t;
+
+// Maintain per-thread site maps so the common case requires no locking.  The
+// notion of "the previous load from a site" is inherently per-thread.
+static __thread site_map_t* thread_sites = nullptr;
+static vector<site_map_t*>* all_sites = nullptr;
+
+// Serialize all accesses to all_sites.
+static pthread_mutex_t redundancy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Initialize some of our variables at first use.
+void initialize_redundancy (void)
+{
+  all_sites = new vector<site_map_t*>();
+}
+
+// Hash a loaded value (64-bit FNV-1a).
+static inline uint64_t hash_value (const uint8_t* value, uint64_t numbytes)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (uint64_t i = 0; i < numbytes; i++) {
+    hash ^= value[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Tally a load, which has just completed, or a store, which is about to be
+// performed.  value points to a copy of the value loaded or to be stored.
+extern "C"
+void bf_track_redundancy (const bf_symbol_info_t* syminfo, uint64_t address,
+                          const uint8_t* value, uint64_t numbytes,
+                          uint8_t load0store1)
+{
+  // Do nothing if counting is suppressed.
+  if (bf_suppress_counting)
+    return;
+
+  // Create the calling thread's site map on first use.
+  site_map_t* sites = thread_sites;
+  if (__builtin_expect(sites == nullptr, 0)) {
+    sites = new site_map_t();
+    pthread_mutex_lock(&redundancy_lock);
+    all_sites->push_back(sites);
+    pthread_mutex_unlock(&redundancy_lock);
+    thread_sites = sites;
+  }
+
+  // Find or create the site.
+  RedundancySite*& site = (*sites)[syminfo->ID];
+  bool first_time = site == nullptr;
+  if (first_time)
+    site = new RedundancySite(*syminfo, load0store1 != 0);
+  site->accesses++;
+  site->bytes += numbytes;
+
+  // Determine whether the access was wasted.
+  bool wasted;
+  if (load0store1) {
+    // Store -- compare the new value against the one in memory.
+    wasted = memcmp((const void*)address, value, numbytes) == 0;
+  }
+  else {
+    // Load -- compare the address and value against the previous load's.
+    uint64_t hash = hash_value(value, numbytes);
+    wasted = !first_time && address == site->last_address && hash == site->last_hash;
+    site->last_address = address;
+    site->last_hash = hash;
+  }
+  if (wasted) {
+    site->redundant++;
+    site->wasted_bytes += numbytes;
+  }
+}
+
+// Sort sites by decreasing wasted bytes then by ID.
+static bool compare_sites (const RedundancySite* a, const RedundancySite* b)
+{
+  if (a->wasted_bytes != b->wasted_bytes)
+    return a->wasted_bytes > b->wasted_bytes;
+  return a->syminfo.ID < b->syminfo.ID;
+}
+
+// Report the sites that wasted the most bytes on redundant loads or silent
+// stores.  Return program-wide totals.
+void bf_report_redundancy (uint64_t* loads, uint64_t* redundant_loads,
+                           uint64_t* stores, uint64_t* silent_stores,
+                           uint64_t* wasted_bytes)
+{
+  // Merge all threads' tallies by site.
+  site_map_t merged;
+  pthread_mutex_lock(&redundancy_lock);
+  for (auto titer = all_sites->cbegin(); titer != all_sites->cend(); titer++)
+    for (auto iter = (*titer)->cbegin(); iter != (*titer)->cend(); iter++) {
+      RedundancySite*& site = merged[iter->first];
+      if (site == nullptr)
+        site = new RedundancySite(iter->second->syminfo, iter->second->is_store);
+      site->merge(*iter->second);
+    }
+  pthread_mutex_unlock(&redundancy_lock);
+
+  // Compute program-wide totals.
+  vector<RedundancySite*> sorted_sites;
+  *loads = *redundant_loads = *stores = *silent_stores = *wasted_bytes = 0;
+  for (auto iter = merged.cbegin(); iter != merged.cend(); iter++) {
+    RedundancySite* site = iter->second;
+    if (site->is_store) {
+      *stores += site->accesses;
+      *silent_stores += site->redundant;
+    }
+    else {
+      *loads += site->accesses;
+      *redundant_loads += site->redundant;
+    }
+    *wasted_bytes += site->wasted_bytes;
+    if (site->redundant > 0)
+      sorted_sites.push_back(site);
+  }
+
+  // Output the most wasteful sites.
+  sort(sorted_sites.begin(), sorted_sites.end(), compare_sites);
+  if (sorted_sites.size() > max_sites_reported)
+    sorted_sites.resize(max_sites_reported);
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Redundant loads and silent stores";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Site ID"
+         << uint8_t(BINOUT_COL_STRING) << "Operation"
+         << uint8_t(BINOUT_COL_STRING) << "Mangled function name"
+         << uint8_t(BINOUT_COL_STRING) << "Demangled function name"
+         << uint8_t(BINOUT_COL_STRING) << "File name"
+         << uint8_t(BINOUT_COL_UINT64) << "Line number"
+         << uint8_t(BINOUT_COL_UINT64) << "Accesses"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes"
+         << uint8_t(BINOUT_COL_UINT64) << "Redundant accesses"
+         << uint8_t(BINOUT_COL_UINT64) << "Wasted bytes"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = sorted_sites.cbegin(); iter != sorted_sites.cend(); iter++) {
+    const RedundancySite* site = *iter;
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << site->syminfo.ID
+           << (site->is_store ? "Store" : "Load")
+           << site->syminfo.function
+           << demangle_func_name(site->syminfo.function)
+           << (strcmp(site->syminfo.file, "??") == 0 ? "" : site->syminfo.file)
+           << uint64_t(site->syminfo.line)
+           << site->accesses
+           << site->bytes
+           << site->redundant
+           << site->wasted_bytes;
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+  for (auto iter = merged.begin(); iter != merged.end(); iter++)
+    delete iter->second;
+}
+
+} // namespace bytesflops
@@ -7,61 +7,12 @@
  */
 
 #include "byfl.h"
+#include "reuse-dist.h"
 
 using namespace std;
 
 namespace bytesflops {
 
-typedef CachedUnorderedMap<uint64_t, uint64_t> addr_to_time_t;
-addr_to_time_t last_access;   // Last access time of a given address
-
-// An RDnode is one node in a reuse-distance tree.
-class RDnode {
-private:
-  RDnode* left;         // Left child
-  RDnode* right;        // Right child
-
-  // Fix the node's weight (subtree size).
-  void fix_node_weight();
-
-  // Fix the weight of all nodes along the path to a given time.
-  void fix_path_weights(uint64_t time);
-
-  // Splay a value to the top of the tree, returning the new tree.
-  RDnode* splay(uint64_t target);
-
-public:
-  uint64_t address;     // Address from trace
-  uint64_t time;        // Time of the address's last access
-  uint64_t weight;      // Number of items in this subtree (self included)
-
-  // Initialize a new RDnode with a given address and timestamp (defaulting to
-  // dummy values).
-  RDnode();
-  RDnode(uint64_t address, uint64_t time);
-
-  // Reinitialize an existing RDnode with a given address and timestamp.
-  void initialize(uint64_t address, uint64_t time);
-
-  // Insert a node into the tree and return the new tree.
-  RDnode* insert(RDnode* new_node);
-
-  // Remove a timestamp from the tree and return the new tree and the node that
-  // was deleted.
-  RDnode* remove(uint64_t timestamp, RDnode** removed_node);
-
-  // Remove all timestamps less than a given value from the tree and from a
-  // given histogram, and return the new tree.
-  RDnode* prune_tree(uint64_t timestamp, addr_to_time_t* histogram);
-
-  // Return the number of nodes in a splay tree whose timestamp is larger than
-  // a given value.
-  uint64_t tree_dist(uint64_t timestamp);
-
-  // Ensure that all nodes have a valid weight.
-  void validate_weights();
-};
-
 // fix_node_weight() sets the weight of a given node to the sum of its
 // immediate children's weight plus one.
 void RDnode::fix_node_weight()
@@ -258,7 +209,7 @@ RDnode* RDnode::prune_tree(uint64_t timestamp, addr_to_time_t* histogram)
   while (new_tree && new_tree->time < timestamp) {
     RDnode* dead_node = new_tree;
     new_tree = new_tree->right;
-    if (new_tree->left)
+    if (new_tree && new_tree->left)
       new_tree = new_tree->splay(0);
     histogram->erase(dead_node->address);
     delete dead_node;
@@ -338,41 +289,6 @@ RDnode::RDnode(uint64_t address, uint64_t time)
 }
 
 
-// Define infinite distance.
-const uint64_t infinite_distance = ~(uint64_t)0;
-
-
-// A ReuseDistance encapsulates all the state needed for a
-// reuse-distance calculation.
-class ReuseDistance {
-private:
-  uint64_t clock;           // Current time
-  vector<uint64_t> hist;    // Histogram of the number of times each reuse distance was observed
-  uint64_t unique_entries;  // Number of unique addresses (infinite reuse distance)
-  RDnode* dist_tree;        // Tree of reuse distances
-
-public:
-  // Initialize our various fields.
-  ReuseDistance() {
-    clock = 0;
-    unique_entries = 0;
-    dist_tree = nullptr;
-  }
-
-  // Incorporate a new address into the reuse-distance histogram.
-  void process_address(uint64_t address);
-
-  // Return a pointer to the reuse-distance histogram.
-  vector<uint64_t>* get_histogram() { return &hist; }
-
-  // Return the number of unique addresses.
-  uint64_t get_unique_addrs() { return unique_entries; }
-
-  // Compute the median reuse distance.
-  void compute_median(uint64_t* median_value, uint64_t* mad_value);
-};
-
-
 // Incorporate a new address into the reuse-distance histogram.
 void ReuseDistance::process_address(uint64_t address)
 {
@@ -415,10 +331,20 @@ void ReuseDistance::process_address(uint64_t address)
   last_access[address] = clock;
   clock++;
 
+  // If we've exceeded our share of the BF_MAX_MEMORY budget, halve the
+  // number of addresses we track.
+  if (bf_mem_over_budget(BF_MEM_REUSE_DIST) && last_access.size() > 1) {
+    max_distance = last_access.size()/2;
+    dist_tree = dist_tree->prune_tree(clock - max_distance, &last_access);
+    bf_mem_degraded(BF_MEM_REUSE_DIST,
+                    "Reuse distances greater than " + to_string(max_distance) +
+                    " are treated as infinite");
+  }
+
   // If the tree and the map have grown too large, prune old addresses from
   // them.
-  if (last_access.size() > bf_max_reuse_distance)
-    dist_tree = dist_tree->prune_tree(clock - bf_max_reuse_distance, &last_access);
+  if (last_access.size() > max_distance)
+    dist_tree = dist_tree->prune_tree(clock - max_distance, &last_access);
 }
 
 
@@ -0,0 +1,284 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (detecting true and false sharing of cache lines)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+extern BinaryOStream* bfbin;
+
+// Describe the coherence state of a single cache line.  We model a write-
+// invalidate protocol: a write gives the writing thread the only valid copy,
+// and a read gives the reading thread a shared copy.  Each miss caused by
+// another thread's write is classified as true sharing if the missing access
+// overlaps the bytes the other threads accessed and false sharing otherwise.
+// Byte ranges are recorded as masks of 64 equal-sized chunks of the line.
+// Thread masks record thread numbers modulo 64.  We remember what each of the
+// first few non-owners read since the last write and merge the rest.
+static const int max_line_readers = 4;
+class LineSharing {
+public:
+  uint64_t sharers = 0;          // Mask of threads holding a valid copy
+  uint64_t readers = 0;          // Mask of threads that ever read the line
+  uint64_t writers = 0;          // Mask of threads that ever wrote the line
+  uint64_t written = 0;          // Chunks the owner wrote since acquiring the line
+  uint32_t reader_thread[max_line_readers];  // Non-owners that read since the last write
+  uint64_t reader_chunks[max_line_readers];  // Chunks each of those threads read
+  uint64_t other_chunks = 0;     // Chunks read by non-owners we couldn't fit above
+  int num_readers = 0;           // Number of valid entries in reader_thread[]
+  uint64_t true_sharing = 0;     // Coherence misses on data another thread accessed
+  uint64_t false_sharing = 0;    // Coherence misses on data no other thread accessed
+  const bf_symbol_info_t* last_write = nullptr;   // Site of the most recent write
+  const bf_symbol_info_t* false_site = nullptr;   // Site of the most recent false-sharing miss
+  const bf_symbol_info_t* false_cause = nullptr;  // Write preceding that miss
+  const void* dstruct = nullptr;  // Data structure containing the line
+  uint32_t owner = ~uint32_t(0);  // Thread that most recently wrote the line
+};
+typedef unordered_map<uint64_t, LineSharing, hash<uint64_t>, equal_to<uint64_t>,
+                      CountingAllocator<pair<const uint64_t, LineSharing>, BF_MEM_SHARING> > line_map_t;
+static line_map_t* lines = nullptr;
+
+// Retain a copy of each load or store site we've seen.  The instrumented code
+// passes us a pointer to a stack-allocated bf_symbol_info_t, which we can't
+// hold onto.
+typedef unordered_map<uint64_t, bf_symbol_info_t, hash<uint64_t>, equal_to<uint64_t>,
+                      CountingAllocator<pair<const uint64_t, bf_symbol_info_t>, BF_MEM_SHARING> > site_map_t;
+static site_map_t* sites = nullptr;
+
+// Serialize all accesses to the line map and the site map.
+static pthread_mutex_t line_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Define the cache-line size and chunk size as powers of two.
+static uint64_t line_bits = 6;
+static uint64_t chunk_bits = 0;
+
+// Report at most this many lines.
+static const size_t max_lines_reported = 100;
+
+// Initialize some of our variables at first use.
+void initialize_sharing (void)
+{
+  if (!bf_false_sharing)
+    return;
+  if (bf_line_size == 0 || (bf_line_size & (bf_line_size - 1)) != 0) {
+    cerr << "Failed to detect false sharing (line size " << bf_line_size
+         << " is not a power of two)\n";
+    bf_abend();
+  }
+  line_bits = 63 - __builtin_clzll(bf_line_size);
+  chunk_bits = line_bits > 6 ? line_bits - 6 : 0;
+  lines = new line_map_t();
+  sites = new site_map_t();
+}
+
+// Return a long-lived copy of a site's symbol information.  The caller must
+// hold line_lock.
+static const bf_symbol_info_t* retain_site (const bf_symbol_info_t* syminfo)
+{
+  auto iter = sites->find(syminfo->ID);
+  if (iter == sites->end())
+    iter = sites->emplace(syminfo->ID, *syminfo).first;
+  return &iter->second;
+}
+
+// Discard the state of every line that has never incurred a coherence miss.
+// The caller must hold line_lock.
+static void forget_quiet_lines (void)
+{
+  for (auto iter = lines->begin(); iter != lines->end(); )
+    if (iter->second.true_sharing + iter->second.false_sharing == 0)
+      iter = lines->erase(iter);
+    else
+      iter++;
+  bf_mem_degraded(BF_MEM_SHARING,
+                  "The false-sharing detector periodically forgets lines that have not yet been shared");
+}
+
+// Update a line's coherence state to reflect an access by the current thread
+// to a range of chunks.
+static void access_line (LineSharing& line, const bf_symbol_info_t* syminfo,
+                         uint32_t thread, uint64_t chunks, bool is_store)
+{
+  uint64_t thread_bit = uint64_t(1) << (thread%64);
+  if (is_store) {
+    // A write invalidates all other copies.  Other threads' accesses since
+    // the line was last written are the chunks other non-owners read plus,
+    // if we don't already own the line, the chunks the owner wrote.
+    line.writers |= thread_bit;
+    if ((line.sharers & ~thread_bit) != 0) {
+      uint64_t others = line.other_chunks | (line.owner == thread ? 0 : line.written);
+      for (int i = 0; i < line.num_readers; i++)
+        if (line.reader_thread[i] != thread)
+          others |= line.reader_chunks[i];
+      if ((others & chunks) != 0)
+        line.true_sharing++;
+      else {
+        line.false_sharing++;
+        line.false_site = syminfo;
+        line.false_cause = line.last_write;
+      }
+    }
+    if (line.owner != thread) {
+      line.owner = thread;
+      line.written = 0;
+    }
+    line.written |= chunks;
+    line.num_readers = 0;
+    line.other_chunks = 0;
+    line.sharers = thread_bit;
+    line.last_write = syminfo;
+  }
+  else {
+    // A read misses only if another thread wrote the line since we last
+    // held a copy.
+    line.readers |= thread_bit;
+    if ((line.sharers & thread_bit) == 0 && line.owner != ~uint32_t(0) && line.owner != thread) {
+      if ((line.written & chunks) != 0)
+        line.true_sharing++;
+      else {
+        line.false_sharing++;
+        line.false_site = syminfo;
+        line.false_cause = line.last_write;
+      }
+    }
+    line.sharers |= thread_bit;
+    if (line.owner != thread) {
+      int i;
+      for (i = 0; i < line.num_readers; i++)
+        if (line.reader_thread[i] == thread)
+          break;
+      if (i < line.num_readers)
+        line.reader_chunks[i] |= chunks;
+      else if (i < max_line_readers) {
+        line.reader_thread[i] = thread;
+        line.reader_chunks[i] = chunks;
+        line.num_readers++;
+      }
+      else
+        line.other_chunks |= chunks;
+    }
+  }
+}
+
+// Track the sharing of every cache line touched by a load or store.
+extern "C"
+void bf_track_sharing (const bf_symbol_info_t* syminfo, uint64_t baseaddr,
+                       uint64_t numaddrs, uint8_t load0store1)
+{
+  // Do nothing if counting is suppressed.
+  if (bf_suppress_counting || numaddrs == 0)
+    return;
+
+  // Update each line the access touches.
+  uint32_t thread = bf_thread_number();
+  uint64_t lastaddr = baseaddr + numaddrs - 1;
+  pthread_mutex_lock(&line_lock);
+  syminfo = retain_site(syminfo);
+  for (uint64_t linenum = baseaddr >> line_bits; linenum <= lastaddr >> line_bits; linenum++) {
+    // Determine which chunks of the line we're accessing.
+    uint64_t line_base = linenum << line_bits;
+    uint64_t first_chunk = (max(baseaddr, line_base) - line_base) >> chunk_bits;
+    uint64_t last_chunk = (min(lastaddr, line_base + bf_line_size - 1) - line_base) >> chunk_bits;
+    uint64_t chunks = (~uint64_t(0) >> (63 - last_chunk)) & (~uint64_t(0) << first_chunk);
+
+    // Find or create the line.
+    auto iter = lines->find(linenum);
+    if (iter == lines->end()) {
+      iter = lines->emplace(linenum, LineSharing()).first;
+      if (bf_data_structs)
+        iter->second.dstruct = bf_find_data_struct(line_base);
+    }
+    access_line(iter->second, syminfo, thread, chunks, load0store1 != 0);
+  }
+  if (bf_mem_over_budget(BF_MEM_SHARING))
+    forget_quiet_lines();
+  pthread_mutex_unlock(&line_lock);
+}
+
+// Describe a load or store site.
+static string describe_site (const bf_symbol_info_t* syminfo)
+{
+  if (syminfo == nullptr)
+    return "";
+  string desc(demangle_func_name(syminfo->function));
+  if (strcmp(syminfo->file, "??") != 0)
+    desc += " at " + string(syminfo->file) + ':' + to_string(syminfo->line);
+  return desc;
+}
+
+// Sort lines by decreasing false sharing then by decreasing true sharing.
+typedef pair<uint64_t, const LineSharing*> numbered_line_t;
+static bool compare_line_sharing (const numbered_line_t& a, const numbered_line_t& b)
+{
+  if (a.second->false_sharing != b.second->false_sharing)
+    return a.second->false_sharing > b.second->false_sharing;
+  if (a.second->true_sharing != b.second->true_sharing)
+    return a.second->true_sharing > b.second->true_sharing;
+  return a.first < b.first;
+}
+
+// Report the cache lines that incurred the most false sharing.
+void bf_report_false_sharing (void)
+{
+  pthread_mutex_lock(&line_lock);
+  vector<numbered_line_t> shared_lines;
+  for (auto iter = lines->cbegin(); iter != lines->cend(); iter++)
+    if (iter->second.true_sharing + iter->second.false_sharing > 0)
+      shared_lines.push_back(numbered_line_t(iter->first, &iter->second));
+  sort(shared_lines.begin(), shared_lines.end(), compare_line_sharing);
+  if (shared_lines.size() > max_lines_reported)
+    shared_lines.resize(max_lines_reported);
+
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Cache-line sharing";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Line address";
+  if (bf_data_structs)
+    *bfbin << uint8_t(BINOUT_COL_STRING) << "Data structure";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Reading threads"
+         << uint8_t(BINOUT_COL_UINT64) << "Writing threads"
+         << uint8_t(BINOUT_COL_UINT64) << "True-sharing misses"
+         << uint8_t(BINOUT_COL_UINT64) << "False-sharing misses"
+         << uint8_t(BINOUT_COL_STRING) << "Falsely shared access"
+         << uint8_t(BINOUT_COL_STRING) << "Preceding write"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = shared_lines.cbegin(); iter != shared_lines.cend(); iter++) {
+    const LineSharing* line = iter->second;
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << (iter->first << line_bits);
+    if (bf_data_structs)
+      *bfbin << (line->dstruct == nullptr ? string("") : bf_describe_data_struct(line->dstruct));
+    *bfbin << uint64_t(__builtin_popcountll(line->readers))
+           << uint64_t(__builtin_popcountll(line->writers))
+           << line->true_sharing
+           << line->false_sharing
+           << describe_site(line->false_site)
+           << describe_site(line->false_cause);
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+  pthread_mutex_unlock(&line_lock);
+}
+
+// Return program-wide sharing statistics.
+void bf_get_sharing_summary (uint64_t* true_misses, uint64_t* false_misses,
+                             uint64_t* true_lines, uint64_t* false_lines)
+{
+  pthread_mutex_lock(&line_lock);
+  *true_misses = *false_misses = *true_lines = *false_lines = 0;
+  for (auto iter = lines->cbegin(); iter != lines->cend(); iter++) {
+    const LineSharing& line = iter->second;
+    *true_misses += line.true_sharing;
+    *false_misses += line.false_sharing;
+    if (line.true_sharing > 0)
+      (*true_lines)++;
+    if (line.false_sharing > 0)
+      (*false_lines)++;
+  }
+  pthread_mutex_unlock(&line_lock);
+}
+
+} // namespace bytesflops
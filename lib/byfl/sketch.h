@@ -0,0 +1,82 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (approximate distinct-address counting)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#ifndef _SKETCH_H_
+#define _SKETCH_H_
+
+#include <cmath>
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+// A UniqueSketch estimates the number of distinct addresses it has seen using
+// the HyperLogLog algorithm.  It occupies a fixed amount of memory, which is
+// charged to subsystem S, regardless of how many addresses it sees.  The
+// standard error of the estimate is about 1.04/sqrt(2^precision) (1.6%).
+template<bf_mem_subsystem_t S>
+class UniqueSketch {
+private:
+  static const int precision = 12;                 // log2 of the number of registers
+  static const size_t num_registers = 1<<precision;
+  vector<uint8_t, CountingAllocator<uint8_t, S> > registers;  // Maximum rank seen per register
+
+  // Scramble the bits of an address (the splitmix64 finalizer).
+  static uint64_t hash (uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+  }
+
+public:
+  // Return the number of bytes of register storage a sketch consumes.
+  static size_t footprint() { return num_registers; }
+
+  UniqueSketch() : registers(num_registers, 0) { }
+
+  // Incorporate a single address into the sketch.
+  void access (uint64_t address) {
+    uint64_t h = hash(address);
+    size_t idx = h >> (64 - precision);
+    uint64_t rest = h << precision;
+    uint8_t rank = rest == 0 ? 64 - precision + 1 : __builtin_clzll(rest) + 1;
+    if (rank > registers[idx])
+      registers[idx] = rank;
+  }
+
+  // Incorporate a range of addresses into the sketch.
+  void access (uint64_t baseaddr, uint64_t numaddrs) {
+    for (uint64_t i = 0; i < numaddrs; i++)
+      access(baseaddr + i);
+  }
+
+  // Return the estimated number of distinct addresses seen.
+  uint64_t estimate (void) const {
+    double m = double(num_registers);
+    double sum = 0.0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < num_registers; i++) {
+      sum += ldexp(1.0, -int(registers[i]));
+      if (registers[i] == 0)
+        zeros++;
+    }
+    double alpha = 0.7213/(1.0 + 1.079/m);
+    double est = alpha*m*m/sum;
+    if (est <= 2.5*m && zeros > 0)
+      // Use linear counting for small cardinalities.
+      est = m*log(m/double(zeros));
+    return uint64_t(est + 0.5);
+  }
+};
+
+} // namespace bytesflops
+
+#endif
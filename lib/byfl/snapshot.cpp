@@ -0,0 +1,159 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (writing snapshots of a running program's measurements)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include <csignal>
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+extern ostream* bfout;
+extern string bfbin_filename;
+
+volatile sig_atomic_t bf_snapshot_requested = 0;  // Set by the signal handler
+const char* bf_snapshot_warning = nullptr;         // Reason we can't take snapshots
+static int snapshot_signal = 0;          // Signal that requests a snapshot (0=none)
+static bool snapshot_reset = false;      // true=reset counters after each snapshot
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;  // Held while writing a snapshot
+static bool snapshots_disabled = false;  // true=program is exiting
+static uint64_t snapshot_sequence = 0;   // Number of snapshots written so far
+
+// Map signal names to numbers.
+static const struct {
+  const char* name;
+  int number;
+} signal_names[] = {
+  {"HUP",   SIGHUP},
+  {"INT",   SIGINT},
+  {"QUIT",  SIGQUIT},
+  {"USR1",  SIGUSR1},
+  {"USR2",  SIGUSR2},
+  {"ALRM",  SIGALRM},
+  {"TERM",  SIGTERM},
+  {"CONT",  SIGCONT},
+  {"URG",   SIGURG},
+  {"WINCH", SIGWINCH},
+  {nullptr, 0}
+};
+
+// Parse a signal name (with or without a "SIG" prefix) or number.  Return 0
+// on failure.
+static int parse_signal (const char* sigstr)
+{
+  if (strncasecmp(sigstr, "SIG", 3) == 0)
+    sigstr += 3;
+  for (size_t i = 0; signal_names[i].name != nullptr; i++)
+    if (strcasecmp(sigstr, signal_names[i].name) == 0)
+      return signal_names[i].number;
+  char* endptr;
+  long signum = strtol(sigstr, &endptr, 10);
+  if (*sigstr == '\0' || *endptr != '\0' || signum <= 0 || signum >= NSIG)
+    return 0;
+  return int(signum);
+}
+
+// Construct the name of the nth snapshot file from the name of the final
+// .byfl file.
+static string snapshot_filename (uint64_t sequence)
+{
+  string base(bfbin_filename);
+  const string ext(".byfl");
+  if (base.size() >= ext.size() &&
+      base.compare(base.size() - ext.size(), ext.size(), ext) == 0)
+    base.erase(base.size() - ext.size());
+  return base + ".snapshot-" + to_string(sequence) + ext;
+}
+
+// Write a snapshot on behalf of the signal handler.  This is called only at
+// a safe point: at the end of a basic block, where the calling thread is not
+// in the middle of updating any Byfl data structure and, with
+// -bf-thread-safe, already holds the mega-lock.
+void bf_service_snapshot (void)
+{
+  // Let only one thread service each request.
+  if (__atomic_exchange_n(&bf_snapshot_requested, 0, __ATOMIC_ACQ_REL) == 0)
+    return;
+  pthread_mutex_lock(&snapshot_mutex);
+  if (snapshots_disabled) {
+    pthread_mutex_unlock(&snapshot_mutex);
+    return;
+  }
+
+  // Write the snapshot if we're allowed to produce output at all.
+  if (!suppress_output() && bfbin_filename != "") {
+    string filename(snapshot_filename(++snapshot_sequence));
+    bf_write_snapshot(filename, snapshot_sequence, snapshot_reset);
+    *bfout << bf_output_prefix << "BYFL_INFO: Snapshot " << snapshot_sequence
+           << " was written to " << filename << '\n';
+    bfout->flush();
+  }
+  pthread_mutex_unlock(&snapshot_mutex);
+}
+
+// Request a snapshot from the signal handler.  The next instrumented thread
+// to reach a safe point writes it.
+static void request_snapshot (int)
+{
+  bf_snapshot_requested = 1;
+}
+
+// If BF_SNAPSHOT_SIGNAL names a signal, install a handler for it that
+// requests a snapshot .byfl file.  If BF_SNAPSHOT_RESET is set to a nonzero
+// value, reset all counters after each snapshot.
+void initialize_snapshots (void)
+{
+  // Do nothing unless the user asked for snapshots.
+  const char* sigstr = getenv("BF_SNAPSHOT_SIGNAL");
+  if (sigstr == nullptr || sigstr[0] == '\0' || strcasecmp(sigstr, "none") == 0)
+    return;
+  snapshot_signal = parse_signal(sigstr);
+  if (snapshot_signal == 0) {
+    cerr << "Failed to parse BF_SNAPSHOT_SIGNAL (\"" << sigstr << "\")\n";
+    bf_abend();
+  }
+  const char* resetstr = getenv("BF_SNAPSHOT_RESET");
+  snapshot_reset = resetstr != nullptr && resetstr[0] != '\0' && strcmp(resetstr, "0") != 0;
+
+  // Snapshots are written only at the end of an instrumented basic block
+  // that calls into the run-time library.
+  if (!bf_every_bb && !bf_per_func && !bf_threads) {
+    bf_snapshot_warning = "BF_SNAPSHOT_SIGNAL has no effect without -bf-every-bb, -bf-by-func, or -bf-threads";
+    snapshot_signal = 0;
+    return;
+  }
+
+  // Don't override a handler the program installed itself.
+  struct sigaction prev_action;
+  if (sigaction(snapshot_signal, nullptr, &prev_action) == 0 &&
+      prev_action.sa_handler != SIG_DFL) {
+    snapshot_signal = 0;
+    return;
+  }
+
+  // Install the signal handler.
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = request_snapshot;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  if (sigaction(snapshot_signal, &action, nullptr) != 0) {
+    cerr << "Failed to install a handler for signal " << snapshot_signal << '\n';
+    bf_abend();
+  }
+}
+
+// Wait for any in-progress snapshot to complete and ignore all subsequent
+// snapshot requests.
+void bf_disable_snapshots (void)
+{
+  pthread_mutex_lock(&snapshot_mutex);
+  snapshots_disabled = true;
+  pthread_mutex_unlock(&snapshot_mutex);
+}
+
+} // namespace bytesflops
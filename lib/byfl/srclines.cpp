@@ -0,0 +1,192 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (tallying counters by source line)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+extern BinaryOStream* bfbin;
+
+// Describe a basic block's static contribution to each of its source lines.
+class LineBlock {
+public:
+  const bf_line_counts_t* records;   // Per-line counts for a single execution
+  uint64_t num_records;              // Number of entries in records[]
+  vector<uint64_t> line_ids;         // Dense line index for each entry in records[]
+
+  LineBlock(const bf_line_counts_t* recs, uint64_t nrecs) :
+    records(recs), num_records(nrecs) { }
+};
+
+// Map every basic block we've seen to its index in all_blocks (plus one) via
+// a per-block cache variable in the instrumented code.  Map every source
+// line we've seen to a dense index.
+static vector<LineBlock*>* all_blocks = nullptr;
+typedef pair<string, uint64_t> file_line_t;
+static map<file_line_t, uint64_t>* line_ids = nullptr;
+
+// Maintain per-thread basic-block execution counts so the common case
+// requires no locking.  Each thread holds its own lock only while resizing
+// its counts, and the report holds it while reading them.
+class ThreadLineCounts {
+public:
+  pthread_mutex_t lock;
+  vector<uint64_t> counts;
+
+  ThreadLineCounts() {
+    pthread_mutex_init(&lock, nullptr);
+  }
+};
+static __thread ThreadLineCounts* thread_counts = nullptr;
+static vector<ThreadLineCounts*>* all_counts = nullptr;
+
+// Serialize all accesses to all_blocks, line_ids, and all_counts.
+static pthread_mutex_t srcline_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Initialize some of our variables at first use.
+void initialize_source_lines (void)
+{
+  all_blocks = new vector<LineBlock*>();
+  line_ids = new map<file_line_t, uint64_t>();
+  all_counts = new vector<ThreadLineCounts*>();
+}
+
+// Assign an ID to a basic block the first time any thread executes it.
+static uint64_t register_block (uint64_t* cache, const bf_line_counts_t* records,
+                                uint64_t num_records)
+{
+  pthread_mutex_lock(&srcline_lock);
+  uint64_t id = __atomic_load_n(cache, __ATOMIC_ACQUIRE);
+  if (id == 0) {
+    LineBlock* block = new LineBlock(records, num_records);
+    for (uint64_t i = 0; i < num_records; i++) {
+      file_line_t key(records[i].file, records[i].line);
+      auto iter = line_ids->find(key);
+      if (iter == line_ids->end())
+        iter = line_ids->emplace(key, line_ids->size()).first;
+      block->line_ids.push_back(iter->second);
+    }
+    all_blocks->push_back(block);
+    id = all_blocks->size();
+    __atomic_store_n(cache, id, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&srcline_lock);
+  return id;
+}
+
+// Tally one execution of a basic block.  The per-line counts are multiplied
+// in only at report time.
+extern "C"
+void bf_tally_bb_lines (uint64_t* cache, const bf_line_counts_t* records,
+                        uint64_t num_records)
+{
+  // Do nothing if counting is suppressed.
+  if (bf_suppress_counting)
+    return;
+
+  // Map the block to its ID.
+  uint64_t id = __atomic_load_n(cache, __ATOMIC_ACQUIRE);
+  if (__builtin_expect(id == 0, 0))
+    id = register_block(cache, records, num_records);
+
+  // Create the calling thread's counts on first use.
+  ThreadLineCounts* tc = thread_counts;
+  if (__builtin_expect(tc == nullptr, 0)) {
+    tc = new ThreadLineCounts();
+    pthread_mutex_lock(&srcline_lock);
+    all_counts->push_back(tc);
+    pthread_mutex_unlock(&srcline_lock);
+    thread_counts = tc;
+  }
+  if (__builtin_expect(tc->counts.size() < id, 0)) {
+    pthread_mutex_lock(&tc->lock);
+    tc->counts.resize(id*2, 0);
+    pthread_mutex_unlock(&tc->lock);
+  }
+
+  // Increment the count with relaxed atomics so a concurrent report can read
+  // it safely without slowing down the common case.
+  uint64_t* count = &tc->counts[id - 1];
+  __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+// Report loads, stores, flops, and ops by source line.
+void bf_report_source_lines (void)
+{
+  // Sum all threads' execution counts for each block.  Other threads may
+  // still be running, so read each thread's counts under its lock.
+  pthread_mutex_lock(&srcline_lock);
+  size_t num_blocks = all_blocks->size();
+  vector<uint64_t> block_execs(num_blocks, 0);
+  for (auto citer = all_counts->cbegin(); citer != all_counts->cend(); citer++) {
+    ThreadLineCounts* tc = *citer;
+    pthread_mutex_lock(&tc->lock);
+    size_t n = min(num_blocks, tc->counts.size());
+    for (size_t b = 0; b < n; b++)
+      block_execs[b] += __atomic_load_n(&tc->counts[b], __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&tc->lock);
+  }
+
+  // Multiply each block's execution count into a dense per-line array.
+  size_t num_lines = line_ids->size();
+  vector<uint64_t> executions(num_lines, 0);
+  vector<bf_line_counts_t> totals(num_lines);
+  memset(totals.data(), 0, num_lines*sizeof(bf_line_counts_t));
+  for (size_t b = 0; b < num_blocks; b++) {
+    uint64_t bb_execs = block_execs[b];
+    if (bb_execs == 0)
+      continue;
+    const LineBlock* block = (*all_blocks)[b];
+    for (uint64_t i = 0; i < block->num_records; i++) {
+      const bf_line_counts_t& rec = block->records[i];
+      uint64_t l = block->line_ids[i];
+      executions[l] += bb_execs;
+      totals[l].loads += rec.loads*bb_execs;
+      totals[l].stores += rec.stores*bb_execs;
+      totals[l].load_bytes += rec.load_bytes*bb_execs;
+      totals[l].store_bytes += rec.store_bytes*bb_execs;
+      totals[l].flops += rec.flops*bb_execs;
+      totals[l].ops += rec.ops*bb_execs;
+    }
+  }
+
+  // Output one row per executed source line in order of file name then line
+  // number.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Source lines";
+  *bfbin << uint8_t(BINOUT_COL_STRING) << "File name"
+         << uint8_t(BINOUT_COL_UINT64) << "Line number"
+         << uint8_t(BINOUT_COL_UINT64) << "Basic-block executions"
+         << uint8_t(BINOUT_COL_UINT64) << "Loads"
+         << uint8_t(BINOUT_COL_UINT64) << "Stores"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes loaded"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes stored"
+         << uint8_t(BINOUT_COL_UINT64) << "Flops"
+         << uint8_t(BINOUT_COL_UINT64) << "Integer ops"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = line_ids->cbegin(); iter != line_ids->cend(); iter++) {
+    uint64_t l = iter->second;
+    if (executions[l] == 0)
+      continue;
+    const bf_line_counts_t& tot = totals[l];
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << (iter->first.first == "??" ? string("") : iter->first.first)
+           << iter->first.second
+           << executions[l]
+           << tot.loads
+           << tot.stores
+           << tot.load_bytes
+           << tot.store_bytes
+           << tot.flops
+           << tot.ops;
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+  pthread_mutex_unlock(&srcline_lock);
+}
+
+} // namespace bytesflops
@@ -155,6 +155,28 @@ void bf_partition_unique_addresses (uint64_t* uti, uint64_t *mti)
   *mti = mti_pt.tally_unique();
 }
 
+// Tally the unit-stride (one word, forward or backward) and zero-stride
+// accesses made by loads and stores within a given range of source lines of
+// a given function, along with the total number of strides observed.
+void bf_get_strides_in_lines (const char* function, const char* file,
+                              uint64_t first_line, uint64_t last_line,
+                              uint64_t* unit_strides, uint64_t* zero_strides,
+                              uint64_t* total_strides)
+{
+  *unit_strides = *zero_strides = *total_strides = 0;
+  for (auto iter = stride_data->begin(); iter != stride_data->end(); iter++) {
+    const AccessPattern* info = iter->second;
+    const bf_symbol_info_t& syminfo = info->syminfo;
+    if (syminfo.line < first_line || syminfo.line > last_line
+        || strcmp(syminfo.function, function) != 0
+        || strcmp(syminfo.file, file) != 0)
+      continue;
+    *unit_strides += info->stride_tally[0];
+    *zero_strides += info->stride_tally[ZERO_STRIDE];
+    *total_strides += info->total_strides;
+  }
+}
+
 // This function is used by sort() to sort stride information in decreasing
 // order of the total number of strides observed.  Break ties using the
 // filename, then line number, and finally the instruction string, all in
@@ -0,0 +1,346 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (tallying accesses to individual structure fields)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+extern BinaryOStream* bfbin;
+
+// Consider a structure's most-accessed fields hot until together they account
+// for at least this fraction of all accesses to the structure.  Consider the
+// remaining fields cold.
+static const double hot_fraction = 0.9;
+
+// Tally accesses to a single structure field.
+class FieldTally {
+public:
+  uint64_t offset = 0;        // Byte offset of the field within its structure
+  uint64_t size = 0;          // Size in bytes of the field
+  uint64_t loads = 0;         // Number of loads from the field
+  uint64_t stores = 0;        // Number of stores to the field
+  uint64_t load_bytes = 0;    // Number of bytes loaded from the field
+  uint64_t store_bytes = 0;   // Number of bytes stored to the field
+
+  // Incorporate another set of tallies into our own.
+  void merge (const FieldTally& other) {
+    offset = other.offset;
+    size = other.size;
+    loads += other.loads;
+    stores += other.stores;
+    load_bytes += other.load_bytes;
+    store_bytes += other.store_bytes;
+  }
+
+  // Return the total number of accesses to the field.
+  uint64_t accesses (void) const {
+    return loads + stores;
+  }
+};
+
+// Tally accesses to all fields of a single structure type plus the number of
+// basic-block executions in which each pair of fields was accessed together.
+typedef pair<uint64_t, uint64_t> field_pair_t;
+class StructTally {
+public:
+  uint64_t size = 0;                          // Size in bytes of the structure
+  map<uint64_t, FieldTally> fields;           // Tallies by field index
+  map<field_pair_t, uint64_t> affinity;       // Co-accesses by pair of field indexes
+
+  // Incorporate another set of tallies into our own.
+  void merge (const StructTally& other) {
+    size = other.size;
+    for (auto iter = other.fields.cbegin(); iter != other.fields.cend(); iter++)
+      fields[iter->first].merge(iter->second);
+    for (auto iter = other.affinity.cbegin(); iter != other.affinity.cend(); iter++)
+      affinity[iter->first] += iter->second;
+  }
+
+  // Return the total number of accesses to all fields.
+  uint64_t accesses (void) const {
+    uint64_t sum = 0;
+    for (auto iter = fields.cbegin(); iter != fields.cend(); iter++)
+      sum += iter->second.accesses();
+    return sum;
+  }
+
+  // Return the number of co-accesses of two fields.
+  uint64_t co_accesses (uint64_t f1, uint64_t f2) const {
+    auto iter = affinity.find(f1 < f2 ? field_pair_t(f1, f2) : field_pair_t(f2, f1));
+    return iter == affinity.end() ? 0 : iter->second;
+  }
+};
+
+// Maintain each thread's tallies, keyed by the address of a structure-name
+// string, and the fields accessed so far in the current basic block.
+class ThreadStructs {
+public:
+  unordered_map<const char*, StructTally> structs;
+  vector<pair<StructTally*, uint64_t> > bb_fields;
+};
+static __thread ThreadStructs* thread_structs = nullptr;
+static vector<ThreadStructs*>* all_structs = nullptr;
+
+// Serialize all accesses to all_structs.
+static pthread_mutex_t struct_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Describe each structure we suggest splitting into hot and cold parts.
+static vector<string>* split_candidates = nullptr;
+
+// Initialize some of our variables at first use.
+void initialize_struct_fields (void)
+{
+  all_structs = new vector<ThreadStructs*>();
+  split_candidates = new vector<string>();
+}
+
+// Tally a load from or store to a structure field.
+extern "C"
+void bf_tally_struct_field (const char* struct_name, uint64_t field,
+                            uint64_t offset, uint64_t field_size,
+                            uint64_t struct_size, uint64_t numbytes,
+                            uint8_t load0store1)
+{
+  // Do nothing if counting is suppressed.
+  if (bf_suppress_counting)
+    return;
+
+  // Create the calling thread's tallies on first use.
+  ThreadStructs* ts = thread_structs;
+  if (__builtin_expect(ts == nullptr, 0)) {
+    ts = new ThreadStructs();
+    pthread_mutex_lock(&struct_lock);
+    all_structs->push_back(ts);
+    pthread_mutex_unlock(&struct_lock);
+    thread_structs = ts;
+  }
+
+  // Tally the access.
+  StructTally& stally = ts->structs[struct_name];
+  stally.size = struct_size;
+  FieldTally& ftally = stally.fields[field];
+  ftally.offset = offset;
+  ftally.size = field_size;
+  if (load0store1) {
+    ftally.stores++;
+    ftally.store_bytes += numbytes;
+  }
+  else {
+    ftally.loads++;
+    ftally.load_bytes += numbytes;
+  }
+  ts->bb_fields.push_back(make_pair(&stally, field));
+}
+
+// Credit every pair of fields of the same structure accessed in the basic
+// block that just ended with one co-access.
+extern "C"
+void bf_end_struct_field_bb (void)
+{
+  ThreadStructs* ts = thread_structs;
+  if (ts == nullptr)
+    return;
+  vector<pair<StructTally*, uint64_t> >& bb_fields = ts->bb_fields;
+  sort(bb_fields.begin(), bb_fields.end());
+  bb_fields.erase(unique(bb_fields.begin(), bb_fields.end()), bb_fields.end());
+  for (size_t i = 0; i < bb_fields.size(); i++)
+    for (size_t j = i + 1; j < bb_fields.size() && bb_fields[j].first == bb_fields[i].first; j++)
+      bb_fields[i].first->affinity[field_pair_t(bb_fields[i].second, bb_fields[j].second)]++;
+  bb_fields.clear();
+}
+
+// Sort field indexes by decreasing number of accesses then by offset.
+class compare_field_heat {
+private:
+  const StructTally* stally;
+public:
+  compare_field_heat(const StructTally* st) : stally(st) { }
+  bool operator() (uint64_t a, uint64_t b) const {
+    const FieldTally& fa = stally->fields.at(a);
+    const FieldTally& fb = stally->fields.at(b);
+    if (fa.accesses() != fb.accesses())
+      return fa.accesses() > fb.accesses();
+    return fa.offset < fb.offset;
+  }
+};
+
+// Partition a structure's fields into hot fields, sorted by decreasing heat,
+// and cold fields.
+static void partition_fields (const StructTally& stally,
+                              vector<uint64_t>& hot, vector<uint64_t>& cold)
+{
+  vector<uint64_t> by_heat;
+  for (auto iter = stally.fields.cbegin(); iter != stally.fields.cend(); iter++)
+    by_heat.push_back(iter->first);
+  sort(by_heat.begin(), by_heat.end(), compare_field_heat(&stally));
+  uint64_t total = stally.accesses();
+  uint64_t so_far = 0;
+  for (auto iter = by_heat.cbegin(); iter != by_heat.cend(); iter++)
+    if (so_far < total*hot_fraction) {
+      hot.push_back(*iter);
+      so_far += stally.fields.at(*iter).accesses();
+    }
+    else
+      cold.push_back(*iter);
+}
+
+// Greedily pack a list of fields into cache lines.  Start each line with the
+// hottest remaining field, then repeatedly add whichever remaining field was
+// most often accessed together with the fields already on the line.  Return
+// the fields in their suggested order and the line on which each belongs.
+static void pack_fields (const StructTally& stally, vector<uint64_t> remaining,
+                         vector<uint64_t>& order, vector<uint64_t>& lines)
+{
+  uint64_t line = lines.empty() ? 0 : lines.back() + 1;
+  uint64_t line_bytes = 0;
+  vector<uint64_t> on_line;
+  while (!remaining.empty()) {
+    // Find the remaining field with the greatest affinity to the current line.
+    size_t best = 0;
+    uint64_t best_affinity = 0;
+    for (size_t i = 0; i < remaining.size() && !on_line.empty(); i++) {
+      uint64_t aff = 0;
+      for (auto liter = on_line.cbegin(); liter != on_line.cend(); liter++)
+        aff += stally.co_accesses(remaining[i], *liter);
+      if (aff > best_affinity) {
+        best = i;
+        best_affinity = aff;
+      }
+    }
+
+    // Start a new line if the field doesn't fit on the current one.
+    uint64_t field = remaining[best];
+    uint64_t field_size = stally.fields.at(field).size;
+    if (!on_line.empty() && line_bytes + field_size > bf_line_size) {
+      line++;
+      line_bytes = 0;
+      on_line.clear();
+      continue;   // Restart with the hottest remaining field.
+    }
+    order.push_back(field);
+    lines.push_back(line);
+    on_line.push_back(field);
+    line_bytes += field_size;
+    remaining.erase(remaining.begin() + best);
+  }
+}
+
+// Report per-field access counts, field co-access affinity, and suggested
+// structure layouts.
+void bf_report_struct_fields (void)
+{
+  // Merge all threads' tallies by structure name.
+  map<string, StructTally> structs;
+  pthread_mutex_lock(&struct_lock);
+  for (auto titer = all_structs->cbegin(); titer != all_structs->cend(); titer++)
+    for (auto iter = (*titer)->structs.cbegin(); iter != (*titer)->structs.cend(); iter++)
+      structs[iter->first].merge(iter->second);
+  pthread_mutex_unlock(&struct_lock);
+
+  // Output each field's access counts.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Struct fields";
+  *bfbin << uint8_t(BINOUT_COL_STRING) << "Struct"
+         << uint8_t(BINOUT_COL_UINT64) << "Struct size"
+         << uint8_t(BINOUT_COL_UINT64) << "Field index"
+         << uint8_t(BINOUT_COL_UINT64) << "Field offset"
+         << uint8_t(BINOUT_COL_UINT64) << "Field size"
+         << uint8_t(BINOUT_COL_UINT64) << "Loads"
+         << uint8_t(BINOUT_COL_UINT64) << "Stores"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes loaded"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes stored"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto siter = structs.cbegin(); siter != structs.cend(); siter++)
+    for (auto fiter = siter->second.fields.cbegin(); fiter != siter->second.fields.cend(); fiter++) {
+      const FieldTally& ftally = fiter->second;
+      *bfbin << uint8_t(BINOUT_ROW_DATA)
+             << siter->first
+             << siter->second.size
+             << fiter->first
+             << ftally.offset
+             << ftally.size
+             << ftally.loads
+             << ftally.stores
+             << ftally.load_bytes
+             << ftally.store_bytes;
+    }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Output the number of basic-block executions in which each pair of fields
+  // was accessed together.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Struct-field affinity";
+  *bfbin << uint8_t(BINOUT_COL_STRING) << "Struct"
+         << uint8_t(BINOUT_COL_UINT64) << "First field index"
+         << uint8_t(BINOUT_COL_UINT64) << "Second field index"
+         << uint8_t(BINOUT_COL_UINT64) << "Co-accesses"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto siter = structs.cbegin(); siter != structs.cend(); siter++)
+    for (auto aiter = siter->second.affinity.cbegin(); aiter != siter->second.affinity.cend(); aiter++)
+      *bfbin << uint8_t(BINOUT_ROW_DATA)
+             << siter->first
+             << aiter->first.first
+             << aiter->first.second
+             << aiter->second;
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Output a suggested layout for each structure: hot fields packed into
+  // cache lines by affinity, followed by cold fields.  Note each structure
+  // that would benefit from moving its cold fields elsewhere.
+  split_candidates->clear();
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Suggested struct layouts";
+  *bfbin << uint8_t(BINOUT_COL_STRING) << "Struct"
+         << uint8_t(BINOUT_COL_UINT64) << "Position"
+         << uint8_t(BINOUT_COL_UINT64) << "Field index"
+         << uint8_t(BINOUT_COL_UINT64) << "Cache line"
+         << uint8_t(BINOUT_COL_BOOL)   << "Hot"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto siter = structs.cbegin(); siter != structs.cend(); siter++) {
+    const StructTally& stally = siter->second;
+    vector<uint64_t> hot, cold;
+    partition_fields(stally, hot, cold);
+    vector<uint64_t> order, lines;
+    pack_fields(stally, hot, order, lines);
+    size_t num_hot = order.size();
+    pack_fields(stally, cold, order, lines);
+    for (size_t i = 0; i < order.size(); i++)
+      *bfbin << uint8_t(BINOUT_ROW_DATA)
+             << siter->first
+             << uint64_t(i)
+             << order[i]
+             << lines[i]
+             << bool(i < num_hot);
+
+    // Suggest a hot/cold split if the structure spans multiple cache lines
+    // and has cold fields.
+    if (stally.size > bf_line_size && !cold.empty()) {
+      uint64_t hot_bytes = 0;
+      for (auto iter = hot.cbegin(); iter != hot.cend(); iter++)
+        hot_bytes += stally.fields.at(*iter).size;
+      split_candidates->push_back(siter->first + " spans " +
+                                  to_string((stally.size + bf_line_size - 1)/bf_line_size) +
+                                  " cache lines, but " + to_string(hot.size()) +
+                                  (hot.size() == 1 ? " field" : " fields") + " occupying " +
+                                  to_string(hot_bytes) + " of its " + to_string(stally.size) +
+                                  " bytes receive at least " + to_string(int(hot_fraction*100)) +
+                                  "% of its accesses; consider moving its " +
+                                  to_string(cold.size()) + " cold " +
+                                  (cold.size() == 1 ? "field" : "fields") +
+                                  " to a separate structure");
+    }
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+}
+
+// Return a description of each structure we suggest splitting into hot and
+// cold parts.  This is valid only after bf_report_struct_fields() is called.
+const vector<string>& bf_struct_split_candidates (void)
+{
+  return *split_candidates;
+}
+
+} // namespace bytesflops
@@ -9,45 +9,199 @@
 
 using namespace std;
 
-// Say whether one string is strictly less than another.
-struct str_less_than
-{
-  bool operator()(const char* s1, const char* s2) const {
-    if (s1 == s2)
-      return false;
-    return strcmp(s1, s2) < 0;
+namespace bytesflops {
+
+// Store symbols contiguously in a list of arena chunks.  Each symbol is
+// preceded by its 64-bit hash and padded to a multiple of 8 bytes.  Chunks are
+// never freed so symbols never move.
+class ArenaChunk {
+public:
+  char* begin;          // First byte of the chunk
+  char* end;            // One past the last byte of the chunk
+  char* next_free;      // First unused byte in the chunk
+  ArenaChunk* next;     // Previously allocated chunk
+};
+static ArenaChunk* arena_head = nullptr;     // Most recently allocated chunk
+static const size_t min_chunk_bytes = 65536;
+
+// Define an open-addressed hash table of symbols.  Readers probe the table
+// without locking; writers, which are serialized, publish new symbols and
+// new, larger tables with release semantics.  Old tables are never freed so
+// readers holding one remain safe.
+class SymbolTable {
+public:
+  uint64_t capacity;      // Number of slots (a power of two)
+  uint64_t num_symbols;   // Number of slots in use
+  const char** slots;     // Symbols, each preceded by its hash, or NULL
+
+  SymbolTable(uint64_t cap) : capacity(cap), num_symbols(0) {
+    slots = new const char*[capacity];
+    memset(slots, 0, capacity*sizeof(const char*));
+    bf_mem_allocated(BF_MEM_SYMBOL_TABLE, sizeof(*this) + capacity*sizeof(const char*));
   }
 };
+static SymbolTable* symbol_table = nullptr;
 
-namespace bytesflops {
+// Serialize all insertions into symbol_table and allocations from the arena.
+static pthread_mutex_t symtable_lock = PTHREAD_MUTEX_INITIALIZER;
 
-// Define a map from equal strings to equivalent strings.
-typedef map<const char*, const char*, str_less_than> symbol_table_t;
-static symbol_table_t* symbol_table = NULL;
+// Cache each thread's most recent lookups, indexed by the address of the
+// string looked up.
+static const size_t front_cache_entries = 256;
+static __thread const char* front_cache_keys[front_cache_entries];
+static __thread const char* front_cache_symbols[front_cache_entries];
 
 
 // Initialize some of our variables at first use.
 void initialize_symtable (void) {
-  symbol_table = new symbol_table_t();
+  symbol_table = new SymbolTable(4096);
+}
+
+// Hash a string (64-bit FNV-1a).
+static inline uint64_t hash_string (const char* str)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (; *str != '\0'; str++) {
+    hash ^= uint8_t(*str);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
 }
 
+// Return a symbol's hash.
+static inline uint64_t symbol_hash (const char* symbol)
+{
+  return *(const uint64_t*)(symbol - sizeof(uint64_t));
+}
+
+// Find a string in a symbol table.  Return the symbol or NULL if the string
+// is not found.
+static const char* find_symbol (const SymbolTable* table, const char* str, uint64_t hash)
+{
+  uint64_t mask = table->capacity - 1;
+  for (uint64_t i = hash & mask; ; i = (i + 1) & mask) {
+    const char* symbol = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+    if (symbol == nullptr)
+      return nullptr;
+    if (symbol_hash(symbol) == hash && strcmp(symbol, str) == 0)
+      return symbol;
+  }
+}
+
+// Say whether a string is already a symbol, not merely a pointer into the
+// middle of one.  This requires no string comparisons.
+static bool is_symbol (const SymbolTable* table, const char* str)
+{
+  // Rule out pointers outside the arena or not aligned like a symbol.
+  if ((uintptr_t(str) & 7) != 0)
+    return false;
+  ArenaChunk* chunk;
+  for (chunk = __atomic_load_n(&arena_head, __ATOMIC_ACQUIRE);
+       chunk != nullptr;
+       chunk = chunk->next)
+    if (str >= chunk->begin + sizeof(uint64_t) && str < chunk->end)
+      break;
+  if (chunk == nullptr)
+    return false;
+
+  // Probe the table for the pointer itself.
+  uint64_t mask = table->capacity - 1;
+  for (uint64_t i = symbol_hash(str) & mask; ; i = (i + 1) & mask) {
+    const char* symbol = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+    if (symbol == nullptr)
+      return false;
+    if (symbol == str)
+      return true;
+  }
+}
+
+// Insert a symbol into a symbol table known not to contain it.
+static void insert_symbol (SymbolTable* table, const char* symbol)
+{
+  uint64_t mask = table->capacity - 1;
+  uint64_t i;
+  for (i = symbol_hash(symbol) & mask; table->slots[i] != nullptr; i = (i + 1) & mask)
+    ;
+  __atomic_store_n(&table->slots[i], symbol, __ATOMIC_RELEASE);
+  table->num_symbols++;
+}
+
+// Copy a string and its hash into the arena and return the copy.  The caller
+// must hold symtable_lock.
+static const char* arena_copy (const char* str, uint64_t hash)
+{
+  size_t len = strlen(str) + 1;
+  size_t bytes = (sizeof(uint64_t) + len + 7) & ~size_t(7);
+  ArenaChunk* chunk = arena_head;
+  if (chunk == nullptr || chunk->next_free + bytes > chunk->end) {
+    // Allocate a new chunk at least twice as large as the previous one.
+    size_t chunk_bytes = chunk == nullptr ? min_chunk_bytes : 2*(chunk->end - chunk->begin);
+    while (chunk_bytes < bytes)
+      chunk_bytes *= 2;
+    ArenaChunk* new_chunk = new ArenaChunk;
+    new_chunk->begin = new_chunk->next_free = new char[chunk_bytes];
+    new_chunk->end = new_chunk->begin + chunk_bytes;
+    new_chunk->next = chunk;
+    bf_mem_allocated(BF_MEM_SYMBOL_TABLE, sizeof(ArenaChunk) + chunk_bytes);
+    __atomic_store_n(&arena_head, new_chunk, __ATOMIC_RELEASE);
+    chunk = new_chunk;
+  }
+  char* copy = chunk->next_free;
+  chunk->next_free += bytes;
+  *(uint64_t*)copy = hash;
+  memcpy(copy + sizeof(uint64_t), str, len);
+  return copy + sizeof(uint64_t);
+}
 
 // Map a nonunique string to a unique string (in other words, intern a
-// string to a symbol).
+// string to a symbol).  This function is thread-safe.  Lookups of existing
+// symbols acquire no locks.
 const char* bf_string_to_symbol (const char* nonunique)
 {
   if (nonunique == NULL)
     return NULL;
-  symbol_table_t::iterator sym_iter = symbol_table->find(nonunique);
-  if (sym_iter == symbol_table->end()) {
-    // New entry for the symbol table -- create a unique symbol and return it.
-    const char* unique = strdup(nonunique);
-    (*symbol_table)[unique] = unique;
-    return unique;
+
+  // Check the calling thread's front cache.  The string at a given address
+  // may have changed since it was cached so verify its contents.
+  size_t cidx = (uintptr_t(nonunique) >> 3) % front_cache_entries;
+  const char* symbol = front_cache_symbols[cidx];
+  if (front_cache_keys[cidx] == nonunique && strcmp(symbol, nonunique) == 0)
+    return symbol;
+
+  // Return symbols as is.
+  const SymbolTable* table = __atomic_load_n(&symbol_table, __ATOMIC_ACQUIRE);
+  if (is_symbol(table, nonunique))
+    return nonunique;
+
+  // Look up the string without locking.
+  uint64_t hash = hash_string(nonunique);
+  symbol = find_symbol(table, nonunique, hash);
+  if (symbol == nullptr) {
+    // The string is probably new.  Check again with the lock held.
+    pthread_mutex_lock(&symtable_lock);
+    SymbolTable* wtable = symbol_table;
+    symbol = find_symbol(wtable, nonunique, hash);
+    if (symbol == nullptr) {
+      // New entry for the symbol table -- create a unique symbol.  Keep the
+      // table at most half full, publishing a larger copy when necessary.
+      symbol = arena_copy(nonunique, hash);
+      if (2*(wtable->num_symbols + 1) > wtable->capacity) {
+        SymbolTable* new_table = new SymbolTable(2*wtable->capacity);
+        for (uint64_t i = 0; i < wtable->capacity; i++)
+          if (wtable->slots[i] != nullptr)
+            insert_symbol(new_table, wtable->slots[i]);
+        wtable = new_table;
+      }
+      insert_symbol(wtable, symbol);
+      __atomic_store_n(&symbol_table, wtable, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&symtable_lock);
   }
-  else
-    // Existing entry in the symbol table -- return it.
-    return sym_iter->second;
+
+  // Cache and return the symbol.
+  front_cache_keys[cidx] = nonunique;
+  front_cache_symbols[cidx] = symbol;
+  return symbol;
 }
 
 } // namespace bytesflops
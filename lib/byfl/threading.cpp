@@ -5,6 +5,7 @@
  * By Scott Pakin <pakin@lanl.gov>
  */
 
+#include <atomic>
 #include "byfl.h"
 
 using namespace std;
@@ -13,8 +14,60 @@ static pthread_mutex_t megalock = PTHREAD_MUTEX_INITIALIZER;    // Lock protecti
 
 namespace bytesflops {
 
+extern BinaryOStream* bfbin;
+
+// Map a function name (or call stack) to a set of counters.
+typedef unordered_map<const char*, ByteFlopCounters*, hash<const char*>, equal_to<const char*>,
+                      CountingAllocator<pair<const char* const, ByteFlopCounters*>, BF_MEM_THREADS> > func_to_counters_t;
+
+// Maintain one thread's share of the program's counters.
+class ThreadCounters : public CountedObject<BF_MEM_THREADS> {
+public:
+  uint32_t thread_num;                 // Small integer identifying the thread
+  ByteFlopCounters counters;           // Operation and byte tallies
+  UniqueSketch<BF_MEM_THREADS>* unique_addrs;  // Distinct addresses accessed (nullptr=not tracked)
+  func_to_counters_t functions;        // Per-function tallies (empty unless -bf-thread-funcs)
+  const char* last_func;               // Function name most recently passed to bf_tally_thread_bb()
+  ByteFlopCounters* last_func_counters;  // Counters associated with last_func
+
+  ThreadCounters(uint32_t tnum) :
+    thread_num(tnum), unique_addrs(nullptr), last_func(nullptr),
+    last_func_counters(nullptr) {
+    if (bf_unique_bytes)
+      unique_addrs = new UniqueSketch<BF_MEM_THREADS>();
+  }
+
+  // Return the counters associated with a function, creating them if
+  // necessary.
+  ByteFlopCounters* function_counters (const char* funcname) {
+    if (funcname == last_func)
+      return last_func_counters;
+    const char* symbol = bf_call_stack ? bf_func_and_parents : bf_string_to_symbol(funcname);
+    ByteFlopCounters*& fc = functions[symbol];
+    if (fc == nullptr) {
+      fc = new ByteFlopCounters();
+      bf_mem_allocated(BF_MEM_THREADS, sizeof(ByteFlopCounters));
+    }
+    if (!bf_call_stack) {
+      // The call stack can change without the function name changing so
+      // cache only function names.
+      last_func = funcname;
+      last_func_counters = fc;
+    }
+    return fc;
+  }
+};
+
+// Point each thread to its own counters.  Keep track of all threads'
+// counters for reporting.
+static thread_local ThreadCounters* my_thread_counters = nullptr;
+static vector<ThreadCounters*>* all_thread_counters = nullptr;
+static pthread_mutex_t thread_counters_lock = PTHREAD_MUTEX_INITIALIZER;
+
 // Initialize some of our variables at first use.
 void initialize_threading (void) {
+  if (bf_threads)
+    all_thread_counters = new vector<ThreadCounters*>();
 }
 
 // Take the mega-lock.
@@ -37,4 +90,189 @@ void bf_release_mega_lock (void)
   }
 }
 
+// Return a small number that identifies the calling thread.  Threads are
+// numbered consecutively from zero in the order in which they first call this
+// function.
+uint32_t bf_thread_number (void)
+{
+  static atomic<uint32_t> num_threads(0);
+  static thread_local uint32_t thread_number = ~uint32_t(0);
+  if (__builtin_expect(thread_number == ~uint32_t(0), 0))
+    thread_number = num_threads++;
+  return thread_number;
+}
+
+// Return the calling thread's counters, creating them on first use.
+static inline ThreadCounters* thread_counters (void)
+{
+  ThreadCounters* tc = my_thread_counters;
+  if (__builtin_expect(tc == nullptr, 0)) {
+    tc = new ThreadCounters(bf_thread_number());
+    pthread_mutex_lock(&thread_counters_lock);
+    all_thread_counters->push_back(tc);
+    pthread_mutex_unlock(&thread_counters_lock);
+    my_thread_counters = tc;
+  }
+  return tc;
+}
+
+// Return the calling thread's counters.
+ByteFlopCounters* bf_thread_counters (void)
+{
+  return &thread_counters()->counters;
+}
+
+// Return the calling thread's counters for a given function.
+ByteFlopCounters* bf_thread_function_counters (const char* funcname)
+{
+  return thread_counters()->function_counters(funcname);
+}
+
+// Attribute a set of addresses to the calling thread.
+void bf_thread_assoc_addresses (uint64_t baseaddr, uint64_t numaddrs)
+{
+  thread_counters()->unique_addrs->access(baseaddr, numaddrs);
+}
+
+// Reset all per-thread counters to zero.  Distinct-address tallies remain
+// cumulative.
+void bf_thread_reset_counters (void)
+{
+  if (!bf_threads)
+    return;
+  pthread_mutex_lock(&thread_counters_lock);
+  for (auto titer = all_thread_counters->begin(); titer != all_thread_counters->end(); titer++) {
+    (*titer)->counters.reset();
+    for (auto fiter = (*titer)->functions.begin(); fiter != (*titer)->functions.end(); fiter++)
+      fiter->second->reset();
+  }
+  pthread_mutex_unlock(&thread_counters_lock);
+}
+
+// Compare two threads by thread number.
+static bool compare_thread_numbers (const ThreadCounters* one, const ThreadCounters* two)
+{
+  return one->thread_num < two->thread_num;
+}
+
+// Compare two functions by name.
+static bool compare_function_names (const pair<const char*, ByteFlopCounters*>& one,
+                                    const pair<const char*, ByteFlopCounters*>& two)
+{
+  return strcmp(one.first, two.first) < 0;
+}
+
+// Return the number of integer operations represented by a set of counters.
+static inline uint64_t integer_ops (const ByteFlopCounters& counters)
+{
+  return counters.ops - counters.flops - counters.load_ins - counters.store_ins - counters.terminators[BF_END_BB_ANY];
+}
+
+// Report per-thread and, if requested, per-function, per-thread counters.
+void bf_report_threads (void)
+{
+  // Sort the threads by thread number.
+  pthread_mutex_lock(&thread_counters_lock);
+  vector<ThreadCounters*> threads(*all_thread_counters);
+  sort(threads.begin(), threads.end(), compare_thread_numbers);
+
+  // Output a table of per-thread counters.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Threads";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Thread number"
+         << uint8_t(BINOUT_COL_UINT64) << "Operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Load operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Store operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Floating-point operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Integer operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Function-call operations (non-exception-throwing)"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes loaded"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes stored";
+  if (bf_unique_bytes)
+    *bfbin << uint8_t(BINOUT_COL_UINT64) << "Unique bytes (estimated)";
+  *bfbin << uint8_t(BINOUT_COL_NONE);
+  for (auto titer = threads.cbegin(); titer != threads.cend(); titer++) {
+    const ThreadCounters* tc = *titer;
+    const ByteFlopCounters& counters = tc->counters;
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << uint64_t(tc->thread_num)
+           << counters.ops
+           << counters.load_ins
+           << counters.store_ins
+           << counters.flops
+           << integer_ops(counters)
+           << counters.call_ins
+           << counters.loads
+           << counters.stores;
+    if (bf_unique_bytes)
+      *bfbin << tc->unique_addrs->estimate();
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Output a table of per-function, per-thread counters if requested.
+  if (bf_thread_funcs) {
+    *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Thread functions";
+    *bfbin << uint8_t(BINOUT_COL_UINT64) << "Thread number";
+    if (bf_call_stack)
+      *bfbin << uint8_t(BINOUT_COL_STRING) << "Mangled call stack"
+             << uint8_t(BINOUT_COL_STRING) << "Demangled call stack";
+    else
+      *bfbin << uint8_t(BINOUT_COL_STRING) << "Mangled function name"
+             << uint8_t(BINOUT_COL_STRING) << "Demangled function name";
+    *bfbin << uint8_t(BINOUT_COL_UINT64) << "Operations"
+           << uint8_t(BINOUT_COL_UINT64) << "Load operations"
+           << uint8_t(BINOUT_COL_UINT64) << "Store operations"
+           << uint8_t(BINOUT_COL_UINT64) << "Floating-point operations"
+           << uint8_t(BINOUT_COL_UINT64) << "Integer operations"
+           << uint8_t(BINOUT_COL_UINT64) << "Function-call operations (non-exception-throwing)"
+           << uint8_t(BINOUT_COL_UINT64) << "Bytes loaded"
+           << uint8_t(BINOUT_COL_UINT64) << "Bytes stored"
+           << uint8_t(BINOUT_COL_NONE);
+    for (auto titer = threads.cbegin(); titer != threads.cend(); titer++) {
+      const ThreadCounters* tc = *titer;
+      vector<pair<const char*, ByteFlopCounters*> > functions(tc->functions.cbegin(), tc->functions.cend());
+      sort(functions.begin(), functions.end(), compare_function_names);
+      for (auto fiter = functions.cbegin(); fiter != functions.cend(); fiter++) {
+        const ByteFlopCounters& counters = *fiter->second;
+        *bfbin << uint8_t(BINOUT_ROW_DATA)
+               << uint64_t(tc->thread_num)
+               << fiter->first
+               << demangle_func_name(fiter->first)
+               << counters.ops
+               << counters.load_ins
+               << counters.store_ins
+               << counters.flops
+               << integer_ops(counters)
+               << counters.call_ins
+               << counters.loads
+               << counters.stores;
+      }
+    }
+    *bfbin << uint8_t(BINOUT_ROW_NONE);
+  }
+  pthread_mutex_unlock(&thread_counters_lock);
+}
+
+// Return the number of threads that executed instrumented code and the
+// maximum and total per-thread operations, flops, and bytes.
+void bf_get_thread_summary (uint64_t* threads,
+                            uint64_t* max_ops, uint64_t* total_ops,
+                            uint64_t* max_flops, uint64_t* total_flops,
+                            uint64_t* max_bytes, uint64_t* total_bytes)
+{
+  *max_ops = *total_ops = *max_flops = *total_flops = *max_bytes = *total_bytes = 0;
+  pthread_mutex_lock(&thread_counters_lock);
+  *threads = all_thread_counters->size();
+  for (auto titer = all_thread_counters->cbegin(); titer != all_thread_counters->cend(); titer++) {
+    const ByteFlopCounters& counters = (*titer)->counters;
+    uint64_t bytes = counters.loads + counters.stores;
+    *max_ops = max(*max_ops, counters.ops);
+    *total_ops += counters.ops;
+    *max_flops = max(*max_flops, counters.flops);
+    *total_flops += counters.flops;
+    *max_bytes = max(*max_bytes, bytes);
+    *total_bytes += bytes;
+  }
+  pthread_mutex_unlock(&thread_counters_lock);
+}
+
 } // namespace bytesflops
@@ -0,0 +1,258 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (modeling TLB reach for various page sizes)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+#include "cache-model.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+extern BinaryOStream* bfbin;
+
+// Define the page sizes we model.
+static const int num_page_sizes = 3;
+static const uint64_t page_sizes[num_page_sizes] = {
+  uint64_t(4) << 10,
+  uint64_t(2) << 20,
+  uint64_t(1) << 30
+};
+static const char* page_size_names[num_page_sizes] = {"4 KB", "2 MB", "1 GB"};
+
+// Report TLB misses for 1, 2, 4, ..., 2^max_entry_bits entries.  Each TLB
+// model retains only as many pages as the largest TLB can hold.
+static const int max_entry_bits = 12;
+static const int num_bins = max_entry_bits + 2;   // Final bin: misses at all sizes
+
+// Summarize in the textual output the misses incurred by a TLB with this
+// many entries.
+static const int summary_entry_bits = 6;
+
+// Tally page accesses by the log base 2 of the number of TLB entries needed
+// for the access to hit.
+class TlbTally {
+public:
+  uint64_t accesses[num_page_sizes][num_bins];
+
+  TlbTally() {
+    memset(accesses, 0, sizeof(accesses));
+  }
+
+  // Record an access at a given LRU stack distance (0=miss).
+  void add (int ps, uint64_t distance) {
+    int bin;
+    if (distance == 0)
+      bin = num_bins - 1;
+    else if (distance == 1)
+      bin = 0;
+    else {
+      bin = 64 - __builtin_clzll(distance - 1);
+      if (bin > max_entry_bits)
+        bin = num_bins - 1;
+    }
+    accesses[ps][bin]++;
+  }
+
+  // Incorporate another set of tallies into our own.
+  void merge (const TlbTally& other) {
+    for (int ps = 0; ps < num_page_sizes; ps++)
+      for (int b = 0; b < num_bins; b++)
+        accesses[ps][b] += other.accesses[ps][b];
+  }
+
+  // Return the total number of page accesses for a given page size.
+  uint64_t total (int ps) const {
+    uint64_t sum = 0;
+    for (int b = 0; b < num_bins; b++)
+      sum += accesses[ps][b];
+    return sum;
+  }
+
+  // Return the number of misses in a TLB with 2^entry_bits entries.
+  uint64_t misses (int ps, int entry_bits) const {
+    uint64_t sum = 0;
+    for (int b = entry_bits + 1; b < num_bins; b++)
+      sum += accesses[ps][b];
+    return sum;
+  }
+};
+
+// Maintain each thread's TLB models and tallies.  TLBs are private to a
+// core, so each thread gets its own.
+class ThreadTlb {
+public:
+  Cache* tlbs[num_page_sizes];
+  unordered_map<const char*, TlbTally> by_func;
+  unordered_map<const void*, TlbTally> by_dstruct;
+
+  ThreadTlb() {
+    for (int ps = 0; ps < num_page_sizes; ps++) {
+      tlbs[ps] = new Cache(page_sizes[ps], 1, false);
+      tlbs[ps]->recordDistances();
+      tlbs[ps]->setCapacity(uint64_t(1) << max_entry_bits);
+    }
+  }
+};
+static __thread ThreadTlb* thread_tlb = nullptr;
+static vector<ThreadTlb*>* all_tlbs = nullptr;
+
+// Serialize all accesses to all_tlbs.
+static pthread_mutex_t tlb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Initialize some of our variables at first use.
+void initialize_tlb (void)
+{
+  all_tlbs = new vector<ThreadTlb*>();
+}
+
+// Run a range of addresses through each TLB model on behalf of a given
+// function.
+extern "C"
+void bf_touch_tlb (const char* funcname, uint64_t baseaddr, uint64_t numaddrs)
+{
+  // Do nothing if counting is suppressed.
+  if (bf_suppress_counting || numaddrs == 0)
+    return;
+
+  // Create the calling thread's TLBs on first use.
+  ThreadTlb* tt = thread_tlb;
+  if (__builtin_expect(tt == nullptr, 0)) {
+    tt = new ThreadTlb();
+    pthread_mutex_lock(&tlb_lock);
+    all_tlbs->push_back(tt);
+    pthread_mutex_unlock(&tlb_lock);
+    thread_tlb = tt;
+  }
+
+  // Tally the LRU stack distance of every page touched.
+  TlbTally& func_tally = tt->by_func[bf_call_stack ? bf_func_and_parents : funcname];
+  TlbTally* dstruct_tally = nullptr;
+  if (bf_data_structs) {
+    const void* dstruct = bf_find_data_struct(baseaddr);
+    if (dstruct != nullptr)
+      dstruct_tally = &tt->by_dstruct[dstruct];
+  }
+  for (int ps = 0; ps < num_page_sizes; ps++) {
+    tt->tlbs[ps]->access(baseaddr, numaddrs);
+    const vector<uint64_t>& distances = tt->tlbs[ps]->getLastDistances();
+    for (auto iter = distances.cbegin(); iter != distances.cend(); iter++) {
+      func_tally.add(ps, *iter);
+      if (dstruct_tally != nullptr)
+        dstruct_tally->add(ps, *iter);
+    }
+  }
+}
+
+// Sort tallies by name.
+typedef pair<string, TlbTally> named_tally_t;
+static bool compare_named_tallies (const named_tally_t& a, const named_tally_t& b)
+{
+  return a.first < b.first;
+}
+
+// Output a table of TLB misses for a list of named tallies.
+static void report_tlb_tallies (const char* table_name, bool by_func,
+                                const vector<named_tally_t>& tallies)
+{
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << table_name;
+  if (by_func)
+    *bfbin << uint8_t(BINOUT_COL_STRING) << "Mangled function name"
+           << uint8_t(BINOUT_COL_STRING) << "Demangled function name";
+  else
+    *bfbin << uint8_t(BINOUT_COL_STRING) << "Data structure";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Page size"
+         << uint8_t(BINOUT_COL_UINT64) << "Page accesses";
+  for (int e = 0; e <= max_entry_bits; e++)
+    *bfbin << uint8_t(BINOUT_COL_UINT64)
+           << "Misses (" + to_string(uint64_t(1) << e) + " entries)";
+  *bfbin << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = tallies.cbegin(); iter != tallies.cend(); iter++) {
+    const TlbTally& tally = iter->second;
+    for (int ps = 0; ps < num_page_sizes; ps++) {
+      *bfbin << uint8_t(BINOUT_ROW_DATA);
+      if (by_func)
+        *bfbin << iter->first << demangle_func_name(iter->first);
+      else
+        *bfbin << iter->first;
+      *bfbin << page_sizes[ps] << tally.total(ps);
+      for (int e = 0; e <= max_entry_bits; e++)
+        *bfbin << tally.misses(ps, e);
+    }
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+}
+
+// Report TLB miss curves for the program as a whole, by function, and, if
+// data structures are being tracked, by data structure.  Return, for each
+// page size, the number of page accesses and the number of misses in a TLB
+// with 2^summary_entry_bits entries.
+void bf_report_tlb (vector<uint64_t>& accesses, vector<uint64_t>& misses)
+{
+  // Merge all threads' tallies by function and by data structure.
+  pthread_mutex_lock(&tlb_lock);
+  TlbTally program;
+  map<string, TlbTally> by_func;
+  unordered_map<const void*, TlbTally> by_dstruct;
+  for (auto titer = all_tlbs->cbegin(); titer != all_tlbs->cend(); titer++) {
+    const ThreadTlb* tt = *titer;
+    for (auto iter = tt->by_func.cbegin(); iter != tt->by_func.cend(); iter++) {
+      by_func[iter->first == nullptr ? "" : iter->first].merge(iter->second);
+      program.merge(iter->second);
+    }
+    for (auto iter = tt->by_dstruct.cbegin(); iter != tt->by_dstruct.cend(); iter++)
+      by_dstruct[iter->first].merge(iter->second);
+  }
+  pthread_mutex_unlock(&tlb_lock);
+
+  // Output the program-wide miss curve for each page size.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "TLB miss curves";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Page size"
+         << uint8_t(BINOUT_COL_UINT64) << "TLB entries"
+         << uint8_t(BINOUT_COL_UINT64) << "Page accesses"
+         << uint8_t(BINOUT_COL_UINT64) << "TLB misses"
+         << uint8_t(BINOUT_COL_NONE);
+  accesses.resize(num_page_sizes);
+  misses.resize(num_page_sizes);
+  for (int ps = 0; ps < num_page_sizes; ps++) {
+    accesses[ps] = program.total(ps);
+    misses[ps] = program.misses(ps, summary_entry_bits);
+    for (int e = 0; e <= max_entry_bits; e++)
+      *bfbin << uint8_t(BINOUT_ROW_DATA)
+             << page_sizes[ps]
+             << (uint64_t(1) << e)
+             << accesses[ps]
+             << program.misses(ps, e);
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Output miss curves by function.
+  vector<named_tally_t> func_tallies(by_func.cbegin(), by_func.cend());
+  report_tlb_tallies("TLB misses by function", true, func_tallies);
+
+  // Output miss curves by data structure.
+  if (bf_data_structs) {
+    vector<named_tally_t> dstruct_tallies;
+    for (auto iter = by_dstruct.cbegin(); iter != by_dstruct.cend(); iter++)
+      dstruct_tallies.push_back(named_tally_t(bf_describe_data_struct(iter->first), iter->second));
+    sort(dstruct_tallies.begin(), dstruct_tallies.end(), compare_named_tallies);
+    report_tlb_tallies("TLB misses by data structure", false, dstruct_tallies);
+  }
+}
+
+// Describe a page size.
+const char* bf_tlb_page_size_name (size_t idx)
+{
+  return page_size_names[idx];
+}
+
+// Return the number of TLB entries summarized by bf_report_tlb().
+uint64_t bf_tlb_summary_entries (void)
+{
+  return uint64_t(1) << summary_entry_bits;
+}
+
+} // namespace bytesflops
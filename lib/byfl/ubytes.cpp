@@ -14,7 +14,8 @@ namespace bytesflops {
 
 // Keep track of the unique bytes touched by each function and by the program
 // as a whole.
-typedef CachedUnorderedMap<const char*, BitPageTable*> func_to_page_t;
+typedef CachedUnorderedMap<const char*, FuncBitPageTable*, hash<const char*>, equal_to<const char*>,
+                           CountingAllocator<pair<const char* const, FuncBitPageTable*>, BF_MEM_FUNC_PAGE_TABLES> > func_to_page_t;
 static BitPageTable* global_unique_bytes = nullptr;
 static func_to_page_t* function_unique_bytes = nullptr;
 
@@ -44,21 +45,37 @@ uint64_t bf_tally_unique_addresses (void)
   return global_unique_bytes->tally_unique();
 }
 
+// Replace each per-function page table that consumes more memory than a
+// sketch with a sketch.  This is invoked when the per-function page tables
+// exceed their share of the BF_MAX_MEMORY budget.
+static void sketch_large_tables (void)
+{
+  for (auto map_iter = function_unique_bytes->begin();
+       map_iter != function_unique_bytes->end();
+       map_iter++)
+    if (map_iter->second->footprint() > UniqueSketch<BF_MEM_FUNC_PAGE_TABLES>::footprint())
+      map_iter->second->convert_to_sketch();
+  bf_mem_degraded(BF_MEM_FUNC_PAGE_TABLES,
+                  "Per-function unique-byte counts are estimates");
+}
+
 // Associate a set of memory locations with a given function.  Return
 // the page-to-bit-vector mapping for the given function.
-static BitPageTable* assoc_addresses_with_func (const char* funcname,
-                                                uint64_t baseaddr,
-                                                uint64_t numaddrs)
+static FuncBitPageTable* assoc_addresses_with_func (const char* funcname,
+                                                    uint64_t baseaddr,
+                                                    uint64_t numaddrs)
 {
-  BitPageTable* unique_bytes;
+  FuncBitPageTable* unique_bytes;
   func_to_page_t::iterator map_iter = function_unique_bytes->find(funcname);
   if (map_iter == function_unique_bytes->end())
     // This is the first time we've seen this function.
-    (*function_unique_bytes)[funcname] = unique_bytes = new BitPageTable(logical_page_size);
+    (*function_unique_bytes)[funcname] = unique_bytes = new FuncBitPageTable(logical_page_size);
   else
     // We've seen this function before.
     unique_bytes = map_iter->second;
   unique_bytes->access(baseaddr, numaddrs);
+  if (bf_mem_over_budget(BF_MEM_FUNC_PAGE_TABLES))
+    sketch_large_tables();
   return unique_bytes;
 }
 
@@ -87,6 +104,15 @@ void bf_assoc_addresses_with_prog (uint64_t baseaddr, uint64_t numaddrs)
   if (bf_suppress_counting)
     return;
   global_unique_bytes->access(baseaddr, numaddrs);
+  if (__builtin_expect(bf_omp_active, 0))
+    bf_omp_assoc_addresses(baseaddr, numaddrs);
+  if (bf_threads)
+    bf_thread_assoc_addresses(baseaddr, numaddrs);
+  if (bf_mem_over_budget(BF_MEM_PAGE_TABLES) && !global_unique_bytes->is_approximate()) {
+    // We're out of memory.  Estimate rather than count unique bytes.
+    global_unique_bytes->convert_to_sketch();
+    bf_mem_degraded(BF_MEM_PAGE_TABLES, "The program's unique-byte count is an estimate");
+  }
 }
 
 } // namespace bytesflops
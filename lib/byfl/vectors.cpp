@@ -71,6 +71,51 @@ typedef CachedUnorderedMap<const char*, vector_to_tally_t*> name_to_vector_t;
 static name_to_vector_t* function_vector_usage = NULL;
 static name_to_vector_t* user_defined_vector_usage = NULL;
 
+// Keep track of the static vector-operation tallies registered by each
+// instrumented module and how much of each tally has already been moved into
+// function_vector_usage.  Module constructors may run before the library is
+// initialized so allocate the list on first use.
+class SlotTable {
+public:
+  const bf_vector_slot_t* slots;   // Static tallies registered by a module
+  uint64_t num_slots;              // Number of entries in slots[]
+  vector<uint64_t> drained;        // Value of each tally when last moved
+
+  SlotTable(const bf_vector_slot_t* s, uint64_t n) :
+    slots(s), num_slots(n), drained(n, 0) { }
+};
+static vector<SlotTable>& vector_slot_tables (void)
+{
+  static vector<SlotTable>* tables = new vector<SlotTable>();
+  return *tables;
+}
+
+
+// Name each kind of masked vector memory operation.
+static const char* lane_op_names[BF_VECLANE_NUM] = {
+  "masked load",
+  "masked store",
+  "gather",
+  "scatter",
+  "expanding load",
+  "compressing store"
+};
+
+// Encapsulate lane utilization for one kind of masked vector memory
+// operation in one function.
+class LaneTally {
+public:
+  uint64_t operations = 0;      // Number of operations performed
+  uint64_t lanes = 0;           // Total number of lanes across all operations
+  uint64_t active_lanes = 0;    // Number of lanes enabled by the mask
+  uint64_t lines = 0;           // Distinct cache lines touched by active lanes (gathers and scatters only)
+  uint64_t conflicts = 0;       // Active lanes writing an address another active lane also writes (scatters only)
+};
+
+// Keep track of lane utilization by function and kind of operation.
+typedef pair<const char*, uint8_t> lane_key_t;
+static map<lane_key_t, LaneTally>* lane_usage = NULL;
+
 
 namespace bytesflops {
 
@@ -81,12 +126,14 @@ void initialize_vectors (void)
 {
   function_vector_usage = new name_to_vector_t();
   user_defined_vector_usage = new name_to_vector_t();
+  lane_usage = new map<lane_key_t, LaneTally>();
 }
 
-// Associate a vector operation with a given name.
+// Associate a given number of vector operations with a given name.
 static void tally_vector_operation (name_to_vector_t* vector_usage,
                                     const char *tag, uint64_t num_elements,
-                                    uint64_t element_bits, bool is_flop)
+                                    uint64_t element_bits, bool is_flop,
+                                    uint64_t tally=1)
 {
   // Find or create the associated vector-to-tally mapping.
   name_to_vector_t::iterator vectally_iter = vector_usage->find(tag);
@@ -94,7 +141,7 @@ static void tally_vector_operation (name_to_vector_t* vector_usage,
     // This is the first time we've seen this tag.  Give it a fresh
     // map and return.
     vector_to_tally_t* newvectally = new vector_to_tally_t();
-    (*newvectally)[new VectorOperation(num_elements, element_bits, is_flop)] = 1;
+    (*newvectally)[new VectorOperation(num_elements, element_bits, is_flop)] = tally;
     (*vector_usage)[tag] = newvectally;
     return;
   }
@@ -107,11 +154,120 @@ static void tally_vector_operation (name_to_vector_t* vector_usage,
   if (tally_iter == vectally->end()) {
     // This is the first time we've seen this vector type in the
     // current tag.  Create an initial tally and return.
-    (*vectally)[search_vector] = 1;
+    (*vectally)[search_vector] = tally;
     search_vector = new VectorOperation();
     return;
   }
-  tally_iter->second++;
+  tally_iter->second += tally;
+}
+
+// Record a module's table of static vector-operation tallies.  The
+// instrumented code increments each slot's tally directly; we decode the
+// tables only when the tallies are needed.
+extern "C"
+void bf_register_vector_slots (const bf_vector_slot_t* slots, uint64_t num_slots)
+{
+  vector_slot_tables().push_back(SlotTable(slots, num_slots));
+}
+
+// Tally the active lanes of a masked vector memory operation.  mask has one
+// bit per lane.  For gathers and scatters, addresses points to the address
+// accessed by each lane; otherwise it is NULL.
+extern "C"
+void bf_tally_vector_lanes (const char *funcname, uint8_t kind,
+                            uint64_t num_lanes, uint64_t mask,
+                            uint64_t element_bytes, const uint64_t* addresses)
+{
+  // Do nothing if counting is suppressed.
+  if (bf_suppress_counting)
+    return;
+
+  // Tally the active lanes.
+  if (bf_per_func)
+    if (bf_call_stack)
+      funcname = bf_func_and_parents;
+    else
+      funcname = bf_string_to_symbol(funcname);
+  else
+    funcname = "";
+  LaneTally& tally = (*lane_usage)[lane_key_t(funcname, kind)];
+  tally.operations++;
+  tally.lanes += num_lanes;
+  tally.active_lanes += __builtin_popcountll(mask);
+  if (addresses == NULL)
+    return;
+
+  // For gathers and scatters, count the distinct cache lines touched and
+  // the lanes whose address duplicates that of an earlier lane.
+  uint64_t lines[64];
+  uint64_t num_lines = 0;
+  for (uint64_t i = 0; i < num_lanes; i++) {
+    if ((mask & (uint64_t(1) << i)) == 0)
+      continue;
+    uint64_t first_line = addresses[i]/bf_line_size;
+    uint64_t last_line = (addresses[i] + element_bytes - 1)/bf_line_size;
+    for (uint64_t line = first_line; line <= last_line; line++) {
+      uint64_t j;
+      for (j = 0; j < num_lines; j++)
+        if (lines[j] == line)
+          break;
+      if (j == num_lines && num_lines < 64)
+        lines[num_lines++] = line;
+    }
+    if (kind == BF_VECLANE_SCATTER)
+      for (uint64_t j = 0; j < i; j++)
+        if ((mask & (uint64_t(1) << j)) != 0 && addresses[j] == addresses[i]) {
+          tally.conflicts++;
+          break;
+        }
+  }
+  tally.lines += num_lines;
+}
+
+// Acquire program-wide lane-utilization statistics for each kind of masked
+// vector memory operation.  Each argument points to an array of
+// BF_VECLANE_NUM elements.
+void bf_get_vector_lane_statistics (uint64_t* operations, uint64_t* lanes,
+                                    uint64_t* active_lanes, uint64_t* lines,
+                                    uint64_t* conflicts)
+{
+  for (int k = 0; k < BF_VECLANE_NUM; k++)
+    operations[k] = lanes[k] = active_lanes[k] = lines[k] = conflicts[k] = 0;
+  for (auto iter = lane_usage->cbegin(); iter != lane_usage->cend(); iter++) {
+    uint8_t k = iter->first.second;
+    const LaneTally& tally = iter->second;
+    operations[k] += tally.operations;
+    lanes[k] += tally.lanes;
+    active_lanes[k] += tally.active_lanes;
+    lines[k] += tally.lines;
+    conflicts[k] += tally.conflicts;
+  }
+}
+
+// Return the name of a kind of masked vector memory operation.
+const char* bf_vector_lane_op_name (uint8_t kind)
+{
+  return lane_op_names[kind];
+}
+
+// Move the growth of each static vector-operation tally since it was last
+// moved into function_vector_usage.  Instrumented threads may still be
+// incrementing the static tallies so we only ever read them.
+static void drain_vector_slots (void)
+{
+  vector<SlotTable>& tables = vector_slot_tables();
+  for (auto titer = tables.begin(); titer != tables.end(); titer++)
+    for (uint64_t i = 0; i < titer->num_slots; i++) {
+      const bf_vector_slot_t& slot = titer->slots[i];
+      uint64_t current = __atomic_load_n(slot.tally, __ATOMIC_RELAXED);
+      uint64_t tally = current - titer->drained[i];
+      if (tally == 0)
+        continue;
+      titer->drained[i] = current;
+      const char* funcname = bf_per_func ? bf_string_to_symbol(slot.function) : "";
+      tally_vector_operation(function_vector_usage, funcname, slot.num_elements,
+                             slot.element_bits, slot.is_flop != 0, tally);
+    }
 }
 
 extern "C"
@@ -140,6 +296,7 @@ void bf_tally_vector_operation (const char *funcname, uint64_t num_elements,
 
 // Acquire statistics on all vector operations encountered.
 void bf_get_vector_statistics(uint64_t* num_ops, uint64_t* total_elts, uint64_t* total_bits) {
+  drain_vector_slots();
   *num_ops = *total_elts = *total_bits = 0;
   for (name_to_vector_t::iterator vectally_iter = function_vector_usage->begin();
        vectally_iter != function_vector_usage->end();
@@ -176,9 +333,21 @@ void bf_get_vector_statistics(const char* tag, uint64_t* num_ops, uint64_t* tota
   }
 }
 
+// Sort lane-utilization keys by function name then by kind of operation.
+static bool compare_lane_keys (const lane_key_t& a, const lane_key_t& b)
+{
+  int cmp = strcmp(a.first, b.first);
+  if (cmp != 0)
+    return cmp < 0;
+  return a.second < b.second;
+}
+
 // Output a histogram of all vector operations encountered.
 void bf_report_vector_operations (void)
 {
+  // Incorporate the static tallies.
+  drain_vector_slots();
+
   // Output a binary table header.
   *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Vector operations";
   *bfbin << uint8_t(BINOUT_COL_UINT64) << "Elements per vector"
@@ -214,6 +383,42 @@ void bf_report_vector_operations (void)
     }
   }
   *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Output lane utilization for each masked vector memory operation, sorted
+  // by function name then by kind of operation.
+  vector<lane_key_t> lane_keys;
+  for (auto iter = lane_usage->cbegin(); iter != lane_usage->cend(); iter++)
+    lane_keys.push_back(iter->first);
+  sort(lane_keys.begin(), lane_keys.end(), compare_lane_keys);
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Vector-lane utilization";
+  *bfbin << uint8_t(BINOUT_COL_STRING) << "Operation"
+         << uint8_t(BINOUT_COL_UINT64) << "Tally"
+         << uint8_t(BINOUT_COL_UINT64) << "Lanes"
+         << uint8_t(BINOUT_COL_UINT64) << "Active lanes"
+         << uint8_t(BINOUT_COL_UINT64) << "Distinct cache lines"
+         << uint8_t(BINOUT_COL_UINT64) << "Conflicting lanes";
+  if (bf_per_func) {
+    if (bf_call_stack)
+      *bfbin << uint8_t(BINOUT_COL_STRING) << "Mangled call stack"
+             << uint8_t(BINOUT_COL_STRING) << "Demangled call stack";
+    else
+      *bfbin << uint8_t(BINOUT_COL_STRING) << "Mangled function name"
+             << uint8_t(BINOUT_COL_STRING) << "Demangled function name";
+  }
+  *bfbin << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = lane_keys.cbegin(); iter != lane_keys.cend(); iter++) {
+    const LaneTally& tally = (*lane_usage)[*iter];
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << lane_op_names[iter->second]
+           << tally.operations
+           << tally.lanes
+           << tally.active_lanes
+           << tally.lines
+           << tally.conflicts;
+    if (bf_per_func)
+      *bfbin << iter->first << demangle_func_name(iter->first);
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
 }
 
 } // namespace bytesflops
@@ -128,6 +128,37 @@ namespace bytesflops_pass {
                cl::desc("Log base 2 of the maximum number of sets modeled at the same time."),
                cl::value_desc("bits"));
 
+  // Define a command-line option to specify the hardware prefetcher the cache
+  // model should simulate.
+  cl::opt<bf_prefetcher_t>
+  Prefetcher("bf-prefetch", cl::init(BF_PREFETCH_NONE), cl::NotHidden,
+             cl::desc("Hardware prefetcher for the simple cache model to simulate"),
+             cl::values(clEnumValN(BF_PREFETCH_NONE,      "none",      "Demand fetch only"),
+                        clEnumValN(BF_PREFETCH_NEXT_LINE, "next-line", "Prefetch the lines following each miss"),
+                        clEnumValN(BF_PREFETCH_STRIDE,    "stride",    "Prefetch along each load/store site's stride"),
+                        clEnumValN(BF_PREFETCH_STREAM,    "stream",    "Prefetch along sequential streams of misses")));
+
+  // Define a command-line option to specify how many lines the prefetcher
+  // fetches at a time.
+  cl::opt<unsigned long long>
+  PrefetchDegree("bf-prefetch-degree", cl::init(1), cl::NotHidden,
+                 cl::desc("Number of lines the modeled prefetcher fetches at a time."),
+                 cl::value_desc("lines"));
+
+  // Define a command-line option to specify how far ahead the prefetcher
+  // fetches.
+  cl::opt<unsigned long long>
+  PrefetchDistance("bf-prefetch-distance", cl::init(1), cl::NotHidden,
+                   cl::desc("Number of lines (or strides) ahead the modeled prefetcher fetches."),
+                   cl::value_desc("lines"));
+
+  // Define a command-line option to specify the capacity of the cache
+  // against which prefetches are judged useful or useless.
+  cl::opt<unsigned long long>
+  PrefetchCacheLines("bf-prefetch-cache", cl::init(512), cl::NotHidden,
+                     cl::desc("Number of lines in the cache into which the modeled prefetcher fetches."),
+                     cl::value_desc("lines"));
+
   static RegisterPass<BytesFlops> H("bytesflops", "Bytes:flops instrumentation");
 
   // Define a command-line option for tracking load/store strides.
@@ -135,4 +166,71 @@ namespace bytesflops_pass {
   TrackStrides("bf-strides", cl::init(false), cl::NotHidden,
                cl::desc("Track data-access strides on a per-call-point basis"));
 
+  // Define a command-line option for tracking which threads touch which
+  // pages of memory.
+  cl::opt<bool>
+  TrackNUMA("bf-numa", cl::init(false), cl::NotHidden,
+            cl::desc("Track first-touch and cross-thread sharing of memory pages"));
+
+  // Define a command-line option for detecting true and false sharing of
+  // cache lines.
+  cl::opt<bool>
+  FalseSharing("bf-false-sharing", cl::init(false), cl::NotHidden,
+               cl::desc("Distinguish true from false sharing of cache lines across threads"));
+
+  // Define a command-line option for modeling TLB reach.
+  cl::opt<bool>
+  TLBModel("bf-tlb", cl::init(false), cl::NotHidden,
+           cl::desc("Model TLB misses for 4 KB, 2 MB, and 1 GB pages"));
+
+  // Define a command-line option for histogramming memory-intrinsic sizes by
+  // call site.
+  cl::opt<bool>
+  TallyMemIntrinsics("bf-mem-intrinsics", cl::init(false), cl::NotHidden,
+                     cl::desc("Histogram memset/memcpy/memmove sizes by call site"));
+
+  // Define a command-line option for profiling conditional branches by site.
+  cl::opt<bool>
+  TrackBranches("bf-branches", cl::init(false), cl::NotHidden,
+                cl::desc("Model branch mispredictions for each conditional-branch site"));
+
+  // Define a command-line option for profiling the targets of indirect calls.
+  cl::opt<bool>
+  TrackCallTargets("bf-call-targets", cl::init(false), cl::NotHidden,
+                   cl::desc("Tally the targets of each indirect-call site"));
+
+  // Define a command-line option for detecting redundant loads and silent
+  // stores.
+  cl::opt<bool>
+  TrackRedundancy("bf-redundant", cl::init(false), cl::NotHidden,
+                  cl::desc("Tally redundant loads and silent stores by site"));
+
+  // Define a command-line option for tallying accesses to individual
+  // structure fields.
+  cl::opt<bool>
+  TrackStructFields("bf-struct-fields", cl::init(false), cl::NotHidden,
+                    cl::desc("Tally loads and stores by structure field"));
+
+  // Define a command-line option for tallying counters by source line.
+  cl::opt<bool>
+  TallyByLine("bf-by-line", cl::init(false), cl::NotHidden,
+              cl::desc("Tally loads, stores, flops, and ops by source line"));
+
+  // Define a command-line option for reporting inner loops that are
+  // candidates for vectorization.
+  cl::opt<bool>
+  TallyLoops("bf-loops", cl::init(false), cl::NotHidden,
+             cl::desc("Rank inner loops by estimated benefit from vectorization"));
+
+  // Define a command-line option for tallying counters by thread.
+  cl::opt<bool>
+  TallyThreads("bf-threads", cl::init(false), cl::NotHidden,
+               cl::desc("Tally counters separately for each thread"));
+
+  // Define a command-line option for tallying counters by function and
+  // thread.
+  cl::opt<bool>
+  TallyThreadFuncs("bf-thread-funcs", cl::init(false), cl::NotHidden,
+                   cl::desc("Tally counters separately for each function and thread"));
+
 }  // namespace bytesflops_pass
@@ -17,13 +17,17 @@
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
 #include "llvm/IR/GlobalValue.h"
+#include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
@@ -35,6 +39,7 @@
 #include <vector>
 #include <memory>
 #include <set>
+#include <tuple>
 #include <iomanip>
 #include <unordered_map>
 #include <time.h>
@@ -120,12 +125,61 @@ namespace bytesflops_pass {
   // Define a command-line option for log2 of the maximum number of sets to model.
   extern cl::opt<unsigned long long> CacheMaxSetBits;
 
+  // Define command-line options for the prefetcher the cache model simulates.
+  extern cl::opt<bf_prefetcher_t> Prefetcher;
+  extern cl::opt<unsigned long long> PrefetchDegree;
+  extern cl::opt<unsigned long long> PrefetchDistance;
+  extern cl::opt<unsigned long long> PrefetchCacheLines;
+
   // Define a command-line option for tracking load/store strides.
   extern cl::opt<bool> TrackStrides;
 
+  // Define a command-line option for tracking page first-touch and sharing.
+  extern cl::opt<bool> TrackNUMA;
+
+  // Define a command-line option for detecting false sharing.
+  extern cl::opt<bool> FalseSharing;
+
+  // Define a command-line option for modeling TLB reach.
+  extern cl::opt<bool> TLBModel;
+
+  // Define a command-line option for histogramming memory-intrinsic sizes.
+  extern cl::opt<bool> TallyMemIntrinsics;
+
+  // Define a command-line option for profiling conditional branches by site.
+  extern cl::opt<bool> TrackBranches;
+
+  // Define a command-line option for profiling the targets of indirect calls.
+  extern cl::opt<bool> TrackCallTargets;
+
+  // Define a command-line option for detecting redundant loads and silent
+  // stores.
+  extern cl::opt<bool> TrackRedundancy;
+
+  // Define a command-line option for tallying accesses to individual
+  // structure fields.
+  extern cl::opt<bool> TrackStructFields;
+
+  // Define a command-line option for tallying counters by source line.
+  extern cl::opt<bool> TallyByLine;
+
+  // Define a command-line option for reporting inner loops that are
+  // candidates for vectorization.
+  extern cl::opt<bool> TallyLoops;
+
+  // Define a command-line option for tallying counters by thread.
+  extern cl::opt<bool> TallyThreads;
+
+  // Define a command-line option for tallying counters by function and
+  // thread.
+  extern cl::opt<bool> TallyThreadFuncs;
+
   // Destructively remove all instances of a given character from a string.
   extern void remove_all_instances(string& some_string, char some_char);
 
+  // Concatenate a directory name and a file name into a full path.
+  extern string full_file_path(StringRef dirname, StringRef filename);
+
   // Parse a list of function names into a set.  The trick is that
   // demangled C++ function names are split (at commas) across list
   // elements and need to be recombined.
@@ -199,6 +253,7 @@ namespace bytesflops_pass {
 
     static const int CLEAR_CALLS;
     static const int CLEAR_MEM_TYPES;
+    static const int CLEAR_STRUCT_FIELDS;
 
     GlobalVariable* load_var;  // Global reference to bf_load_count, a 64-bit load counter
     GlobalVariable* store_var; // Global reference to bf_store_count, a 64-bit store counter
@@ -214,6 +269,7 @@ namespace bytesflops_pass {
     GlobalVariable* op_var;    // Global reference to bf_op_count, a 64-bit operation counter
     GlobalVariable* op_bits_var;   // Global reference to bf_op_bits_count, a 64-bit operation-bit counter
     GlobalVariable* call_inst_var;              // Global reference to bf_call_ins_count, a 64-bit call-instruction counter
+    GlobalVariable* count_mask_var;             // Global reference to bf_count_mask, zero while counting is suppressed
     uint64_t static_loads;   // Number of static load instructions
     uint64_t static_stores;  // Number of static store instructions
     uint64_t static_flops;   // Number of static floating-point instructions
@@ -234,6 +290,9 @@ namespace bytesflops_pass {
     Function* take_mega_lock;      // Pointer to bf_acquire_mega_lock()
     Function* release_mega_lock;   // Pointer to bf_release_mega_lock()
     Function* tally_vector;        // Pointer to bf_tally_vector_operation()
+    Function* register_vector_slots;   // Pointer to bf_register_vector_slots()
+    Function* tally_vector_lanes;  // Pointer to bf_tally_vector_lanes()
+    Function* register_loops;      // Pointer to bf_register_loops()
     Function* access_data_struct;  // Pointer to bf_access_data_struct()
     Function* assoc_addrs_with_sstruct;     // Pointer to bf_assoc_addresses_with_sstruct()
     Function* assoc_addrs_with_dstruct;     // Pointer to bf_assoc_addresses_with_dstruct
@@ -242,9 +301,20 @@ namespace bytesflops_pass {
     Function* disassoc_addrs_with_dstruct;  // Pointer to bf_disassoc_addresses_with_dstruct
     Function* reuse_dist_prog;   // Pointer to bf_reuse_dist_addrs_prog()
     Function* memset_intrinsic;  // Pointer to LLVM's memset() intrinsic
-    Function* access_cache;      // Pointer to bf_touch_cache()
+    Function* access_cache;      // Pointer to bf_touch_cache() or bf_touch_cache_site()
     Function* tally_bb_exec;     // Pointer to bf_tally_bb_execution()
     Function* track_stride;      // Pointer to bf_track_stride()
+    Function* numa_touch;        // Pointer to bf_numa_touch()
+    Function* track_sharing;     // Pointer to bf_track_sharing()
+    Function* touch_tlb;         // Pointer to bf_touch_tlb()
+    Function* tally_mem_intrin;  // Pointer to bf_tally_mem_intrinsic()
+    Function* track_branch;      // Pointer to bf_track_branch()
+    Function* track_call_target; // Pointer to bf_track_call_target()
+    Function* track_redundancy;  // Pointer to bf_track_redundancy()
+    Function* tally_struct_field;    // Pointer to bf_tally_struct_field()
+    Function* end_struct_field_bb;   // Pointer to bf_end_struct_field_bb()
+    Function* tally_bb_lines;    // Pointer to bf_tally_bb_lines()
+    Function* tally_thread_bb;   // Pointer to bf_tally_thread_bb()
     StringMap<Constant*> func_name_to_arg;   // Map from a function name to an IR function argument
     set<string>* instrument_only;   // Set of functions to instrument; NULL=all
     set<string>* dont_instrument;   // Set of functions not to instrument; NULL=none
@@ -259,6 +329,43 @@ namespace bytesflops_pass {
     str2ul_t loop_len;        // Number of instructions in each inner loop
     StructType* syminfo_type; // bf_symbol_info_t struct type
     AllocaInst* func_syminfo;   // Recyclable, function-local, stack-allocated bf_symbol_info_t struct
+    unordered_map<Type*, AllocaInst*> func_value_slots;   // Recyclable, function-local stack slots, one per type
+    StructType* line_counts_type;   // bf_line_counts_t struct type
+    StructType* vector_slot_type;   // bf_vector_slot_t struct type
+    typedef tuple<string, uint64_t, uint64_t, bool> vector_shape_t;
+    map<vector_shape_t, GlobalVariable*> vector_slots;   // Per-module tally for each {function, elements, bits, flop} tuple
+    StructType* loop_info_type;     // bf_loop_info_t struct type
+
+    // Describe an inner loop and the global variable holding its tallies.
+    struct LoopSlot {
+      GlobalVariable* counters;   // [BF_LOOP_NUM_COUNTERS x i64] tallies
+      BasicBlock* header;         // Loop header
+      string function;            // Name of the function containing the loop
+      string file;                // Name of directory+file containing the loop header
+      unsigned int line;          // Line number of the loop header
+      unsigned int first_line;    // Lowest line number appearing in the loop
+      unsigned int last_line;     // Highest line number appearing in the loop
+      uint64_t calls;             // Number of calls to non-intrinsic functions
+      uint64_t recurrences;       // Number of loop-carried scalars other than induction variables
+    };
+    vector<LoopSlot*> loop_slots;                       // Every inner loop in the module
+    unordered_map<BasicBlock*, LoopSlot*> bb_to_loop;   // Inner loop containing each basic block
+    unordered_map<BasicBlock*, LoopSlot*> bb_enters_loop;   // Inner loop entered unconditionally by each basic block
+    uint64_t bb_loop_counts[BF_LOOP_NUM_COUNTERS];      // Current basic block's contribution to its loop's tallies
+
+    // Tally the static operations a source line contributes to the current
+    // basic block.
+    struct LineTally {
+      uint64_t loads = 0;
+      uint64_t stores = 0;
+      uint64_t load_bytes = 0;
+      uint64_t store_bytes = 0;
+      uint64_t flops = 0;
+      uint64_t ops = 0;
+    };
+    typedef pair<string, unsigned int> file_line_t;
+    map<file_line_t, LineTally> bb_line_tallies;   // Per-line tallies for the current basic block
+    file_line_t bb_last_line;                      // Most recent source line seen in the current basic block
 
     // Say whether one str2ul_t should be output before another.
     class compare_str2ul_t {
@@ -296,6 +403,12 @@ namespace bytesflops_pass {
                                    Constant* global_var,
                                    Value* increment);
 
+    // Insert after a given instruction some code to increment a
+    // global variable unless counting is suppressed.
+    void increment_global_variable_if_counting(BasicBlock::iterator& insert_before,
+                                               Constant* global_var,
+                                               Value* increment);
+
     // Insert after a given instruction some code to increment an
     // element of a global array.
     void increment_global_array(BasicBlock::iterator& insert_before,
@@ -427,6 +540,19 @@ namespace bytesflops_pass {
                          BasicBlock::iterator& insert_before,
                          int& must_clear);
 
+    // Pass the target of an indirect call or invoke to
+    // bf_track_call_target().
+    void instrument_indirect_call(Module* module,
+                                  Instruction* inst,
+                                  Value* callee);
+
+    // Pass the active-lane mask and, for gathers and scatters, the lane
+    // addresses of a masked vector memory operation to
+    // bf_tally_vector_lanes().
+    void instrument_masked_vector_op(Module* module,
+                                     Instruction* inst,
+                                     Function* callee);
+
     // Instrument Invoke instructions.
     void instrument_invoke(Module* module,
                            Instruction* inst,
@@ -520,6 +646,39 @@ namespace bytesflops_pass {
     // addresses on every invocation.
     bool all_constant_refs(Instruction* inst);
 
+    // Determine the structure type and field index, if any, that a pointer
+    // to be loaded from or stored to refers to.
+    bool find_struct_field(Value* ptr, StructType*& struct_type, uint64_t& field);
+
+    // Return the global variable that tallies a given function's vector
+    // operations of a given shape, creating it if necessary.
+    GlobalVariable* vector_slot(Module* module, StringRef function_name,
+                                uint64_t num_elements, uint64_t element_bits,
+                                bool is_flop);
+
+    // Find all inner loops in a function and prepare to tally their
+    // execution.
+    void find_inner_loops(Function& function);
+
+    // Insert code to add a constant to one of an inner loop's tallies.
+    void increment_loop_counter(BasicBlock::iterator& insert_before,
+                                LoopSlot* slot, int idx, uint64_t increment);
+
+    // Insert code to add the current basic block's contribution to its inner
+    // loop's tallies.
+    void insert_loop_tallies(BasicBlock& bb, BasicBlock::iterator& insert_before);
+
+    // Return the tally for the source line to which an instruction belongs.
+    LineTally& line_tally(Instruction& inst);
+
+    // Insert a call to bf_tally_bb_lines() that credits each source line with
+    // its contribution to the current basic block.
+    void insert_line_tallies(Module* module, BasicBlock::iterator& insert_before);
+
+    // Copy a value to a function-local stack slot and return a pointer to
+    // the slot as an i8*.
+    Value* spill_value(Module* module, Value* value, Instruction* insert_before);
+
   public:
     static char ID;
 
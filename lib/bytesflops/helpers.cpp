@@ -160,6 +160,30 @@ void BytesFlops::increment_global_variable(BasicBlock::iterator& insert_before,
   mark_as_byfl(new StoreInst(inc_var, global_var, false, &*insert_before));
 }
 
+// Insert before a given instruction some code to increment a global variable
+// unless the program disabled counting via bf_enable_counting().  Counters
+// the run-time library doesn't update itself need this to respect
+// suppression.
+void BytesFlops::increment_global_variable_if_counting(BasicBlock::iterator& insert_before,
+                                                       Constant* global_var,
+                                                       Value* increment)
+{
+  // %0 = load i64* @bf_count_mask, align 8
+#if LLVM_VERSION_MAJOR >= 11
+  LoadInst* mask = new LoadInst(cast<PointerType>(count_mask_var->getType())->getElementType(), count_mask_var, "mask", false, &*insert_before);
+#else
+  LoadInst* mask = new LoadInst(count_mask_var, "mask", false, &*insert_before);
+#endif
+  mark_as_byfl(mask);
+
+  // %1 = and i64 <increment>, %0
+  BinaryOperator* masked_inc =
+    BinaryOperator::Create(Instruction::And, increment, mask,
+                           "masked_inc", &*insert_before);
+  mark_as_byfl(masked_inc);
+  increment_global_variable(insert_before, global_var, masked_inc);
+}
+
 // Insert before a given instruction some code to increment an element of a
 // global array (really, a pointer to a vector).
 void BytesFlops::increment_global_array(BasicBlock::iterator& insert_before,
@@ -675,6 +699,25 @@ void BytesFlops::insert_end_bb_code (Module* module, KeyType_t funcKey,
                                &*insert_before);
           mark_as_byfl(array_offset);
           increment_global_array(insert_before, terminator_var, array_offset, one);
+
+          // If requested by the user, additionally pass the branch site and
+          // its outcome to bf_track_branch().  As above, a true condition
+          // counts as "not taken".
+          if (TrackBranches) {
+            func_syminfo = find_value_provenance(*module, &inst, inst_to_string(&inst),
+                                                 insert_before, func_syminfo);
+            SelectInst* taken =
+              SelectInst::Create(br_inst->getCondition(),
+                                 ConstantInt::get(globctx, APInt(8, 0)),
+                                 ConstantInt::get(globctx, APInt(8, 1)),
+                                 "bf_taken",
+                                 &*insert_before);
+            mark_as_byfl(taken);
+            vector<Value*> arg_list;
+            arg_list.push_back(func_syminfo);
+            arg_list.push_back(taken);
+            callinst_create(track_branch, arg_list, &*insert_before);
+          }
         }
         else {
           // Unconditional branch -- statically choose to increment
@@ -722,8 +765,22 @@ void BytesFlops::insert_end_bb_code (Module* module, KeyType_t funcKey,
     callinst_create(assoc_counts_with_func, arg_list, &*insert_before);
   }
 
+  // If we're tallying by thread, insert a call to bf_tally_thread_bb() at the
+  // end of the basic block.
+  if (TallyThreads) {
+    vector<Value*> arg_list;
+    arg_list.push_back(map_func_name_to_arg(module, inst.getFunction()->getName()));
+    callinst_create(tally_thread_bb, arg_list, &*insert_before);
+  }
+
+  // If any load or store in the basic block accessed a structure field, insert
+  // a call to bf_end_struct_field_bb() to tally which fields were accessed
+  // together.
+  if (must_clear & CLEAR_STRUCT_FIELDS)
+    callinst_create(end_struct_field_bb, &*insert_before);
+
   // Reset all of our counter variables.
-  if (InstrumentEveryBB || TallyByFunction) {
+  if (InstrumentEveryBB || TallyByFunction || TallyThreads) {
     if (must_clear & CLEAR_LOADS) {
       mark_as_byfl(new StoreInst(zero, load_var, false, &*insert_before));
       mark_as_byfl(new StoreInst(zero, load_inst_var, false, &*insert_before));
@@ -1180,6 +1237,259 @@ AllocaInst* BytesFlops::find_value_provenance(Module& module,
   return find_value_provenance(module, syminfo, &*insert_before, syminfo_struct);
 }
 
+// Determine the structure type and field index, if any, that a pointer to be
+// loaded from or stored to refers to.  We consider only pointers produced by
+// a getelementptr (possibly followed by a bitcast) that indexes into a named
+// structure type and report the innermost structure indexed.
+bool BytesFlops::find_struct_field(Value* ptr, StructType*& struct_type, uint64_t& field)
+{
+  if (BitCastOperator* cast_op = dyn_cast<BitCastOperator>(ptr))
+    ptr = cast_op->getOperand(0);
+  GEPOperator* gep = dyn_cast<GEPOperator>(ptr);
+  if (gep == nullptr)
+    return false;
+  struct_type = nullptr;
+  for (gep_type_iterator gti = gep_type_begin(gep); gti != gep_type_end(gep); gti++)
+    if (StructType* stype = gti.getStructTypeOrNull()) {
+      struct_type = stype;
+      field = cast<ConstantInt>(gti.getOperand())->getZExtValue();
+    }
+  return struct_type != nullptr && struct_type->hasName();
+}
+
+// Return the global variable that tallies a given function's vector
+// operations of a given shape, creating it if necessary.  The run-time
+// library learns of every slot from a table registered by the module
+// constructor.
+GlobalVariable* BytesFlops::vector_slot(Module* module, StringRef function_name,
+                                        uint64_t num_elements, uint64_t element_bits,
+                                        bool is_flop)
+{
+  GlobalVariable*& slot =
+    vector_slots[vector_shape_t(function_name.str(), num_elements, element_bits, is_flop)];
+  if (slot == nullptr) {
+    IntegerType* i64type = Type::getInt64Ty(module->getContext());
+    slot = new GlobalVariable(*module, i64type, false, GlobalValue::PrivateLinkage,
+                              ConstantInt::get(i64type, 0), "bf_vector_slot");
+  }
+  return slot;
+}
+
+// Say whether a loop-header phi node is an induction variable, i.e., a
+// pointer or integer that each iteration advances by a loop-invariant amount.
+static bool is_induction_variable(Loop* loop, PHINode* phi)
+{
+  if (!phi->getType()->isIntegerTy() && !phi->getType()->isPointerTy())
+    return false;
+  for (unsigned int i = 0; i < phi->getNumIncomingValues(); i++) {
+    if (!loop->contains(phi->getIncomingBlock(i)))
+      continue;
+    Value* next = phi->getIncomingValue(i);
+    if (BinaryOperator* binop = dyn_cast<BinaryOperator>(next)) {
+      unsigned int opcode = binop->getOpcode();
+      if (opcode != Instruction::Add && opcode != Instruction::Sub)
+        return false;
+      Value* step = binop->getOperand(0) == phi ? binop->getOperand(1) : binop->getOperand(0);
+      if ((binop->getOperand(0) != phi && binop->getOperand(1) != phi)
+          || !loop->isLoopInvariant(step))
+        return false;
+    }
+    else if (GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(next)) {
+      if (gep->getPointerOperand() != phi)
+        return false;
+      for (auto idx = gep->idx_begin(); idx != gep->idx_end(); idx++)
+        if (!loop->isLoopInvariant(*idx))
+          return false;
+    }
+    else
+      return false;
+  }
+  return true;
+}
+
+// Find all inner loops in a function and prepare to tally their execution.
+// This must be called before the function's control flow is modified.
+void BytesFlops::find_inner_loops(Function& function)
+{
+  bb_to_loop.clear();
+  bb_enters_loop.clear();
+  DominatorTree dom_tree(function);
+  LoopInfo loop_info(dom_tree);
+  LLVMContext& globctx = function.getContext();
+  ArrayType* counters_type =
+    ArrayType::get(Type::getInt64Ty(globctx), BF_LOOP_NUM_COUNTERS);
+  SmallVector<Loop*, 16> worklist(loop_info.begin(), loop_info.end());
+  while (!worklist.empty()) {
+    // Consider only inner loops.
+    Loop* loop = worklist.pop_back_val();
+    if (!loop->getSubLoops().empty()) {
+      worklist.append(loop->begin(), loop->end());
+      continue;
+    }
+
+    // Describe the loop.
+    LoopSlot* slot = new LoopSlot;
+    slot->counters =
+      new GlobalVariable(*function.getParent(), counters_type, false,
+                         GlobalValue::PrivateLinkage,
+                         ConstantAggregateZero::get(counters_type), "bf_loop_counters");
+    slot->header = loop->getHeader();
+    slot->function = function.getName().str();
+    slot->file = "??";
+    slot->line = slot->first_line = slot->last_line = 0;
+    slot->calls = 0;
+    slot->recurrences = 0;
+    for (auto inst_iter = slot->header->begin(); inst_iter != slot->header->end(); inst_iter++)
+      if (const DebugLoc& dbloc = inst_iter->getDebugLoc())
+        if (const DIScope* scope = dyn_cast_or_null<DIScope>(dbloc->getScope())) {
+          slot->file = full_file_path(scope->getDirectory(), scope->getFilename());
+          slot->line = slot->first_line = slot->last_line = dbloc.getLine();
+          break;
+        }
+    for (auto bb_iter = loop->block_begin(); bb_iter != loop->block_end(); bb_iter++) {
+      BasicBlock* bb = *bb_iter;
+      bb_to_loop[bb] = slot;
+      for (auto inst_iter = bb->begin(); inst_iter != bb->end(); inst_iter++) {
+        Instruction& inst = *inst_iter;
+        if (isa<CallInst>(inst) || isa<InvokeInst>(inst)) {
+          Function* callee = isa<CallInst>(inst)
+            ? cast<CallInst>(inst).getCalledFunction()
+            : cast<InvokeInst>(inst).getCalledFunction();
+          if (callee == nullptr || !callee->isIntrinsic())
+            slot->calls++;
+        }
+        if (const DebugLoc& dbloc = inst.getDebugLoc())
+          if (dbloc.getLine() != 0) {
+            slot->first_line = slot->first_line == 0 ? dbloc.getLine() : min(slot->first_line, dbloc.getLine());
+            slot->last_line = max(slot->last_line, dbloc.getLine());
+          }
+      }
+    }
+    for (auto inst_iter = slot->header->begin(); isa<PHINode>(*inst_iter); inst_iter++)
+      if (!is_induction_variable(loop, cast<PHINode>(&*inst_iter)))
+        slot->recurrences++;
+
+    // Count loop entries in each predecessor outside the loop that can
+    // branch only to the loop header.
+    for (auto pred_iter = pred_begin(slot->header); pred_iter != pred_end(slot->header); pred_iter++) {
+      BasicBlock* pred = *pred_iter;
+      if (!loop->contains(pred) && pred->getSingleSuccessor() == slot->header)
+        bb_enters_loop[pred] = slot;
+    }
+    loop_slots.push_back(slot);
+  }
+}
+
+// Insert code to add a constant to one of an inner loop's tallies unless
+// counting is currently suppressed.
+void BytesFlops::increment_loop_counter(BasicBlock::iterator& insert_before,
+                                        LoopSlot* slot, int idx, uint64_t increment)
+{
+  LLVMContext& globctx = slot->counters->getContext();
+  vector<Constant*> getelementptr_indices;
+  getelementptr_indices.push_back(zero);
+  getelementptr_indices.push_back(ConstantInt::get(globctx, APInt(64, idx)));
+  Constant* counter =
+    ConstantExpr::getGetElementPtr(nullptr, slot->counters, getelementptr_indices);
+  increment_global_variable_if_counting(insert_before, counter,
+                                       ConstantInt::get(globctx, APInt(64, increment)));
+}
+
+// Insert code to add the current basic block's contribution to its inner
+// loop's tallies and, if the block enters an inner loop, to that loop's
+// entry count.
+void BytesFlops::insert_loop_tallies(BasicBlock& bb, BasicBlock::iterator& insert_before)
+{
+  auto loop_iter = bb_to_loop.find(&bb);
+  if (loop_iter != bb_to_loop.end()) {
+    LoopSlot* slot = loop_iter->second;
+    if (slot->header == &bb)
+      bb_loop_counts[BF_LOOP_ITERATIONS]++;
+    for (int i = 0; i < BF_LOOP_NUM_COUNTERS; i++)
+      if (bb_loop_counts[i] > 0)
+        increment_loop_counter(insert_before, slot, i, bb_loop_counts[i]);
+  }
+  auto enter_iter = bb_enters_loop.find(&bb);
+  if (enter_iter != bb_enters_loop.end())
+    increment_loop_counter(insert_before, enter_iter->second, BF_LOOP_ENTRIES, 1);
+}
+
+// Return the tally for the source line to which an instruction belongs.
+// Instructions lacking a debug location are attributed to the most recent
+// source line seen in the same basic block.
+BytesFlops::LineTally& BytesFlops::line_tally(Instruction& inst)
+{
+  if (const DebugLoc& dbloc = inst.getDebugLoc())
+    if (const DIScope* scope = dyn_cast_or_null<DIScope>(dbloc->getScope()))
+      bb_last_line = file_line_t(full_file_path(scope->getDirectory(), scope->getFilename()),
+                                 dbloc.getLine());
+  return bb_line_tallies[bb_last_line];
+}
+
+// Insert a call to bf_tally_bb_lines() that credits each source line with its
+// contribution to the current basic block.  The per-line contributions are
+// stored in a constant array of bf_line_counts_t.  The run-time library
+// caches its internal ID for the array in a private, per-block global
+// variable.
+void BytesFlops::insert_line_tallies(Module* module, BasicBlock::iterator& insert_before)
+{
+  if (bb_line_tallies.empty())
+    return;
+  LLVMContext& globctx = module->getContext();
+  IntegerType* i64type = Type::getInt64Ty(globctx);
+  vector<Constant*> records;
+  for (auto iter = bb_line_tallies.cbegin(); iter != bb_line_tallies.cend(); iter++) {
+    const LineTally& tally = iter->second;
+    vector<Constant*> fields;
+    fields.push_back(map_func_name_to_arg(module, iter->first.first));
+    fields.push_back(ConstantInt::get(i64type, iter->first.second));
+    fields.push_back(ConstantInt::get(i64type, tally.loads));
+    fields.push_back(ConstantInt::get(i64type, tally.stores));
+    fields.push_back(ConstantInt::get(i64type, tally.load_bytes));
+    fields.push_back(ConstantInt::get(i64type, tally.store_bytes));
+    fields.push_back(ConstantInt::get(i64type, tally.flops));
+    fields.push_back(ConstantInt::get(i64type, tally.ops));
+    records.push_back(ConstantStruct::get(line_counts_type, fields));
+  }
+  ArrayType* records_type = ArrayType::get(line_counts_type, records.size());
+  GlobalVariable* records_var =
+    new GlobalVariable(*module, records_type, true, GlobalValue::PrivateLinkage,
+                       ConstantArray::get(records_type, records), "bf_line_counts");
+  GlobalVariable* cache_var =
+    new GlobalVariable(*module, i64type, false, GlobalValue::PrivateLinkage,
+                       ConstantInt::get(i64type, 0), "bf_line_counts_id");
+  vector<Constant*> getelementptr_indices;
+  getelementptr_indices.push_back(zero);
+  getelementptr_indices.push_back(zero);
+  vector<Value*> arg_list;
+  arg_list.push_back(cache_var);
+  arg_list.push_back(ConstantExpr::getGetElementPtr(nullptr, records_var, getelementptr_indices));
+  arg_list.push_back(ConstantInt::get(i64type, records.size()));
+  callinst_create(tally_bb_lines, arg_list, &*insert_before);
+  bb_line_tallies.clear();
+}
+
+// Copy a value to a function-local stack slot and return a pointer to the
+// slot as an i8*.  Slots are allocated in the function's bf_entry block and
+// recycled across all values of the same type.
+Value* BytesFlops::spill_value(Module* module, Value* value, Instruction* insert_before)
+{
+  LLVMContext& globctx = module->getContext();
+  Type* value_type = value->getType();
+  AllocaInst*& slot = func_value_slots[value_type];
+  if (slot == nullptr) {
+    Function* function = insert_before->getParent()->getParent();
+    slot = new AllocaInst(value_type, 0, "bf_value_slot", function->front().getTerminator());
+    mark_as_byfl(slot);
+  }
+  StoreInst* spill = new StoreInst(value, slot, insert_before);
+  mark_as_byfl(spill);
+  CastInst* slot_ptr =
+    new BitCastInst(slot, PointerType::get(IntegerType::get(globctx, 8), 0), "", insert_before);
+  mark_as_byfl(slot_ptr);
+  return slot_ptr;
+}
+
 // Return true if an arbitrary instruction provably returns the same values on
 // every invocation.
 static bool all_constant_refs_helper(Instruction* inst)
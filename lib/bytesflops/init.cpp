@@ -192,6 +192,7 @@ namespace bytesflops_pass {
     op_var          = declare_global_var(module, i64type, "bf_op_count");
     op_bits_var     = declare_global_var(module, i64type, "bf_op_bits_count");
     call_inst_var   = declare_global_var(module, i64type, "bf_call_ins_count");
+    count_mask_var  = declare_global_var(module, i64type, "bf_count_mask");
 
     // bf_inst_deps_histo is a bit tricky because it's a 3D array.
     ArrayType* i64array1Dtype = ArrayType::get(i64type, 2);
@@ -224,6 +225,54 @@ namespace bytesflops_pass {
     }
     PointerType* ptr_to_syminfo_arg = PointerType::get(syminfo_type, 0);
 
+    // Declare a bf_line_counts_t struct type.
+#if LLVM_VERSION_MAJOR >= 12
+    line_counts_type = StructType::getTypeByName(globctx, "struct.bf_line_counts_t");
+#else
+    line_counts_type = module.getTypeByName("struct.bf_line_counts_t");
+#endif
+    if (line_counts_type == nullptr) {
+      line_counts_type = StructType::create(globctx, "struct.bf_line_counts_t");
+      std::vector<Type*> line_counts_fields;
+      line_counts_fields.push_back(ptr_to_char_arg);
+      for (int i = 0; i < 7; i++)
+        line_counts_fields.push_back(i64type);
+      line_counts_type->setBody(line_counts_fields, false);
+    }
+
+    // Declare a bf_loop_info_t struct type.
+#if LLVM_VERSION_MAJOR >= 12
+    loop_info_type = StructType::getTypeByName(globctx, "struct.bf_loop_info_t");
+#else
+    loop_info_type = module.getTypeByName("struct.bf_loop_info_t");
+#endif
+    if (loop_info_type == nullptr) {
+      loop_info_type = StructType::create(globctx, "struct.bf_loop_info_t");
+      std::vector<Type*> loop_info_fields;
+      loop_info_fields.push_back(ptr_to_char_arg);
+      loop_info_fields.push_back(ptr_to_char_arg);
+      for (int i = 0; i < 5; i++)
+        loop_info_fields.push_back(i64type);
+      loop_info_fields.push_back(PointerType::get(i64type, 0));
+      loop_info_type->setBody(loop_info_fields, false);
+    }
+
+    // Declare a bf_vector_slot_t struct type.
+#if LLVM_VERSION_MAJOR >= 12
+    vector_slot_type = StructType::getTypeByName(globctx, "struct.bf_vector_slot_t");
+#else
+    vector_slot_type = module.getTypeByName("struct.bf_vector_slot_t");
+#endif
+    if (vector_slot_type == nullptr) {
+      vector_slot_type = StructType::create(globctx, "struct.bf_vector_slot_t");
+      std::vector<Type*> vector_slot_fields;
+      vector_slot_fields.push_back(ptr_to_char_arg);
+      for (int i = 0; i < 3; i++)
+        vector_slot_fields.push_back(i64type);
+      vector_slot_fields.push_back(PointerType::get(i64type, 0));
+      vector_slot_type->setBody(vector_slot_fields, false);
+    }
+
     // Assign a few constant values.
     not_end_of_bb = ConstantInt::get(globctx, APInt(32, 0));
     uncond_end_bb = ConstantInt::get(globctx, APInt(32, 1));
@@ -278,6 +327,42 @@ namespace bytesflops_pass {
     // Assign a value to bf_strides.
     create_global_constant(module, "bf_strides", bool(TrackStrides));
 
+    // Assign a value to bf_numa.
+    create_global_constant(module, "bf_numa", bool(TrackNUMA));
+
+    // Assign a value to bf_false_sharing.
+    create_global_constant(module, "bf_false_sharing", bool(FalseSharing));
+
+    // Assign a value to bf_tlb.
+    create_global_constant(module, "bf_tlb", bool(TLBModel));
+
+    // Assign a value to bf_mem_intrinsics.
+    create_global_constant(module, "bf_mem_intrinsics", bool(TallyMemIntrinsics));
+
+    // Assign a value to bf_branches.
+    create_global_constant(module, "bf_branches", bool(TrackBranches));
+
+    // Assign a value to bf_call_targets.
+    create_global_constant(module, "bf_call_targets", bool(TrackCallTargets));
+
+    // Assign a value to bf_redundancy.
+    create_global_constant(module, "bf_redundancy", bool(TrackRedundancy));
+
+    // Assign a value to bf_struct_fields.
+    create_global_constant(module, "bf_struct_fields", bool(TrackStructFields));
+
+    // Assign a value to bf_by_line.
+    create_global_constant(module, "bf_by_line", bool(TallyByLine));
+
+    // Assign a value to bf_loops.
+    create_global_constant(module, "bf_loops", bool(TallyLoops));
+
+    // Assign values to bf_threads and bf_thread_funcs.
+    if (TallyThreadFuncs && !TallyThreads)
+      report_fatal_error("-bf-thread-funcs is allowed only in conjuction with -bf-threads");
+    create_global_constant(module, "bf_threads", bool(TallyThreads));
+    create_global_constant(module, "bf_thread_funcs", bool(TallyThreadFuncs));
+
     // Assign a value to bf_max_reuse_dist.
     create_global_constant(module, "bf_max_reuse_distance", uint64_t(MaxReuseDist));
 
@@ -290,6 +375,13 @@ namespace bytesflops_pass {
     // Assign a value to bf_max_sets.
     create_global_constant(module, "bf_max_set_bits", uint64_t(CacheMaxSetBits));
 
+    // Assign values to bf_prefetcher, bf_prefetch_degree,
+    // bf_prefetch_distance, and bf_prefetch_cache.
+    create_global_constant(module, "bf_prefetcher", uint64_t(Prefetcher));
+    create_global_constant(module, "bf_prefetch_degree", uint64_t(PrefetchDegree));
+    create_global_constant(module, "bf_prefetch_distance", uint64_t(PrefetchDistance));
+    create_global_constant(module, "bf_prefetch_cache", uint64_t(PrefetchCacheLines));
+
     // Create a global string that stores all of our command-line options.
     vector<string> command_line = parse_command_line();   // All command-line arguments
     string bf_cmdline;   // Reconstructed command line with -bf-* options only
@@ -410,6 +502,34 @@ namespace bytesflops_pass {
         declare_extern_c(void_func_result,
                          "bf_tally_vector_operation",
                          &module);
+
+      // Declare bf_register_vector_slots(), which the module constructor
+      // calls to report the module's static vector-operation tallies.
+      all_function_args.clear();
+      all_function_args.push_back(PointerType::get(vector_slot_type, 0));
+      all_function_args.push_back(uint64_arg);
+      void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      register_vector_slots =
+        declare_extern_c(void_func_result,
+                         "bf_register_vector_slots",
+                         &module);
+
+      // Declare bf_tally_vector_lanes(), which tallies the active lanes of
+      // masked vector memory operations.
+      all_function_args.clear();
+      all_function_args.push_back(ptr_to_char_arg);
+      all_function_args.push_back(uint8_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(ptr_to_char_arg);
+      void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      tally_vector_lanes =
+        declare_extern_c(void_func_result,
+                         "bf_tally_vector_lanes",
+                         &module);
     }
 
     // Inject external declarations for bf_assoc_addresses_with_prog()
@@ -530,16 +650,23 @@ namespace bytesflops_pass {
                          &module);
     }
 
-    // Declare bf_touch_cache() only if we are asked to use it.
+    // Declare bf_touch_cache() only if we are asked to use it.  Declare
+    // bf_touch_cache_site() instead if we're also modeling a prefetcher or
+    // tallying by function, which need to know which load or store is
+    // accessing the cache.
     if (CacheModel) {
       vector<Type*> all_function_args;
+      if (Prefetcher != BF_PREFETCH_NONE || TallyByFunction)
+        all_function_args.push_back(ptr_to_syminfo_arg);
       all_function_args.push_back(uint64_arg);
       all_function_args.push_back(uint64_arg);
       FunctionType* void_func_result =
         FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
       access_cache =
         declare_extern_c(void_func_result,
-                         "_ZN10bytesflops14bf_touch_cacheEmm",
+                         Prefetcher != BF_PREFETCH_NONE || TallyByFunction
+                         ? "bf_touch_cache_site"
+                         : "_ZN10bytesflops14bf_touch_cacheEmm",
                          &module);
     }
 
@@ -558,6 +685,141 @@ namespace bytesflops_pass {
       track_stride = declare_extern_c(void_func_result, "bf_track_stride", &module);
     }
 
+    // Declare bf_numa_touch() only if we were asked to track page sharing.
+    if (TrackNUMA) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(ptr_to_char_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      numa_touch = declare_extern_c(void_func_result, "bf_numa_touch", &module);
+    }
+
+    // Declare bf_track_sharing() only if we were asked to detect false sharing.
+    if (FalseSharing) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(ptr_to_syminfo_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint8_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      track_sharing = declare_extern_c(void_func_result, "bf_track_sharing", &module);
+    }
+
+    // Declare bf_touch_tlb() only if we were asked to model TLB reach.
+    if (TLBModel) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(ptr_to_char_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      touch_tlb = declare_extern_c(void_func_result, "bf_touch_tlb", &module);
+    }
+
+    // Declare bf_tally_mem_intrinsic() only if we were asked to histogram
+    // memory-intrinsic sizes.
+    if (TallyMemIntrinsics) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(ptr_to_syminfo_arg);
+      all_function_args.push_back(uint8_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      tally_mem_intrin = declare_extern_c(void_func_result, "bf_tally_mem_intrinsic", &module);
+    }
+
+    // Declare bf_track_branch() only if we were asked to profile conditional
+    // branches by site.
+    if (TrackBranches) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(ptr_to_syminfo_arg);
+      all_function_args.push_back(uint8_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      track_branch = declare_extern_c(void_func_result, "bf_track_branch", &module);
+    }
+
+    // Declare bf_track_call_target() only if we were asked to profile the
+    // targets of indirect calls.
+    if (TrackCallTargets) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(ptr_to_syminfo_arg);
+      all_function_args.push_back(uint64_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      track_call_target = declare_extern_c(void_func_result, "bf_track_call_target", &module);
+    }
+
+    // Declare bf_track_redundancy() only if we were asked to detect redundant
+    // loads and silent stores.
+    if (TrackRedundancy) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(ptr_to_syminfo_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(ptr_to_char_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint8_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      track_redundancy = declare_extern_c(void_func_result, "bf_track_redundancy", &module);
+    }
+
+    // Declare bf_tally_struct_field() and bf_end_struct_field_bb() only if we
+    // were asked to tally accesses by structure field.
+    if (TrackStructFields) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(ptr_to_char_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint8_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      tally_struct_field = declare_extern_c(void_func_result, "bf_tally_struct_field", &module);
+      end_struct_field_bb = declare_thunk(&module, "bf_end_struct_field_bb");
+    }
+
+    // Declare bf_register_loops() only if we were asked to report inner
+    // loops.  The module constructor calls it to describe the module's inner
+    // loops and where their tallies are kept.
+    if (TallyLoops) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(PointerType::get(loop_info_type, 0));
+      all_function_args.push_back(uint64_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      register_loops = declare_extern_c(void_func_result, "bf_register_loops", &module);
+    }
+
+    // Declare bf_tally_bb_lines() only if we were asked to tally counters by
+    // source line.
+    if (TallyByLine) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(PointerType::get(i64type, 0));
+      all_function_args.push_back(PointerType::get(line_counts_type, 0));
+      all_function_args.push_back(uint64_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      tally_bb_lines = declare_extern_c(void_func_result, "bf_tally_bb_lines", &module);
+    }
+
+    // Declare bf_tally_thread_bb() only if we were asked to tally counters by
+    // thread.
+    if (TallyThreads) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(ptr_to_char_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      tally_thread_bb = declare_extern_c(void_func_result, "bf_tally_thread_bb", &module);
+    }
+
     // Inject an external declaration for llvm.memset.p0i8.i64().
     memset_intrinsic = module.getFunction("llvm.memset.p0i8.i64");
     if (memset_intrinsic == NULL) {
@@ -677,6 +939,10 @@ namespace bytesflops_pass {
     // string.
     map_instructions_to_strings(function);
 
+    // Find the function's inner loops before we modify its control flow.
+    if (TallyLoops)
+      find_inner_loops(function);
+
     // Instrument "interesting" instructions in every basic block.
     Module* module = function.getParent();
     instrument_entire_function(module, function, function_name);
@@ -20,6 +20,7 @@ namespace bytesflops_pass {
   const int BytesFlops::CLEAR_OP_BITS        =  32;
   const int BytesFlops::CLEAR_CALLS          =  64;
   const int BytesFlops::CLEAR_MEM_TYPES      = 128;
+  const int BytesFlops::CLEAR_STRUCT_FIELDS  = 256;
 
   /**
    * Create a constructor for the module in which we make a call to
@@ -66,6 +67,65 @@ namespace bytesflops_pass {
     AttributeList void_12_PAL;
     void_12->setAttributes(void_12_PAL);
 
+    // Insert a call to register the module's vector-operation tallies.
+    if (!vector_slots.empty()) {
+      IntegerType* i64type = Type::getInt64Ty(ctx);
+      vector<Constant*> slot_records;
+      for (auto iter = vector_slots.cbegin(); iter != vector_slots.cend(); iter++) {
+        vector<Constant*> fields;
+        fields.push_back(map_func_name_to_arg(&module, get<0>(iter->first)));
+        fields.push_back(ConstantInt::get(i64type, get<1>(iter->first)));
+        fields.push_back(ConstantInt::get(i64type, get<2>(iter->first)));
+        fields.push_back(ConstantInt::get(i64type, get<3>(iter->first)));
+        fields.push_back(iter->second);
+        slot_records.push_back(ConstantStruct::get(vector_slot_type, fields));
+      }
+      ArrayType* slots_type = ArrayType::get(vector_slot_type, slot_records.size());
+      GlobalVariable* slots_var =
+        new GlobalVariable(module, slots_type, true, GlobalValue::PrivateLinkage,
+                           ConstantArray::get(slots_type, slot_records), "bf_vector_slots");
+      vector<Constant*> getelementptr_indices;
+      getelementptr_indices.push_back(zero);
+      getelementptr_indices.push_back(zero);
+      vector<Value*> slot_args;
+      slot_args.push_back(ConstantExpr::getGetElementPtr(nullptr, slots_var, getelementptr_indices));
+      slot_args.push_back(ConstantInt::get(i64type, slot_records.size()));
+      CallInst::Create(register_vector_slots, slot_args, "", ctor_bb)->setCallingConv(CallingConv::C);
+      vector_slots.clear();
+    }
+
+    // Insert a call to register the module's inner loops.
+    if (!loop_slots.empty()) {
+      IntegerType* i64type = Type::getInt64Ty(ctx);
+      vector<Constant*> loop_records;
+      vector<Constant*> getelementptr_indices;
+      getelementptr_indices.push_back(zero);
+      getelementptr_indices.push_back(zero);
+      for (auto iter = loop_slots.cbegin(); iter != loop_slots.cend(); iter++) {
+        const LoopSlot* slot = *iter;
+        vector<Constant*> fields;
+        fields.push_back(map_func_name_to_arg(&module, slot->function));
+        fields.push_back(map_func_name_to_arg(&module, slot->file));
+        fields.push_back(ConstantInt::get(i64type, slot->line));
+        fields.push_back(ConstantInt::get(i64type, slot->first_line));
+        fields.push_back(ConstantInt::get(i64type, slot->last_line));
+        fields.push_back(ConstantInt::get(i64type, slot->calls));
+        fields.push_back(ConstantInt::get(i64type, slot->recurrences));
+        fields.push_back(ConstantExpr::getGetElementPtr(nullptr, slot->counters, getelementptr_indices));
+        loop_records.push_back(ConstantStruct::get(loop_info_type, fields));
+        delete slot;
+      }
+      ArrayType* loops_type = ArrayType::get(loop_info_type, loop_records.size());
+      GlobalVariable* loops_var =
+        new GlobalVariable(module, loops_type, true, GlobalValue::PrivateLinkage,
+                           ConstantArray::get(loops_type, loop_records), "bf_loops");
+      vector<Value*> loop_args;
+      loop_args.push_back(ConstantExpr::getGetElementPtr(nullptr, loops_var, getelementptr_indices));
+      loop_args.push_back(ConstantInt::get(i64type, loop_records.size()));
+      CallInst::Create(register_loops, loop_args, "", ctor_bb)->setCallingConv(CallingConv::C);
+      loop_slots.clear();
+    }
+
     ReturnInst::Create(ctx, ctor_bb);
   }
 
@@ -175,6 +235,12 @@ namespace bytesflops_pass {
       }
       must_clear |= CLEAR_LOADS;
       static_loads++;
+      bb_loop_counts[BF_LOOP_LOADS]++;
+      if (TallyByLine) {
+        LineTally& tally = line_tally(inst);
+        tally.loads++;
+        tally.load_bytes += byte_count;
+      }
     }
     else
       if (opcode == Instruction::Store) {
@@ -187,13 +253,20 @@ namespace bytesflops_pass {
         }
         must_clear |= CLEAR_STORES;
         static_stores++;
+        bb_loop_counts[BF_LOOP_STORES]++;
+        if (TallyByLine) {
+          LineTally& tally = line_tally(inst);
+          tally.stores++;
+          tally.store_bytes += byte_count;
+        }
       }
 
     // Determine the memory address that was loaded or stored.
     CastInst* mem_addr = nullptr;
     Value* mem_ptr = nullptr;
     if (TrackUniqueBytes || FindMemFootprint || rd_bits > 0 ||
-        TallyByDataStruct || TrackStrides || CacheModel) {
+        TallyByDataStruct || TrackStrides || CacheModel || TrackNUMA ||
+        FalseSharing || TLBModel) {
       mem_ptr =
         opcode == Instruction::Load
         ? cast<LoadInst>(inst).getPointerOperand()
@@ -223,14 +296,38 @@ namespace bytesflops_pass {
       callinst_create(assoc_addrs_with_prog, arg_list, &*insert_before);
     }
 
-    // If requested by the user, insert a call to bf_touch_cache().
+    // If requested by the user, insert a call to bf_touch_cache() or
+    // bf_touch_cache_site().
     if (CacheModel) {
       vector<Value*> arg_list;
+      if (Prefetcher != BF_PREFETCH_NONE || TallyByFunction) {
+        func_syminfo =
+          find_value_provenance(*module, &inst, inst_to_string(&inst), insert_before, func_syminfo);
+        arg_list.push_back(func_syminfo);
+      }
       arg_list.push_back(mem_addr);
       arg_list.push_back(num_bytes);
       callinst_create(access_cache, arg_list, &*insert_before);
     }
 
+    // If requested by the user, insert a call to bf_numa_touch().
+    if (TrackNUMA) {
+      vector<Value*> arg_list;
+      arg_list.push_back(map_func_name_to_arg(module, function_name));
+      arg_list.push_back(mem_addr);
+      arg_list.push_back(num_bytes);
+      callinst_create(numa_touch, arg_list, &*insert_before);
+    }
+
+    // If requested by the user, insert a call to bf_touch_tlb().
+    if (TLBModel) {
+      vector<Value*> arg_list;
+      arg_list.push_back(map_func_name_to_arg(module, function_name));
+      arg_list.push_back(mem_addr);
+      arg_list.push_back(num_bytes);
+      callinst_create(touch_tlb, arg_list, &*insert_before);
+    }
+
     // If requested by the user, also insert a call to
     // bf_reuse_dist_addrs_prog().
     if ((opcode == Instruction::Load && (rd_bits&(1<<RD_LOADS)) != 0)
@@ -256,6 +353,72 @@ namespace bytesflops_pass {
       callinst_create(track_stride, arg_list, &*insert_before);
     }
 
+    // If requested by the user, also insert a call to bf_track_sharing().
+    if (FalseSharing) {
+      vector<Value*> arg_list;
+      func_syminfo =
+        find_value_provenance(*module, &inst, inst_to_string(&inst), insert_before, func_syminfo);
+      uint8_t load0store1 = opcode == Instruction::Load ? 0 : 1;
+      arg_list.push_back(func_syminfo);
+      arg_list.push_back(mem_addr);
+      arg_list.push_back(num_bytes);
+      arg_list.push_back(ConstantInt::get(bbctx, APInt(8, load0store1)));
+      callinst_create(track_sharing, arg_list, &*insert_before);
+    }
+
+    // If requested by the user, also insert a call to bf_tally_struct_field()
+    // if the load or store accesses a field of a named structure.
+    StructType* struct_type;
+    uint64_t field;
+    if (TrackStructFields &&
+        find_struct_field(opcode == Instruction::Load
+                          ? cast<LoadInst>(inst).getPointerOperand()
+                          : cast<StoreInst>(inst).getPointerOperand(),
+                          struct_type, field)) {
+      const StructLayout* layout = target_data.getStructLayout(struct_type);
+      uint64_t field_size = target_data.getTypeAllocSize(struct_type->getElementType(field));
+      uint8_t load0store1 = opcode == Instruction::Load ? 0 : 1;
+      vector<Value*> arg_list;
+      arg_list.push_back(map_func_name_to_arg(module, struct_type->getName()));
+      arg_list.push_back(ConstantInt::get(bbctx, APInt(64, field)));
+      arg_list.push_back(ConstantInt::get(bbctx, APInt(64, layout->getElementOffset(field))));
+      arg_list.push_back(ConstantInt::get(bbctx, APInt(64, field_size)));
+      arg_list.push_back(ConstantInt::get(bbctx, APInt(64, layout->getSizeInBytes())));
+      arg_list.push_back(num_bytes);
+      arg_list.push_back(ConstantInt::get(bbctx, APInt(8, load0store1)));
+      callinst_create(tally_struct_field, arg_list, &*insert_before);
+      must_clear |= CLEAR_STRUCT_FIELDS;
+    }
+
+    // If requested by the user, also insert a call to bf_track_redundancy().
+    // We can't delay this to the end of the basic block because we need to
+    // see the value in memory before a store overwrites it.  Loads are
+    // instrumented immediately after the load; stores immediately before the
+    // store.
+    if (TrackRedundancy) {
+      BasicBlock::iterator insert_at = iter;
+      if (opcode == Instruction::Load)
+        insert_at++;
+      Value* value_ptr = spill_value(module, mem_value, &*insert_at);
+      Value* ptr_operand =
+        opcode == Instruction::Load
+        ? cast<LoadInst>(inst).getPointerOperand()
+        : cast<StoreInst>(inst).getPointerOperand();
+      CastInst* imm_mem_addr =
+        new PtrToIntInst(ptr_operand, IntegerType::get(bbctx, 64), "", &*insert_at);
+      mark_as_byfl(imm_mem_addr);
+      func_syminfo =
+        find_value_provenance(*module, &inst, inst_to_string(&inst), insert_at, func_syminfo);
+      uint8_t load0store1 = opcode == Instruction::Load ? 0 : 1;
+      vector<Value*> arg_list;
+      arg_list.push_back(func_syminfo);
+      arg_list.push_back(imm_mem_addr);
+      arg_list.push_back(value_ptr);
+      arg_list.push_back(num_bytes);
+      arg_list.push_back(ConstantInt::get(bbctx, APInt(8, load0store1)));
+      callinst_create(track_redundancy, arg_list, &*insert_at);
+    }
+
     // If requested by the user, insert a call to bf_access_data_struct().
     if (TallyByDataStruct) {
       // We can't delay instrumentation to the end of the basic block.  We have
@@ -329,8 +492,52 @@ namespace bytesflops_pass {
     Function* func = call_inst->getCalledFunction();
     StringRef callee_name = func ? func->getName() : "*UNNAMED*";
 
+    // If requested by the user, tally the target of each indirect call.
+    if (TrackCallTargets && func == nullptr)
+#if LLVM_VERSION_MAJOR >= 11
+      instrument_indirect_call(module, inst, call_inst->getCalledOperand());
+#else
+      instrument_indirect_call(module, inst, call_inst->getCalledValue());
+#endif
+
+    // If requested by the user, tally the active lanes of each masked vector
+    // memory operation.
+    if (TallyVectors && func != nullptr && func->isIntrinsic())
+      instrument_masked_vector_op(module, inst, func);
+
     // Tally calls to the LLVM memory intrinsics (llvm.mem{set,cpy,move}.*).
     if (isa<MemIntrinsic>(inst)) {
+      // If requested by the user, pass the call site, destination, source,
+      // and length to bf_tally_mem_intrinsic() before the call.
+      if (TallyMemIntrinsics) {
+        MemIntrinsic* memfunc = cast<MemIntrinsic>(inst);
+        uint8_t kind = BF_MEMINTRIN_MEMSET;
+        Value* src_ptr = memfunc->getDest();
+        if (MemTransferInst* memxferfunc = dyn_cast<MemTransferInst>(inst)) {
+          kind = isa<MemMoveInst>(inst) ? BF_MEMINTRIN_MEMMOVE : BF_MEMINTRIN_MEMCPY;
+          src_ptr = memxferfunc->getSource();
+        }
+        BasicBlock::iterator insert_pre_mem = iter;
+        func_syminfo =
+          find_value_provenance(*module, inst, inst_to_string(inst), insert_pre_mem, func_syminfo);
+        CastInst* dest_addr =
+          new PtrToIntInst(memfunc->getDest(), IntegerType::get(globctx, 64), "", inst);
+        mark_as_byfl(dest_addr);
+        CastInst* src_addr =
+          new PtrToIntInst(src_ptr, IntegerType::get(globctx, 64), "", inst);
+        mark_as_byfl(src_addr);
+        CastInst* length =
+          CastInst::CreateZExtOrBitCast(memfunc->getLength(), IntegerType::get(globctx, 64), "", inst);
+        mark_as_byfl(length);
+        vector<Value*> arg_list;
+        arg_list.push_back(func_syminfo);
+        arg_list.push_back(ConstantInt::get(globctx, APInt(8, kind)));
+        arg_list.push_back(dest_addr);
+        arg_list.push_back(src_addr);
+        arg_list.push_back(length);
+        callinst_create(tally_mem_intrin, arg_list, inst);
+      }
+
       if (MemSetInst* memsetfunc = dyn_cast<MemSetInst>(inst)) {
         // Handle llvm.memset.* by incrementing the memset tally and
         // byte count.
@@ -541,6 +748,129 @@ namespace bytesflops_pass {
     }
   }
 
+  // Pass the target of an indirect call or invoke to bf_track_call_target()
+  // before the call is made.  Calls through inline assembly or through a
+  // bitcast of a known function aren't really indirect so we ignore those.
+  void BytesFlops::instrument_indirect_call(Module* module,
+                                            Instruction* inst,
+                                            Value* callee) {
+    if (isa<InlineAsm>(callee) || isa<Function>(callee->stripPointerCasts()))
+      return;
+    LLVMContext& globctx = module->getContext();
+    BasicBlock::iterator insert_pre_call = inst->getIterator();
+    func_syminfo =
+      find_value_provenance(*module, inst, inst_to_string(inst), insert_pre_call, func_syminfo);
+    CastInst* target =
+      new PtrToIntInst(callee, IntegerType::get(globctx, 64), "", inst);
+    mark_as_byfl(target);
+    vector<Value*> arg_list;
+    arg_list.push_back(func_syminfo);
+    arg_list.push_back(target);
+    callinst_create(track_call_target, arg_list, inst);
+  }
+
+  // Pass the active-lane mask and, for gathers and scatters, the lane
+  // addresses of a masked vector memory operation to bf_tally_vector_lanes()
+  // before the operation is performed.  Vectors of more than 64 lanes are
+  // ignored.
+  void BytesFlops::instrument_masked_vector_op(Module* module,
+                                               Instruction* inst,
+                                               Function* callee) {
+    // Determine the kind of operation and locate its mask, addresses, and
+    // data.
+    CallInst* call_inst = cast<CallInst>(inst);
+    uint8_t kind;
+    Value* mask;
+    Value* addresses = nullptr;
+    Type* data_type;
+    switch (callee->getIntrinsicID()) {
+      case Intrinsic::masked_load:
+        kind = BF_VECLANE_MASKED_LOAD;
+        mask = call_inst->getArgOperand(2);
+        data_type = inst->getType();
+        break;
+
+      case Intrinsic::masked_store:
+        kind = BF_VECLANE_MASKED_STORE;
+        mask = call_inst->getArgOperand(3);
+        data_type = call_inst->getArgOperand(0)->getType();
+        break;
+
+      case Intrinsic::masked_gather:
+        kind = BF_VECLANE_GATHER;
+        mask = call_inst->getArgOperand(2);
+        addresses = call_inst->getArgOperand(0);
+        data_type = inst->getType();
+        break;
+
+      case Intrinsic::masked_scatter:
+        kind = BF_VECLANE_SCATTER;
+        mask = call_inst->getArgOperand(3);
+        addresses = call_inst->getArgOperand(1);
+        data_type = call_inst->getArgOperand(0)->getType();
+        break;
+
+      case Intrinsic::masked_expandload:
+        kind = BF_VECLANE_EXPAND_LOAD;
+        mask = call_inst->getArgOperand(1);
+        data_type = inst->getType();
+        break;
+
+      case Intrinsic::masked_compressstore:
+        kind = BF_VECLANE_COMPRESS_STORE;
+        mask = call_inst->getArgOperand(2);
+        data_type = call_inst->getArgOperand(0)->getType();
+        break;
+
+      default:
+        return;
+    }
+#if LLVM_VERSION_MAJOR >= 12
+    FixedVectorType* vt = dyn_cast<FixedVectorType>(data_type);
+#else
+    VectorType* vt = dyn_cast<VectorType>(data_type);
+#endif
+    if (vt == nullptr || vt->getNumElements() > 64)
+      return;
+    uint64_t num_lanes = vt->getNumElements();
+
+    // Convert the mask from <N x i1> to i64.
+    LLVMContext& globctx = module->getContext();
+    IntegerType* i64type = Type::getInt64Ty(globctx);
+    CastInst* mask_bits =
+      new BitCastInst(mask, IntegerType::get(globctx, num_lanes), "", inst);
+    mark_as_byfl(mask_bits);
+    CastInst* mask_int = CastInst::CreateZExtOrBitCast(mask_bits, i64type, "", inst);
+    mark_as_byfl(mask_int);
+
+    // Spill a gather's or scatter's addresses to the stack as a vector of
+    // i64s.
+    Value* address_ptr;
+    if (addresses == nullptr)
+      address_ptr = ConstantPointerNull::get(PointerType::get(IntegerType::get(globctx, 8), 0));
+    else {
+#if LLVM_VERSION_MAJOR >= 11
+      Type* int_vector_type = FixedVectorType::get(i64type, num_lanes);
+#else
+      Type* int_vector_type = VectorType::get(i64type, num_lanes);
+#endif
+      CastInst* address_ints = new PtrToIntInst(addresses, int_vector_type, "", inst);
+      mark_as_byfl(address_ints);
+      address_ptr = spill_value(module, address_ints, inst);
+    }
+
+    // Tally the operation.
+    const DataLayout& target_data = module->getDataLayout();
+    vector<Value*> arg_list;
+    arg_list.push_back(map_func_name_to_arg(module, inst->getFunction()->getName()));
+    arg_list.push_back(ConstantInt::get(globctx, APInt(8, kind)));
+    arg_list.push_back(ConstantInt::get(i64type, num_lanes));
+    arg_list.push_back(mask_int);
+    arg_list.push_back(ConstantInt::get(i64type, target_data.getTypeStoreSize(vt->getElementType())));
+    arg_list.push_back(address_ptr);
+    callinst_create(tally_vector_lanes, arg_list, inst);
+  }
+
   // Instrument Invoke instructions.
   void BytesFlops::instrument_invoke(Module* module,
                                      Instruction* inst,
@@ -551,6 +881,14 @@ namespace bytesflops_pass {
     Function* func = invoke_inst->getCalledFunction();
     StringRef callee_name = func ? func->getName() : "*UNNAMED*";
 
+    // If requested by the user, tally the target of each indirect invoke.
+    if (TrackCallTargets && func == nullptr)
+#if LLVM_VERSION_MAJOR >= 11
+      instrument_indirect_call(module, inst, invoke_inst->getCalledOperand());
+#else
+      instrument_indirect_call(module, inst, invoke_inst->getCalledValue());
+#endif
+
     // Tally the callee (with a distinguishing "-" in front of its
     // name) in order to keep track of invocations to uninstrumented
     // functions.
@@ -718,6 +1056,8 @@ namespace bytesflops_pass {
                                 ConstantInt::get(bbctx, APInt(64, arg_op_bits)));
       must_clear |= CLEAR_OP_BITS;
       static_ops += arg_ops;
+      if (TallyByLine)
+        line_tally(inst).ops += arg_ops;
     }
     else {
       // We're not a getelementptr instruction.  Determine the number
@@ -731,6 +1071,8 @@ namespace bytesflops_pass {
       // Increment the operation counter and the operation bit counter.
       increment_global_variable(insert_before, op_var, num_elts);
       must_clear |= CLEAR_OPS;
+      if (TallyByLine)
+        line_tally(inst).ops += num_elts->getZExtValue();
       if (!isa<LoadInst>(inst) && !isa<StoreInst>(inst)) {
         // Count loads and stores as zero op bits to clarify reports
         // of bits per op bit: we don't want memory bits contributing
@@ -770,6 +1112,12 @@ namespace bytesflops_pass {
       increment_global_variable(insert_before, fp_bits_var, num_bits);
       must_clear |= CLEAR_FP_BITS;
       static_flops++;
+      if (TallyByLine)
+        line_tally(inst).flops += num_elts->getZExtValue();
+      if (instType->isVectorTy())
+        bb_loop_counts[BF_LOOP_VECTOR_FLOPS] += num_elts->getZExtValue();
+      else
+        bb_loop_counts[BF_LOOP_SCALAR_FLOPS]++;
     }
 
     // If the user requested a characterization of vector operations,
@@ -790,18 +1138,29 @@ namespace bytesflops_pass {
           break;
 
         // Tally this vector operation.
-        vector<Value*> arg_list;
 #if LLVM_VERSION_MAJOR >= 12
         uint64_t elt_count = dyn_cast<FixedVectorType>(vt)->getNumElements();
 #else	
 	uint64_t elt_count = vt->getNumElements();
 #endif
 	uint64_t total_bits = instType->getPrimitiveSizeInBits();
-        arg_list.push_back(map_func_name_to_arg(module, function_name));
-        arg_list.push_back(get_vector_length(bbctx, vt, one));
-        arg_list.push_back(ConstantInt::get(bbctx, APInt(64, total_bits/elt_count)));
-        arg_list.push_back(ConstantInt::get(bbctx, APInt(8, 1)));
-        callinst_create(tally_vector, arg_list, &*insert_before);
+        if (TrackCallStack || InstrumentEveryBB) {
+          // Call stacks and user-defined partitions are known only at run
+          // time so let the run-time library find the tally.
+          vector<Value*> arg_list;
+          arg_list.push_back(map_func_name_to_arg(module, function_name));
+          arg_list.push_back(get_vector_length(bbctx, vt, one));
+          arg_list.push_back(ConstantInt::get(bbctx, APInt(64, total_bits/elt_count)));
+          arg_list.push_back(ConstantInt::get(bbctx, APInt(8, tally_fp)));
+          callinst_create(tally_vector, arg_list, &*insert_before);
+        }
+        else
+          // The function and vector shape are known statically so simply
+          // increment a dedicated counter.
+          increment_global_variable_if_counting(insert_before,
+                                                vector_slot(module, function_name, elt_count,
+                                                            total_bits/elt_count, tally_fp),
+                                                one);
       }
       while (0);
   }
@@ -832,6 +1191,7 @@ namespace bytesflops_pass {
     // Stack-allocate a bf_symbol_info_t to be used throughout the function.
     InternalSymbolInfo first_syminfo(&function);
     func_syminfo = find_value_provenance(*module, first_syminfo, br_inst);
+    func_value_slots.clear();
 
     // Insert a call at the beginning of the function to bf_push_function() if
     // -bf-call-stack was specified or to bf_incr_func_tally() if -bf-by-func
@@ -868,6 +1228,9 @@ namespace bytesflops_pass {
       terminator_inst--;
       int must_clear = 0;   // Keep track of which counters we need to clear.
       uint64_t num_insts = bb.size();
+      bb_line_tallies.clear();
+      bb_last_line = file_line_t("??", 0);
+      memset(bb_loop_counts, 0, sizeof(bb_loop_counts));
 
       // Insert an "unreachable" instruction as a sentinel before the real
       // terminator instruction.  New code is inserted before the real
@@ -958,6 +1321,10 @@ namespace bytesflops_pass {
 
       // Add one last bit of code then release the mega-lock and elide
       // the sentinel terminator.
+      if (TallyByLine)
+        insert_line_tallies(module, terminator_inst);
+      if (TallyLoops)
+        insert_loop_tallies(bb, terminator_inst);
       insert_end_bb_code(module, keyval, num_insts, must_clear, terminator_inst);
       if (ThreadSafety)
         callinst_create(release_mega_lock, &*terminator_inst);
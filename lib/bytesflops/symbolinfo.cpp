@@ -10,7 +10,7 @@
 namespace bytesflops_pass {
 
 // Concatenate a directory name and a file name into a full path.
-static string full_file_path(StringRef dirname, StringRef filename)
+string full_file_path(StringRef dirname, StringRef filename)
 {
   if (dirname == "")
     return filename == "" ? "??" : filename.str();
@@ -0,0 +1,234 @@
+/*
+ * Validate the run-time library's branch-predictor models against
+ * hand-computed misprediction counts
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include <functional>
+#include <thread>
+#include "byfl.h"
+
+// Define all of the constants that the Byfl compiler pass would normally
+// define in instrumented code.  We enable only the analysis under test.
+uint64_t bf_bb_merge = 1;
+uint8_t  bf_call_stack = 0;
+uint8_t  bf_every_bb = 0;
+uint64_t bf_max_reuse_distance = ~uint64_t(0) - 1;
+const char* bf_option_string = "branch-oracle";
+uint8_t  bf_per_func = 0;
+uint8_t  bf_mem_footprint = 0;
+uint8_t  bf_tally_inst_mix = 0;
+uint8_t  bf_tally_inst_deps = 0;
+uint8_t  bf_types = 0;
+uint8_t  bf_unique_bytes = 0;
+uint8_t  bf_vectors = 0;
+uint8_t  bf_cache_model = 0;
+uint8_t  bf_data_structs = 0;
+uint8_t  bf_strides = 0;
+uint8_t  bf_numa = 0;
+uint8_t  bf_false_sharing = 0;
+uint8_t  bf_tlb = 0;
+uint8_t  bf_mem_intrinsics = 0;
+uint8_t  bf_branches = 1;
+uint8_t  bf_call_targets = 0;
+uint8_t  bf_redundancy = 0;
+uint8_t  bf_struct_fields = 0;
+uint8_t  bf_by_line = 0;
+uint8_t  bf_loops = 0;
+uint8_t  bf_threads = 0;
+uint8_t  bf_thread_funcs = 0;
+uint64_t bf_line_size = 64;
+uint64_t bf_max_set_bits = 16;
+uint64_t bf_prefetcher = 0;
+uint64_t bf_prefetch_degree = 1;
+uint64_t bf_prefetch_distance = 1;
+uint64_t bf_prefetch_cache = 512;
+
+using namespace bytesflops;
+
+namespace bytesflops {
+  extern "C" void bf_track_branch(const bf_symbol_info_t* syminfo, uint8_t taken);
+}
+
+// Count the number of failed comparisons.
+static int num_failures = 0;
+
+// Report a failure.
+static void fail (const string& test, const string& what)
+{
+  cerr << "FAIL: " << test << ": " << what << '\n';
+  num_failures++;
+}
+
+// Compare two integers, reporting a failure if they differ.
+static void compare (const string& test, const string& what,
+                     uint64_t expected, uint64_t actual)
+{
+  if (expected != actual) {
+    ostringstream msg;
+    msg << what << " is " << actual << " but should be " << expected;
+    fail(test, msg.str());
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+// Summarize the branch-predictor models' program-wide tallies.
+class BranchSummary {
+public:
+  uint64_t branches = 0;
+  uint64_t transitions = 0;
+  uint64_t bimodal_mispredicts = 0;
+  uint64_t gshare_mispredicts = 0;
+
+  // Take a snapshot of the run-time library's current tallies.
+  static BranchSummary current (void) {
+    BranchSummary summary;
+    bf_get_branch_summary(&summary.branches, &summary.transitions,
+                          &summary.bimodal_mispredicts, &summary.gshare_mispredicts);
+    return summary;
+  }
+};
+
+// Run a function on a new thread, which starts with untrained predictors
+// and an empty global history, and compare the tallies it adds to the
+// expected tallies.
+static void check_fresh_thread (const string& test, const BranchSummary& expected,
+                                function<void()> func)
+{
+  BranchSummary before(BranchSummary::current());
+  thread(func).join();
+  BranchSummary after(BranchSummary::current());
+  compare(test, "branches", expected.branches, after.branches - before.branches);
+  compare(test, "transitions", expected.transitions,
+          after.transitions - before.transitions);
+  compare(test, "bimodal mispredictions", expected.bimodal_mispredicts,
+          after.bimodal_mispredicts - before.bimodal_mispredicts);
+  compare(test, "gshare mispredictions", expected.gshare_mispredicts,
+          after.gshare_mispredicts - before.gshare_mispredicts);
+}
+
+// Feed a single branch site a repeating pattern of outcomes.
+static void repeat_pattern (const bf_symbol_info_t* site, const vector<bool>& pattern,
+                            size_t reps)
+{
+  for (size_t r = 0; r < reps; r++)
+    for (bool taken : pattern)
+      bf_track_branch(site, taken ? 1 : 0);
+}
+
+// Check each predictor model's misprediction count on outcome streams whose
+// behavior under a table of 2-bit counters initialized to "weakly not
+// taken" can be worked out by hand.  A fresh counter mispredicts a taken
+// outcome but not a not-taken outcome.  Gshare indexes its table with a
+// 14-bit history, so the first 14 outcomes of a stream see 14 distinct
+// histories.
+static void check_branches (void)
+{
+  static const bf_symbol_info_t sites[] = {
+    {1, "oracle", "", "always", "oracle.c", 10},
+    {2, "oracle", "", "alternate", "oracle.c", 20},
+    {3, "oracle", "", "loop", "oracle.c", 30},
+    {4, "oracle", "", "biased", "oracle.c", 40}
+  };
+  const vector<bool> always_taken = {true};
+  const vector<bool> alternating = {true, false};
+  const vector<bool> loop4 = {true, true, true, false};
+  vector<bool> bursts(10, true);
+  bursts.insert(bursts.end(), 3, false);
+  bursts.push_back(true);
+  bursts.insert(bursts.end(), 10, false);
+  bursts.push_back(true);
+
+  // An always-taken branch trains the bimodal counter after one
+  // misprediction.  Gshare mispredicts once for each of the 15 histories
+  // 0, 1, 3, ..., 0x3FFF, after which the history is always 0x3FFF.
+  string test("branches, always taken");
+  BranchSummary expected;
+  expected.branches = 100;
+  expected.transitions = 0;
+  expected.bimodal_mispredicts = 1;
+  expected.gshare_mispredicts = 15;
+  check_fresh_thread(test, expected,
+                     [&] { repeat_pattern(&sites[0], always_taken, 100); });
+
+  // An alternating branch toggles the bimodal counter between 1 and 2, so
+  // bimodal mispredicts every outcome.  Gshare sees a new history at each
+  // of the first 15 outcomes, mispredicting the 8 taken ones, after which
+  // the two steady-state histories alternate and predict perfectly.
+  test = "branches, alternating";
+  expected.branches = 100;
+  expected.transitions = 99;
+  expected.bimodal_mispredicts = 100;
+  expected.gshare_mispredicts = 8;
+  check_fresh_thread(test, expected,
+                     [&] { repeat_pattern(&sites[1], alternating, 50); });
+
+  // A four-iteration loop branch (taken, taken, taken, not taken) costs
+  // bimodal one misprediction to train plus one per loop exit.  Gshare
+  // mispredicts the 11 taken outcomes among the first 14, plus the taken
+  // outcomes at zero-based positions 14 and 16, whose histories begin with
+  // a taken outcome and hence are new.  Every later history is one it has
+  // already trained.
+  test = "branches, period-4 loop";
+  expected.branches = 400;
+  expected.transitions = 199;
+  expected.bimodal_mispredicts = 101;
+  expected.gshare_mispredicts = 13;
+  check_fresh_thread(test, expected,
+                     [&] { repeat_pattern(&sites[2], loop4, 100); });
+
+  // A biased branch with bursts of the other outcome (10 taken, 3 not
+  // taken, 1 taken, 10 not taken, 1 taken) exercises saturation at both
+  // ends of the bimodal counter: one misprediction to train, two to flip
+  // the saturated counter, and one for each of the two isolated taken
+  // outcomes.  Each of gshare's 12 taken outcomes sees a new history.
+  test = "branches, biased with bursts";
+  expected.branches = 25;
+  expected.transitions = 4;
+  expected.bimodal_mispredicts = 5;
+  expected.gshare_mispredicts = 12;
+  check_fresh_thread(test, expected,
+                     [&] { repeat_pattern(&sites[3], bursts, 1); });
+
+  // Each thread models its own predictors, so two threads running the same
+  // stream each pay for warming them up.
+  test = "branches, per-thread predictors";
+  expected.branches = 200;
+  expected.transitions = 0;
+  expected.bimodal_mispredicts = 2;
+  expected.gshare_mispredicts = 30;
+  check_fresh_thread(test, expected, [&] {
+      thread t1([&] { repeat_pattern(&sites[0], always_taken, 100); });
+      thread t2([&] { repeat_pattern(&sites[0], always_taken, 100); });
+      t1.join();
+      t2.join();
+    });
+
+  // Branches executed while counting is suppressed are ignored.
+  test = "branches, suppressed";
+  expected = BranchSummary();
+  check_fresh_thread(test, expected, [&] {
+      bf_suppress_counting = true;
+      repeat_pattern(&sites[2], loop4, 100);
+      bf_suppress_counting = false;
+    });
+}
+
+// ----------------------------------------------------------------------------
+
+int main (void)
+{
+  initialize_branches();
+  check_branches();
+
+  // Report success or failure.  Exit without producing a Byfl report.
+  if (num_failures == 0)
+    cout << "All branch-predictor checks passed\n";
+  else
+    cout << num_failures << " branch-predictor checks failed\n";
+  cout.flush();
+  cerr.flush();
+  _exit(num_failures == 0 ? 0 : 1);
+}
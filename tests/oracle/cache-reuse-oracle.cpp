@@ -0,0 +1,512 @@
+/*
+ * Validate the cache model and the reuse-distance calculation against
+ * naive but obviously correct reference implementations
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include <random>
+#include "byfl.h"
+#include "cache-model.h"
+#include "reuse-dist.h"
+
+// Define all of the constants that the Byfl compiler pass would normally
+// define in instrumented code.  Only bf_max_reuse_distance affects the
+// classes under test, and we vary it from test to test.
+uint64_t bf_bb_merge = 1;
+uint8_t  bf_call_stack = 0;
+uint8_t  bf_every_bb = 0;
+uint64_t bf_max_reuse_distance = ~uint64_t(0) - 1;
+const char* bf_option_string = "cache-reuse-oracle";
+uint8_t  bf_per_func = 0;
+uint8_t  bf_mem_footprint = 0;
+uint8_t  bf_tally_inst_mix = 0;
+uint8_t  bf_tally_inst_deps = 0;
+uint8_t  bf_types = 0;
+uint8_t  bf_unique_bytes = 0;
+uint8_t  bf_vectors = 0;
+uint8_t  bf_cache_model = 0;
+uint8_t  bf_data_structs = 0;
+uint8_t  bf_strides = 0;
+uint8_t  bf_numa = 0;
+uint8_t  bf_false_sharing = 0;
+uint8_t  bf_tlb = 0;
+uint8_t  bf_mem_intrinsics = 0;
+uint8_t  bf_branches = 0;
+uint8_t  bf_call_targets = 0;
+uint8_t  bf_redundancy = 0;
+uint8_t  bf_struct_fields = 0;
+uint8_t  bf_by_line = 0;
+uint8_t  bf_loops = 0;
+uint8_t  bf_threads = 0;
+uint8_t  bf_thread_funcs = 0;
+uint64_t bf_line_size = 64;
+uint64_t bf_max_set_bits = 16;
+uint64_t bf_prefetcher = 0;
+uint64_t bf_prefetch_degree = 1;
+uint64_t bf_prefetch_distance = 1;
+uint64_t bf_prefetch_cache = 512;
+
+using namespace bytesflops;
+
+// Count the number of failed comparisons.
+static int num_failures = 0;
+
+// An access is a base address and a number of bytes.
+typedef pair<uint64_t, uint64_t> access_t;
+typedef vector<access_t> trace_t;
+
+// Report a failure.
+static void fail (const string& test, const string& what)
+{
+  cerr << "FAIL: " << test << ": " << what << '\n';
+  num_failures++;
+}
+
+// Compare two integers, reporting a failure if they differ.
+static void compare (const string& test, const string& what,
+                     uint64_t expected, uint64_t actual)
+{
+  if (expected != actual) {
+    ostringstream msg;
+    msg << what << " is " << actual << " but should be " << expected;
+    fail(test, msg.str());
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+// Compute reuse distances using an O(n^2) list of (address, last access time)
+// pairs.  Pruning mimics ReuseDistance::process_address(): once more than
+// bf_max_reuse_distance addresses are tracked, forget every address whose
+// last access precedes the most recent bf_max_reuse_distance accesses.
+class NaiveReuseDistance {
+private:
+  uint64_t clock = 0;
+  vector<access_t> recent;   // {address, time} in increasing time order
+  vector<uint64_t> hist;
+  uint64_t unique_entries = 0;
+
+public:
+  void process_address (uint64_t address) {
+    bool found = false;
+    for (size_t i = 0; i < recent.size(); i++)
+      if (recent[i].first == address) {
+        uint64_t distance = recent.size() - i - 1;
+        if (distance >= hist.size())
+          hist.resize(distance + 1, 0);
+        hist[distance]++;
+        recent.erase(recent.begin() + i);
+        found = true;
+        break;
+      }
+    if (!found)
+      unique_entries++;
+    recent.push_back(access_t(address, clock));
+    clock++;
+    if (recent.size() > bf_max_reuse_distance) {
+      uint64_t oldest = clock - bf_max_reuse_distance;
+      size_t i = 0;
+      while (i < recent.size() && recent[i].second < oldest)
+        i++;
+      recent.erase(recent.begin(), recent.begin() + i);
+    }
+  }
+
+  vector<uint64_t>* get_histogram() { return &hist; }
+  uint64_t get_unique_addrs() { return unique_entries; }
+};
+
+// Run a trace through both the production and the naive reuse-distance
+// calculations and compare the results.
+static void check_reuse_distance (const string& name, const trace_t& trace,
+                                  uint64_t max_dist)
+{
+  ostringstream test;
+  test << "reuse distance, " << name << ", max distance " << max_dist;
+  bf_max_reuse_distance = max_dist;
+  ReuseDistance actual;
+  NaiveReuseDistance expected;
+  for (auto& acc : trace)
+    for (uint64_t ofs = 0; ofs < acc.second; ofs++) {
+      actual.process_address(acc.first + ofs);
+      expected.process_address(acc.first + ofs);
+    }
+  compare(test.str(), "unique addresses",
+          expected.get_unique_addrs(), actual.get_unique_addrs());
+  vector<uint64_t>* ehist = expected.get_histogram();
+  vector<uint64_t>* ahist = actual.get_histogram();
+  compare(test.str(), "histogram length", ehist->size(), ahist->size());
+  for (size_t d = 0; d < ehist->size() && d < ahist->size(); d++)
+    if ((*ehist)[d] != (*ahist)[d]) {
+      ostringstream what;
+      what << "histogram[" << d << "]";
+      compare(test.str(), what.str(), (*ehist)[d], (*ahist)[d]);
+      break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+// Model a cache using an O(n^2) LRU stack of line addresses.  For every hit
+// and every power-of-two number of sets, record the line's 1-based stack
+// position among only those lines that map to the same set.
+class NaiveCache {
+private:
+  uint64_t line_size;
+  uint64_t max_set_bits;
+  vector<uint64_t> lines;    // Line numbers; back is MRU
+
+public:
+  uint64_t accesses = 0;
+  uint64_t cold_misses = 0;
+  uint64_t misaligned_mem_ops = 0;
+  vector<unordered_map<uint64_t,uint64_t> > hits;
+
+  NaiveCache (uint64_t line_size_, uint64_t max_set_bits_) :
+    line_size(line_size_), max_set_bits(max_set_bits_), hits(max_set_bits_) {}
+
+  void access (uint64_t baseaddr, uint64_t numaddrs) {
+    uint64_t first_line = baseaddr/line_size;
+    uint64_t last_line = (baseaddr + numaddrs - 1)/line_size;
+    for (uint64_t line = first_line; line <= last_line; line++) {
+      size_t pos;
+      for (pos = 0; pos < lines.size(); pos++)
+        if (lines[pos] == line)
+          break;
+      if (pos == lines.size())
+        cold_misses++;
+      else {
+        for (uint64_t set_bits = 0; set_bits < max_set_bits; set_bits++) {
+          uint64_t mask = (uint64_t(1) << set_bits) - 1;
+          uint64_t position = 1;
+          for (size_t i = pos + 1; i < lines.size(); i++)
+            if ((lines[i]&mask) == (line&mask))
+              position++;
+          hits[set_bits][position]++;
+        }
+        lines.erase(lines.begin() + pos);
+      }
+      lines.push_back(line);
+    }
+    uint64_t num_lines = last_line - first_line + 1;
+    accesses += num_lines;
+    if (num_lines != (numaddrs + line_size - 1)/line_size)
+      misaligned_mem_ops++;
+  }
+};
+
+// Run a trace through both the production and the naive cache models and
+// compare the results.
+static void check_cache (const string& name, const trace_t& trace,
+                         uint64_t line_size, uint64_t max_set_bits)
+{
+  ostringstream test;
+  test << "cache model, " << name << ", " << line_size << "-byte lines, "
+       << max_set_bits << " set bits";
+  Cache actual(line_size, max_set_bits, true);
+  NaiveCache expected(line_size, max_set_bits);
+  for (auto& acc : trace) {
+    actual.access(acc.first, acc.second);
+    expected.access(acc.first, acc.second);
+  }
+  compare(test.str(), "accesses", expected.accesses, actual.getAccesses());
+  compare(test.str(), "cold misses", expected.cold_misses, actual.getColdMisses());
+  compare(test.str(), "misaligned operations",
+          expected.misaligned_mem_ops, actual.getMisalignedMemOps());
+  vector<unordered_map<uint64_t,uint64_t> > ahits = actual.getHits();
+  for (uint64_t set_bits = 0; set_bits < max_set_bits; set_bits++) {
+    auto& emap = expected.hits[set_bits];
+    auto& amap = ahits[set_bits];
+    ostringstream what;
+    what << "number of distinct hit positions with " << set_bits << " set bits";
+    compare(test.str(), what.str(), emap.size(), amap.size());
+    for (auto& ent : emap) {
+      auto iter = amap.find(ent.first);
+      ostringstream what;
+      what << "hits at position " << ent.first << " with " << set_bits << " set bits";
+      compare(test.str(), what.str(), ent.second, iter == amap.end() ? 0 : iter->second);
+    }
+  }
+
+  // With only one thread, no hit can be to a line brought in by another
+  // thread.
+  vector<unordered_map<uint64_t,uint64_t> > remote = actual.getRemoteHits();
+  for (auto& rmap : remote)
+    for (auto& ent : rmap)
+      if (ent.second != 0) {
+        fail(test.str(), "single-threaded trace produced remote hits");
+        return;
+      }
+}
+
+// ----------------------------------------------------------------------------
+
+// Model a fully associative LRU cache of a fixed number of lines, each tagged
+// with whether it was prefetched and not yet used, and feed it from a
+// prefetcher.  Unlike Cache, this evicts lines as soon as they fall out of the
+// cache.
+class NaivePrefetchCache {
+private:
+  uint64_t line_size;
+  uint64_t capacity;
+  Prefetcher* prefetcher;
+  vector< pair<uint64_t, bool> > lines;   // {line address, prefetched}; back is MRU
+
+  // Return the position of a line in the cache or lines.size() if absent.
+  size_t find_line (uint64_t lineaddr) {
+    for (size_t pos = 0; pos < lines.size(); pos++)
+      if (lines[pos].first == lineaddr)
+        return pos;
+    return lines.size();
+  }
+
+  // Insert a line at the MRU position, evicting the LRU line if necessary.
+  void insert_line (uint64_t lineaddr, bool prefetched) {
+    lines.push_back(make_pair(lineaddr, prefetched));
+    if (lines.size() > capacity) {
+      if (lines.front().second)
+        counters.useless_prefetches++;
+      lines.erase(lines.begin());
+    }
+  }
+
+public:
+  PrefetchCounters counters;
+
+  NaivePrefetchCache (uint64_t line_size_, uint64_t capacity_, Prefetcher* prefetcher_) :
+    line_size(line_size_), capacity(capacity_), prefetcher(prefetcher_) {}
+
+  void access (uint64_t baseaddr, uint64_t numaddrs, uint64_t site) {
+    for (uint64_t addr = baseaddr/line_size*line_size;
+         addr <= (baseaddr + numaddrs - 1)/line_size*line_size;
+         addr += line_size) {
+      counters.demand_accesses++;
+      LineOutcome outcome;
+      size_t pos = find_line(addr);
+      if (pos == lines.size()) {
+        counters.demand_misses++;
+        outcome = LINE_MISS;
+      }
+      else {
+        outcome = lines[pos].second ? LINE_PREFETCH_HIT : LINE_HIT;
+        if (outcome == LINE_PREFETCH_HIT)
+          counters.prefetch_hits++;
+        lines.erase(lines.begin() + pos);
+      }
+      insert_line(addr, false);
+      vector<uint64_t> targets;
+      prefetcher->observe(site, addr, outcome, targets);
+      for (auto target : targets)
+        if (target != addr && find_line(target) == lines.size()) {
+          counters.prefetches++;
+          insert_line(target, true);
+        }
+    }
+  }
+
+  // Count the prefetched lines that were never used.
+  uint64_t pending (void) {
+    uint64_t unused = 0;
+    for (auto& line : lines)
+      if (line.second)
+        unused++;
+    return unused;
+  }
+};
+
+// Run a trace through both the production cache model with a prefetcher and
+// a naive bounded cache with an identical prefetcher and compare the
+// prefetcher's effectiveness.
+static void check_prefetching (const string& name, const trace_t& trace,
+                               int type, uint64_t capacity, uint64_t degree,
+                               uint64_t distance)
+{
+  const uint64_t line_size = 64;
+  ostringstream test;
+  test << "prefetching, " << name << ", prefetcher " << type << ", "
+       << capacity << " lines, degree " << degree << ", distance " << distance;
+  Cache actual(line_size, 4, false);
+  actual.setPrefetcher(make_prefetcher(type, line_size, degree, distance), capacity);
+  PrefetchCounters acounters;
+  NaivePrefetchCache expected(line_size, capacity,
+                              make_prefetcher(type, line_size, degree, distance));
+  for (size_t i = 0; i < trace.size(); i++) {
+    uint64_t site = i%3;
+    actual.access(trace[i].first, trace[i].second, site, &acounters, nullptr);
+    expected.access(trace[i].first, trace[i].second, site);
+  }
+  unordered_map<PrefetchCounters*, uint64_t> pending;
+  actual.tallyPendingPrefetches(pending);
+  compare(test.str(), "demand accesses",
+          expected.counters.demand_accesses, acounters.demand_accesses);
+  compare(test.str(), "demand misses",
+          expected.counters.demand_misses, acounters.demand_misses);
+  compare(test.str(), "prefetches", expected.counters.prefetches, acounters.prefetches);
+  compare(test.str(), "prefetch hits", expected.counters.prefetch_hits, acounters.prefetch_hits);
+  compare(test.str(), "useless prefetches",
+          expected.counters.useless_prefetches + expected.pending(),
+          acounters.useless_prefetches + pending[&acounters]);
+}
+
+// ----------------------------------------------------------------------------
+
+// Run a trace through a TLB modeled the way tlb.cpp models one -- a
+// fixed-capacity LRU stack of pages that reports each access's stack distance
+// -- and through naive LRU TLBs of various sizes.  A TLB with N entries should
+// miss exactly on those accesses whose distance is 0 or greater than N.
+static void check_tlb (const string& name, const trace_t& trace, uint64_t page_size)
+{
+  const uint64_t max_entries = 4096;
+  const uint64_t entry_counts[] = {1, 8, 64, 512, max_entries};
+  ostringstream test;
+  test << "TLB, " << name << ", " << page_size << "-byte pages";
+  Cache actual(page_size, 1, false);
+  actual.recordDistances();
+  actual.setCapacity(max_entries);
+  vector<uint64_t> actual_misses(sizeof(entry_counts)/sizeof(entry_counts[0]), 0);
+  vector<uint64_t> expected_misses(actual_misses.size(), 0);
+  vector< vector<uint64_t> > tlbs(actual_misses.size());   // Pages; back is MRU
+  for (auto& acc : trace) {
+    actual.access(acc.first, acc.second);
+    const vector<uint64_t>& distances = actual.getLastDistances();
+    for (size_t e = 0; e < actual_misses.size(); e++)
+      for (auto dist : distances)
+        if (dist == 0 || dist > entry_counts[e])
+          actual_misses[e]++;
+    for (uint64_t page = acc.first/page_size;
+         page <= (acc.first + acc.second - 1)/page_size;
+         page++)
+      for (size_t e = 0; e < tlbs.size(); e++) {
+        vector<uint64_t>& tlb = tlbs[e];
+        auto iter = find(tlb.begin(), tlb.end(), page);
+        if (iter == tlb.end()) {
+          expected_misses[e]++;
+          if (tlb.size() == entry_counts[e])
+            tlb.erase(tlb.begin());
+        }
+        else
+          tlb.erase(iter);
+        tlb.push_back(page);
+      }
+  }
+  for (size_t e = 0; e < actual_misses.size(); e++) {
+    ostringstream what;
+    what << "misses with " << entry_counts[e] << " entries";
+    compare(test.str(), what.str(), expected_misses[e], actual_misses[e]);
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+// Generate uniformly random accesses of a fixed size within a footprint.
+static trace_t random_trace (std::mt19937_64& prng, size_t length,
+                             uint64_t footprint, uint64_t size)
+{
+  trace_t trace;
+  std::uniform_int_distribution<uint64_t> offset(0, footprint/size - 1);
+  for (size_t i = 0; i < length; i++)
+    trace.push_back(access_t(0x10000 + offset(prng)*size, size));
+  return trace;
+}
+
+// Generate random accesses of random sizes at random alignments so that many
+// accesses straddle line boundaries.
+static trace_t misaligned_trace (std::mt19937_64& prng, size_t length,
+                                 uint64_t footprint)
+{
+  trace_t trace;
+  std::uniform_int_distribution<uint64_t> offset(0, footprint - 1);
+  std::uniform_int_distribution<uint64_t> size(1, 300);
+  for (size_t i = 0; i < length; i++)
+    trace.push_back(access_t(0x10000 + offset(prng), size(prng)));
+  return trace;
+}
+
+// Repeatedly sweep a region with a given stride.  Power-of-two strides make
+// all accesses collide in a few sets; sweeping a region larger than the
+// number of distinct addresses retained defeats LRU.
+static trace_t sweep_trace (size_t passes, uint64_t count, uint64_t stride,
+                            uint64_t size, bool alternate)
+{
+  trace_t trace;
+  for (size_t p = 0; p < passes; p++)
+    for (uint64_t i = 0; i < count; i++) {
+      uint64_t idx = alternate && p%2 == 1 ? count - i - 1 : i;
+      trace.push_back(access_t(0x10000 + idx*stride, size));
+    }
+  return trace;
+}
+
+// Repeatedly access the same address.
+static trace_t repeat_trace (size_t length, uint64_t size)
+{
+  return trace_t(length, access_t(0x12345, size));
+}
+
+int main (void)
+{
+  std::mt19937_64 prng(20240601);
+
+  // Build a set of named traces.
+  vector< pair<string, trace_t> > traces;
+  traces.push_back(make_pair("random small footprint", random_trace(prng, 3000, 512, 8)));
+  traces.push_back(make_pair("random large footprint", random_trace(prng, 3000, 65536, 8)));
+  traces.push_back(make_pair("random single bytes", random_trace(prng, 3000, 256, 1)));
+  traces.push_back(make_pair("misaligned", misaligned_trace(prng, 1000, 8192)));
+  traces.push_back(make_pair("cyclic sweep", sweep_trace(6, 300, 8, 8, false)));
+  traces.push_back(make_pair("sawtooth sweep", sweep_trace(6, 300, 8, 8, true)));
+  traces.push_back(make_pair("power-of-two stride", sweep_trace(6, 100, 4096, 8, false)));
+  traces.push_back(make_pair("odd stride", sweep_trace(6, 100, 72, 16, true)));
+  traces.push_back(make_pair("repeated address", repeat_trace(500, 4)));
+
+  // Check reuse distance both with and without pruning.
+  const uint64_t max_dists[] = {~uint64_t(0) - 1, 1000, 100, 7, 2, 1, 0};
+  for (auto& named : traces)
+    for (auto max_dist : max_dists)
+      check_reuse_distance(named.first, named.second, max_dist);
+
+  // Check the cache model with a variety of geometries.
+  const uint64_t line_sizes[] = {64, 32, 128};
+  const uint64_t set_bits[] = {16, 8, 4, 1};
+  for (auto& named : traces)
+    for (auto line_size : line_sizes)
+      for (auto bits : set_bits)
+        check_cache(named.first, named.second, line_size, bits);
+
+  // Check the prefetchers' accounting against a cache of bounded capacity.
+  // The sweeps exercise lines that fall out of the cache before their
+  // prefetches are used.
+  const uint64_t capacities[] = {4, 64, 512};
+  for (auto& named : traces)
+    for (int type = BF_PREFETCH_NEXT_LINE; type < BF_PREFETCH_NUM; type++)
+      for (auto capacity : capacities) {
+        check_prefetching(named.first, named.second, type, capacity, 1, 1);
+        check_prefetching(named.first, named.second, type, capacity, 4, 2);
+      }
+
+  // Check the TLB model's miss curves.  A tiny memory budget must not shrink
+  // the modeled TLBs.
+  vector< pair<string, trace_t> > tlb_traces;
+  tlb_traces.push_back(make_pair("random pages", random_trace(prng, 20000, uint64_t(64) << 20, 8)));
+  tlb_traces.push_back(make_pair("page sweep", sweep_trace(3, 5000, 4096, 8, false)));
+  tlb_traces.push_back(make_pair("page sawtooth", sweep_trace(3, 600, 4104, 8, true)));
+  tlb_traces.push_back(make_pair("misaligned", misaligned_trace(prng, 2000, 65536)));
+  for (uint64_t budget : {uint64_t(0), uint64_t(1)}) {
+    bf_mem_budget = budget;
+    for (auto& named : tlb_traces) {
+      check_tlb(named.first, named.second, 4096);
+      check_tlb(named.first, named.second, 256);
+    }
+  }
+  bf_mem_budget = 0;
+
+  // Report success or failure.  Exit without producing a Byfl report.
+  if (num_failures == 0)
+    cout << "All cache-model and reuse-distance checks passed\n";
+  else
+    cout << num_failures << " cache-model and reuse-distance checks failed\n";
+  cout.flush();
+  cerr.flush();
+  _exit(num_failures == 0 ? 0 : 1);
+}
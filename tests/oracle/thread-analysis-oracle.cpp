@@ -0,0 +1,737 @@
+/*
+ * Validate the run-time library's multithreaded analyses against naive but
+ * obviously correct reference implementations
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include "byfl.h"
+
+// Define all of the constants that the Byfl compiler pass would normally
+// define in instrumented code.  We enable only the analyses under test.
+uint64_t bf_bb_merge = 1;
+uint8_t  bf_call_stack = 0;
+uint8_t  bf_every_bb = 0;
+uint64_t bf_max_reuse_distance = ~uint64_t(0) - 1;
+const char* bf_option_string = "thread-analysis-oracle";
+uint8_t  bf_per_func = 0;
+uint8_t  bf_mem_footprint = 0;
+uint8_t  bf_tally_inst_mix = 0;
+uint8_t  bf_tally_inst_deps = 0;
+uint8_t  bf_types = 0;
+uint8_t  bf_unique_bytes = 0;
+uint8_t  bf_vectors = 0;
+uint8_t  bf_cache_model = 0;
+uint8_t  bf_data_structs = 0;
+uint8_t  bf_strides = 0;
+uint8_t  bf_numa = 1;
+uint8_t  bf_false_sharing = 1;
+uint8_t  bf_tlb = 0;
+uint8_t  bf_mem_intrinsics = 0;
+uint8_t  bf_branches = 0;
+uint8_t  bf_call_targets = 0;
+uint8_t  bf_redundancy = 0;
+uint8_t  bf_struct_fields = 0;
+uint8_t  bf_by_line = 0;
+uint8_t  bf_loops = 0;
+uint8_t  bf_threads = 1;
+uint8_t  bf_thread_funcs = 0;
+uint64_t bf_line_size = 64;
+uint64_t bf_max_set_bits = 16;
+uint64_t bf_prefetcher = 0;
+uint64_t bf_prefetch_degree = 1;
+uint64_t bf_prefetch_distance = 1;
+uint64_t bf_prefetch_cache = 512;
+
+using namespace bytesflops;
+
+namespace bytesflops {
+  extern "C" void bf_numa_touch(const char* funcname, uint64_t baseaddr, uint64_t numaddrs);
+  extern "C" void bf_track_sharing(const bf_symbol_info_t* syminfo, uint64_t baseaddr,
+                                   uint64_t numaddrs, uint8_t load0store1);
+}
+
+// Count the number of failed comparisons.
+static int num_failures = 0;
+
+// Report a failure.
+static void fail (const string& test, const string& what)
+{
+  cerr << "FAIL: " << test << ": " << what << '\n';
+  num_failures++;
+}
+
+// Compare two integers, reporting a failure if they differ.
+static void compare (const string& test, const string& what,
+                     uint64_t expected, uint64_t actual)
+{
+  if (expected != actual) {
+    ostringstream msg;
+    msg << what << " is " << actual << " but should be " << expected;
+    fail(test, msg.str());
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+// Run functions on a fixed set of threads one at a time so that a test can
+// interleave different threads' accesses deterministically.  Worker 0 is the
+// calling thread.
+class ThreadPool {
+private:
+  mutex lock;
+  condition_variable cond;
+  vector<thread> threads;
+  vector<uint32_t> thread_nums;      // bf_thread_number() of each worker
+  size_t job_worker = ~size_t(0);    // Worker that should run job
+  function<void()> job;
+  bool quit = false;
+
+  // Repeatedly wait for and run a job.
+  void worker_loop (size_t w) {
+    unique_lock<mutex> guard(lock);
+    while (true) {
+      cond.wait(guard, [&] { return quit || job_worker == w; });
+      if (quit)
+        return;
+      job();
+      job_worker = ~size_t(0);
+      cond.notify_all();
+    }
+  }
+
+public:
+  ThreadPool (size_t num_workers) : thread_nums(num_workers) {
+    thread_nums[0] = bf_thread_number();
+    for (size_t w = 1; w < num_workers; w++) {
+      threads.push_back(thread(&ThreadPool::worker_loop, this, w));
+      run(w, [&] { thread_nums[w] = bf_thread_number(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      lock_guard<mutex> guard(lock);
+      quit = true;
+    }
+    cond.notify_all();
+    for (auto& t : threads)
+      t.join();
+  }
+
+  size_t size (void) const { return thread_nums.size(); }
+
+  uint32_t thread_number (size_t w) const { return thread_nums[w]; }
+
+  // Run a function on a given worker and wait for it to finish.
+  void run (size_t w, const function<void()>& func) {
+    if (w == 0) {
+      func();
+      return;
+    }
+    unique_lock<mutex> guard(lock);
+    job = func;
+    job_worker = w;
+    cond.notify_all();
+    cond.wait(guard, [&] { return job_worker != w; });
+  }
+};
+
+// ----------------------------------------------------------------------------
+
+// Summarize page sharing the way bf_get_numa_summary() does.
+struct NumaSummary {
+  uint64_t threads = 0;
+  uint64_t pages_touched = 0;
+  uint64_t pages_shared = 0;
+  uint64_t initial_pages_shared = 0;
+};
+
+// Log every thread's page touches and replay them at any page size.
+class NaiveNuma {
+private:
+  struct Touch {
+    uint32_t thread;
+    uint64_t baseaddr;
+    uint64_t numaddrs;
+  };
+  vector<Touch> touches;
+
+public:
+  void touch (uint32_t thread, uint64_t baseaddr, uint64_t numaddrs) {
+    touches.push_back(Touch{thread, baseaddr, numaddrs});
+  }
+
+  NumaSummary summarize (uint64_t page_size) const {
+    map<uint64_t, pair<uint32_t, set<uint32_t> > > pages;  // Page --> {first thread, all threads}
+    NumaSummary summary;
+    for (auto& t : touches) {
+      if (t.numaddrs == 0)
+        continue;
+      for (uint64_t pg = t.baseaddr/page_size; pg <= (t.baseaddr + t.numaddrs - 1)/page_size; pg++) {
+        auto iter = pages.find(pg);
+        if (iter == pages.end())
+          iter = pages.emplace(pg, make_pair(t.thread, set<uint32_t>())).first;
+        iter->second.second.insert(t.thread);
+      }
+      summary.threads = max(summary.threads, uint64_t(t.thread) + 1);
+    }
+    for (auto& pg : pages) {
+      summary.pages_touched++;
+      if (pg.second.second.size() > 1) {
+        summary.pages_shared++;
+        if (pg.second.first == 0)
+          summary.initial_pages_shared++;
+      }
+    }
+    return summary;
+  }
+};
+
+// Have a worker touch a range of addresses both in the NUMA tracker and in
+// the naive model.
+static void numa_touch (ThreadPool& pool, NaiveNuma& naive, size_t w,
+                        uint64_t baseaddr, uint64_t numaddrs)
+{
+  pool.run(w, [&] { bf_numa_touch("numa_touch", baseaddr, numaddrs); });
+  naive.touch(pool.thread_number(w), baseaddr, numaddrs);
+}
+
+// Compare the NUMA tracker's summary to a naive summary.  First-touching
+// threads are ambiguous once pages are coarsened, so we compare initial
+// sharing only when asked.
+static void compare_numa (const string& test, const NumaSummary& expected,
+                          uint64_t expected_page_size, bool check_initial)
+{
+  uint64_t page_size, threads, pages_touched, pages_shared, initial_pages_shared;
+  bf_get_numa_summary(&page_size, &threads, &pages_touched, &pages_shared,
+                      &initial_pages_shared);
+  compare(test, "page size", expected_page_size, page_size);
+  compare(test, "threads", expected.threads, threads);
+  compare(test, "pages touched", expected.pages_touched, pages_touched);
+  compare(test, "pages shared", expected.pages_shared, pages_shared);
+  if (check_initial)
+    compare(test, "initial pages shared", expected.initial_pages_shared, initial_pages_shared);
+}
+
+// Check the NUMA page-sharing tracker on a hand-built scenario, on random
+// touches from several threads, and after a memory budget forces it to track
+// coarser pages.
+static void check_numa (std::mt19937_64& prng, ThreadPool& pool)
+{
+  NaiveNuma naive;
+  uint64_t page_size, threads, pages_touched, pages_shared, initial_pages_shared;
+  bf_get_numa_summary(&page_size, &threads, &pages_touched, &pages_shared,
+                      &initial_pages_shared);
+
+  // Thread 0 initializes pages 0-9.  Another thread touches pages 5-14, and
+  // a third touches page 12 plus, straddling a boundary, pages 15 and 16.
+  string test("NUMA, first touch");
+  uint64_t base = page_size*1024;
+  numa_touch(pool, naive, 0, base, 10*page_size);
+  numa_touch(pool, naive, 1, base + 5*page_size, 10*page_size);
+  numa_touch(pool, naive, 2, base + 12*page_size + 7, 1);
+  numa_touch(pool, naive, 2, base + 16*page_size - 4, 8);
+  NumaSummary hand;
+  hand.threads = pool.thread_number(2) + 1;
+  hand.pages_touched = 17;
+  hand.pages_shared = 6;
+  hand.initial_pages_shared = 5;
+  compare_numa(test, hand, page_size, true);
+  compare_numa(test + " (naive)", naive.summarize(page_size), page_size, true);
+
+  // Have all threads touch random ranges, often repeating a thread's
+  // previous page.
+  test = "NUMA, random touches";
+  base = page_size*4096;
+  uint64_t footprint = 64*page_size;
+  vector<uint64_t> previous(pool.size(), base);
+  for (size_t i = 0; i < 3000; i++) {
+    size_t w = prng()%pool.size();
+    uint64_t addr = prng()%4 == 0 ? previous[w] : base + prng()%footprint;
+    uint64_t size = prng()%8 == 0 ? prng()%(3*page_size) : 1 + prng()%16;
+    numa_touch(pool, naive, w, addr, size);
+    previous[w] = addr;
+  }
+  compare_numa(test, naive.summarize(page_size), page_size, true);
+
+  // Have each thread touch its own page last.  Exhaust the memory budget,
+  // which should double the page size exactly once.  Then have each thread
+  // touch the coarse page whose number matches that of its previous fine
+  // page, which must not be mistaken for the same page.
+  test = "NUMA, coarsened pages";
+  uint64_t first_page = base/page_size + 128;
+  for (size_t w = 0; w < pool.size(); w++)
+    numa_touch(pool, naive, w, (first_page + w)*page_size, 1);
+  bf_mem_budget = 1;
+  numa_touch(pool, naive, 0, base, 1);
+  bf_mem_budget = 0;
+  compare_numa(test, naive.summarize(2*page_size), 2*page_size, false);
+  for (size_t w = 0; w < pool.size(); w++)
+    numa_touch(pool, naive, w, (first_page + w)*2*page_size, 1);
+  compare_numa(test, naive.summarize(2*page_size), 2*page_size, false);
+  for (size_t i = 0; i < 1000; i++) {
+    size_t w = prng()%pool.size();
+    numa_touch(pool, naive, w, base + prng()%(2*footprint), 1 + prng()%64);
+  }
+  compare_numa(test, naive.summarize(2*page_size), 2*page_size, false);
+}
+
+// ----------------------------------------------------------------------------
+
+// Summarize cache-line sharing the way bf_get_sharing_summary() does.
+struct SharingSummary {
+  uint64_t true_misses = 0;
+  uint64_t false_misses = 0;
+  uint64_t true_lines = 0;
+  uint64_t false_lines = 0;
+};
+
+// Model the write-invalidate protocol described in sharing.cpp with a set of
+// threads holding a valid copy of each line and an unbounded record of what
+// each non-owner read since the last write.
+class NaiveSharing {
+private:
+  struct Line {
+    bool has_owner = false;
+    uint32_t owner = 0;                   // Thread that most recently wrote the line
+    set<uint64_t> written;                // Chunks the owner wrote since acquiring the line
+    set<uint32_t> valid;                  // Threads holding a valid copy
+    map<uint32_t, set<uint64_t> > reads;  // Chunks each non-owner read since the last write
+    uint64_t true_sharing = 0;
+    uint64_t false_sharing = 0;
+  };
+  map<uint64_t, Line> lines;
+  uint64_t line_size;
+  uint64_t chunk_size;
+
+  static bool overlaps (const set<uint64_t>& a, const set<uint64_t>& b) {
+    for (auto c : b)
+      if (a.find(c) != a.end())
+        return true;
+    return false;
+  }
+
+public:
+  NaiveSharing (uint64_t lsize) : line_size(lsize), chunk_size(max(lsize/64, uint64_t(1))) { }
+
+  void access (uint32_t thread, uint64_t baseaddr, uint64_t numaddrs, bool is_store) {
+    for (uint64_t linenum = baseaddr/line_size; linenum <= (baseaddr + numaddrs - 1)/line_size; linenum++) {
+      set<uint64_t> chunks;
+      for (uint64_t a = max(baseaddr, linenum*line_size);
+           a < min(baseaddr + numaddrs, (linenum + 1)*line_size);
+           a++)
+        chunks.insert((a - linenum*line_size)/chunk_size);
+      Line& line = lines[linenum];
+      bool miss;
+      set<uint64_t> others;
+      if (is_store) {
+        miss = false;
+        for (auto t : line.valid)
+          miss |= t != thread;
+        for (auto& r : line.reads)
+          if (r.first != thread)
+            others.insert(r.second.begin(), r.second.end());
+        if (line.has_owner && line.owner != thread)
+          others.insert(line.written.begin(), line.written.end());
+        if (!line.has_owner || line.owner != thread) {
+          line.has_owner = true;
+          line.owner = thread;
+          line.written.clear();
+        }
+        line.written.insert(chunks.begin(), chunks.end());
+        line.reads.clear();
+        line.valid.clear();
+      }
+      else {
+        miss = line.valid.find(thread) == line.valid.end() && line.has_owner && line.owner != thread;
+        others = line.written;
+        if (!line.has_owner || line.owner != thread)
+          line.reads[thread].insert(chunks.begin(), chunks.end());
+      }
+      line.valid.insert(thread);
+      if (miss) {
+        if (overlaps(others, chunks))
+          line.true_sharing++;
+        else
+          line.false_sharing++;
+      }
+    }
+  }
+
+  SharingSummary summarize (void) const {
+    SharingSummary summary;
+    for (auto& ln : lines) {
+      summary.true_misses += ln.second.true_sharing;
+      summary.false_misses += ln.second.false_sharing;
+      summary.true_lines += ln.second.true_sharing > 0;
+      summary.false_lines += ln.second.false_sharing > 0;
+    }
+    return summary;
+  }
+};
+
+// Have a worker load or store a range of addresses both in the false-sharing
+// detector and in the naive model.
+static void share_access (ThreadPool& pool, NaiveSharing& naive, size_t w,
+                          const bf_symbol_info_t* site, uint64_t baseaddr,
+                          uint64_t numaddrs, bool is_store)
+{
+  pool.run(w, [&] { bf_track_sharing(site, baseaddr, numaddrs, is_store ? 1 : 0); });
+  naive.access(pool.thread_number(w), baseaddr, numaddrs, is_store);
+}
+
+// Compare the false-sharing detector's summary to an expected summary.
+static void compare_sharing (const string& test, const SharingSummary& expected)
+{
+  uint64_t true_misses, false_misses, true_lines, false_lines;
+  bf_get_sharing_summary(&true_misses, &false_misses, &true_lines, &false_lines);
+  compare(test, "true-sharing misses", expected.true_misses, true_misses);
+  compare(test, "false-sharing misses", expected.false_misses, false_misses);
+  compare(test, "lines with true sharing", expected.true_lines, true_lines);
+  compare(test, "lines with false sharing", expected.false_lines, false_lines);
+}
+
+// Check the false-sharing detector's classification of coherence misses on
+// hand-built scenarios and on random loads and stores from several threads.
+static void check_sharing (std::mt19937_64& prng, ThreadPool& pool)
+{
+  // Define a few load and store sites.
+  static const bf_symbol_info_t sites[] = {
+    {1, "oracle", "a", "update_a", "oracle.c", 10},
+    {2, "oracle", "b", "update_b", "oracle.c", 20},
+    {3, "oracle", "c", "read_c", "oracle.c", 30}
+  };
+  const uint64_t num_sites = sizeof(sites)/sizeof(sites[0]);
+
+  // Two threads repeatedly write and read disjoint halves of line A, which
+  // is false sharing.  Two threads write and read overlapping bytes of line
+  // B, which is true sharing.  A single thread accessing line C incurs no
+  // coherence misses.  An unaligned store to the end of line D and the
+  // beginning of line E is followed by another thread's reads of a
+  // different byte of D (false sharing) and of a written byte of E (true
+  // sharing).
+  string test("sharing, hand-built");
+  bf_line_size = 64;
+  initialize_sharing();
+  NaiveSharing naive(64);
+  const uint64_t lineA = 64*100, lineB = 64*200, lineC = 64*300, lineD = 64*400;
+  share_access(pool, naive, 0, &sites[0], lineA, 8, true);
+  share_access(pool, naive, 1, &sites[1], lineA + 8, 8, true);
+  share_access(pool, naive, 0, &sites[0], lineA, 8, true);
+  share_access(pool, naive, 1, &sites[2], lineA + 8, 8, false);
+  share_access(pool, naive, 0, &sites[0], lineB, 8, true);
+  share_access(pool, naive, 1, &sites[2], lineB, 4, false);
+  share_access(pool, naive, 1, &sites[1], lineB + 4, 4, true);
+  share_access(pool, naive, 0, &sites[2], lineB, 8, false);
+  for (int i = 0; i < 10; i++)
+    share_access(pool, naive, 2, &sites[i%num_sites], lineC + i, 4, i%2 == 0);
+  share_access(pool, naive, 3, &sites[0], lineD + 60, 8, true);
+  share_access(pool, naive, 2, &sites[2], lineD + 64, 1, false);
+  share_access(pool, naive, 2, &sites[2], lineD, 1, false);
+  SharingSummary hand;
+  hand.true_misses = 4;
+  hand.false_misses = 4;
+  hand.true_lines = 2;
+  hand.false_lines = 2;
+  compare_sharing(test, hand);
+  compare_sharing(test + " (naive)", naive.summarize());
+
+  // Have several threads access random, often unaligned, ranges of a few
+  // lines.  The detector remembers exactly what up to four non-owners read,
+  // so we use only that many threads.
+  const size_t num_threads = min(pool.size(), size_t(4));
+  for (uint64_t line_size : {64, 256}) {
+    test = "sharing, random accesses, " + to_string(line_size) + "-byte lines";
+    bf_line_size = line_size;
+    initialize_sharing();
+    NaiveSharing random_naive(line_size);
+    for (size_t i = 0; i < 5000; i++) {
+      size_t w = prng()%num_threads;
+      uint64_t addr = line_size*1000 + prng()%(8*line_size);
+      uint64_t size = 1 + prng()%16;
+      share_access(pool, random_naive, w, &sites[prng()%num_sites], addr, size, prng()%2 == 0);
+    }
+    compare_sharing(test, random_naive.summarize());
+  }
+  bf_line_size = 64;
+}
+
+// ----------------------------------------------------------------------------
+
+// Intern a string from a freshly allocated copy so that neither its address
+// nor the calling thread's front cache gives away the answer.
+static const char* intern_copy (const string& str)
+{
+  vector<char> copy(str.c_str(), str.c_str() + str.size() + 1);
+  return bf_string_to_symbol(copy.data());
+}
+
+// Say whether a symbol is the unique symbol for a given string.
+static void check_symbol (const string& test, const string& str, const char* symbol)
+{
+  if (symbol == nullptr || str != symbol)
+    fail(test, "symbol for \"" + str.substr(0, 40) + "\" has the wrong contents");
+  else if (intern_copy(str) != symbol)
+    fail(test, "\"" + str.substr(0, 40) + "\" maps to more than one symbol");
+}
+
+// Check that interning maps equal strings to the same symbol and unequal
+// strings to different symbols, including while the table grows and while
+// several threads insert the same strings concurrently.
+static void check_symbols (std::mt19937_64& prng)
+{
+  // Check simple cases.
+  string test("symbols, simple cases");
+  if (bf_string_to_symbol(nullptr) != nullptr)
+    fail(test, "NULL does not map to NULL");
+  const char* abc = intern_copy("abc");
+  check_symbol(test, "abc", abc);
+  check_symbol(test, "", intern_copy(""));
+  if (bf_string_to_symbol(abc) != abc)
+    fail(test, "a symbol does not map to itself");
+  if (intern_copy("abd") == abc)
+    fail(test, "different strings map to the same symbol");
+  check_symbol(test, "bc", bf_string_to_symbol(abc + 1));
+  string long_str(200000, 'x');
+  check_symbol(test, long_str, intern_copy(long_str));
+
+  // Reuse the same buffer for different strings, which defeats a front
+  // cache that doesn't check contents.
+  char buffer[32];
+  strcpy(buffer, "first");
+  const char* first = bf_string_to_symbol(buffer);
+  strcpy(buffer, "second");
+  const char* second = bf_string_to_symbol(buffer);
+  check_symbol(test, "first", first);
+  check_symbol(test, "second", second);
+
+  // Intern enough strings to grow the table several times, then make sure
+  // every string still maps to the symbol it did originally.
+  test = "symbols, table growth";
+  vector<string> strs;
+  vector<const char*> symbols;
+  for (size_t i = 0; i < 50000; i++) {
+    strs.push_back("growth_" + to_string(i) + string(prng()%32, 'g'));
+    symbols.push_back(intern_copy(strs.back()));
+  }
+  for (size_t i = 0; i < strs.size(); i++)
+    check_symbol(test, strs[i], symbols[i]);
+  compare(test, "distinct symbols", strs.size(),
+          set<const char*>(symbols.begin(), symbols.end()).size());
+
+  // Have several threads intern the same new strings in different orders
+  // while the table grows.
+  test = "symbols, concurrent insertion";
+  const size_t num_threads = 8;
+  const size_t num_strs = 20000;
+  vector<string> shared_strs;
+  for (size_t i = 0; i < num_strs; i++)
+    shared_strs.push_back("concurrent_" + to_string(i));
+  vector< vector<size_t> > orders(num_threads);
+  for (auto& order : orders) {
+    for (size_t i = 0; i < num_strs; i++)
+      order.push_back(i);
+    shuffle(order.begin(), order.end(), prng);
+  }
+  vector< vector<const char*> > results(num_threads, vector<const char*>(num_strs));
+  atomic<size_t> ready(0);
+  vector<thread> threads;
+  for (size_t t = 0; t < num_threads; t++)
+    threads.push_back(thread([&, t] {
+          ready++;
+          while (ready < num_threads)
+            ;
+          for (auto i : orders[t])
+            results[t][i] = intern_copy(shared_strs[i]);
+        }));
+  for (auto& t : threads)
+    t.join();
+  for (size_t i = 0; i < num_strs; i++) {
+    for (size_t t = 1; t < num_threads; t++)
+      if (results[t][i] != results[0][i]) {
+        fail(test, "threads disagree on the symbol for \"" + shared_strs[i] + '"');
+        break;
+      }
+    check_symbol(test, shared_strs[i], results[0][i]);
+  }
+  compare(test, "distinct symbols", num_strs,
+          set<const char*>(results[0].begin(), results[0].end()).size());
+}
+
+// ----------------------------------------------------------------------------
+
+// Summarize per-thread work the way bf_get_thread_summary() does.
+struct ThreadSummary {
+  uint64_t threads = 0;
+  uint64_t max_ops = 0;
+  uint64_t total_ops = 0;
+  uint64_t max_flops = 0;
+  uint64_t total_flops = 0;
+  uint64_t max_bytes = 0;
+  uint64_t total_bytes = 0;
+
+  // Incorporate one thread's work.
+  void add (uint64_t ops, uint64_t flops, uint64_t bytes) {
+    threads++;
+    max_ops = max(max_ops, ops);
+    total_ops += ops;
+    max_flops = max(max_flops, flops);
+    total_flops += flops;
+    max_bytes = max(max_bytes, bytes);
+    total_bytes += bytes;
+  }
+};
+
+// Add work to the calling thread's counters the way bf_tally_thread_bb()
+// would.
+static void add_thread_work (uint64_t ops, uint64_t flops, uint64_t loads, uint64_t stores)
+{
+  ByteFlopCounters* counters = bf_thread_counters();
+  counters->ops += ops;
+  counters->flops += flops;
+  counters->loads += loads;
+  counters->stores += stores;
+}
+
+// Compare bf_get_thread_summary() to an expected summary.
+static void compare_threads (const string& test, const ThreadSummary& expected)
+{
+  ThreadSummary actual;
+  bf_get_thread_summary(&actual.threads, &actual.max_ops, &actual.total_ops,
+                        &actual.max_flops, &actual.total_flops,
+                        &actual.max_bytes, &actual.total_bytes);
+  compare(test, "threads", expected.threads, actual.threads);
+  compare(test, "maximum operations", expected.max_ops, actual.max_ops);
+  compare(test, "total operations", expected.total_ops, actual.total_ops);
+  compare(test, "maximum flops", expected.max_flops, actual.max_flops);
+  compare(test, "total flops", expected.total_flops, actual.total_flops);
+  compare(test, "maximum bytes", expected.max_bytes, actual.max_bytes);
+  compare(test, "total bytes", expected.total_bytes, actual.total_bytes);
+}
+
+// Compare the max/mean ratio of per-thread operations to a given fraction.
+static void compare_imbalance (const string& test, uint64_t numerator, uint64_t denominator)
+{
+  uint64_t threads, max_ops, total_ops, max_flops, total_flops, max_bytes, total_bytes;
+  bf_get_thread_summary(&threads, &max_ops, &total_ops, &max_flops, &total_flops,
+                        &max_bytes, &total_bytes);
+  if (max_ops*threads*denominator != total_ops*numerator) {
+    ostringstream msg;
+    msg << "max/mean operations is " << max_ops*threads << '/' << total_ops
+        << " but should be " << numerator << '/' << denominator;
+    fail(test, msg.str());
+  }
+}
+
+// Check per-thread maxima and totals, from which the report derives the
+// max/mean imbalance as max*threads/total, for balanced, skewed, and random
+// work and for threads that register concurrently.
+static void check_threads (std::mt19937_64& prng, ThreadPool& pool)
+{
+  initialize_threading();
+  ThreadSummary empty;
+  compare_threads("threads, none", empty);
+
+  // Give every worker the same work.  The imbalance is 1.
+  string test("threads, balanced");
+  vector<uint64_t> ops(pool.size()), flops(pool.size()), bytes(pool.size());
+  for (size_t w = 0; w < pool.size(); w++) {
+    pool.run(w, [&] { add_thread_work(1000, 100, 64, 32); });
+    ops[w] += 1000;
+    flops[w] += 100;
+    bytes[w] += 96;
+  }
+  ThreadSummary expected;
+  for (size_t w = 0; w < pool.size(); w++)
+    expected.add(ops[w], flops[w], bytes[w]);
+  compare_threads(test, expected);
+  compare_imbalance(test, 1, 1);
+
+  // Give the last worker all the extra work.  With N workers, the maximum is
+  // 1000*(N+1) operations and the mean is 2000, so the imbalance is (N+1)/2.
+  test = "threads, skewed";
+  size_t last = pool.size() - 1;
+  pool.run(last, [&] { add_thread_work(1000*pool.size(), 0, 8000, 0); });
+  ops[last] += 1000*pool.size();
+  bytes[last] += 8000;
+  expected = ThreadSummary();
+  for (size_t w = 0; w < pool.size(); w++)
+    expected.add(ops[w], flops[w], bytes[w]);
+  compare_threads(test, expected);
+  compare_imbalance(test, pool.size() + 1, 2);
+
+  // Give workers random work.
+  test = "threads, random";
+  for (size_t i = 0; i < 1000; i++) {
+    size_t w = prng()%pool.size();
+    uint64_t o = prng()%1000, f = prng()%100, l = prng()%800, s = prng()%800;
+    pool.run(w, [&] { add_thread_work(o, f, l, s); });
+    ops[w] += o;
+    flops[w] += f;
+    bytes[w] += l + s;
+  }
+  expected = ThreadSummary();
+  for (size_t w = 0; w < pool.size(); w++)
+    expected.add(ops[w], flops[w], bytes[w]);
+  compare_threads(test, expected);
+
+  // Have new threads register and count concurrently.
+  test = "threads, concurrent";
+  const size_t num_threads = 8;
+  atomic<size_t> ready(0);
+  vector<thread> threads;
+  for (size_t t = 0; t < num_threads; t++)
+    threads.push_back(thread([&, t] {
+          ready++;
+          while (ready < num_threads)
+            ;
+          for (size_t i = 0; i < 10000; i++)
+            add_thread_work(t + 1, 1, 8, 0);
+        }));
+  for (auto& t : threads)
+    t.join();
+  for (size_t t = 0; t < num_threads; t++)
+    expected.add(10000*(t + 1), 10000, 80000);
+  compare_threads(test, expected);
+
+  // Reset all threads' counters.
+  test = "threads, reset";
+  bf_thread_reset_counters();
+  empty.threads = expected.threads;
+  compare_threads(test, empty);
+}
+
+// ----------------------------------------------------------------------------
+
+int main (void)
+{
+  std::mt19937_64 prng(20240601);
+
+  // Number the calling thread 0 and initialize the analyses under test.
+  ThreadPool pool(5);
+  initialize_symtable();
+  initialize_numa();
+
+  // Check each analysis.
+  check_numa(prng, pool);
+  check_sharing(prng, pool);
+  check_symbols(prng);
+  check_threads(prng, pool);
+
+  // Report success or failure.  Exit without producing a Byfl report.
+  if (num_failures == 0)
+    cout << "All multithreaded-analysis checks passed\n";
+  else
+    cout << num_failures << " multithreaded-analysis checks failed\n";
+  cout.flush();
+  cerr.flush();
+  _exit(num_failures == 0 ? 0 : 1);
+}
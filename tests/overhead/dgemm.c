@@ -0,0 +1,41 @@
+/***********************************
+ * Blocked DGEMM kernel for        *
+ * measuring Byfl overhead         *
+ * By Scott Pakin <pakin@lanl.gov> *
+ ***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BLOCK 16
+
+int main (int argc, char *argv[])
+{
+  long n = argc > 1 ? atol(argv[1]) : 96;
+  double *a = malloc(n*n*sizeof(double));
+  double *b = malloc(n*n*sizeof(double));
+  double *c = calloc(n*n, sizeof(double));
+  double sum = 0.0;
+  long i, j, k, ii, jj, kk;
+
+  for (i = 0; i < n*n; i++) {
+    a[i] = (double)(i%13);
+    b[i] = (double)(i%17);
+  }
+  for (ii = 0; ii < n; ii += BLOCK)
+    for (kk = 0; kk < n; kk += BLOCK)
+      for (jj = 0; jj < n; jj += BLOCK)
+        for (i = ii; i < ii + BLOCK && i < n; i++)
+          for (k = kk; k < kk + BLOCK && k < n; k++) {
+            double aik = a[i*n + k];
+            for (j = jj; j < jj + BLOCK && j < n; j++)
+              c[i*n + j] += aik*b[k*n + j];
+          }
+  for (i = 0; i < n*n; i++)
+    sum += c[i];
+  printf("DGEMM checksum is %.6g\n", sum);
+  free(a);
+  free(b);
+  free(c);
+  return 0;
+}
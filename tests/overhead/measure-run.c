@@ -0,0 +1,63 @@
+/***********************************
+ * Run a command and record its    *
+ * wall-clock time and peak memory *
+ * usage                           *
+ * By Scott Pakin <pakin@lanl.gov> *
+ ***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+int main (int argc, char *argv[])
+{
+  struct timespec start, stop;
+  struct rusage usage;
+  FILE *outfile;
+  pid_t pid;
+  int status;
+
+  /* Parse the command line. */
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <result file> <command> [<arg>...]\n", argv[0]);
+    return 1;
+  }
+
+  /* Run the command. */
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return 1;
+  }
+  if (pid == 0) {
+    execvp(argv[2], &argv[2]);
+    perror(argv[2]);
+    _exit(127);
+  }
+  if (wait4(pid, &status, 0, &usage) == -1) {
+    perror("wait4");
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s: %s failed\n", argv[0], argv[2]);
+    return 1;
+  }
+
+  /* Write "<seconds> <peak RSS in KiB>" to the result file. */
+  outfile = fopen(argv[1], "w");
+  if (outfile == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  fprintf(outfile, "%.6f %ld\n",
+          (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec)*1e-9,
+          usage.ru_maxrss);
+  fclose(outfile);
+  return 0;
+}
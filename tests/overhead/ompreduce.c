@@ -0,0 +1,29 @@
+/***********************************
+ * OpenMP reduction kernel for     *
+ * measuring Byfl overhead         *
+ * By Scott Pakin <pakin@lanl.gov> *
+ ***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main (int argc, char *argv[])
+{
+  long n = argc > 1 ? atol(argv[1]) : 200000;
+  int iters = argc > 2 ? atoi(argv[2]) : 5;
+  double *a = malloc(n*sizeof(double));
+  double sum = 0.0;
+  long i;
+  int it;
+
+  for (i = 0; i < n; i++)
+    a[i] = 1.0/(i + 1);
+  for (it = 0; it < iters; it++) {
+#pragma omp parallel for reduction(+:sum)
+    for (i = 0; i < n; i++)
+      sum += a[i]*a[i];
+  }
+  printf("Reduction checksum is %.6g\n", sum);
+  free(a);
+  return 0;
+}
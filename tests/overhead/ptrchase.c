@@ -0,0 +1,51 @@
+/***********************************
+ * Pointer-chasing kernel for      *
+ * measuring Byfl overhead         *
+ * By Scott Pakin <pakin@lanl.gov> *
+ ***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct node {
+  struct node *next;
+  long payload[7];     /* Pad each node to a 64-byte cache line. */
+} node_t;
+
+int main (int argc, char *argv[])
+{
+  long n = argc > 1 ? atol(argv[1]) : 50000;
+  long steps = argc > 2 ? atol(argv[2]) : 500000;
+  node_t *nodes = malloc(n*sizeof(node_t));
+  long *order = malloc(n*sizeof(long));
+  unsigned long seed = 54321;
+  node_t *p;
+  long i, sum = 0;
+
+  /* Link the nodes into a single random cycle (Sattolo's algorithm). */
+  for (i = 0; i < n; i++)
+    order[i] = i;
+  for (i = n - 1; i > 0; i--) {
+    long j, t;
+    seed = seed*6364136223846793005UL + 1442695040888963407UL;
+    j = (long)((seed >> 33)%(unsigned long)i);
+    t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+  for (i = 0; i < n; i++) {
+    nodes[order[i]].next = &nodes[order[(i + 1)%n]];
+    nodes[i].payload[0] = i;
+  }
+
+  /* Chase pointers. */
+  p = &nodes[0];
+  for (i = 0; i < steps; i++) {
+    sum += p->payload[0];
+    p = p->next;
+  }
+  printf("Pointer-chase checksum is %ld\n", sum);
+  free(nodes);
+  free(order);
+  return 0;
+}
@@ -0,0 +1,59 @@
+/***********************************
+ * Sparse matrix-vector multiply   *
+ * (CSR) for measuring Byfl        *
+ * overhead                        *
+ * By Scott Pakin <pakin@lanl.gov> *
+ ***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main (int argc, char *argv[])
+{
+  long nrows = argc > 1 ? atol(argv[1]) : 20000;
+  int iters = argc > 2 ? atoi(argv[2]) : 5;
+  const int nnz_per_row = 8;
+  long nnz = nrows*nnz_per_row;
+  long *row_ptr = malloc((nrows + 1)*sizeof(long));
+  long *col_idx = malloc(nnz*sizeof(long));
+  double *vals = malloc(nnz*sizeof(double));
+  double *x = malloc(nrows*sizeof(double));
+  double *y = malloc(nrows*sizeof(double));
+  unsigned long seed = 12345;
+  double sum = 0.0;
+  long i, j;
+  int it;
+
+  /* Build a pseudorandom sparse matrix. */
+  for (i = 0; i < nrows; i++) {
+    row_ptr[i] = i*nnz_per_row;
+    for (j = 0; j < nnz_per_row; j++) {
+      seed = seed*6364136223846793005UL + 1442695040888963407UL;
+      col_idx[i*nnz_per_row + j] = (long)((seed >> 33)%(unsigned long)nrows);
+      vals[i*nnz_per_row + j] = 1.0/(j + 1);
+    }
+    x[i] = 1.0;
+  }
+  row_ptr[nrows] = nnz;
+
+  /* Repeatedly multiply. */
+  for (it = 0; it < iters; it++) {
+    for (i = 0; i < nrows; i++) {
+      double dot = 0.0;
+      for (j = row_ptr[i]; j < row_ptr[i + 1]; j++)
+        dot += vals[j]*x[col_idx[j]];
+      y[i] = dot;
+    }
+    for (i = 0; i < nrows; i++)
+      x[i] = y[i]/nnz_per_row;
+  }
+  for (i = 0; i < nrows; i++)
+    sum += x[i];
+  printf("SpMV checksum is %.6g\n", sum);
+  free(row_ptr);
+  free(col_idx);
+  free(vals);
+  free(x);
+  free(y);
+  return 0;
+}
@@ -0,0 +1,43 @@
+/***********************************
+ * 7-point stencil kernel for      *
+ * measuring Byfl overhead         *
+ * By Scott Pakin <pakin@lanl.gov> *
+ ***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define IDX(i, j, k) (((i)*n + (j))*n + (k))
+
+int main (int argc, char *argv[])
+{
+  long n = argc > 1 ? atol(argv[1]) : 40;
+  int iters = argc > 2 ? atoi(argv[2]) : 5;
+  double *in = calloc(n*n*n, sizeof(double));
+  double *out = calloc(n*n*n, sizeof(double));
+  double *tmp;
+  double sum = 0.0;
+  long i, j, k;
+  int it;
+
+  for (i = 0; i < n*n*n; i++)
+    in[i] = (double)(i%11);
+  for (it = 0; it < iters; it++) {
+    for (i = 1; i < n - 1; i++)
+      for (j = 1; j < n - 1; j++)
+        for (k = 1; k < n - 1; k++)
+          out[IDX(i, j, k)] = 0.4*in[IDX(i, j, k)]
+            + 0.1*(in[IDX(i - 1, j, k)] + in[IDX(i + 1, j, k)]
+                   + in[IDX(i, j - 1, k)] + in[IDX(i, j + 1, k)]
+                   + in[IDX(i, j, k - 1)] + in[IDX(i, j, k + 1)]);
+    tmp = in;
+    in = out;
+    out = tmp;
+  }
+  for (i = 0; i < n*n*n; i++)
+    sum += in[i];
+  printf("Stencil checksum is %.6g\n", sum);
+  free(in);
+  free(out);
+  return 0;
+}
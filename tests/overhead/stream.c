@@ -0,0 +1,36 @@
+/***********************************
+ * STREAM triad kernel for         *
+ * measuring Byfl overhead         *
+ * By Scott Pakin <pakin@lanl.gov> *
+ ***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main (int argc, char *argv[])
+{
+  long n = argc > 1 ? atol(argv[1]) : 100000;
+  int iters = argc > 2 ? atoi(argv[2]) : 5;
+  double *a = malloc(n*sizeof(double));
+  double *b = malloc(n*sizeof(double));
+  double *c = malloc(n*sizeof(double));
+  double scalar = 3.0;
+  double sum = 0.0;
+  long i;
+  int it;
+
+  for (i = 0; i < n; i++) {
+    b[i] = 1.0 + i%7;
+    c[i] = 2.0 - i%5;
+  }
+  for (it = 0; it < iters; it++)
+    for (i = 0; i < n; i++)
+      a[i] = b[i] + scalar*c[i];
+  for (i = 0; i < n; i++)
+    sum += a[i];
+  printf("Triad checksum is %.6g\n", sum);
+  free(a);
+  free(b);
+  free(c);
+  return 0;
+}
@@ -0,0 +1,331 @@
+/*
+ * Measure the cost of individual Byfl run-time library entry points
+ * by driving them directly with synthetic address traces
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include <chrono>
+#include <random>
+#include <thread>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "byfl.h"
+
+// Define all of the constants that the Byfl compiler pass would normally
+// define in instrumented code.  We enable every analysis whose entry point we
+// intend to measure.
+uint64_t bf_bb_merge = 1;
+uint8_t  bf_call_stack = 1;
+uint8_t  bf_every_bb = 0;
+uint64_t bf_max_reuse_distance = ~uint64_t(0) - 1;
+const char* bf_option_string = "byfl-bench";
+uint8_t  bf_per_func = 1;
+uint8_t  bf_mem_footprint = 0;
+uint8_t  bf_tally_inst_mix = 0;
+uint8_t  bf_tally_inst_deps = 0;
+uint8_t  bf_types = 0;
+uint8_t  bf_unique_bytes = 1;
+uint8_t  bf_vectors = 1;
+uint8_t  bf_cache_model = 1;
+uint8_t  bf_data_structs = 1;
+uint8_t  bf_strides = 1;
+uint8_t  bf_numa = 0;
+uint8_t  bf_false_sharing = 0;
+uint8_t  bf_tlb = 0;
+uint8_t  bf_mem_intrinsics = 0;
+uint8_t  bf_branches = 0;
+uint8_t  bf_call_targets = 0;
+uint8_t  bf_redundancy = 0;
+uint8_t  bf_struct_fields = 0;
+uint8_t  bf_by_line = 0;
+uint8_t  bf_loops = 0;
+uint8_t  bf_threads = 0;
+uint8_t  bf_thread_funcs = 0;
+uint64_t bf_line_size = 64;
+uint64_t bf_max_set_bits = 16;
+uint64_t bf_prefetcher = 0;
+uint64_t bf_prefetch_degree = 1;
+uint64_t bf_prefetch_distance = 1;
+uint64_t bf_prefetch_cache = 512;
+
+// Declare the run-time library entry points we intend to measure.  These are
+// normally declared only by the Byfl compiler pass.
+extern "C" {
+  void bf_initialize_if_necessary (void);
+  void bf_acquire_mega_lock (void);
+  void bf_release_mega_lock (void);
+  void bf_reuse_dist_addrs_prog (uint64_t baseaddr, uint64_t numaddrs);
+  void bf_assoc_addresses_with_prog (uint64_t baseaddr, uint64_t numaddrs);
+  void bf_assoc_addresses_with_func (const char* funcname, uint64_t baseaddr, uint64_t numaddrs);
+  void bf_assoc_addresses_with_prog_tb (uint64_t baseaddr, uint64_t numaddrs);
+  void bf_assoc_addresses_with_func_tb (const char* funcname, uint64_t baseaddr, uint64_t numaddrs);
+  void bf_assoc_addresses_with_sstruct (const bf_symbol_info_t* syminfo, void* baseptr, uint64_t numaddrs);
+  void bf_access_data_struct (const bf_symbol_info_t* syminfo, uint64_t baseaddr,
+                              uint64_t numaddrs, uint8_t load0store1);
+  void bf_track_stride (bf_symbol_info_t* syminfo, uint64_t baseaddr,
+                        uint64_t numaddrs, uint8_t load0store1, uint8_t is_const);
+  void bf_tally_vector_operation (const char *funcname, uint64_t num_elements,
+                                  uint64_t element_bits, bool is_flop);
+  void bf_push_function (const char* funcname, KeyType_t keyID, bf_symbol_info_t* syminfo);
+  void bf_pop_function (void);
+}
+namespace bytesflops {
+  extern void bf_touch_cache (uint64_t baseaddr, uint64_t numaddrs);
+}
+
+using namespace bytesflops;
+
+// All synthetic addresses lie within a region of this many bytes.
+static const uint64_t region_base = UINT64_C(0x100000000);
+static const uint64_t region_bytes = UINT64_C(1) << 26;
+
+// Each synthetic memory access touches this many bytes.
+static const uint64_t access_bytes = 8;
+
+// Define a symbol and a function name that all entry points can share.
+static bf_symbol_info_t bench_syminfo = {
+  UINT64_C(0x42), "byfl-bench", "bench_array", "bench_kernel", __FILE__, __LINE__
+};
+static const char* bench_funcname = "bench_kernel";
+
+// Describe one entry point to benchmark.  The call function is passed the
+// next address from a trace.
+typedef struct {
+  const char* name;                // Name to report
+  void (*call)(uint64_t address);  // Function that invokes the entry point
+  bool uses_trace;                 // false=address is ignored
+} entry_point_t;
+
+static void call_touch_cache (uint64_t address)
+{
+  bf_touch_cache(address, access_bytes);
+}
+
+static void call_reuse_dist (uint64_t address)
+{
+  bf_reuse_dist_addrs_prog(address, access_bytes);
+}
+
+static void call_assoc_prog (uint64_t address)
+{
+  bf_assoc_addresses_with_prog(address, access_bytes);
+}
+
+static void call_assoc_func (uint64_t address)
+{
+  bf_assoc_addresses_with_func(bench_funcname, address, access_bytes);
+}
+
+static void call_assoc_prog_tb (uint64_t address)
+{
+  bf_assoc_addresses_with_prog_tb(address, access_bytes);
+}
+
+static void call_assoc_func_tb (uint64_t address)
+{
+  bf_assoc_addresses_with_func_tb(bench_funcname, address, access_bytes);
+}
+
+static void call_access_data_struct (uint64_t address)
+{
+  bf_access_data_struct(&bench_syminfo, address, access_bytes, 0);
+}
+
+static void call_track_stride (uint64_t address)
+{
+  bf_track_stride(&bench_syminfo, address, access_bytes, 0, 0);
+}
+
+static void call_tally_vector (uint64_t address)
+{
+  bf_tally_vector_operation(bench_funcname, 4, 64, (address&8) != 0);
+}
+
+static void call_push_pop (uint64_t address)
+{
+  static const char* funcnames[] = {"bench_a", "bench_b", "bench_c", "bench_d"};
+  size_t which = (address/access_bytes)%4;
+  bf_push_function(funcnames[which], KeyType_t(1000 + which), &bench_syminfo);
+  bf_pop_function();
+}
+
+static const entry_point_t entry_points[] = {
+  {"bf_touch_cache",                  call_touch_cache,        true},
+  {"bf_reuse_dist_addrs_prog",        call_reuse_dist,         true},
+  {"bf_assoc_addresses_with_prog",    call_assoc_prog,         true},
+  {"bf_assoc_addresses_with_func",    call_assoc_func,         true},
+  {"bf_assoc_addresses_with_prog_tb", call_assoc_prog_tb,      true},
+  {"bf_assoc_addresses_with_func_tb", call_assoc_func_tb,      true},
+  {"bf_access_data_struct",           call_access_data_struct, true},
+  {"bf_track_stride",                 call_track_stride,       true},
+  {"bf_tally_vector_operation",       call_tally_vector,       false},
+  {"bf_push_function",                call_push_pop,           false}
+};
+
+// Generate a trace of a given number of addresses.
+static vector<uint64_t> generate_trace (const string& kind, size_t num_calls, unsigned int seed)
+{
+  vector<uint64_t> trace(num_calls);
+  std::mt19937_64 prng(seed);
+  if (kind == "sequential") {
+    for (size_t i = 0; i < num_calls; i++)
+      trace[i] = region_base + (i*access_bytes)%region_bytes;
+  }
+  else if (kind == "strided") {
+    // Touch every 16th word, wrapping around with a shifted phase.
+    const uint64_t stride = 16*access_bytes;
+    const uint64_t per_pass = region_bytes/stride;
+    for (size_t i = 0; i < num_calls; i++) {
+      uint64_t pass = i/per_pass;
+      trace[i] = region_base + ((i%per_pass)*stride + (pass*access_bytes)%stride);
+    }
+  }
+  else if (kind == "random") {
+    std::uniform_int_distribution<uint64_t> word(0, region_bytes/access_bytes - 1);
+    for (size_t i = 0; i < num_calls; i++)
+      trace[i] = region_base + word(prng)*access_bytes;
+  }
+  else if (kind == "pointer-chase") {
+    // Follow a single random cycle through all cache lines (Sattolo's
+    // algorithm), as a linked-list traversal would.
+    const uint64_t num_lines = region_bytes/bf_line_size;
+    vector<uint32_t> next(num_lines);
+    for (uint64_t i = 0; i < num_lines; i++)
+      next[i] = uint32_t(i);
+    for (uint64_t i = num_lines - 1; i > 0; i--) {
+      std::uniform_int_distribution<uint64_t> pick(0, i - 1);
+      std::swap(next[i], next[pick(prng)]);
+    }
+    uint64_t line = 0;
+    for (size_t i = 0; i < num_calls; i++) {
+      trace[i] = region_base + line*bf_line_size;
+      line = next[line];
+    }
+  }
+  else {
+    cerr << "byfl-bench: Unknown trace type \"" << kind << "\"\n";
+    std::exit(1);
+  }
+  return trace;
+}
+
+// Drive one entry point with one trace from a single thread.  Take the
+// mega-lock around each call when multiple threads are running, as code
+// instrumented with -bf-thread-safe would do.
+static void run_trace (const entry_point_t* ep, const vector<uint64_t>* trace, bool locked)
+{
+  if (locked)
+    for (auto iter = trace->cbegin(); iter != trace->cend(); iter++) {
+      bf_acquire_mega_lock();
+      ep->call(*iter);
+      bf_release_mega_lock();
+    }
+  else
+    for (auto iter = trace->cbegin(); iter != trace->cend(); iter++)
+      ep->call(*iter);
+}
+
+// Benchmark one entry point with one trace and output a line of CSV.  We run
+// in a child process so that every measurement starts from pristine run-time
+// library state and reports its own peak memory usage.
+static void run_benchmark (const entry_point_t* ep, const string& kind,
+                           size_t num_calls, unsigned int num_threads)
+{
+  cout.flush();
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    std::exit(1);
+  }
+  if (pid > 0) {
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      cerr << "byfl-bench: " << ep->name << " failed on the " << kind << " trace\n";
+      std::exit(1);
+    }
+    return;
+  }
+
+  // Child process: prepare the run-time library and the traces.
+  bf_initialize_if_necessary();
+  bf_assoc_addresses_with_sstruct(&bench_syminfo, (void*)uintptr_t(region_base),
+                                  region_bytes*num_threads);
+  vector< vector<uint64_t> > traces(num_threads);
+  for (unsigned int t = 0; t < num_threads; t++) {
+    traces[t] = generate_trace(kind, num_calls/num_threads, 12345 + t);
+    for (auto iter = traces[t].begin(); iter != traces[t].end(); iter++)
+      *iter += t*region_bytes;
+  }
+
+  // Time all calls to the entry point.
+  auto start = std::chrono::steady_clock::now();
+  if (num_threads == 1)
+    run_trace(ep, &traces[0], false);
+  else {
+    vector<std::thread> workers;
+    for (unsigned int t = 0; t < num_threads; t++)
+      workers.push_back(std::thread(run_trace, ep, &traces[t], true));
+    for (auto iter = workers.begin(); iter != workers.end(); iter++)
+      iter->join();
+  }
+  auto stop = std::chrono::steady_clock::now();
+  double elapsed_ns = std::chrono::duration<double, std::nano>(stop - start).count();
+  size_t total_calls = (num_calls/num_threads)*num_threads;
+
+  // Output a line of CSV data.
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  cout << ep->name << ','
+       << (ep->uses_trace ? kind : string("n/a")) << ','
+       << num_threads << ','
+       << total_calls << ','
+       << std::fixed << std::setprecision(2) << elapsed_ns*num_threads/double(total_calls) << ','
+       << usage.ru_maxrss << '\n';
+  cout.flush();
+
+  // Exit without producing a Byfl report.
+  _exit(0);
+}
+
+int main (int argc, char* argv[])
+{
+  // Parse the command line.
+  if (argc > 4) {
+    cerr << "Usage: " << argv[0] << " [<calls> [<threads> [<entry point substring>]]]\n";
+    return 1;
+  }
+  size_t num_calls = argc > 1 ? size_t(strtoull(argv[1], nullptr, 10)) : 20000;
+  unsigned int num_threads = argc > 2 ? unsigned(strtoul(argv[2], nullptr, 10)) : 4;
+  string only = argc > 3 ? string(argv[3]) : string("");
+  if (num_calls == 0 || num_threads == 0) {
+    cerr << "byfl-bench: Call and thread counts must be positive\n";
+    return 1;
+  }
+
+  // Discard all Byfl output from the child processes.
+  setenv("BF_BINOUT", "", 1);
+  setenv("BF_PREFIX", "/dev/null", 1);
+
+  // Run every benchmark and report the results in CSV format.  ns/call is
+  // the wall-clock time a single thread spends per call.
+  const char* traces[] = {"sequential", "strided", "random", "pointer-chase"};
+  cout << "Entry point,Trace,Threads,Calls,ns/call,Peak RSS (KiB)\n";
+  for (auto& ep : entry_points) {
+    if (only != "" && string(ep.name).find(only) == string::npos)
+      continue;
+    if (ep.uses_trace) {
+      for (auto kind : traces)
+        run_benchmark(&ep, kind, num_calls, 1);
+      run_benchmark(&ep, "random", num_calls, num_threads);
+    }
+    else {
+      run_benchmark(&ep, "sequential", num_calls, 1);
+      run_benchmark(&ep, "sequential", num_calls, num_threads);
+    }
+  }
+
+  // Skip Byfl's end-of-program report.
+  cout.flush();
+  _exit(0);
+}